@@ -0,0 +1,30 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QtGlobal>
+
+/// The number of allocations made with operator new so far
+/**
+ * The benchmarks executable replaces the global operator new to count
+ * allocations. The counter is global, so allocations made by other
+ * threads at the same time are counted too.
+ */
+quint64 allocationsCount();
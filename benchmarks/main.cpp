@@ -0,0 +1,43 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "messageeventmodelbenchmark.h"
+#include "roomlistmodelbenchmark.h"
+
+#include <QtGui/QGuiApplication>
+#include <QtTest/QtTest>
+
+int main(int argc, char* argv[])
+{
+    // Benchmarks don't show anything; don't require a display either
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+    // Keep the settings separate from those of a real Quaternion
+    QGuiApplication::setOrganizationName(QStringLiteral("QMatrixClient"));
+    QGuiApplication::setApplicationName(QStringLiteral("quaternion-benchmarks"));
+
+    int result = 0;
+    MessageEventModelBenchmark messageEventModelBenchmark;
+    result |= QTest::qExec(&messageEventModelBenchmark, argc, argv);
+    RoomListModelBenchmark roomListModelBenchmark;
+    result |= QTest::qExec(&roomListModelBenchmark, argc, argv);
+    return result;
+}
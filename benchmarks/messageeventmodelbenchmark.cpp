@@ -0,0 +1,208 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "messageeventmodelbenchmark.h"
+
+#include "quaternionroom.h"
+#include "models/messageeventmodel.h"
+
+#include <settings.h>
+
+#include <QtTest/QtTest>
+
+static const int EventCounts[] = { 1000, 10000, 100000 };
+static const int RedactionsCount = 100;
+static const int HistoryBaseSize = 100;
+
+static QString sizeTag(int eventCount)
+{
+    return QStringLiteral("%1k").arg(eventCount / 1000);
+}
+
+static TimelineMix mixByName(const QString& name)
+{
+    return name == TimelineMix::busy().name ? TimelineMix::busy()
+                                            : TimelineMix::chat();
+}
+
+static void addSizeRows(const TimelineMix& mix, const QString& prefix = {})
+{
+    for (auto count: EventCounts)
+        QTest::newRow(qPrintable(prefix + sizeTag(count) + '/' + mix.name))
+            << count << mix.name;
+}
+
+static void addSizeColumns()
+{
+    QTest::addColumn<int>("eventCount");
+    QTest::addColumn<QString>("mixName");
+}
+
+void MessageEventModelBenchmark::initTestCase()
+{
+    m_timeline = new SyntheticTimeline(this);
+}
+
+void MessageEventModelBenchmark::cleanup()
+{
+    QMatrixClient::Settings().remove("UI/show_joinleave");
+}
+
+QuaternionRoom* MessageEventModelBenchmark::sharedRoom(int eventCount,
+                                                       const TimelineMix& mix)
+{
+    const auto key = sizeTag(eventCount) + '/' + mix.name;
+    auto*& room = m_rooms[key];
+    if (!room)
+    {
+        room = m_timeline->makeRoom();
+        m_timeline->feed(room, m_timeline->makeEvents(eventCount, mix));
+    }
+    return room;
+}
+
+void MessageEventModelBenchmark::ingestNewEvents_data()
+{
+    addSizeColumns();
+    addSizeRows(TimelineMix::chat());
+    addSizeRows(TimelineMix::busy());
+}
+
+void MessageEventModelBenchmark::ingestNewEvents()
+{
+    QFETCH(int, eventCount);
+    QFETCH(QString, mixName);
+    const auto events =
+            m_timeline->makeEvents(eventCount, mixByName(mixName));
+    auto* room = m_timeline->makeRoom();
+    MessageEventModel model;
+    model.changeRoom(room);
+    QBENCHMARK_ONCE {
+        m_timeline->feed(room, events);
+    }
+    QCOMPARE(model.rowCount(), room->timelineSize());
+}
+
+void MessageEventModelBenchmark::roleData_data()
+{
+    QTest::addColumn<int>("eventCount");
+    QTest::addColumn<int>("role");
+
+    const auto roles = MessageEventModel().roleNames();
+    auto roleIds = roles.keys();
+    std::sort(roleIds.begin(), roleIds.end());
+    for (auto role: roleIds)
+        for (auto count: EventCounts)
+            QTest::newRow(qPrintable(QString::fromLatin1(roles.value(role))
+                                     + '/' + sizeTag(count) + "/chat"))
+                << count << role;
+}
+
+void MessageEventModelBenchmark::roleData()
+{
+    QFETCH(int, eventCount);
+    QFETCH(int, role);
+    MessageEventModel model;
+    model.changeRoom(sharedRoom(eventCount, TimelineMix::chat()));
+    const auto rowCount = model.rowCount();
+    QBENCHMARK {
+        for (int row = 0; row < rowCount; ++row)
+            model.data(model.index(row), role);
+    }
+}
+
+void MessageEventModelBenchmark::aboveAuthorChains_data()
+{
+    addSizeColumns();
+    addSizeRows(TimelineMix::busy());
+}
+
+void MessageEventModelBenchmark::aboveAuthorChains()
+{
+    QFETCH(int, eventCount);
+    // Hidden joins and leaves make AboveAuthorRole walk further up
+    QMatrixClient::Settings().setValue("UI/show_joinleave", false);
+    MessageEventModel model;
+    model.changeRoom(sharedRoom(eventCount, TimelineMix::busy()));
+    const auto roleId = model.roleNames().key("aboveAuthor");
+    const auto rowCount = model.rowCount();
+    QBENCHMARK {
+        for (int row = 0; row < rowCount; ++row)
+            model.data(model.index(row), roleId);
+    }
+}
+
+void MessageEventModelBenchmark::refreshLastUserEvents_data()
+{
+    addSizeColumns();
+    addSizeRows(TimelineMix::chat(), QStringLiteral("redact100/"));
+}
+
+void MessageEventModelBenchmark::refreshLastUserEvents()
+{
+    QFETCH(int, eventCount);
+    // Redactions go through Room::replacedEvent, which makes the model
+    // refresh the rows of the last events of the redacted event's author.
+    auto* room = m_timeline->makeRoom();
+    const auto events = m_timeline->makeEvents(eventCount, TimelineMix::chat());
+    m_timeline->feed(room, events);
+    const auto redactions =
+            m_timeline->makeRedactions(events, RedactionsCount);
+    MessageEventModel model;
+    model.changeRoom(room);
+    QBENCHMARK_ONCE {
+        m_timeline->feed(room, redactions);
+    }
+}
+
+void MessageEventModelBenchmark::historyInsertion_data()
+{
+    addSizeColumns();
+    addSizeRows(TimelineMix::chat());
+}
+
+void MessageEventModelBenchmark::historyInsertion()
+{
+    QFETCH(int, eventCount);
+    auto* room = m_timeline->makeRoom();
+    m_timeline->feed(room,
+        m_timeline->makeEvents(HistoryBaseSize, TimelineMix::chat()));
+
+    // /messages returns events from the newest to the oldest
+    const auto events = m_timeline->makeEvents(eventCount, TimelineMix::chat());
+    QJsonArray history;
+    for (auto it = events.end(); it != events.begin();)
+        history.push_back(*--it);
+    m_timeline->setHistory(history);
+
+    // Only time the insertion itself, not the loopback request and parsing
+    QElapsedTimer et;
+    connect(room, &QMatrixClient::Room::aboutToAddHistoricalMessages,
+            this, [&et] { et.start(); });
+    MessageEventModel model;
+    model.changeRoom(room);
+    qint64 elapsedNs = 0;
+    connect(room, &QMatrixClient::Room::addedMessages,
+            this, [&et, &elapsedNs] { elapsedNs = et.nsecsElapsed(); });
+    m_timeline->loadHistory(room, eventCount);
+    room->disconnect(this);
+
+    QCOMPARE(room->timelineSize(), HistoryBaseSize + eventCount);
+    QTest::setBenchmarkResult(elapsedNs / 1e6, QTest::WalltimeMilliseconds);
+}
@@ -0,0 +1,57 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include "synthetictimeline.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+
+/// Timings of MessageEventModel over synthetic timelines
+/**
+ * Each case runs at 1k, 10k and 100k events; data tags are named
+ * "<what>/<event count>/<mix>" so that results of different runs can be
+ * matched line by line (use -o <file>,csv for machine-readable output).
+ */
+class MessageEventModelBenchmark: public QObject
+{
+        Q_OBJECT
+    private slots:
+        void initTestCase();
+        void cleanup();
+
+        void ingestNewEvents_data();
+        void ingestNewEvents();
+        void roleData_data();
+        void roleData();
+        void aboveAuthorChains_data();
+        void aboveAuthorChains();
+        void refreshLastUserEvents_data();
+        void refreshLastUserEvents();
+        void historyInsertion_data();
+        void historyInsertion();
+
+    private:
+        SyntheticTimeline* m_timeline = nullptr;
+        /// Rooms that are only read from, shared between cases
+        QHash<QString, QuaternionRoom*> m_rooms;
+
+        QuaternionRoom* sharedRoom(int eventCount, const TimelineMix& mix);
+};
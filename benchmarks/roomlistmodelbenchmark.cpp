@@ -0,0 +1,256 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "roomlistmodelbenchmark.h"
+
+#include "alloccounter.h"
+#include "synthetictimeline.h"
+#include "quaternionroom.h"
+#include "models/roomlistmodel.h"
+
+#include <connection.h>
+
+#include <QtTest/QtTest>
+
+static const int RoomCounts[] = { 100, 1000, 5000, 20000 };
+static const int CustomTagsCount = 20;
+static const int TagChangesCount = 100;
+static const int RejoinsCount = 10;
+
+static void addColumns()
+{
+    QTest::addColumn<int>("roomCount");
+    QTest::addColumn<QString>("tagging");
+    QTest::addColumn<int>("accountCount");
+}
+
+static void addRows()
+{
+    addColumns();
+    for (auto count: RoomCounts)
+        for (const auto& tagging: { "untagged", "favourites", "custom" })
+            for (auto accounts: { 1, 3 })
+                QTest::newRow(qPrintable(QStringLiteral("%1/%2/%3acc")
+                                         .arg(count).arg(tagging).arg(accounts)))
+                    << count << QString(tagging) << accounts;
+}
+
+/// Tags for the n-th room, deterministic for each distribution
+static QStringList tagsFor(const QString& tagging, int n)
+{
+    if (tagging == "favourites")
+        return n % 10 == 0 ? QStringList { QStringLiteral("m.favourite") } :
+               n % 10 == 1 ? QStringList { QStringLiteral("m.lowpriority") } :
+                             QStringList();
+    if (tagging == "custom")
+    {
+        QStringList tags;
+        for (int i = 0; i <= n % 3; ++i)
+            tags.push_back(QStringLiteral("u.tag%1")
+                           .arg((n * 7 + i) % CustomTagsCount));
+        return tags;
+    }
+    return {};
+}
+
+void RoomListModelBenchmark::cleanupTestCase()
+{
+    for (const auto& accounts: qAsConst(m_accounts))
+        qDeleteAll(accounts);
+    m_accounts.clear();
+}
+
+const RoomListModelBenchmark::accounts_t& RoomListModelBenchmark::accounts()
+{
+    QFETCH(int, roomCount);
+    QFETCH(QString, tagging);
+    QFETCH(int, accountCount);
+
+    auto& accounts = m_accounts[QStringLiteral("%1/%2/%3")
+                                .arg(roomCount).arg(tagging).arg(accountCount)];
+    if (accounts.empty())
+    {
+        for (int i = 0; i < accountCount; ++i)
+            accounts.push_back(new SyntheticTimeline(nullptr,
+                QStringLiteral("@bench%1:localhost").arg(i)));
+        for (int n = 0; n < roomCount; ++n)
+        {
+            auto* room = accounts[n % accountCount]->makeRoom();
+            const auto tags = tagsFor(tagging, n);
+            if (!tags.isEmpty())
+                accounts[n % accountCount]->setTags(room, tags);
+        }
+    }
+    return accounts;
+}
+
+void RoomListModelBenchmark::reportAllocations(
+        const std::function<void()>& operation, int operationsCount)
+{
+    const auto before = allocationsCount();
+    operation();
+    qInfo().noquote() << "Allocations per operation:"
+        << (allocationsCount() - before) / quint64(operationsCount);
+}
+
+void RoomListModelBenchmark::addConnection_data()
+{
+    addRows();
+}
+
+void RoomListModelBenchmark::addConnection()
+{
+    const auto& accs = accounts();
+    const auto operation = [&accs] {
+        RoomListModel model;
+        model.setOrder(RoomListModel::GroupByTag, RoomListModel::SortByName);
+        for (auto* a: accs)
+            model.addConnection(a->connection());
+    };
+    reportAllocations(operation);
+    QBENCHMARK { operation(); }
+}
+
+void RoomListModelBenchmark::setOrder_data()
+{
+    addRows();
+}
+
+void RoomListModelBenchmark::setOrder()
+{
+    RoomListModel model;
+    for (auto* a: accounts())
+        model.addConnection(a->connection());
+    const auto operation = [&model] {
+        model.setOrder(RoomListModel::GroupByTag, RoomListModel::SortByName);
+    };
+    reportAllocations(operation);
+    QBENCHMARK { operation(); }
+}
+
+void RoomListModelBenchmark::changeTags_data()
+{
+    addRows();
+}
+
+void RoomListModelBenchmark::changeTags()
+{
+    // Tag changes go through prepareToUpdateGroups() and updateGroups()
+    QFETCH(QString, tagging);
+    const auto& accs = accounts();
+    RoomListModel model;
+    model.setOrder(RoomListModel::GroupByTag, RoomListModel::SortByName);
+    for (auto* a: accs)
+        model.addConnection(a->connection());
+
+    QVector<QPair<SyntheticTimeline*, QuaternionRoom*>> rooms;
+    for (auto* a: accs)
+        for (auto* r: a->connection()->roomMap())
+            if (rooms.size() < TagChangesCount)
+                rooms.push_back({ a, static_cast<QuaternionRoom*>(r) });
+
+    // Each operation moves the rooms to a new tag and back, leaving
+    // the model in the same state as before
+    const auto operation = [&rooms, &tagging] {
+        for (int i = 0; i < rooms.size(); ++i)
+        {
+            auto tags = tagsFor(tagging, i);
+            rooms[i].first->setTags(rooms[i].second,
+                                    tags + QStringList { "u.benchmark" });
+            rooms[i].first->setTags(rooms[i].second, tags);
+        }
+    };
+    reportAllocations(operation, 2 * rooms.size());
+    QBENCHMARK { operation(); }
+}
+
+void RoomListModelBenchmark::leaveAndRejoin_data()
+{
+    addRows();
+}
+
+void RoomListModelBenchmark::leaveAndRejoin()
+{
+    // Each join state change makes replaceRoom() rebuild the whole model
+    using QMatrixClient::JoinState;
+    auto* connection = accounts().front()->connection();
+    RoomListModel model;
+    model.setOrder(RoomListModel::GroupByTag, RoomListModel::SortByName);
+    for (auto* a: accounts())
+        model.addConnection(a->connection());
+
+    QStringList roomIds;
+    for (auto* r: connection->roomMap())
+        if (roomIds.size() < RejoinsCount)
+            roomIds.push_back(r->id());
+
+    const auto operation = [connection, &roomIds] {
+        for (const auto& id: roomIds)
+        {
+            connection->provideRoom(id, JoinState::Leave);
+            connection->provideRoom(id, JoinState::Join);
+        }
+    };
+    reportAllocations(operation, 2 * roomIds.size());
+    QBENCHMARK { operation(); }
+}
+
+void RoomListModelBenchmark::roleData_data()
+{
+    addColumns();
+    QTest::addColumn<int>("role");
+    const std::pair<const char*, int> roles[] = {
+        { "display", Qt::DisplayRole },
+        { "decoration", Qt::DecorationRole },
+        { "toolTip", Qt::ToolTipRole },
+        { "hasUnread", RoomListModel::HasUnreadRole },
+        { "highlightCount", RoomListModel::HighlightCountRole },
+        { "joinState", RoomListModel::JoinStateRole },
+        { "object", RoomListModel::ObjectRole }
+    };
+    for (const auto& role: roles)
+        for (auto count: RoomCounts)
+            QTest::newRow(qPrintable(QStringLiteral("%1/%2/custom/1acc")
+                                     .arg(role.first).arg(count)))
+                << count << QStringLiteral("custom") << 1 << role.second;
+}
+
+void RoomListModelBenchmark::roleData()
+{
+    QFETCH(int, role);
+    RoomListModel model;
+    model.setOrder(RoomListModel::GroupByTag, RoomListModel::SortByName);
+    for (auto* a: accounts())
+        model.addConnection(a->connection());
+
+    QModelIndexList indices;
+    for (int g = 0; g < model.rowCount({}); ++g)
+    {
+        const auto groupIdx = model.index(g, 0);
+        indices.push_back(groupIdx);
+        for (int r = 0; r < model.rowCount(groupIdx); ++r)
+            indices.push_back(model.index(r, 0, groupIdx));
+    }
+    const auto operation = [&model, &indices, role] {
+        for (const auto& idx: indices)
+            model.data(idx, role);
+    };
+    reportAllocations(operation, indices.size());
+    QBENCHMARK { operation(); }
+}
@@ -0,0 +1,61 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+
+#include <functional>
+#include <vector>
+
+class SyntheticTimeline;
+
+/// Scaling of RoomListModel with the number of rooms and accounts
+/**
+ * Cases run over 100 to 20000 rooms, split between one or three accounts,
+ * with different tag distributions. Besides the time, each case reports
+ * the number of allocations per operation as a QINFO line.
+ */
+class RoomListModelBenchmark: public QObject
+{
+        Q_OBJECT
+    private slots:
+        void cleanupTestCase();
+
+        void addConnection_data();
+        void addConnection();
+        void setOrder_data();
+        void setOrder();
+        void changeTags_data();
+        void changeTags();
+        void leaveAndRejoin_data();
+        void leaveAndRejoin();
+        void roleData_data();
+        void roleData();
+
+    private:
+        using accounts_t = std::vector<SyntheticTimeline*>;
+        QHash<QString, accounts_t> m_accounts;
+
+        /// Accounts with rooms for the current data row, cached between cases
+        const accounts_t& accounts();
+        void reportAllocations(const std::function<void()>& operation,
+                               int operationsCount = 1);
+};
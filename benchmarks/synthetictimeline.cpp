@@ -0,0 +1,267 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "synthetictimeline.h"
+
+#include "quaternionroom.h"
+
+#include <connection.h>
+#include <jobs/syncjob.h>
+
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtCore/QEventLoop>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
+
+#include <algorithm>
+#include <random>
+
+using namespace QMatrixClient;
+
+static const int SenderPoolSize = 50;
+static const auto BaseTimestamp = qint64(1535760000000); // 2018-09-01
+static const int HistoryTimeoutMs = 600000;
+
+const QString SyntheticTimeline::LocalUserId =
+        QStringLiteral("@bench:localhost");
+
+TimelineMix TimelineMix::chat()
+{
+    TimelineMix mix;
+    mix.name = QStringLiteral("chat");
+    return mix;
+}
+
+TimelineMix TimelineMix::busy()
+{
+    TimelineMix mix;
+    mix.name = QStringLiteral("busy");
+    mix.messages = 40;
+    mix.membership = 50;
+    mix.redactions = 5;
+    mix.state = 5;
+    return mix;
+}
+
+SyntheticTimeline::SyntheticTimeline(QObject* parent, const QString& userId)
+    : QObject(parent), m_server(new QTcpServer(this))
+{
+    m_server->listen(QHostAddress::LocalHost);
+    connect(m_server, &QTcpServer::newConnection,
+            this, &SyntheticTimeline::serveRequest);
+
+    Connection::setRoomType<QuaternionRoom>();
+    m_connection = new Connection(
+        QUrl(QStringLiteral("http://127.0.0.1:%1").arg(m_server->serverPort())),
+        this);
+    m_connection->connectWithToken(userId,
+                                   QStringLiteral("benchmark_token"),
+                                   QStringLiteral("BENCHMARK"));
+}
+
+SyntheticTimeline::~SyntheticTimeline() = default;
+
+Connection* SyntheticTimeline::connection() const
+{
+    return m_connection;
+}
+
+QuaternionRoom* SyntheticTimeline::makeRoom()
+{
+    const auto roomId =
+        QStringLiteral("!room%1:localhost").arg(++m_roomCounter);
+    return static_cast<QuaternionRoom*>(
+                m_connection->provideRoom(roomId, JoinState::Join));
+}
+
+QJsonObject SyntheticTimeline::makeEvent(const QString& type,
+        const QString& senderId, const QJsonObject& content)
+{
+    const auto n = ++m_eventCounter;
+    return QJsonObject {
+        { QStringLiteral("type"), type },
+        { QStringLiteral("event_id"), QStringLiteral("$e%1:localhost").arg(n) },
+        { QStringLiteral("sender"), senderId },
+        { QStringLiteral("origin_server_ts"), BaseTimestamp + n * 15000 },
+        { QStringLiteral("content"), content }
+    };
+}
+
+QJsonArray SyntheticTimeline::makeEvents(int count, const TimelineMix& mix)
+{
+    std::mt19937 gen { m_seed++ };
+    std::uniform_int_distribution<int> senderDist { 1, SenderPoolSize };
+    std::uniform_int_distribution<int> kindDist {
+        1, mix.messages + mix.membership + mix.redactions + mix.state };
+    std::uniform_int_distribution<int> lengthDist { 1, 40 };
+
+    QJsonArray events;
+    QVector<bool> joined(SenderPoolSize + 1, true);
+    QStringList redactableIds;
+    for (int i = 0; i < count; ++i)
+    {
+        const auto senderNo = senderDist(gen);
+        const auto senderId = QStringLiteral("@user%1:localhost").arg(senderNo);
+        auto kind = kindDist(gen);
+        if ((kind -= mix.messages) <= 0)
+        {
+            const auto body = QStringLiteral("Lorem ipsum dolor sit amet ")
+                                .repeated(lengthDist(gen));
+            auto e = makeEvent(QStringLiteral("m.room.message"), senderId,
+                { { QStringLiteral("msgtype"), QStringLiteral("m.text") },
+                  { QStringLiteral("body"), body } });
+            redactableIds.push_back(e.value("event_id").toString());
+            events.push_back(e);
+        }
+        else if ((kind -= mix.membership) <= 0)
+        {
+            joined[senderNo] = !joined[senderNo];
+            auto e = makeEvent(QStringLiteral("m.room.member"), senderId,
+                { { QStringLiteral("membership"),
+                    joined[senderNo] ? QStringLiteral("join")
+                                     : QStringLiteral("leave") },
+                  { QStringLiteral("displayname"),
+                    QStringLiteral("User %1").arg(senderNo) } });
+            e.insert(QStringLiteral("state_key"), senderId);
+            events.push_back(e);
+        }
+        else if ((kind -= mix.redactions) <= 0 && !redactableIds.isEmpty())
+        {
+            std::uniform_int_distribution<int> targetDist {
+                0, redactableIds.size() - 1 };
+            auto e = makeEvent(QStringLiteral("m.room.redaction"), senderId,
+                { { QStringLiteral("reason"), QStringLiteral("Benchmark") } });
+            e.insert(QStringLiteral("redacts"),
+                     redactableIds.takeAt(targetDist(gen)));
+            events.push_back(e);
+        }
+        else
+        {
+            auto e = makeEvent(QStringLiteral("m.room.topic"), senderId,
+                { { QStringLiteral("topic"),
+                    QStringLiteral("Topic #%1").arg(i) } });
+            e.insert(QStringLiteral("state_key"), QString());
+            events.push_back(e);
+        }
+    }
+    return events;
+}
+
+QJsonArray SyntheticTimeline::makeRedactions(const QJsonArray& events,
+                                             int count)
+{
+    QStringList targetIds;
+    QSet<QString> redactedIds;
+    for (const auto& v: events)
+    {
+        const auto e = v.toObject();
+        const auto type = e.value("type").toString();
+        if (type == "m.room.message")
+            targetIds.push_back(e.value("event_id").toString());
+        else if (type == "m.room.redaction")
+            redactedIds.insert(e.value("redacts").toString());
+    }
+    targetIds.erase(std::remove_if(targetIds.begin(), targetIds.end(),
+        [&redactedIds] (const QString& id) { return redactedIds.contains(id); }),
+        targetIds.end());
+
+    QJsonArray redactions;
+    const auto step = std::max(1, targetIds.size() / std::max(1, count));
+    for (int i = 0; i < targetIds.size() && redactions.size() < count; i += step)
+    {
+        auto e = makeEvent(QStringLiteral("m.room.redaction"), LocalUserId,
+            { { QStringLiteral("reason"), QStringLiteral("Benchmark") } });
+        e.insert(QStringLiteral("redacts"), targetIds[i]);
+        redactions.push_back(e);
+    }
+    return redactions;
+}
+
+void SyntheticTimeline::feed(QuaternionRoom* room, const QJsonArray& events)
+{
+    const QJsonObject roomJson {
+        { QStringLiteral("timeline"), QJsonObject {
+            { QStringLiteral("events"), events },
+            { QStringLiteral("limited"), true },
+            { QStringLiteral("prev_batch"),
+              QStringLiteral("b%1").arg(++m_batchCounter) }
+        } }
+    };
+    room->updateData(SyncRoomData(room->id(), JoinState::Join, roomJson));
+}
+
+void SyntheticTimeline::setTags(QuaternionRoom* room, const QStringList& tags)
+{
+    QJsonObject tagsJson;
+    for (const auto& t: tags)
+        tagsJson.insert(t, QJsonObject());
+    const QJsonObject roomJson {
+        { QStringLiteral("account_data"), QJsonObject {
+            { QStringLiteral("events"), QJsonArray { QJsonObject {
+                { QStringLiteral("type"), QStringLiteral("m.tag") },
+                { QStringLiteral("content"), QJsonObject {
+                    { QStringLiteral("tags"), tagsJson } } }
+            } } }
+        } }
+    };
+    room->updateData(SyncRoomData(room->id(), JoinState::Join, roomJson));
+}
+
+void SyntheticTimeline::setHistory(const QJsonArray& eventsNewestFirst)
+{
+    m_history = eventsNewestFirst;
+}
+
+void SyntheticTimeline::loadHistory(QuaternionRoom* room, int limit)
+{
+    QEventLoop loop;
+    connect(room, &Room::addedMessages, &loop, &QEventLoop::quit);
+    QTimer::singleShot(HistoryTimeoutMs, &loop, &QEventLoop::quit);
+    room->getPreviousContent(limit);
+    loop.exec();
+}
+
+void SyntheticTimeline::serveRequest()
+{
+    // Only /messages is ever requested, and only one request at a time;
+    // so there's no need to parse the request beyond its headers.
+    while (auto* socket = m_server->nextPendingConnection())
+    {
+        connect(socket, &QTcpSocket::disconnected,
+                socket, &QObject::deleteLater);
+        connect(socket, &QTcpSocket::readyRead, socket, [this, socket] {
+            if (!socket->peek(socket->bytesAvailable()).contains("\r\n\r\n"))
+                return; // Wait for the rest of the headers
+            socket->readAll();
+            const auto body = QJsonDocument(QJsonObject {
+                { QStringLiteral("start"), QStringLiteral("h%1").arg(m_batchCounter) },
+                { QStringLiteral("end"), QStringLiteral("h%1").arg(++m_batchCounter) },
+                { QStringLiteral("chunk"), m_history }
+            }).toJson(QJsonDocument::Compact);
+            socket->write("HTTP/1.1 200 OK\r\n"
+                          "Content-Type: application/json\r\n"
+                          "Connection: close\r\n"
+                          "Content-Length: " + QByteArray::number(body.size()) +
+                          "\r\n\r\n" + body);
+            socket->disconnectFromHost();
+        });
+    }
+}
@@ -0,0 +1,98 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QJsonArray>
+#include <QtCore/QObject>
+#include <QtCore/QUrl>
+
+class QTcpServer;
+
+namespace QMatrixClient
+{
+    class Connection;
+}
+class QuaternionRoom;
+
+/// Relative weights of event kinds in a synthetic timeline
+struct TimelineMix
+{
+    QString name;
+    int messages = 85;
+    int membership = 8;
+    int redactions = 4;
+    int state = 3;
+
+    /// Mostly messages, as in a quiet chat
+    static TimelineMix chat();
+    /// Lots of joins and leaves, as in large public rooms
+    static TimelineMix busy();
+};
+
+/// Generates reproducible timelines and feeds them to rooms
+/**
+ * Events are made from a fixed-seed PRNG, so the same mix and count
+ * give the same timeline on every run and timings can be compared across
+ * commits. Rooms are real QuaternionRoom objects of a Connection that
+ * never talks to a real server: new events are fed as if they came from
+ * a sync, and history is served by a minimal in-process HTTP responder.
+ */
+class SyntheticTimeline: public QObject
+{
+        Q_OBJECT
+    public:
+        static const QString LocalUserId;
+
+        explicit SyntheticTimeline(QObject* parent = nullptr,
+                                   const QString& userId = LocalUserId);
+        ~SyntheticTimeline() override;
+
+        QMatrixClient::Connection* connection() const;
+
+        /// Make a new room with no events in it
+        QuaternionRoom* makeRoom();
+        /// Make count events with the given mix, oldest first
+        QJsonArray makeEvents(int count, const TimelineMix& mix);
+        /// Make redactions of count messages spread evenly over events
+        QJsonArray makeRedactions(const QJsonArray& events, int count);
+        /// Pass events to the room as if they arrived with a sync
+        void feed(QuaternionRoom* room, const QJsonArray& events);
+
+        /// Replace the room tags, as if the change came with a sync
+        void setTags(QuaternionRoom* room, const QStringList& tags);
+
+        /// Events to be returned by the next /messages request
+        void setHistory(const QJsonArray& eventsNewestFirst);
+        /// Request history and wait until the room has added it
+        void loadHistory(QuaternionRoom* room, int limit);
+
+    private:
+        QMatrixClient::Connection* m_connection;
+        QTcpServer* m_server;
+        QJsonArray m_history;
+        int m_roomCounter = 0;
+        int m_eventCounter = 0;
+        int m_batchCounter = 0;
+        quint32 m_seed = 20180901;
+
+        QJsonObject makeEvent(const QString& type, const QString& senderId,
+                              const QJsonObject& content);
+        void serveRequest();
+};
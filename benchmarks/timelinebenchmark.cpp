@@ -0,0 +1,331 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "timelinebenchmark.h"
+
+#include "synthetictimeline.h"
+#include "quaternionroom.h"
+#include "imageprovider.h"
+#include "models/messageeventmodel.h"
+
+#include <user.h>
+#include <settings.h>
+#include <events/roommessageevent.h>
+
+#include <QtQuick/QQuickItem>
+#include <QtQuick/QQuickRenderControl>
+#include <QtQuick/QQuickWindow>
+#include <QtQml/QQmlComponent>
+#include <QtQml/QQmlContext>
+#include <QtQml/QQmlEngine>
+#include <QtQml/QtQml>
+#include <QtGui/QGuiApplication>
+#include <QtGui/QOffscreenSurface>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLFramebufferObject>
+#include <QtGui/QOpenGLFunctions>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QJsonArray>
+#include <QtCore/QTextStream>
+
+#include <algorithm>
+#include <cmath>
+
+static const int FrameIntervalMs = 16;
+static const int MaxFramesPerFling = 300;
+static const int FramesPerHistoryLoad = 30;
+static const qreal FlingVelocity = 4000;
+static const QSize DefaultSize { 800, 600 };
+static const QSize ResizeSizes[] = {
+    { 800, 600 }, { 1024, 768 }, { 640, 480 }, { 1280, 1024 }
+};
+
+QVariant CountingModel::data(const QModelIndex& index, int role) const
+{
+    ++m_counts[role];
+    return QIdentityProxyModel::data(index, role);
+}
+
+QMap<QByteArray, quint64> CountingModel::takeCounts()
+{
+    const auto names = roleNames();
+    QMap<QByteArray, quint64> result;
+    for (auto it = m_counts.cbegin(); it != m_counts.cend(); ++it)
+        result.insert(names.value(it.key(), QByteArray::number(it.key())),
+                      it.value());
+    m_counts.clear();
+    return result;
+}
+
+TimelineBenchmark::TimelineBenchmark(int eventCount, QObject* parent)
+    : QObject(parent), m_eventCount(eventCount)
+    , m_timeline(new SyntheticTimeline(this))
+    , m_messageModel(new MessageEventModel(this))
+    , m_countingModel(new CountingModel(this))
+    , m_controller(new TimelineControllerStub(this))
+    , m_animationDriver(new SteppedAnimationDriver(FrameIntervalMs))
+{
+    m_countingModel->setSourceModel(m_messageModel);
+}
+
+TimelineBenchmark::~TimelineBenchmark()
+{
+    if (m_context)
+        m_context->makeCurrent(m_surface);
+    delete m_rootItem;
+    delete m_engine;
+    delete m_window;
+    delete m_renderControl;
+    delete m_fbo;
+    if (m_context)
+        m_context->doneCurrent();
+    delete m_surface;
+    delete m_context;
+    m_animationDriver->uninstall();
+    delete m_animationDriver;
+}
+
+bool TimelineBenchmark::initialize()
+{
+    using namespace QMatrixClient;
+    // Same as in ChatRoomWidget
+    qmlRegisterUncreatableType<QuaternionRoom>("QMatrixClient", 1, 0, "Room",
+        "Room objects can only be created by libqmatrixclient");
+    qmlRegisterUncreatableType<User>("QMatrixClient", 1, 0, "User",
+        "User objects can only be created by libqmatrixclient");
+    qmlRegisterType<Settings>("QMatrixClient", 1, 0, "Settings");
+    qmlRegisterUncreatableType<RoomMessageEvent>("QMatrixClient", 1, 0,
+        "RoomMessageEvent", "RoomMessageEvent is uncreatable");
+
+    m_animationDriver->install();
+
+    QSurfaceFormat format;
+    format.setDepthBufferSize(24);
+    format.setStencilBufferSize(8);
+    m_context = new QOpenGLContext;
+    m_context->setFormat(format);
+    if (!m_context->create())
+    {
+        qCritical() << "Could not create an OpenGL context; try another"
+                       " QT_QPA_PLATFORM";
+        return false;
+    }
+    m_surface = new QOffscreenSurface;
+    m_surface->setFormat(m_context->format());
+    m_surface->create();
+    m_context->makeCurrent(m_surface);
+
+    m_renderControl = new QQuickRenderControl;
+    m_window = new QQuickWindow(m_renderControl);
+    m_renderControl->initialize(m_context);
+
+    m_room = m_timeline->makeRoom();
+    m_timeline->feed(m_room, m_timeline->makeEvents(m_eventCount,
+                                                    TimelineMix::chat()));
+
+    m_engine = new QQmlEngine;
+    m_engine->addImageProvider("mtx", new ImageProvider(m_room->connection()));
+    auto* ctxt = m_engine->rootContext();
+    ctxt->setContextProperty("messageModel", m_countingModel);
+    ctxt->setContextProperty("controller", m_controller);
+    ctxt->setContextProperty("debug", QVariant(false));
+    ctxt->setContextProperty("room", m_room);
+
+    QQmlComponent component(m_engine, QUrl("qrc:///qml/Timeline.qml"));
+    m_rootItem = qobject_cast<QQuickItem*>(component.create());
+    if (!m_rootItem)
+    {
+        qCritical() << "Could not load Timeline.qml:" << component.errors();
+        return false;
+    }
+    m_rootItem->setParentItem(m_window->contentItem());
+    m_chatView = m_rootItem->findChild<QQuickItem*>("chatView");
+    Q_ASSERT(m_chatView);
+    auto* contentItem = m_chatView->property("contentItem").value<QQuickItem*>();
+    connect(contentItem, &QQuickItem::childrenChanged,
+            this, &TimelineBenchmark::trackDelegates);
+    resize(DefaultSize);
+
+    m_messageModel->changeRoom(m_room);
+    // Settle the initial layout, so that it doesn't count in the scenarios
+    for (int i = 0; i < FramesPerHistoryLoad; ++i)
+        renderFrame();
+    m_frameTimesNs.clear();
+    m_delegatesCreated = 0;
+    m_countingModel->takeCounts();
+    return true;
+}
+
+void TimelineBenchmark::resize(const QSize& size)
+{
+    if (m_fbo && m_fbo->size() == size)
+        return;
+    delete m_fbo;
+    m_fbo = new QOpenGLFramebufferObject(size,
+                QOpenGLFramebufferObject::CombinedDepthStencil);
+    m_window->setRenderTarget(m_fbo);
+    m_window->setGeometry(QRect(QPoint(), size));
+    m_window->contentItem()->setSize(size);
+    m_rootItem->setSize(size);
+}
+
+void TimelineBenchmark::renderFrame()
+{
+    QElapsedTimer et;
+    et.start();
+    m_animationDriver->advanceFrame();
+    QCoreApplication::processEvents();
+    m_renderControl->polishItems();
+    m_renderControl->sync();
+    m_renderControl->render();
+    m_context->functions()->glFinish();
+    m_frameTimesNs.push_back(et.nsecsElapsed());
+}
+
+void TimelineBenchmark::trackDelegates()
+{
+    auto* contentItem = m_chatView->property("contentItem").value<QQuickItem*>();
+    for (auto* item: contentItem->childItems())
+        if (!m_delegates.contains(item))
+        {
+            m_delegates.insert(item);
+            ++m_delegatesCreated;
+            connect(item, &QObject::destroyed, this, [this, item] {
+                m_delegates.remove(item);
+            });
+        }
+}
+
+void TimelineBenchmark::runFlings(int flingCount)
+{
+    for (int i = 0; i < flingCount; ++i)
+    {
+        // Fling towards older events, and back on every other fling
+        const auto velocity = i % 2 == 0 ? FlingVelocity : -FlingVelocity;
+        QMetaObject::invokeMethod(m_chatView, "flick",
+                                  Q_ARG(qreal, 0), Q_ARG(qreal, velocity));
+        int frames = 0;
+        do
+            renderFrame();
+        while (m_chatView->property("moving").toBool() &&
+               ++frames < MaxFramesPerFling);
+    }
+    report("fling");
+}
+
+void TimelineBenchmark::runHistoryLoads(int loadCount, int eventsPerLoad)
+{
+    QMetaObject::invokeMethod(m_chatView, "positionViewAtEnd");
+    for (int i = 0; i < loadCount; ++i)
+    {
+        const auto events =
+            m_timeline->makeEvents(eventsPerLoad, TimelineMix::chat());
+        QJsonArray history;
+        for (auto it = events.end(); it != events.begin();)
+            history.push_back(*--it);
+        m_timeline->setHistory(history);
+        m_timeline->loadHistory(m_room, eventsPerLoad);
+        for (int f = 0; f < FramesPerHistoryLoad; ++f)
+            renderFrame();
+    }
+    m_timeline->setHistory({});
+    report("history");
+}
+
+void TimelineBenchmark::runResizes(int frameCount)
+{
+    const auto sizesCount = int(sizeof(ResizeSizes) / sizeof(ResizeSizes[0]));
+    for (int i = 0; i < frameCount; ++i)
+    {
+        resize(ResizeSizes[i % sizesCount]);
+        renderFrame();
+    }
+    resize(DefaultSize);
+    report("resize");
+}
+
+void TimelineBenchmark::report(const QString& scenario)
+{
+    auto times = m_frameTimesNs;
+    std::sort(times.begin(), times.end());
+    const auto percentile = [&times] (double p) {
+        if (times.isEmpty())
+            return 0.0;
+        const auto i = std::max(0, int(std::ceil(p * times.size())) - 1);
+        return times[i] / 1e6;
+    };
+
+    QTextStream out(stdout);
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+    out.setRealNumberPrecision(3);
+    out << scenario << ".frames " << times.size() << '\n'
+        << scenario << ".frame_ms.p50 " << percentile(0.50) << '\n'
+        << scenario << ".frame_ms.p95 " << percentile(0.95) << '\n'
+        << scenario << ".frame_ms.p99 " << percentile(0.99) << '\n'
+        << scenario << ".delegates_created " << m_delegatesCreated << '\n';
+    const auto counts = m_countingModel->takeCounts();
+    quint64 total = 0;
+    for (auto it = counts.cbegin(); it != counts.cend(); ++it)
+    {
+        out << scenario << ".role_reads." << it.key() << ' '
+            << it.value() << '\n';
+        total += it.value();
+    }
+    out << scenario << ".role_reads " << total << '\n';
+
+    m_frameTimesNs.clear();
+    m_delegatesCreated = 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // Nothing is shown; the offscreen platform needs no display
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+    QGuiApplication::setOrganizationName(QStringLiteral("QMatrixClient"));
+    QGuiApplication::setApplicationName(QStringLiteral("quaternion-benchmarks"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Renders the Quaternion timeline offscreen and reports frame times"));
+    parser.addHelpOption();
+    QCommandLineOption eventsOption("events",
+        QStringLiteral("Number of events in the synthetic room"), "count", "2000");
+    QCommandLineOption flingsOption("flings",
+        QStringLiteral("Number of flings to make"), "count", "20");
+    QCommandLineOption loadsOption("history-loads",
+        QStringLiteral("Number of history pages to load"), "count", "10");
+    QCommandLineOption resizesOption("resizes",
+        QStringLiteral("Number of frames to resize the window at"), "count", "60");
+    parser.addOptions({ eventsOption, flingsOption, loadsOption, resizesOption });
+    parser.process(app);
+
+    TimelineBenchmark benchmark(parser.value(eventsOption).toInt());
+    if (!benchmark.initialize())
+        return 1;
+
+    QTextStream(stdout) << "# events " << parser.value(eventsOption) << '\n';
+    benchmark.runFlings(parser.value(flingsOption).toInt());
+    benchmark.runHistoryLoads(parser.value(loadsOption).toInt(), 100);
+    benchmark.runResizes(parser.value(resizesOption).toInt());
+    return 0;
+}
@@ -0,0 +1,145 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QAbstractAnimation>
+#include <QtCore/QIdentityProxyModel>
+#include <QtCore/QMap>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+
+namespace QMatrixClient
+{
+    class User;
+}
+class QuaternionRoom;
+class MessageEventModel;
+class SyntheticTimeline;
+
+class QOffscreenSurface;
+class QOpenGLContext;
+class QOpenGLFramebufferObject;
+class QQmlEngine;
+class QQuickItem;
+class QQuickRenderControl;
+class QQuickWindow;
+
+/// Stands in for ChatRoomWidget as the "controller" of Timeline.qml
+class TimelineControllerStub: public QObject
+{
+        Q_OBJECT
+    public:
+        using QObject::QObject;
+
+    signals:
+        void scrollToRowRequested(int row);
+
+    public slots:
+        void showStatusMessage(const QString&, int = 0) const { }
+        void insertMention(QMatrixClient::User*) { }
+        void focusInput() { }
+        void onMessageShownChanged(const QString&, bool) { }
+        void saveFileAs(QString) { }
+};
+
+/// Advances animations by exactly one frame interval per frame
+/**
+ * This makes flicks and transitions take the same number of frames
+ * on every run, regardless of how long each frame takes to render.
+ */
+class SteppedAnimationDriver: public QAnimationDriver
+{
+    public:
+        explicit SteppedAnimationDriver(int frameIntervalMs)
+            : m_interval(frameIntervalMs)
+        { }
+
+        void advanceFrame()
+        {
+            m_elapsed += m_interval;
+            advance();
+        }
+        qint64 elapsed() const override { return m_elapsed; }
+
+    private:
+        int m_interval;
+        qint64 m_elapsed = 0;
+};
+
+/// Counts data() calls made by QML, by role
+/**
+ * QML reads model roles when creating delegates and when the model
+ * reports changes; this is the closest measure of binding re-evaluations
+ * driven by the model that Qt makes available outside of the profiler.
+ */
+class CountingModel: public QIdentityProxyModel
+{
+    public:
+        using QIdentityProxyModel::QIdentityProxyModel;
+
+        QVariant data(const QModelIndex& index, int role) const override;
+
+        QMap<QByteArray, quint64> takeCounts();
+
+    private:
+        mutable QHash<int, quint64> m_counts;
+};
+
+/// Renders Timeline.qml offscreen through scripted scenarios
+class TimelineBenchmark: public QObject
+{
+        Q_OBJECT
+    public:
+        TimelineBenchmark(int eventCount, QObject* parent = nullptr);
+        ~TimelineBenchmark() override;
+
+        bool initialize();
+
+        void runFlings(int flingCount);
+        void runHistoryLoads(int loadCount, int eventsPerLoad);
+        void runResizes(int frameCount);
+
+    private:
+        int m_eventCount;
+        SyntheticTimeline* m_timeline;
+        QuaternionRoom* m_room = nullptr;
+        MessageEventModel* m_messageModel;
+        CountingModel* m_countingModel;
+        TimelineControllerStub* m_controller;
+        SteppedAnimationDriver* m_animationDriver;
+
+        QOpenGLContext* m_context = nullptr;
+        QOffscreenSurface* m_surface = nullptr;
+        QOpenGLFramebufferObject* m_fbo = nullptr;
+        QQuickRenderControl* m_renderControl = nullptr;
+        QQuickWindow* m_window = nullptr;
+        QQmlEngine* m_engine = nullptr;
+        QQuickItem* m_rootItem = nullptr;
+        QQuickItem* m_chatView = nullptr;
+
+        QVector<qint64> m_frameTimesNs;
+        QSet<QQuickItem*> m_delegates;
+        int m_delegatesCreated = 0;
+
+        void resize(const QSize& size);
+        void renderFrame();
+        void trackDelegates();
+        void report(const QString& scenario);
+};
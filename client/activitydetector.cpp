@@ -20,6 +20,7 @@
 #include "activitydetector.h"
 
 #include <QtCore/QDebug>
+#include <QtCore/QTimerEvent>
 
 #include "mainwindow.h"
 #include "chatroomwidget.h"
@@ -49,25 +50,46 @@ void ActivityDetector::setEnabled(bool enabled)
         return;
 
     m_enabled = enabled;
+    m_activityDetected = false;
     m_mainWindow.setMouseTracking(enabled);
     if (enabled)
+    {
         m_app.installEventFilter(this);
-    else
+        m_checkTimer.start(200, this);
+    } else {
         m_app.removeEventFilter(this);
+        m_checkTimer.stop();
+    }
     qDebug() << "Activity Detector enabled:" << enabled;
 }
 
 bool ActivityDetector::eventFilter(QObject* obj, QEvent* ev)
 {
+    // This sees every event in the application; so only take a note here
+    // and let timerEvent() deal with it.
     switch (ev->type())
     {
     case QEvent::KeyPress:
     case QEvent::FocusIn:
     case QEvent::MouseMove:
     case QEvent::MouseButtonPress:
-        emit triggered();
+        m_activityDetected = true;
         break;
     default:;
     }
     return QObject::eventFilter(obj, ev);
 }
+
+void ActivityDetector::timerEvent(QTimerEvent* event)
+{
+    if (event->timerId() != m_checkTimer.timerId())
+    {
+        QObject::timerEvent(event);
+        return;
+    }
+    if (m_activityDetected)
+    {
+        m_activityDetected = false;
+        emit triggered();
+    }
+}
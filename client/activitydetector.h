@@ -20,6 +20,7 @@
 #pragma once
 
 #include <QtWidgets/QApplication>
+#include <QtCore/QBasicTimer>
 
 class MainWindow;
 
@@ -39,9 +40,12 @@ class ActivityDetector : public QObject
 
     protected:
         bool eventFilter(QObject* obj, QEvent* ev);
+        void timerEvent(QTimerEvent* event) override;
 
     private:
         QApplication& m_app;
         MainWindow& m_mainWindow;
         bool m_enabled;
+        bool m_activityDetected = false;
+        QBasicTimer m_checkTimer;
 };
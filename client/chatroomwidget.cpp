@@ -25,9 +25,12 @@
 #include <QtWidgets/QLabel>
 #include <QtWidgets/QFileDialog>
 #include <QtWidgets/QApplication>
+#include <QtWidgets/QAction>
 
 #include <QtQml/QQmlContext>
 #include <QtQml/QQmlEngine>
+#include <QtQuick/QQuickWindow>
+#include <QtQuick/QQuickItem>
 #ifdef DISABLE_QQUICKWIDGET
 #include <QtQuick/QQuickView>
 #else
@@ -42,15 +45,44 @@
 #include <settings.h>
 #include "models/messageeventmodel.h"
 #include "imageprovider.h"
+#include "readreceiptscheduler.h"
+#include "roomfindbar.h"
 #include "chatedit.h"
+#include "perfstats.h"
+#include "roomswitchstats.h"
+#include "tracing.h"
 
 static const auto DefaultPlaceholderText =
         ChatRoomWidget::tr("Choose a room to send messages or enter a command...");
+static const int ScrollBackPageSize = 100;
+static const int MaxScrollBackPages = 20;
+
+/// Record scene graph synchronisation and rendering as tracing spans
+/** The signals come from the render thread, if the scene graph uses one. */
+static void traceFrames(QQuickWindow* window)
+{
+    if (!Tracer::isActive())
+        return;
+    QObject::connect(window, &QQuickWindow::beforeSynchronizing, window,
+        [] { TRACE_BEGIN("QQuickWindow::synchronize", "qml"); },
+        Qt::DirectConnection);
+    QObject::connect(window, &QQuickWindow::afterSynchronizing, window,
+        [] { TRACE_END(); }, Qt::DirectConnection);
+    QObject::connect(window, &QQuickWindow::beforeRendering, window,
+        [] { TRACE_BEGIN("QQuickWindow::render", "qml"); },
+        Qt::DirectConnection);
+    QObject::connect(window, &QQuickWindow::afterRendering, window,
+        [] { TRACE_END(); }, Qt::DirectConnection);
+    QObject::connect(window, &QQuickWindow::frameSwapped, window,
+        [] { Tracer::instant("QQuickWindow::frameSwapped", "qml"); },
+        Qt::DirectConnection);
+}
 
 ChatRoomWidget::ChatRoomWidget(QWidget* parent)
     : QWidget(parent)
     , m_messageModel(new MessageEventModel(this))
     , m_currentRoom(nullptr)
+    , m_receiptScheduler(new ReadReceiptScheduler(this))
     , readMarkerOnScreen(false)
 {
     {
@@ -90,17 +122,40 @@ ChatRoomWidget::ChatRoomWidget(QWidget* parent)
     qmlContainer->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
 
     m_timelineWidget->setResizeMode(timelineWidget_t::SizeRootObjectToView);
+#ifdef DISABLE_QQUICKWIDGET
+    QQuickWindow* quickWindow = m_timelineWidget;
+#else
+    QQuickWindow* quickWindow = m_timelineWidget->quickWindow();
+#endif
+    traceFrames(quickWindow);
 
     m_imageProvider = new ImageProvider(nullptr); // No connection yet
     m_timelineWidget->engine()->addImageProvider("mtx", m_imageProvider);
+    PerfStats::instance()->watchTimeline(quickWindow, m_messageModel,
+                                         m_imageProvider);
+    RoomSwitchStats::instance()->watchWindow(quickWindow);
 
     QQmlContext* ctxt = m_timelineWidget->rootContext();
     ctxt->setContextProperty("messageModel", m_messageModel);
     ctxt->setContextProperty("controller", this);
     ctxt->setContextProperty("debug", QVariant(false));
+    ctxt->setContextProperty("perfStats", PerfStats::instance());
 
     m_timelineWidget->setSource(QUrl("qrc:///qml/Timeline.qml"));
 
+    m_findBar = new RoomFindBar(m_messageModel, this);
+    m_findBar->hide();
+    connect(m_findBar, &RoomFindBar::matchSelected,
+            this, &ChatRoomWidget::scrollToEvent);
+    auto* findAction = new QAction(this);
+    findAction->setShortcut(QKeySequence::Find);
+    findAction->setShortcutContext(Qt::WindowShortcut);
+    connect(findAction, &QAction::triggered, this, [this] {
+        if (m_currentRoom)
+            m_findBar->activate();
+    });
+    addAction(findAction);
+
     m_currentlyTyping = new QLabel();
     m_currentlyTyping->setWordWrap(true);
 
@@ -126,14 +181,69 @@ ChatRoomWidget::ChatRoomWidget(QWidget* parent)
     layout->addLayout(headerLayout);
 
     layout->addWidget(topicSeparator);
+    layout->addWidget(m_findBar);
     layout->addWidget(qmlContainer);
     layout->addWidget(m_currentlyTyping);
     layout->addWidget(m_chatEdit);
     setLayout(layout);
 }
 
+qint64 ChatRoomWidget::modelMemoryFootprint() const
+{
+    return m_messageModel->memoryFootprint();
+}
+
+void ChatRoomWidget::setSuspended(bool suspended)
+{
+    if (suspended == m_messageModel->isSuspended())
+        return;
+
+    TRACE_SPAN("ChatRoomWidget::setSuspended", "ui");
+    if (suspended)
+        m_messageModel->suspend();
+    else
+        m_messageModel->resume();
+    // Invisible items are neither polished nor rendered; this also stops
+    // the delegates from requesting images while nobody can see them
+    if (auto* root = m_timelineWidget->rootObject())
+        root->setVisible(!suspended);
+}
+
+void ChatRoomWidget::flushReadReceipts()
+{
+    m_receiptScheduler->flush();
+}
+
+void ChatRoomWidget::prewarm(QuaternionRoom* room)
+{
+    if (room == m_prewarmedRoom)
+        return;
+    dropPrewarmedRoom();
+    if (!room || room == m_currentRoom)
+        return;
+    TRACE_SPAN("ChatRoomWidget::prewarm", "ui");
+    if (!room->isMaterialized())
+    {
+        room->materialize();
+        m_prewarmedRoom = room;
+    }
+    // Get the avatar scaled to the header size (assuming the header
+    // of the other room takes the same height), so that updateHeader()
+    // finds it in the cache
+    room->avatar(m_topicLabel->heightForWidth(width()));
+}
+
+void ChatRoomWidget::dropPrewarmedRoom()
+{
+    // Rooms with highlights stay materialized, as countChanged() does it
+    if (m_prewarmedRoom && m_prewarmedRoom->highlightCount() == 0)
+        m_prewarmedRoom->dematerialize();
+    m_prewarmedRoom.clear();
+}
+
 void ChatRoomWidget::enableDebug()
 {
+    PerfStats::instance()->setEnabled(true);
     QQmlContext* ctxt = m_timelineWidget->rootContext();
     ctxt->setContextProperty("debug", true);
 }
@@ -153,16 +263,26 @@ void ChatRoomWidget::setRoom(QuaternionRoom* room)
         m_currentRoom->connection()->disconnect(this);
         m_currentRoom->disconnect( this );
     }
+    auto* switchStats = RoomSwitchStats::instance();
+    switchStats->stage("leave the previous room");
     readMarkerOnScreen = false;
     maybeReadTimer.stop();
     indicesOnScreen.clear();
+    m_eventToScrollTo.clear();
+    m_scrollBackInFlight = false;
     m_chatEdit->cancelCompletion();
+    if (m_prewarmedRoom == room)
+        m_prewarmedRoom.clear(); // Opened, so it stays materialized
+    else
+        dropPrewarmedRoom();
 
     m_currentRoom = room;
     m_timelineWidget->rootContext()->setContextProperty("room", room);
     if( m_currentRoom )
     {
         using namespace QMatrixClient;
+        m_currentRoom->materialize();
+        switchStats->stage("materialize");
         m_imageProvider->setConnection(room->connection());
         m_chatEdit->setText( m_currentRoom->cachedInput() );
         m_chatEdit->setHistory(roomHistories.value(m_currentRoom));
@@ -187,6 +307,16 @@ void ChatRoomWidget::setRoom(QuaternionRoom* room)
         });
         connect( m_currentRoom, &Room::encryption,
                  this, &ChatRoomWidget::encryptionChanged);
+        connect(m_currentRoom, &Room::addedMessages, this,
+                [this] (int, int biggest) {
+            // Only history pages can bring the event; live events from
+            // syncs shouldn't eat the scroll-back budget
+            if (m_eventToScrollTo.isEmpty()
+                    || biggest >= m_currentRoom->maxTimelineIndex())
+                return;
+            m_scrollBackInFlight = false;
+            scrollToEvent(m_eventToScrollTo);
+        });
         connect(m_currentRoom->connection(), &Connection::loggedOut,
                 this, [this]
         {
@@ -196,11 +326,16 @@ void ChatRoomWidget::setRoom(QuaternionRoom* room)
         m_currentRoom->setDisplayed(true);
     } else
         m_imageProvider->setConnection(nullptr);
+    switchStats->stage("input and signals");
     updateHeader();
     typingChanged();
     encryptionChanged();
+    switchStats->stage("header");
 
     m_messageModel->changeRoom( m_currentRoom );
+    switchStats->stage("timeline model");
+    m_findBar->setRoom(m_currentRoom);
+    switchStats->stage("find bar");
 }
 
 void ChatRoomWidget::typingChanged()
@@ -330,6 +465,13 @@ QString ChatRoomWidget::doSendInput()
         qApp->closeAllWindows();
         return {};
     }
+    if (command == "search")
+    {
+        if (argString.trimmed().isEmpty())
+            return tr("/search <words or \"a phrase\">");
+        emit searchCommandEntered(argString);
+        return {};
+    }
     // --- Add more roomless commands here
     if (!m_currentRoom)
         return tr("There's no such /command outside of room."
@@ -531,6 +673,39 @@ QStringList ChatRoomWidget::findCompletionMatches(const QString& pattern) const
     return matches;
 }
 
+void ChatRoomWidget::scrollToEvent(const QString& eventId)
+{
+    if (!m_currentRoom)
+        return;
+    const auto row = m_messageModel->findRow(eventId);
+    if (row != -1)
+    {
+        m_eventToScrollTo.clear();
+        emit scrollToRowRequested(row);
+        return;
+    }
+    // The event is older than the loaded history; load more and try again
+    if (m_eventToScrollTo != eventId)
+    {
+        m_eventToScrollTo = eventId;
+        m_scrollBackPagesLeft = MaxScrollBackPages;
+        m_scrollBackInFlight = false;
+    }
+    if (m_scrollBackInFlight)
+        return; // Wait for the page requested before
+    if (m_scrollBackPagesLeft-- == 0)
+    {
+        m_eventToScrollTo.clear();
+        emit showStatusMessage(
+            tr("The message is too far back in the room history"), 5000);
+        return;
+    }
+    emit showStatusMessage(tr("Loading the room history to find the message"),
+                           5000);
+    m_scrollBackInFlight = true;
+    m_currentRoom->getPreviousContent(ScrollBackPageSize);
+}
+
 void ChatRoomWidget::saveFileAs(QString eventId)
 {
     if (!m_currentRoom)
@@ -638,7 +813,7 @@ void ChatRoomWidget::markShownAsRead()
     {
         const auto iter = m_currentRoom->findInTimeline(indicesOnScreen.back());
         Q_ASSERT( iter != m_currentRoom->timelineEdge() );
-        m_currentRoom->markMessagesAsRead((*iter)->id());
+        m_receiptScheduler->schedule(m_currentRoom, (*iter)->id());
     }
 }
 
@@ -21,6 +21,7 @@
 
 #include <QtWidgets/QWidget>
 #include <QtCore/QBasicTimer>
+#include <QtCore/QPointer>
 
 #include "quaternionroom.h"
 
@@ -30,6 +31,8 @@
 
 class ChatEdit;
 class MessageEventModel;
+class ReadReceiptScheduler;
+class RoomFindBar;
 class ImageProvider;
 
 class QFrame;
@@ -51,12 +54,26 @@ class ChatRoomWidget: public QWidget
         bool pendingMarkRead() const;
 
         QStringList findCompletionMatches(const QString& pattern) const;
+        /// Estimated memory taken by the timeline model, in bytes
+        qint64 modelMemoryFootprint() const;
+        /// Prepare what can be prepared before switching to the room
+        /**
+         * A room materialized here goes back to being a stub if another
+         * room is prewarmed or opened instead of it.
+         */
+        void prewarm(QuaternionRoom* room);
+        /// Stop updating and rendering the timeline, e.g. while hidden
+        void setSuspended(bool suspended);
+        /// Send the read receipts scheduled so far, e.g. before quitting
+        void flushReadReceipts();
 
     signals:
         void joinCommandEntered(const QString& roomAlias);
+        void searchCommandEntered(const QString& query);
         void showStatusMessage(const QString& message, int timeout = 0) const;
         void readMarkerMoved();
         void readMarkerCandidateMoved();
+        void scrollToRowRequested(int row);
 
     public slots:
         void setRoom(QuaternionRoom* room);
@@ -69,6 +86,8 @@ class ChatRoomWidget: public QWidget
         void onMessageShownChanged(const QString& eventId, bool shown);
         void markShownAsRead();
         void saveFileAs(QString eventId);
+        /// Scroll the timeline to the event, loading more history if needed
+        void scrollToEvent(const QString& eventId);
 
     protected:
         void timerEvent(QTimerEvent* event) override;
@@ -80,6 +99,8 @@ class ChatRoomWidget: public QWidget
     private:
         MessageEventModel* m_messageModel;
         QuaternionRoom* m_currentRoom;
+        /// The room materialized by prewarm() and not opened yet
+        QPointer<QuaternionRoom> m_prewarmedRoom;
 
 #ifdef DISABLE_QQUICKWIDGET
         using timelineWidget_t = QQuickView;
@@ -88,6 +109,8 @@ class ChatRoomWidget: public QWidget
 #endif
         timelineWidget_t* m_timelineWidget;
         ImageProvider* m_imageProvider;
+        ReadReceiptScheduler* m_receiptScheduler;
+        RoomFindBar* m_findBar;
         ChatEdit* m_chatEdit;
         QLabel* m_currentlyTyping;
         QLabel* m_topicLabel;
@@ -99,7 +122,12 @@ class ChatRoomWidget: public QWidget
         QBasicTimer maybeReadTimer;
         bool readMarkerOnScreen;
         QMap<QuaternionRoom*, QVector<QTextDocument*>> roomHistories;
+        QString m_eventToScrollTo;
+        int m_scrollBackPagesLeft = 0;
+        bool m_scrollBackInFlight = false;
 
         void reStartShownTimer();
         QString doSendInput();
+        /// Dematerialize the prewarmed room, unless it got highlights since
+        void dropPrewarmedRoom();
 };
@@ -0,0 +1,257 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "eventloopwatchdog.h"
+
+#include "tracing.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QEvent>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+
+const int EventLoopWatchdog::PingIntervalMs = 100;
+
+static const int BucketBoundsMs[] =
+    { 4, 8, 16, 33, 50, 100, 200, 500, 1000, 2000, 5000, -1 };
+/// Stalls longer than that are reported while still going on
+static const int HangReportMs = 5000;
+static const int CausesInSummary = 10;
+
+static const QEvent::Type PingEventType =
+    QEvent::Type(QEvent::registerEventType());
+
+class PingEvent: public QEvent
+{
+    public:
+        explicit PingEvent(quint64 sequence)
+            : QEvent(PingEventType), sequence(sequence)
+        { }
+
+        const quint64 sequence;
+};
+
+class EventLoopWatchdog::Thread: public QThread
+{
+    public:
+        explicit Thread(EventLoopWatchdog* watchdog)
+            : q(watchdog)
+        {
+            setObjectName(QStringLiteral("EventLoopWatchdog"));
+        }
+
+        void requestStop()
+        {
+            QMutexLocker lock(&mutex);
+            stopping = true;
+            condition.wakeAll();
+        }
+
+        /// Called on the GUI thread when the ping has got through
+        void pong(quint64 sequence, qint64 atMs)
+        {
+            QMutexLocker lock(&mutex);
+            if (sequence != pingSequence)
+                return;
+            answeredAtMs = atMs;
+            condition.wakeAll();
+        }
+
+    protected:
+        void run() override;
+
+    private:
+        EventLoopWatchdog* q;
+        QMutex mutex;
+        QWaitCondition condition;
+        bool stopping = false;
+        quint64 pingSequence = 0;
+        qint64 answeredAtMs = -1;
+};
+
+void EventLoopWatchdog::Thread::run()
+{
+    const auto* guiThread = q->thread();
+    const auto thresholdMs = q->m_stallThresholdMs;
+    QMutexLocker lock(&mutex);
+    while (!stopping)
+    {
+        answeredAtMs = -1;
+        const auto sentAtMs = q->m_clock.elapsed();
+        QCoreApplication::postEvent(q, new PingEvent(++pingSequence));
+
+        const char* stallSpan = nullptr;
+        bool stallDetected = false;
+        auto nextHangReportMs = HangReportMs;
+        while (answeredAtMs < 0 && !stopping)
+        {
+            const auto waitedMs = q->m_clock.elapsed() - sentAtMs;
+            if (!stallDetected && waitedMs >= thresholdMs)
+            {
+                // The GUI thread is still stuck where it was at this point
+                stallSpan = Tracer::currentSpan(guiThread);
+                stallDetected = true;
+            }
+            if (waitedMs >= nextHangReportMs)
+            {
+                qWarning().nospace() << "The event loop has been stalled for "
+                    << waitedMs << " ms so far, in "
+                    << (stallSpan ? stallSpan : "an unknown place");
+                nextHangReportMs += HangReportMs;
+            }
+            condition.wait(&mutex, stallDetected
+                ? ulong(nextHangReportMs - waitedMs)
+                : ulong(std::max(qint64(1), thresholdMs - waitedMs)));
+        }
+        if (stopping)
+            break;
+
+        const auto lagMs = answeredAtMs - sentAtMs;
+        lock.unlock();
+        q->addLag(lagMs, lagMs >= thresholdMs ? stallSpan : nullptr);
+        lock.relock();
+        if (!stopping)
+            condition.wait(&mutex, ulong(PingIntervalMs));
+    }
+}
+
+EventLoopWatchdog::EventLoopWatchdog(int stallThresholdMs, QObject* parent)
+    : QObject(parent), m_stallThresholdMs(stallThresholdMs)
+{
+    for (auto bound: BucketBoundsMs)
+        m_histogram.push_back({ bound, 0 });
+}
+
+EventLoopWatchdog::~EventLoopWatchdog()
+{
+    stop();
+}
+
+void EventLoopWatchdog::start()
+{
+    if (m_thread)
+        return;
+    // Without span tracking, stalls can't be attributed to anything
+    Tracer::trackSpans();
+    m_clock.start();
+    m_thread.reset(new Thread(this));
+    m_thread->start(QThread::HighPriority);
+}
+
+void EventLoopWatchdog::stop()
+{
+    if (!m_thread)
+        return;
+    m_thread->requestStop();
+    m_thread->wait();
+    m_thread.reset();
+}
+
+int EventLoopWatchdog::stallThreshold() const
+{
+    return m_stallThresholdMs;
+}
+
+QVector<EventLoopWatchdog::Bucket> EventLoopWatchdog::histogram() const
+{
+    QMutexLocker lock(&m_statsMutex);
+    return m_histogram;
+}
+
+QVector<EventLoopWatchdog::Cause> EventLoopWatchdog::stallCauses() const
+{
+    QMutexLocker lock(&m_statsMutex);
+    auto causes = m_causes;
+    std::sort(causes.begin(), causes.end(),
+              [] (const Cause& a, const Cause& b) {
+                  return a.totalMs > b.totalMs;
+              });
+    return causes;
+}
+
+void EventLoopWatchdog::logSummary() const
+{
+    const auto buckets = histogram();
+    qint64 pings = 0;
+    for (const auto& b: buckets)
+        pings += b.count;
+    if (pings == 0)
+        return;
+
+    qDebug() << "Event loop lag over" << pings << "ping(s):";
+    int lowerBoundMs = 0;
+    for (const auto& b: buckets)
+    {
+        if (b.count > 0)
+        {
+            auto d = qDebug().noquote().nospace();
+            d << "  " << lowerBoundMs << '-';
+            if (b.upToMs >= 0)
+                d << b.upToMs << " ms: ";
+            else
+                d << "... ms: ";
+            d << b.count;
+        }
+        lowerBoundMs = b.upToMs;
+    }
+    const auto causes = stallCauses();
+    if (causes.isEmpty())
+        return;
+    qDebug() << "Event loop stalls longer than" << m_stallThresholdMs
+             << "ms, by cause:";
+    for (const auto& c: causes.mid(0, CausesInSummary))
+        qDebug().noquote().nospace()
+            << "  " << c.span << ": " << c.stalls << " stall(s), "
+            << c.totalMs << " ms in total, " << c.maxMs << " ms at most";
+}
+
+bool EventLoopWatchdog::event(QEvent* e)
+{
+    if (e->type() != PingEventType)
+        return QObject::event(e);
+    if (m_thread)
+        m_thread->pong(static_cast<PingEvent*>(e)->sequence,
+                       m_clock.elapsed());
+    return true;
+}
+
+void EventLoopWatchdog::addLag(qint64 lagMs, const char* span)
+{
+    QMutexLocker lock(&m_statsMutex);
+    auto bucketIt = std::find_if(m_histogram.begin(), m_histogram.end(),
+        [lagMs] (const Bucket& b) { return b.upToMs < 0 || lagMs < b.upToMs; });
+    ++bucketIt->count;
+    if (lagMs < m_stallThresholdMs)
+        return;
+
+    const auto cause = span ? QString::fromUtf8(span)
+                            : QStringLiteral("(unknown)");
+    qWarning().noquote().nospace() << "The event loop has stalled for "
+                                   << lagMs << " ms, in " << cause;
+    auto causeIt = std::find_if(m_causes.begin(), m_causes.end(),
+        [&cause] (const Cause& c) { return c.span == cause; });
+    if (causeIt == m_causes.end())
+        causeIt = m_causes.insert(m_causes.end(), { cause, 0, 0, 0 });
+    ++causeIt->stalls;
+    causeIt->totalMs += lagMs;
+    causeIt->maxMs = std::max(causeIt->maxMs, lagMs);
+}
@@ -0,0 +1,89 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+#include <memory>
+
+class QThread;
+
+/// Measures how late the GUI event loop is and reports stalls
+/**
+ * A thread of its own posts an event to the watchdog (which lives in
+ * the GUI thread) every PingIntervalMs and measures how long it takes
+ * for the event loop to get to it. The delays go to a histogram; those
+ * longer than the stall threshold are also logged, along with the tracing
+ * span the GUI thread was in when the stall was detected (see Tracer).
+ * Stalls are aggregated by that span so that the causes can be ranked.
+ */
+class EventLoopWatchdog: public QObject
+{
+        Q_OBJECT
+    public:
+        struct Bucket
+        {
+            /// The upper bound of the bucket, or -1 for the last one
+            int upToMs;
+            qint64 count;
+        };
+        struct Cause
+        {
+            QString span;
+            int stalls;
+            qint64 totalMs;
+            qint64 maxMs;
+        };
+
+        static const int PingIntervalMs;
+
+        explicit EventLoopWatchdog(int stallThresholdMs = 200,
+                                   QObject* parent = nullptr);
+        ~EventLoopWatchdog() override;
+
+        void start();
+        void stop();
+
+        int stallThreshold() const;
+        QVector<Bucket> histogram() const;
+        /// Stall causes, from the one that took the longest time in total
+        QVector<Cause> stallCauses() const;
+        /// Log the histogram and the stall causes
+        void logSummary() const;
+
+    protected:
+        bool event(QEvent* e) override;
+
+    private:
+        class Thread;
+
+        const int m_stallThresholdMs;
+        std::unique_ptr<Thread> m_thread;
+        QElapsedTimer m_clock;
+
+        mutable QMutex m_statsMutex;
+        QVector<Bucket> m_histogram;
+        QVector<Cause> m_causes;
+
+        void addLag(qint64 lagMs, const char* span);
+};
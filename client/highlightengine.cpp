@@ -0,0 +1,214 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "highlightengine.h"
+
+#include "quaternionroom.h"
+
+#include <settings.h>
+#include <user.h>
+
+#include <QtCore/QDebug>
+#include <QtCore/QAtomicInt>
+
+static const auto KeywordsSettingsKey = QStringLiteral("UI/highlight_keywords");
+static QAtomicInt generation { 0 };
+
+inline quint64 transitionKey(int state, QChar c)
+{
+    return quint64(state) << 16 | c.unicode();
+}
+
+HighlightEngine::HighlightEngine(const QVector<Keyword>& keywords,
+                                 const QVector<QRegularExpression>& regexes)
+    : failure { 0 }, keywordAt { -1 }, outputLink { -1 }
+    , keywords(keywords), regexes(regexes)
+{
+    // Build the trie
+    for (int k = 0; k < keywords.size(); ++k)
+    {
+        const auto& text = keywords[k].text;
+        if (text.isEmpty())
+            continue;
+        int state = 0;
+        for (const auto c: text)
+        {
+            const auto key = transitionKey(state, c.toCaseFolded());
+            auto it = transitions.constFind(key);
+            if (it == transitions.cend())
+            {
+                it = transitions.insert(key, keywordAt.size());
+                failure.push_back(0);
+                keywordAt.push_back(-1);
+                outputLink.push_back(-1);
+            }
+            state = it.value();
+        }
+        keywordAt[state] = k;
+    }
+
+    // Compute failure and output links breadth-first, so that the links
+    // of shorter prefixes are ready by the time longer ones need them.
+    // There's no explicit list of children per state; so collect them
+    // from the transition table, grouped by depth.
+    QVector<QVector<QPair<int, QChar>>> childrenOf(keywordAt.size());
+    for (auto it = transitions.cbegin(); it != transitions.cend(); ++it)
+        childrenOf[int(it.key() >> 16)].push_back(
+            { it.value(), QChar(ushort(it.key() & 0xFFFF)) });
+
+    QVector<int> queue;
+    for (const auto& child: childrenOf[0])
+        queue.push_back(child.first); // Failure links at depth 1 are 0
+    for (int i = 0; i < queue.size(); ++i)
+    {
+        const auto state = queue[i];
+        for (const auto& child: childrenOf[state])
+        {
+            const auto childState = child.first;
+            failure[childState] = next(failure[state], child.second);
+            const auto f = failure[childState];
+            outputLink[childState] = keywordAt[f] != -1 ? f : outputLink[f];
+            queue.push_back(childState);
+        }
+    }
+}
+
+int HighlightEngine::next(int state, QChar c) const
+{
+    for (;;)
+    {
+        const auto it = transitions.constFind(transitionKey(state, c));
+        if (it != transitions.cend())
+            return it.value();
+        if (state == 0)
+            return 0;
+        state = failure[state];
+    }
+}
+
+bool HighlightEngine::isMatchAccepted(const QString& text, int keywordIdx,
+                                      int lastPos) const
+{
+    const auto& keyword = keywords[keywordIdx];
+    if (!keyword.wholeWord)
+        return true;
+
+    const auto firstPos = lastPos - keyword.text.size() + 1;
+    return (firstPos == 0 || !text[firstPos - 1].isLetterOrNumber()) &&
+           (lastPos + 1 == text.size() || !text[lastPos + 1].isLetterOrNumber());
+}
+
+bool HighlightEngine::matches(const QString& text) const
+{
+    if (!transitions.isEmpty())
+    {
+        int state = 0;
+        for (int pos = 0; pos < text.size(); ++pos)
+        {
+            state = next(state, text[pos].toCaseFolded());
+            for (auto s = keywordAt[state] != -1 ? state : outputLink[state];
+                 s != -1; s = outputLink[s])
+                if (isMatchAccepted(text, keywordAt[s], pos))
+                    return true;
+        }
+    }
+    for (const auto& re: regexes)
+        if (re.match(text).hasMatch())
+            return true;
+    return false;
+}
+
+std::shared_ptr<const HighlightEngine>
+HighlightEngine::fromSettings(const QStringList& extraKeywords)
+{
+    QVector<Keyword> keywords;
+    QVector<QRegularExpression> regexes;
+    for (const auto& k: extraKeywords)
+        keywords.push_back({ k, false });
+    for (const auto& k: userKeywords())
+    {
+        if (k.size() > 2 && k.startsWith('/') && k.endsWith('/'))
+        {
+            QRegularExpression re { k.mid(1, k.size() - 2),
+                                    QRegularExpression::CaseInsensitiveOption };
+            if (re.isValid())
+                regexes.push_back(re);
+            else
+                qWarning() << "HighlightEngine: invalid regular expression"
+                           << k << "-" << re.errorString();
+        } else if (!k.isEmpty())
+            keywords.push_back({ k, true });
+    }
+    return std::make_shared<const HighlightEngine>(keywords, regexes);
+}
+
+QStringList HighlightEngine::userKeywords()
+{
+    return QMatrixClient::Settings().value(KeywordsSettingsKey).toStringList();
+}
+
+void HighlightEngine::setUserKeywords(const QStringList& keywords)
+{
+    QMatrixClient::Settings().setValue(KeywordsSettingsKey, keywords);
+    generation.ref();
+}
+
+int HighlightEngine::settingsGeneration()
+{
+    return generation.load();
+}
+
+const QString HighlightProcessor::StageName = QStringLiteral("highlights");
+
+QString HighlightProcessor::name() const
+{
+    return StageName;
+}
+
+QStringList HighlightProcessor::eventTypes() const
+{
+    return { QStringLiteral("m.room.message") };
+}
+
+int HighlightProcessor::snapshotParts() const
+{
+    return EventSnapshot::PlainBodyPart;
+}
+
+TimelineProcessor::Job HighlightProcessor::prepare(QuaternionRoom* room)
+{
+    if (!room->isMaterialized())
+        return {}; // materialize() will go through the whole timeline anyway
+
+    return [engine = room->highlightEngine(),
+            localUserId = room->localUser()->id(),
+            scanGeneration = room->m_scanGeneration]
+           (const EventBatch& batch) -> Publisher
+    {
+        QVector<QuaternionRoom::index_t> found;
+        for (const auto& e: batch.events)
+            if (e.senderId != localUserId && engine->matches(e.plainBody))
+                found.push_back(e.index);
+        if (found.isEmpty())
+            return {};
+        return [found, scanGeneration] (QuaternionRoom* r) {
+            r->addHighlights(found, scanGeneration);
+        };
+    };
+}
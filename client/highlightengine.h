@@ -0,0 +1,101 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include "timelineprocessor.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QRegularExpression>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include <memory>
+
+/// Finds highlight triggers in message texts
+/**
+ * Plain keywords are compiled into an Aho-Corasick automaton over
+ * case-folded text, so that all of them are looked for in a single pass
+ * over a message, no matter how many there are. Keywords can be required
+ * to match whole words only. Regular expressions are checked after
+ * the automaton, for texts that it didn't find anything in.
+ *
+ * An engine is immutable once built; it is safe to use the same engine
+ * from several threads at once.
+ */
+class HighlightEngine
+{
+    public:
+        struct Keyword
+        {
+            QString text;
+            bool wholeWord;
+        };
+
+        HighlightEngine(const QVector<Keyword>& keywords,
+                        const QVector<QRegularExpression>& regexes);
+
+        bool matches(const QString& text) const;
+
+        /// Build an engine from the user's highlight settings
+        /**
+         * \param extraKeywords keywords that are matched anywhere in
+         *        the text, e.g. the user id and the name in the room
+         */
+        static std::shared_ptr<const HighlightEngine>
+        fromSettings(const QStringList& extraKeywords);
+
+        /// The highlight settings as entered by the user
+        /**
+         * Each entry is either a keyword matched as a whole word, or
+         * a regular expression enclosed in slashes, e.g. /mee+t/.
+         */
+        static QStringList userKeywords();
+        static void setUserKeywords(const QStringList& keywords);
+        /// Incremented each time the user changes the highlight settings
+        static int settingsGeneration();
+
+    private:
+        /// Goto function: (state << 16 | folded character) -> state
+        QHash<quint64, int> transitions;
+        /// Failure function: the state for the longest proper suffix
+        QVector<int> failure;
+        /// The keyword ending at the state, or -1
+        QVector<int> keywordAt;
+        /// The nearest state on the failure chain that ends a keyword, or -1
+        QVector<int> outputLink;
+        QVector<Keyword> keywords;
+        QVector<QRegularExpression> regexes;
+
+        int next(int state, QChar c) const;
+        bool isMatchAccepted(const QString& text, int keywordIdx,
+                             int lastPos) const;
+};
+
+/// Finds highlights in materialized rooms as events arrive
+class HighlightProcessor: public TimelineProcessor
+{
+    public:
+        static const QString StageName;
+
+        QString name() const override;
+        QStringList eventTypes() const override;
+        int snapshotParts() const override;
+        Job prepare(QuaternionRoom* room) override;
+};
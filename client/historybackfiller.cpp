@@ -0,0 +1,255 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "historybackfiller.h"
+
+#include "quaternionroom.h"
+#include "tracing.h"
+
+#include <connection.h>
+#include <networkaccessmanager.h>
+#include <settings.h>
+
+#include <QtNetwork/QNetworkReply>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+using QMatrixClient::Connection;
+using QMatrixClient::Settings;
+
+const int HistoryBackfiller::IdleDelayMs = 30000;
+
+static const auto BudgetSettingsKey =
+        QStringLiteral("Network/backfill_budget_kb_per_min");
+static const int DefaultBudgetKbPerMinute = 256;
+static const auto VisitsSettingsKey = QStringLiteral("UI/room_visits");
+static const int TickIntervalMs = 5000;
+static const int PageSize = 100;
+/// A room doesn't get more than that in one go, even if the read marker
+/// is still not reached
+static const qint64 RoomBudgetBytes = 2 * 1024 * 1024;
+/// Give up on a request taking longer than that; the room isn't finished
+/// though, the request might have been made by someone else
+static const int RequestTimeoutMs = 60000;
+/// Each visit to any room makes the earlier visits weigh less
+static const double VisitDecay = 0.98;
+/// Rooms visited less than that are not backfilled
+static const double MinVisits = 0.5;
+
+static QString roomKey(const QuaternionRoom* room)
+{
+    return room->connection()->userId() + '|' + room->id();
+}
+
+HistoryBackfiller::HistoryBackfiller(QObject* parent)
+    : QObject(parent)
+    , m_budgetBytesPerMinute(
+        Settings().value(BudgetSettingsKey, DefaultBudgetKbPerMinute).toInt()
+            * qint64(1024))
+    , m_pageBytesEstimate(PageSize * 1024) // ~1 KB per event to begin with
+{
+    loadVisits();
+    if (m_budgetBytesPerMinute <= 0)
+    {
+        qDebug() << "History backfill is disabled";
+        return;
+    }
+    m_clock.start();
+    m_tokens = m_budgetBytesPerMinute;
+    m_lastInputMs = m_lastRefillMs = m_clock.elapsed();
+    qApp->installEventFilter(this);
+    // Same as with PerfStats, the manager reports a finished reply
+    // before the job that owns it has read the data
+    connect(QMatrixClient::NetworkAccessManager::instance(),
+            &QNetworkAccessManager::finished,
+            this, &HistoryBackfiller::replyFinished);
+    m_timer.setInterval(TickIntervalMs);
+    connect(&m_timer, &QTimer::timeout, this, &HistoryBackfiller::tick);
+    m_timer.start();
+}
+
+HistoryBackfiller::~HistoryBackfiller()
+{
+    saveVisits();
+}
+
+void HistoryBackfiller::addConnection(Connection* connection)
+{
+    m_connections.push_back(connection);
+}
+
+void HistoryBackfiller::roomVisited(QuaternionRoom* room)
+{
+    for (auto& v: m_visits)
+        v *= VisitDecay;
+    const auto key = roomKey(room);
+    m_visits[key] += 1;
+    // The read marker is going to move on; let the room be backfilled anew
+    m_finished.remove(key);
+    m_roomBytes.remove(key);
+}
+
+bool HistoryBackfiller::eventFilter(QObject* watched, QEvent* event)
+{
+    switch (event->type())
+    {
+    case QEvent::KeyPress:
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseMove:
+    case QEvent::Wheel:
+        m_lastInputMs = m_clock.elapsed();
+        break;
+    default:;
+    }
+    return QObject::eventFilter(watched, event);
+}
+
+void HistoryBackfiller::tick()
+{
+    refill();
+    const auto now = m_clock.elapsed();
+    if (m_room)
+    {
+        // The page is processed by now, if it has arrived
+        if (m_pageArrived)
+            pageLoaded();
+        else if (now - m_requestedAtMs > RequestTimeoutMs)
+            m_room = nullptr;
+        return;
+    }
+    if (now - m_lastInputMs < IdleDelayMs || m_tokens < m_pageBytesEstimate)
+        return;
+
+    const auto rooms = candidates();
+    if (rooms.isEmpty())
+        return;
+    TRACE_SPAN("HistoryBackfiller::tick", "sync");
+    auto* room = rooms.front().room;
+    qDebug() << "Backfilling history in" << room->objectName()
+             << "with priority" << rooms.front().priority;
+    m_room = room;
+    m_pageArrived = false;
+    m_timelineSizeBefore = room->timelineSize();
+    m_requestedAtMs = now;
+    room->getPreviousContent(PageSize);
+}
+
+void HistoryBackfiller::refill()
+{
+    const auto now = m_clock.elapsed();
+    m_tokens = std::min(double(m_budgetBytesPerMinute),
+        m_tokens + (now - m_lastRefillMs) * m_budgetBytesPerMinute / 60000.0);
+    m_lastRefillMs = now;
+}
+
+void HistoryBackfiller::replyFinished(QNetworkReply* reply)
+{
+    if (!m_room || m_pageArrived)
+        return;
+    const auto path = QUrl::fromPercentEncoding(reply->url().path().toUtf8());
+    if (!path.endsWith(QStringLiteral("/rooms/") + m_room->id()
+                       + QStringLiteral("/messages")))
+        return;
+
+    // The bucket may go below zero here; then it takes longer to refill
+    const auto bytes = reply->bytesAvailable();
+    m_tokens -= bytes;
+    m_pageBytesEstimate = 0.8 * m_pageBytesEstimate + 0.2 * bytes;
+    const auto key = roomKey(m_room);
+    m_roomBytes[key] += bytes;
+    if (reply->error() != QNetworkReply::NoError)
+    {
+        qDebug() << "Backfilling" << m_room->objectName() << "failed:"
+                 << reply->errorString();
+        m_finished.insert(key);
+        m_room = nullptr;
+        return;
+    }
+    m_pageArrived = true;
+}
+
+void HistoryBackfiller::pageLoaded()
+{
+    auto* room = m_room.data();
+    m_room = nullptr;
+    m_pageArrived = false;
+    const auto key = roomKey(room);
+    if (room->timelineSize() == m_timelineSizeBefore)
+    {
+        m_finished.insert(key); // No more history
+        return;
+    }
+    emit historyLoaded(room->connection());
+    if (room->readMarker() != room->timelineEdge())
+        qDebug() << "Backfilled" << room->objectName() << "up to the read marker";
+    else if (m_roomBytes.value(key) >= RoomBudgetBytes)
+        qDebug() << "Backfilled" << room->objectName()
+                 << "up to the room budget";
+    else
+        return;
+    m_finished.insert(key);
+}
+
+QVector<HistoryBackfiller::Candidate> HistoryBackfiller::candidates() const
+{
+    QVector<Candidate> result;
+    for (const auto& c: m_connections)
+    {
+        if (!c)
+            continue;
+        for (auto* r: c->roomMap())
+        {
+            auto* room = static_cast<QuaternionRoom*>(r);
+            if (room->joinState() != QMatrixClient::JoinState::Join
+                    || room->displayed() || !room->hasUnreadMessages()
+                    || room->readMarker() != room->timelineEdge())
+                continue;
+            const auto key = roomKey(room);
+            const auto visits = m_visits.value(key);
+            if (visits < MinVisits || m_finished.contains(key))
+                continue;
+            const auto unread = std::max(0, room->unreadCount());
+            result.push_back({ room, visits * (1 + std::log1p(unread)) });
+        }
+    }
+    std::sort(result.begin(), result.end(),
+        [] (const Candidate& a, const Candidate& b) {
+            return a.priority > b.priority;
+        });
+    return result;
+}
+
+void HistoryBackfiller::loadVisits()
+{
+    const auto visits = Settings().value(VisitsSettingsKey).toMap();
+    for (auto it = visits.cbegin(); it != visits.cend(); ++it)
+        m_visits.insert(it.key(), it.value().toDouble());
+}
+
+void HistoryBackfiller::saveVisits() const
+{
+    QVariantMap visits;
+    for (auto it = m_visits.cbegin(); it != m_visits.cend(); ++it)
+        if (it.value() >= MinVisits / 10) // Forget the long unvisited rooms
+            visits.insert(it.key(), it.value());
+    Settings().setValue(VisitsSettingsKey, visits);
+}
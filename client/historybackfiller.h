@@ -0,0 +1,105 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QPointer>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+
+namespace QMatrixClient
+{
+    class Connection;
+}
+class QuaternionRoom;
+class QNetworkReply;
+
+/// Loads the history of frequently visited rooms while the user is idle
+/**
+ * Rooms are ranked by how often they are visited (an exponentially decaying
+ * count, kept in the settings) and by the number of unread messages. While
+ * there's no user input for IdleDelayMs, the backfiller loads pages of
+ * history into the top rooms, one page at a time, until the read marker is
+ * loaded, the room gets over its byte budget, or the history has no more
+ * events. Opening such a room then shows the unread messages right away.
+ *
+ * All backfill traffic goes through a token bucket refilled at
+ * the configured rate (Network/backfill_budget_kb_per_min, 0 turns the
+ * backfiller off), so it never takes more than its share of the bandwidth.
+ */
+class HistoryBackfiller: public QObject
+{
+        Q_OBJECT
+    public:
+        static const int IdleDelayMs;
+
+        explicit HistoryBackfiller(QObject* parent = nullptr);
+        ~HistoryBackfiller() override;
+
+        void addConnection(QMatrixClient::Connection* connection);
+        void roomVisited(QuaternionRoom* room);
+
+    signals:
+        /// History has been added to a room of the connection
+        void historyLoaded(QMatrixClient::Connection* connection);
+
+    protected:
+        bool eventFilter(QObject* watched, QEvent* event) override;
+
+    private:
+        struct Candidate
+        {
+            QuaternionRoom* room;
+            double priority;
+        };
+
+        QVector<QPointer<QMatrixClient::Connection>> m_connections;
+        QHash<QString, double> m_visits;
+        QTimer m_timer;
+        QElapsedTimer m_clock;
+        qint64 m_lastInputMs = 0;
+
+        qint64 m_budgetBytesPerMinute = 0;
+        double m_tokens = 0;
+        qint64 m_lastRefillMs = 0;
+        /// The running average of the page size, to decide whether
+        /// the bucket has enough for the next page
+        double m_pageBytesEstimate;
+
+        QPointer<QuaternionRoom> m_room;
+        bool m_pageArrived = false;
+        int m_timelineSizeBefore = 0;
+        qint64 m_requestedAtMs = -1;
+        /// Bytes loaded into each room, by room key
+        QHash<QString, qint64> m_roomBytes;
+        /// Rooms that don't need (or can't get) more history
+        QSet<QString> m_finished;
+
+        void tick();
+        void refill();
+        void replyFinished(QNetworkReply* reply);
+        void pageLoaded();
+        QVector<Candidate> candidates() const;
+        void loadVisits();
+        void saveVisits() const;
+};
@@ -19,6 +19,8 @@
 
 #include "imageprovider.h"
 
+#include "tracing.h"
+
 #include <connection.h>
 #include <jobs/mediathumbnailjob.h>
 
@@ -47,9 +49,11 @@ QImage ImageProvider::requestImage(const QString& id,
         return {};
     }
 
+    TRACE_SPAN("ImageProvider::requestImage", "image");
     QUrl mxcUri { "mxc://" + id };
     qDebug() << "ImageProvider::requestImage:" << mxcUri.toString();
 
+    ++m_pendingRequests;
     MediaThumbnailJob* job = nullptr;
     QReadLocker locker(&m_lock);
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
@@ -64,6 +68,7 @@ QImage ImageProvider::requestImage(const QString& id,
     if (!job)
     {
         qDebug() << "ImageProvider: failed to send a request";
+        --m_pendingRequests;
         return {};
     }
     QImage result;
@@ -75,6 +80,7 @@ QImage ImageProvider::requestImage(const QString& id,
         });
         condition.wait(&m_lock);
     }
+    --m_pendingRequests;
 
     if( pSize != nullptr )
         *pSize = result.size();
@@ -82,6 +88,11 @@ QImage ImageProvider::requestImage(const QString& id,
     return result;
 }
 
+int ImageProvider::pendingRequests() const
+{
+    return m_pendingRequests;
+}
+
 void ImageProvider::setConnection(QMatrixClient::Connection* connection)
 {
     QWriteLocker locker(&m_lock);
@@ -22,6 +22,8 @@
 #include <QtQuick/QQuickImageProvider>
 #include <QtCore/QReadWriteLock>
 
+#include <atomic>
+
 namespace QMatrixClient {
     class Connection;
 }
@@ -35,8 +37,11 @@ class ImageProvider: public QQuickImageProvider
                               const QSize& requestedSize) override;
 
         void setConnection(QMatrixClient::Connection* connection);
+        /// The number of thumbnails being fetched at the moment
+        int pendingRequests() const;
 
     private:
         QMatrixClient::Connection* m_connection;
         QReadWriteLock m_lock;
+        std::atomic<int> m_pendingRequests { 0 };
 };
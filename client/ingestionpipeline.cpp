@@ -0,0 +1,196 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "ingestionpipeline.h"
+
+#include "tracing.h"
+
+#include <connection.h>
+#include <events/roommessageevent.h>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThread>
+#include <QtCore/QDebug>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <algorithm>
+#include <utility>
+
+using namespace QMatrixClient;
+
+static EventSnapshot makeSnapshot(const TimelineItem& ti, int parts)
+{
+    const auto& evt = *ti.event();
+    EventSnapshot snapshot { ti.index(), evt.id(),
+                             EventTypeRegistry::getMatrixType(evt.type()),
+                             evt.senderId(), evt.timestamp(), evt.isRedacted(),
+                             {}, {} };
+    if (parts & EventSnapshot::PlainBodyPart)
+        if (const auto* message = ti.viewAs<RoomMessageEvent>())
+            snapshot.plainBody = message->plainBody();
+    if (parts & EventSnapshot::ContentJsonPart)
+        snapshot.contentJson = evt.contentJson();
+    return snapshot;
+}
+
+IngestionPipeline* IngestionPipeline::instance()
+{
+    static auto* pipeline = new IngestionPipeline;
+    return pipeline;
+}
+
+IngestionPipeline::IngestionPipeline()
+{
+    // Leave a core to the GUI thread
+    m_pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 1));
+}
+
+void IngestionPipeline::addProcessor(TimelineProcessor* processor)
+{
+    Q_ASSERT(processor);
+    m_stages.push_back({ std::unique_ptr<TimelineProcessor>(processor),
+                         processor->eventTypes() });
+    QMutexLocker lock(&m_mutex);
+    m_stats.push_back({});
+    m_stats.back().name = processor->name();
+}
+
+void IngestionPipeline::submit(QuaternionRoom* room,
+                               QuaternionRoom::timeline_iter_t from,
+                               QuaternionRoom::timeline_iter_t to,
+                               bool historical, const QString& stageName)
+{
+    if (from == to)
+        return;
+
+    // Prepare the jobs first, to only take the snapshot parts they need
+    std::vector<std::pair<size_t, TimelineProcessor::Job>> jobs;
+    int parts = 0;
+    for (size_t i = 0; i < m_stages.size(); ++i)
+    {
+        const auto& stage = m_stages[i];
+        if (!stageName.isEmpty() && stage.processor->name() != stageName)
+            continue;
+
+        auto job = stage.processor->prepare(room);
+        if (!job)
+            continue;
+        jobs.emplace_back(i, std::move(job));
+        parts |= stage.processor->snapshotParts();
+    }
+    if (jobs.empty())
+        return;
+
+    EventBatch allEvents { room->connection()->userId(), room->id(),
+                           historical, {} };
+    allEvents.events.reserve(int(to - from));
+    std::transform(from, to, std::back_inserter(allEvents.events),
+        [parts] (const TimelineItem& ti) { return makeSnapshot(ti, parts); });
+
+    for (auto& stageJob: jobs)
+    {
+        const auto i = stageJob.first;
+        const auto& stage = m_stages[i];
+        const auto job = std::move(stageJob.second);
+
+        auto batch = allEvents;
+        if (!stage.eventTypes.isEmpty())
+        {
+            batch.events.clear();
+            std::copy_if(allEvents.events.cbegin(), allEvents.events.cend(),
+                std::back_inserter(batch.events),
+                [&stage] (const EventSnapshot& e) {
+                    return stage.eventTypes.contains(e.matrixType);
+                });
+            if (batch.events.isEmpty())
+                continue;
+        }
+
+        QtConcurrent::run(&m_pool,
+            [this, job, batch, stageIndex = int(i),
+             roomPtr = QPointer<QuaternionRoom>(room)] {
+                QElapsedTimer et; et.start();
+                auto publisher = [&] {
+                    TRACE_SPAN_ARG("IngestionPipeline::process", "sync",
+                                   "stage", stageIndex);
+                    return job(batch);
+                }();
+                const auto elapsedNs = et.nsecsElapsed();
+
+                QMutexLocker lock(&m_mutex);
+                auto& s = m_stats[stageIndex];
+                ++s.batches;
+                s.events += batch.events.size();
+                s.processingNs += elapsedNs;
+                s.maxProcessingNs = std::max(s.maxProcessingNs, elapsedNs);
+                if (!publisher)
+                    return;
+                if (m_results.isEmpty())
+                    QMetaObject::invokeMethod(this, "publishResults",
+                                              Qt::QueuedConnection);
+                m_results.push_back(
+                    { stageIndex, roomPtr, std::move(publisher) });
+            });
+    }
+}
+
+bool IngestionPipeline::waitForDone(int msecs)
+{
+    return m_pool.waitForDone(msecs);
+}
+
+void IngestionPipeline::publishResults()
+{
+    QVector<Result> results;
+    {
+        QMutexLocker lock(&m_mutex);
+        results.swap(m_results);
+    }
+    TRACE_SPAN_ARG("IngestionPipeline::publishResults", "sync",
+                   "results", results.size());
+    QVector<qint64> publishingNs(m_stages.size());
+    QElapsedTimer et;
+    for (const auto& r: qAsConst(results))
+        if (r.room)
+        {
+            et.start();
+            r.publisher(r.room);
+            publishingNs[r.stageIndex] += et.nsecsElapsed();
+        }
+
+    QMutexLocker lock(&m_mutex);
+    for (int i = 0; i < publishingNs.size(); ++i)
+        m_stats[i].publishingNs += publishingNs[i];
+}
+
+QVector<IngestionPipeline::StageStats> IngestionPipeline::stats() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_stats;
+}
+
+void IngestionPipeline::logStats() const
+{
+    for (const auto& s: stats())
+        qDebug().nospace() << "Ingestion stage " << s.name << ": "
+            << s.events << " event(s) in " << s.batches << " batch(es), "
+            << s.processingNs / 1000000 << " ms processing (max "
+            << s.maxProcessingNs / 1000000 << " ms per batch), "
+            << s.publishingNs / 1000000 << " ms publishing";
+}
@@ -0,0 +1,99 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include "timelineprocessor.h"
+#include "quaternionroom.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QMutex>
+#include <QtCore/QPointer>
+#include <QtCore/QThreadPool>
+
+#include <memory>
+#include <vector>
+
+/// Runs timeline events through processing stages on a worker pool
+/**
+ * QuaternionRoom submits events as they are added to the timeline. The
+ * pipeline takes snapshots of them, filters them by the event types each
+ * stage wants, and runs the stages in parallel on its own thread pool.
+ * Results are collected and published on the GUI thread in batches, once
+ * per event loop iteration, rather than one signal per stage and batch.
+ */
+class IngestionPipeline: public QObject
+{
+        Q_OBJECT
+    public:
+        struct StageStats
+        {
+            QString name;
+            qint64 batches = 0;
+            qint64 events = 0;
+            qint64 processingNs = 0;
+            qint64 maxProcessingNs = 0;
+            qint64 publishingNs = 0;
+        };
+
+        static IngestionPipeline* instance();
+
+        /// Add a stage; the pipeline takes the ownership of the processor
+        void addProcessor(TimelineProcessor* processor);
+
+        /// Run events from the room timeline through the stages
+        /**
+         * \param stageName if not empty, only run the stage with this name
+         */
+        void submit(QuaternionRoom* room, QuaternionRoom::timeline_iter_t from,
+                    QuaternionRoom::timeline_iter_t to, bool historical,
+                    const QString& stageName = {});
+
+        /// Wait until submitted batches are processed (not published)
+        bool waitForDone(int msecs);
+
+        QVector<StageStats> stats() const;
+        void logStats() const;
+
+    private slots:
+        void publishResults();
+
+    private:
+        struct Stage
+        {
+            std::unique_ptr<TimelineProcessor> processor;
+            QStringList eventTypes;
+        };
+        struct Result
+        {
+            int stageIndex;
+            QPointer<QuaternionRoom> room;
+            TimelineProcessor::Publisher publisher;
+        };
+
+        IngestionPipeline();
+
+        std::vector<Stage> m_stages;
+        QThreadPool m_pool;
+
+        mutable QMutex m_mutex;
+        // Guarded by m_mutex
+        QVector<Result> m_results;
+        QVector<StageStats> m_stats;
+};
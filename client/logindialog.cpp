@@ -56,7 +56,8 @@ LoginDialog::LoginDialog(QWidget* parent)
     connect( userEdit, &QLineEdit::editingFinished, m_connection.data(),
              [=] {
                  auto userId = userEdit->text();
-                 if (userId.startsWith('@') && userId.indexOf(':') != -1)
+                 if (!homeserverFixed &&
+                         userId.startsWith('@') && userId.indexOf(':') != -1)
                      m_connection->resolveServer(userId);
              });
     connect( m_connection.data(), &Connection::homeserverChanged, serverEdit,
@@ -109,6 +110,16 @@ bool LoginDialog::keepLoggedIn() const
     return saveTokenCheck->isChecked();
 }
 
+void LoginDialog::setHomeserver(const QUrl& url)
+{
+    homeserverFixed = true;
+    m_connection->setHomeserver(url);
+    serverEdit->setText(url.toString());
+    serverEdit->setReadOnly(true);
+    // Sessions with a test server aren't worth keeping
+    saveTokenCheck->setChecked(false);
+}
+
 void LoginDialog::apply()
 {
     auto url = QUrl::fromUserInput(serverEdit->text());
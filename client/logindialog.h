@@ -23,6 +23,7 @@
 
 class QLineEdit;
 class QCheckBox;
+class QUrl;
 
 namespace QMatrixClient {
     class Connection;
@@ -38,6 +39,8 @@ class LoginDialog : public Dialog
         QMatrixClient::Connection* releaseConnection();
         QString deviceName() const;
         bool keepLoggedIn() const;
+        /// Log in to this server only, without resolving it from the user id
+        void setHomeserver(const QUrl& url);
 
     private slots:
         void apply() override;
@@ -48,6 +51,7 @@ class LoginDialog : public Dialog
         QLineEdit* passwordEdit;
         QLineEdit* initialDeviceName;
         QCheckBox* saveTokenCheck;
+        bool homeserverFixed = false;
 
         QScopedPointer<QMatrixClient::Connection, QScopedPointerDeleteLater>
             m_connection;
@@ -21,13 +21,27 @@
 #include <QtCore/QTranslator>
 #include <QtCore/QLibraryInfo>
 #include <QtCore/QCommandLineParser>
+#include <QtCore/QTemporaryDir>
 #include <QtCore/QDebug>
 
 #include "networksettings.h"
 #include "mainwindow.h"
 #include "activitydetector.h"
+#include "ingestionpipeline.h"
+#include "highlightengine.h"
+#include "searchindex.h"
+#include "relationsindex.h"
+#include "memoryusage.h"
+#include "syncrecorder.h"
+#include "syncreplayserver.h"
+#include "tracing.h"
+#include "eventloopwatchdog.h"
+#include "roomswitchstats.h"
+#include "perfstats.h"
 #include <settings.h>
 
+#include <memory>
+
 int main( int argc, char* argv[] )
 {
     QApplication app(argc, argv);
@@ -63,9 +77,39 @@ int main( int argc, char* argv[] )
     QCommandLineOption debug("debug", QApplication::translate("main", "Display debug information"));
     parser.addOption(debug);
 
+    QCommandLineOption record("record",
+        QApplication::translate("main", "Record sync and history responses to <file>"),
+        QApplication::translate("main", "file"));
+    parser.addOption(record);
+    QCommandLineOption scrub("scrub",
+        QApplication::translate("main", "Replace message texts, room and member names, media URLs and user ids in the recording"));
+    parser.addOption(scrub);
+    QCommandLineOption replay("replay",
+        QApplication::translate("main", "Replay a recorded session from <file> instead of connecting to accounts"),
+        QApplication::translate("main", "file"));
+    parser.addOption(replay);
+    QCommandLineOption replaySpeed("replay-speed",
+        QApplication::translate("main", "Replay syncs <factor> times faster than recorded; 0 - without delays"),
+        QApplication::translate("main", "factor"), "1");
+    parser.addOption(replaySpeed);
+    QCommandLineOption homeserver("homeserver",
+        QApplication::translate("main", "Log in to the server at <url> instead of the saved accounts"),
+        QApplication::translate("main", "url"));
+    parser.addOption(homeserver);
+    QCommandLineOption trace("trace",
+        QApplication::translate("main", "Record a trace of the session to <file>, in Chrome trace format"),
+        QApplication::translate("main", "file"));
+    parser.addOption(trace);
+    QCommandLineOption stallThreshold("stall-threshold",
+        QApplication::translate("main", "Report event loop stalls longer than <ms> milliseconds (implied with --debug or --trace); 0 - don't watch the event loop"),
+        QApplication::translate("main", "ms"), "200");
+    parser.addOption(stallThreshold);
+
     parser.process(app);
     bool debugEnabled = parser.isSet(debug);
     qDebug() << "Debug: " << debugEnabled;
+    if (parser.isSet(trace))
+        Tracer::start(parser.value(trace));
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
     app.setAttribute(Qt::AA_DisableWindowContextHelpButton);
@@ -73,14 +117,69 @@ int main( int argc, char* argv[] )
 
     QMatrixClient::NetworkSettings().setupApplicationProxy();
 
+    // Replayed and mock server sessions may carry anyone's messages; keep
+    // them out of the real search index
+    QTemporaryDir throwawayIndexDir;
+    if (parser.isSet(replay) || parser.isSet(homeserver))
+        SearchIndex::setLocation(throwawayIndexDir.path());
+
+    auto* pipeline = IngestionPipeline::instance();
+    pipeline->addProcessor(new HighlightProcessor);
+    pipeline->addProcessor(new SearchIndexProcessor);
+    pipeline->addProcessor(new RelationsProcessor);
+    pipeline->addProcessor(new MemoryAccountingProcessor);
+
     MainWindow window;
     if( debugEnabled )
         window.enableDebug();
 
+    std::unique_ptr<SyncRecorder> recorder;
+    if (parser.isSet(record))
+    {
+        recorder.reset(new SyncRecorder(parser.value(record),
+                                        parser.isSet(scrub)));
+        if (recorder->isOpen())
+            window.setSyncRecorder(recorder.get());
+    }
+    if (parser.isSet(homeserver))
+        window.setHomeserverOverride(
+            QUrl::fromUserInput(parser.value(homeserver)));
+    SyncReplayServer replayServer;
+    if (parser.isSet(replay))
+    {
+        const auto error = replayServer.load(parser.value(replay));
+        if (!error.isEmpty())
+        {
+            qCritical().noquote() << "Can't replay:" << error;
+            return 1;
+        }
+        replayServer.setSpeed(parser.value(replaySpeed).toDouble());
+        if (!replayServer.listen())
+            return 1;
+        window.setReplayServer(&replayServer);
+    }
+
     ActivityDetector ad(app, window); Q_UNUSED(ad);
     qDebug() << "--- Show time!";
     window.show();
 
-    return app.exec();
+    // The watchdog needs span tracking, which costs a bit on every traced
+    // call; so only watch the event loop when asked to
+    const auto stallThresholdMs =
+        parser.isSet(stallThreshold) || debugEnabled || parser.isSet(trace)
+        ? parser.value(stallThreshold).toInt() : 0;
+    EventLoopWatchdog watchdog(stallThresholdMs);
+    if (stallThresholdMs > 0)
+    {
+        watchdog.start();
+        PerfStats::instance()->setWatchdog(&watchdog);
+    }
+
+    const auto exitCode = app.exec();
+    watchdog.stop();
+    watchdog.logSummary();
+    RoomSwitchStats::instance()->logSummary();
+    Tracer::stop();
+    return exitCode;
 }
 
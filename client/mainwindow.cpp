@@ -21,11 +21,23 @@
 
 #include "roomlistdock.h"
 #include "userlistdock.h"
+#include "searchresultsdock.h"
+#include "networkinspectordock.h"
+#include "roomswitchstats.h"
+#include "historybackfiller.h"
 #include "chatroomwidget.h"
 #include "logindialog.h"
 #include "networkconfigdialog.h"
+#include "memorydialog.h"
 #include "roomdialogs.h"
 #include "systemtrayicon.h"
+#include "highlightengine.h"
+#include "ingestionpipeline.h"
+#include "quaternionroom.h"
+#include "syncrecorder.h"
+#include "syncreplayserver.h"
+#include "perfstats.h"
+#include "tracing.h"
 
 #include <csapi/joining.h>
 #include <connection.h>
@@ -57,6 +69,8 @@
 #include <QtGui/QCloseEvent>
 #include <QtGui/QDesktopServices>
 
+#include <cstdio>
+
 using QMatrixClient::NetworkAccessManager;
 using QMatrixClient::AccountSettings;
 
@@ -78,15 +92,41 @@ MainWindow::MainWindow()
     addDockWidget(Qt::LeftDockWidgetArea, roomListDock);
     userListDock = new UserListDock(this);
     addDockWidget(Qt::RightDockWidgetArea, userListDock);
+    searchDock = new SearchResultsDock(this);
+    addDockWidget(Qt::BottomDockWidgetArea, searchDock);
+    searchDock->hide();
+    networkDock = new NetworkInspectorDock(this);
+    addDockWidget(Qt::BottomDockWidgetArea, networkDock);
+    networkDock->hide();
     chatRoomWidget = new ChatRoomWidget(this);
     setCentralWidget(chatRoomWidget);
+    backfiller = new HistoryBackfiller(this);
+    // Backfilled history goes to the state cache with the next save
+    connect( backfiller, &HistoryBackfiller::historyLoaded, this,
+             [this] (Connection* c) { unsavedConnections.insert(c); });
     connect( chatRoomWidget, &ChatRoomWidget::joinCommandEntered,
              this, [=] (QString roomIdOrAlias)  { joinRoom(roomIdOrAlias); });
     connect( roomListDock, &RoomListDock::roomSelected,
              this, &MainWindow::selectRoom);
+    connect( roomListDock, &RoomListDock::roomHovered,
+             this, [this] (QuaternionRoom* room) {
+                 chatRoomWidget->prewarm(room);
+                 userListDock->prewarm(room);
+             });
     connect( chatRoomWidget, &ChatRoomWidget::showStatusMessage, statusBar(), &QStatusBar::showMessage );
     connect( userListDock, &UserListDock::userMentionRequested,
              chatRoomWidget, &ChatRoomWidget::insertMention);
+    connect( chatRoomWidget, &ChatRoomWidget::searchCommandEntered,
+             this, [this] (const QString& query) {
+                 searchDock->show();
+                 searchDock->raise();
+                 searchDock->search(query);
+             });
+    connect( searchDock, &SearchResultsDock::hitActivated, this,
+             [this] (QuaternionRoom* room, const QString& eventId) {
+                 selectRoom(room);
+                 chatRoomWidget->scrollToEvent(eventId);
+             });
 
     createMenu();
     systemTrayIcon = new SystemTrayIcon(this);
@@ -105,6 +145,13 @@ MainWindow::MainWindow()
     QTimer::singleShot(0, this, SLOT(invokeLogin()));
 }
 
+MainWindow::~MainWindow()
+{
+    if (shutdownTimer.isValid())
+        qDebug() << "Time from close to exit:" << shutdownTimer.elapsed()
+                 << "ms";
+}
+
 ChatRoomWidget* MainWindow::getChatRoomWidget() const
 {
    return chatRoomWidget;
@@ -169,6 +216,13 @@ void MainWindow::createMenu()
     userListDock->toggleViewAction()
         ->setStatusTip("Show/hide Users dock panel");
     dockPanesMenu->addAction(userListDock->toggleViewAction());
+    searchDock->toggleViewAction()
+        ->setStatusTip("Show/hide Search dock panel");
+    dockPanesMenu->addAction(searchDock->toggleViewAction());
+    networkDock->toggleViewAction()
+        ->setStatusTip("Show/hide Network dock panel");
+    networkDock->toggleViewAction()->setVisible(false); // Until debug is on
+    dockPanesMenu->addAction(networkDock->toggleViewAction());
 
     viewMenu->addSeparator();
 
@@ -194,6 +248,13 @@ void MainWindow::createMenu()
            " possibly with redactions between"),
         QStringLiteral("show_spammy")
     );
+    addTimelineOptionCheckbox(
+        showEventsMenu,
+        tr("Collapse &membership runs"),
+        tr("Show consecutive joins, leaves and profile changes"
+           " as a single expandable row"),
+        QStringLiteral("collapse_membership_runs")
+    );
 
     // Room menu
     auto roomMenu = menuBar()->addMenu(tr("&Room"));
@@ -304,12 +365,40 @@ void MainWindow::createMenu()
         QStringLiteral("autoload_images"), true
     );
 
+    settingsMenu->addAction(tr("Highlight &keywords..."), [this]
+    {
+        bool ok = false;
+        const auto keywords = QInputDialog::getMultiLineText(this,
+            tr("Highlight keywords"),
+            tr("Messages mentioning your name are always highlighted.\n"
+               "Enter additional keywords, one per line; enclose a line\n"
+               "in slashes to use it as a regular expression, e.g. /mee+t/"),
+            HighlightEngine::userKeywords().join('\n'), &ok);
+        if (!ok)
+            return;
+        HighlightEngine::setUserKeywords(
+            keywords.split('\n', QString::SkipEmptyParts));
+        // Other rooms will pick the new keywords when they are selected
+        if (currentRoom)
+            currentRoom->materialize();
+    });
+
     settingsMenu->addSeparator();
     settingsMenu->addAction(tr("Configure &network proxy..."), [this]
     {
         static QPointer<NetworkConfigDialog> dlg;
         summon(dlg, this);
     });
+    settingsMenu->addAction(tr("&Memory..."), [this]
+    {
+        static QPointer<MemoryDialog> dlg;
+        summon(dlg, connections, QVector<MemoryDialog::ModelFootprint> {
+                { tr("Room list model"),
+                  [this] { return roomListDock->modelMemoryFootprint(); } },
+                { tr("Timeline model"),
+                  [this] { return chatRoomWidget->modelMemoryFootprint(); } }
+            }, this);
+    });
 }
 
 void MainWindow::loadSettings()
@@ -332,6 +421,57 @@ void MainWindow::saveSettings() const
     sg.sync();
 }
 
+/// Save the connection state without ever leaving a half-written cache
+/**
+ * The state is written to a temporary file next to the cache first;
+ * the cache is only replaced once the new state has been written in full,
+ * so an interrupted save leaves the previous cache intact.
+ */
+static void saveStateSafely(QMatrixClient::Connection* c)
+{
+    TRACE_SPAN("saveStateSafely", "state");
+    const auto cachePath = c->stateCachePath();
+    const auto tempPath = cachePath + QStringLiteral(".saving");
+    c->saveState(QUrl::fromLocalFile(tempPath));
+    if (!QFile::exists(tempPath))
+        return; // State caching is disabled or failed - nothing to replace
+
+    // std::rename() replaces the target atomically on POSIX systems;
+    // elsewhere the old cache has to be removed first.
+    if (std::rename(QFile::encodeName(tempPath).constData(),
+                    QFile::encodeName(cachePath).constData()) != 0)
+    {
+        QFile::remove(cachePath);
+        if (!QFile::rename(tempPath, cachePath))
+            qWarning() << "Couldn't replace the state cache at" << cachePath;
+    }
+}
+
+void MainWindow::saveConnectionStates(int timeoutMs)
+{
+    // Connection::saveState() reads connection and room objects that are
+    // not thread-safe, so the connections are saved one by one on this
+    // thread. Once out of time, the remaining saves are skipped; their
+    // caches stay at the last complete state.
+    QElapsedTimer et; et.start();
+    for (auto c: qAsConst(connections))
+    {
+        if (!unsavedConnections.contains(c))
+        {
+            qDebug() << "The saved state of" << c->userId() << "is up to date";
+            continue;
+        }
+        if (et.hasExpired(timeoutMs))
+        {
+            qWarning() << "Saving the state took longer than" << timeoutMs
+                       << "ms, skipped saving the state of" << c->userId();
+            continue;
+        }
+        saveStateSafely(c);
+    }
+    unsavedConnections.clear();
+}
+
 inline QString accessTokenFileName(const AccountSettings& account)
 {
     QString fileName = account.userId();
@@ -405,6 +545,23 @@ bool MainWindow::saveAccessToken(const AccountSettings& account,
 void MainWindow::enableDebug()
 {
     chatRoomWidget->enableDebug();
+    networkDock->toggleViewAction()->setVisible(true);
+    networkDock->setRecording(true);
+}
+
+void MainWindow::setSyncRecorder(SyncRecorder* recorder)
+{
+    syncRecorder = recorder;
+}
+
+void MainWindow::setReplayServer(SyncReplayServer* server)
+{
+    replayServer = server;
+}
+
+void MainWindow::setHomeserverOverride(const QUrl& url)
+{
+    homeserverOverride = url;
 }
 
 void MainWindow::addConnection(Connection* c, const QString& deviceName)
@@ -414,12 +571,24 @@ void MainWindow::addConnection(Connection* c, const QString& deviceName)
     using Room = QMatrixClient::Room;
 
     connections.push_back(c);
+    if (syncRecorder)
+        syncRecorder->addConnection(c);
 
     roomListDock->addConnection(c);
+    searchDock->addConnection(c);
+    PerfStats::instance()->addConnection(c);
+    if (c != replayConnection)
+        backfiller->addConnection(c);
 
     connect( c, &Connection::syncDone, this, [=]
     {
+        TRACE_SPAN("Connection::syncDone", "sync");
+        TRACE_COUNTER("Connection.rooms", c->roomMap().size());
         gotEvents(c);
+        if (c == replayConnection)
+            return; // Replayed sessions never touch the real cache
+
+        unsavedConnections.insert(c);
 
         // Borrowed the logic from Quiark's code in Tensor to cache not too
         // aggressively and not on the first sync. The static variable instance
@@ -427,7 +596,10 @@ void MainWindow::addConnection(Connection* c, const QString& deviceName)
         // code is not in gotEvents() ).
         static int counter = 0;
         if (++counter % 17 == 2)
-            c->saveState();
+        {
+            saveStateSafely(c);
+            unsavedConnections.remove(c);
+        }
     } );
     connect( c, &Connection::loggedOut, this, [=]
     {
@@ -547,6 +719,7 @@ void MainWindow::dropConnection(Connection* c)
         selectRoom(nullptr);
     connections.removeOne(c);
     logoutOnExit.removeOne(c);
+    unsavedConnections.remove(c);
     createRoomAction->setDisabled(connections.isEmpty());
 
     Q_ASSERT(!connections.contains(c) && !logoutOnExit.contains(c) &&
@@ -564,6 +737,8 @@ void MainWindow::showFirstSyncIndicator()
 void MainWindow::showLoginWindow(const QString& statusMessage)
 {
     LoginDialog dialog(this);
+    if (homeserverOverride.isValid())
+        dialog.setHomeserver(homeserverOverride);
     dialog.setStatusMessage(statusMessage);
     if( dialog.exec() )
     {
@@ -617,8 +792,30 @@ void MainWindow::showAboutWindow()
     aboutDialog.exec();
 }
 
+void MainWindow::connectToReplayServer()
+{
+    replayConnection = new Connection(replayServer->url());
+    connect(replayConnection, &Connection::connected, this,
+            [this] { addConnection(replayConnection, "replay"); });
+    replayConnection->connectWithToken(replayServer->userId(),
+                                       "replay", "REPLAY");
+    showFirstSyncIndicator();
+}
+
 void MainWindow::invokeLogin()
 {
+    if (replayServer)
+    {
+        connectToReplayServer();
+        return;
+    }
+    if (homeserverOverride.isValid())
+    {
+        // Don't send saved access tokens to a server they don't belong to
+        showLoginWindow(tr("Log in to %1").arg(homeserverOverride.toString()));
+        return;
+    }
+
     using namespace QMatrixClient;
     const auto accounts = SettingsGroup("Accounts").childGroups();
     bool autoLoggedIn = false;
@@ -645,7 +842,10 @@ void MainWindow::invokeLogin()
             auto deviceName = account.deviceName();
             connect(c, &Connection::connected, this,
                 [=] {
-                    c->loadState();
+                    {
+                        TRACE_SPAN("Connection::loadState", "state");
+                        c->loadState();
+                    }
                     addConnection(c, deviceName);
                 });
             c->connectWithToken(account.userId(), accessToken,
@@ -676,19 +876,23 @@ void MainWindow::logout(Connection* c)
 
 void MainWindow::selectRoom(QMatrixClient::Room* r)
 {
-    QElapsedTimer et; et.start();
+    TRACE_SPAN("MainWindow::selectRoom", "ui");
+    auto* switchStats = RoomSwitchStats::instance();
+    switchStats->begin();
     currentRoom = static_cast<QuaternionRoom*>(r);
     setWindowTitle(r ? r->displayName() : QString());
     chatRoomWidget->setRoom(currentRoom);
     userListDock->setRoom(currentRoom);
+    switchStats->stage("user list");
+    switchStats->finish();
+    if (currentRoom)
+        backfiller->roomVisited(currentRoom);
     roomSettingsAction->setEnabled(r != nullptr);
     if (r && !isActiveWindow())
     {
         show();
         activateWindow();
     }
-    qDebug().noquote() << et << "to "
-        << (r ? "select room " + r->canonicalAlias() : "close the room");
 }
 
 QMatrixClient::Connection* MainWindow::chooseConnection()
@@ -952,15 +1156,47 @@ void MainWindow::proxyAuthenticationRequired(const QNetworkProxy&,
 
 void MainWindow::closeEvent(QCloseEvent* event)
 {
+    shutdownTimer.start();
+    saveSettings(); // Needs the window geometry, so do it before hiding
+    hide(); // Don't keep the user waiting while the state is being saved
+    // Move the read markers before their rooms get saved
+    chatRoomWidget->flushReadReceipts();
     for (auto c: qAsConst(connections))
     {
-        c->saveState();
         c->stopSync(); // Instead of deleting the connection, merely stop it
 //        dropConnection(c);
     }
+    saveConnectionStates(5000);
+    IngestionPipeline::instance()->waitForDone(1000);
+    IngestionPipeline::instance()->logStats();
+    SearchIndex::instance()->shutdown(1000);
     for (auto c: qAsConst(logoutOnExit))
         c->logout(); // For the record, dropConnection() does it automatically
-    saveSettings();
+    qDebug() << "Shutdown tasks took" << shutdownTimer.elapsed() << "ms";
     event->accept();
 }
 
+void MainWindow::showEvent(QShowEvent* event)
+{
+    QMainWindow::showEvent(event);
+    updateBackgroundMode();
+}
+
+void MainWindow::hideEvent(QHideEvent* event)
+{
+    QMainWindow::hideEvent(event);
+    updateBackgroundMode();
+}
+
+void MainWindow::changeEvent(QEvent* event)
+{
+    QMainWindow::changeEvent(event);
+    if (event->type() == QEvent::WindowStateChange)
+        updateBackgroundMode();
+}
+
+void MainWindow::updateBackgroundMode()
+{
+    if (chatRoomWidget)
+        chatRoomWidget->setSuspended(!isVisible() || isMinimized());
+}
@@ -24,6 +24,9 @@
 #define STR(tok) STR_EXPAND(tok)
 
 #include <QtWidgets/QMainWindow>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSet>
+#include <QtCore/QUrl>
 
 namespace QMatrixClient {
     class Room;
@@ -33,9 +36,14 @@ namespace QMatrixClient {
 
 class RoomListDock;
 class UserListDock;
+class SearchResultsDock;
+class NetworkInspectorDock;
 class ChatRoomWidget;
 class SystemTrayIcon;
 class QuaternionRoom;
+class SyncRecorder;
+class SyncReplayServer;
+class HistoryBackfiller;
 
 class QAction;
 class QMenu;
@@ -56,8 +64,15 @@ class MainWindow: public QMainWindow
         using Connection = QMatrixClient::Connection;
 
         MainWindow();
+        ~MainWindow() override;
 
         void enableDebug();
+        /// Record syncs of all connections added from now on
+        void setSyncRecorder(SyncRecorder* recorder);
+        /// Connect to the replay server instead of logging in to accounts
+        void setReplayServer(SyncReplayServer* server);
+        /// Log in to this server instead of the saved accounts
+        void setHomeserverOverride(const QUrl& url);
 
         void addConnection(Connection* c, const QString& deviceName);
         void dropConnection(Connection* c);
@@ -69,6 +84,9 @@ class MainWindow: public QMainWindow
 
     protected:
         void closeEvent(QCloseEvent* event) override;
+        void showEvent(QShowEvent* event) override;
+        void hideEvent(QHideEvent* event) override;
+        void changeEvent(QEvent* event) override;
 
     private slots:
         void invokeLogin();
@@ -92,10 +110,15 @@ class MainWindow: public QMainWindow
     private:
         QVector<Connection*> connections;
         QVector<Connection*> logoutOnExit;
+        QSet<Connection*> unsavedConnections;
+        QElapsedTimer shutdownTimer;
 
         RoomListDock* roomListDock = nullptr;
         UserListDock* userListDock = nullptr;
+        SearchResultsDock* searchDock = nullptr;
+        NetworkInspectorDock* networkDock = nullptr;
         ChatRoomWidget* chatRoomWidget = nullptr;
+        HistoryBackfiller* backfiller = nullptr;
 
         QMovie* busyIndicator = nullptr;
         QLabel* busyLabel = nullptr;
@@ -107,6 +130,11 @@ class MainWindow: public QMainWindow
 
         SystemTrayIcon* systemTrayIcon = nullptr;
 
+        SyncRecorder* syncRecorder = nullptr;
+        SyncReplayServer* replayServer = nullptr;
+        Connection* replayConnection = nullptr;
+        QUrl homeserverOverride;
+
         // FIXME: This will be a problem when we get ability to show
         // several rooms at once.
         QuaternionRoom* currentRoom = nullptr;
@@ -116,8 +144,12 @@ class MainWindow: public QMainWindow
             const QString& text, const QString& statusTip,
             const QString& settingsKey, bool defaultValue = false);
         void showFirstSyncIndicator();
+        void connectToReplayServer();
         void loadSettings();
         void saveSettings() const;
+        /// Suspend the timeline while the window is hidden or minimized
+        void updateBackgroundMode();
+        void saveConnectionStates(int timeoutMs);
         QByteArray loadAccessToken(const QMatrixClient::AccountSettings& account);
         bool saveAccessToken(const QMatrixClient::AccountSettings& account,
                              const QByteArray& accessToken);
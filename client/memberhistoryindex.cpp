@@ -0,0 +1,89 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "memberhistoryindex.h"
+
+#include "memoryusage.h"
+
+#include <events/roommemberevent.h>
+
+#include <algorithm>
+
+using namespace QMatrixClient;
+
+void MemberHistoryIndex::add(const TimelineItem& ti)
+{
+    const auto* e = ti.viewAs<RoomMemberEvent>();
+    if (!e || e->repeatsState())
+        return;
+
+    Change change { ti.index(), e->prevContent() != nullptr, {},
+                    { e->displayName(), e->avatarUrl() } };
+    if (change.beforeKnown)
+        change.before = { e->prevContent()->displayName,
+                          e->prevContent()->avatarUrl };
+
+    // New events go to the back and historical ones to the front
+    auto& changes = m_byMember[e->userId()];
+    if (changes.empty() || change.index > changes.back().index)
+        changes.push_back(change);
+    else if (change.index < changes.front().index)
+        changes.push_front(change);
+    else
+    {
+        const auto it = std::lower_bound(changes.begin(), changes.end(),
+            change.index,
+            [] (const Change& c, index_t i) { return c.index < i; });
+        if (it->index != change.index)
+            changes.insert(it, change);
+    }
+}
+
+void MemberHistoryIndex::clear()
+{
+    m_byMember.clear();
+}
+
+const MemberHistoryIndex::Profile*
+MemberHistoryIndex::profileAt(const QString& userId, index_t index) const
+{
+    const auto historyIt = m_byMember.constFind(userId);
+    if (historyIt == m_byMember.cend())
+        return nullptr;
+
+    const auto& changes = *historyIt;
+    const auto it = std::lower_bound(changes.cbegin(), changes.cend(), index,
+        [] (const Change& c, index_t i) { return c.index < i; });
+    const Profile* profile =
+        it != changes.cbegin() ? &(it - 1)->after :
+        it->beforeKnown ? &it->before : &it->after;
+    return profile != &changes.back().after ? profile : nullptr;
+}
+
+qint64 MemberHistoryIndex::memoryFootprint() const
+{
+    // Display names are mostly shared with the events; URLs are not
+    static const qint64 EntryOverheadBytes = 64;
+    static const qint64 ChangeBytes = sizeof(Change) + 2 * 64;
+    qint64 result = 0;
+    for (auto it = m_byMember.cbegin(); it != m_byMember.cend(); ++it)
+        result += EntryOverheadBytes + MemoryUsage::ofString(it.key())
+                  + qint64(it->size()) * ChangeBytes;
+    return result;
+}
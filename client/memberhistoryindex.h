@@ -0,0 +1,76 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <room.h>
+
+#include <QtCore/QHash>
+#include <QtCore/QUrl>
+
+#include <deque>
+
+/// Keeps the history of display names and avatars of room members
+/**
+ * Each member event in the timeline adds a change to the history of
+ * the member it's about, ordered by the timeline index; events come at
+ * either end as the timeline grows, so the histories are built once and
+ * only ever extended. Looking up the profile of a member as of an event
+ * is a binary search over the changes of that member, so that timeline
+ * delegates can show names that were in effect at the time in O(log k).
+ */
+class MemberHistoryIndex
+{
+    public:
+        using index_t = QMatrixClient::TimelineItem::index_t;
+
+        struct Profile
+        {
+            QString displayName;
+            QUrl avatarUrl;
+        };
+
+        /// Record the change made by the item, if it's a member event
+        void add(const QMatrixClient::TimelineItem& ti);
+        void clear();
+
+        /// The profile of the member as of the event with the index
+        /**
+         * That is the profile after the latest change before the event;
+         * for events before any known change, the profile before
+         * the earliest one. Returns nullptr if the profile is the one after
+         * the latest change or if there are no changes known, i.e. if
+         * the current profile of the member applies.
+         */
+        const Profile* profileAt(const QString& userId, index_t index) const;
+        /// Estimated memory taken by the index, in bytes
+        qint64 memoryFootprint() const;
+
+    private:
+        struct Change
+        {
+            index_t index;
+            /// The profile before the change, if the event carried it
+            bool beforeKnown;
+            Profile before;
+            Profile after;
+        };
+
+        QHash<QString, std::deque<Change>> m_byMember;
+};
@@ -0,0 +1,194 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "memorydialog.h"
+
+#include "quaternionroom.h"
+
+#include <connection.h>
+
+#include <QtWidgets/QTreeWidget>
+#include <QtWidgets/QHeaderView>
+#include <QtWidgets/QPushButton>
+#include <QtWidgets/QLabel>
+
+#include <algorithm>
+
+using QMatrixClient::Connection;
+
+static const int TopRoomsShown = 100;
+
+enum Columns { RoomColumn, AccountColumn, EventsColumn, TimelineColumn,
+               MembersColumn, ClientDataColumn, TotalColumn, ColumnCount };
+
+static QString formatBytes(qint64 bytes)
+{
+    if (bytes < 10 * 1024)
+        return MemoryDialog::tr("%1 B").arg(bytes);
+    if (bytes < 10 * 1024 * 1024)
+        return MemoryDialog::tr("%1 KB").arg(bytes / 1024);
+    return MemoryDialog::tr("%1 MB").arg(bytes / (1024 * 1024));
+}
+
+/// Sorts numeric columns by the values rather than the texts
+class MemoryItem : public QTreeWidgetItem
+{
+    public:
+        using QTreeWidgetItem::QTreeWidgetItem;
+
+        bool operator<(const QTreeWidgetItem& other) const override
+        {
+            const auto column = treeWidget()->sortColumn();
+            if (column == RoomColumn || column == AccountColumn)
+                return QTreeWidgetItem::operator<(other);
+            return data(column, Qt::UserRole).toLongLong()
+                    < other.data(column, Qt::UserRole).toLongLong();
+        }
+};
+
+MemoryDialog::MemoryDialog(const connections_t& connections,
+                           QVector<ModelFootprint> models, QWidget* parent)
+    : Dialog(tr("Memory"), QDialogButtonBox::Close | QDialogButtonBox::Reset,
+             parent)
+    , m_models(std::move(models))
+    , m_summary(new QLabel)
+    , m_rooms(new QTreeWidget)
+    , m_modelsLabel(new QLabel)
+    , m_trimButton(buttonBox()->addButton(tr("&Trim selected"),
+                                          QDialogButtonBox::ActionRole))
+{
+    for (auto* c: connections)
+        m_connections.push_back(c);
+
+    buttonBox()->button(QDialogButtonBox::Reset)->setText(tr("&Refresh"));
+    m_trimButton->setToolTip(
+        tr("Drop the data Quaternion keeps for the selected rooms on top of"
+           " their timelines; it will be rebuilt when a room is opened"));
+    m_trimButton->setEnabled(false);
+
+    m_rooms->setColumnCount(ColumnCount);
+    m_rooms->setHeaderLabels({ tr("Room"), tr("Account"), tr("Events"),
+                               tr("Timeline"), tr("Members"),
+                               tr("Highlights, reactions, receipts"),
+                               tr("Total") });
+    m_rooms->setRootIsDecorated(false);
+    m_rooms->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    m_rooms->setSortingEnabled(true);
+    m_rooms->header()->setSectionResizeMode(RoomColumn, QHeaderView::Stretch);
+    m_rooms->setMinimumSize(720, 400);
+    connect(m_rooms, &QTreeWidget::itemSelectionChanged, this, [this] {
+        m_trimButton->setEnabled(!m_rooms->selectedItems().isEmpty());
+    });
+
+    m_summary->setWordWrap(true);
+    m_modelsLabel->setWordWrap(true);
+    addWidget(m_summary);
+    addWidget(m_rooms);
+    addWidget(m_modelsLabel);
+}
+
+void MemoryDialog::load()
+{
+    struct Entry
+    {
+        QuaternionRoom* room;
+        RoomMemoryUsage usage;
+    };
+    std::vector<Entry> entries;
+    qint64 total = 0;
+    int materializedCount = 0;
+    for (const auto& c: qAsConst(m_connections))
+    {
+        if (!c)
+            continue;
+        for (auto* r: c->roomMap())
+        {
+            auto* room = static_cast<QuaternionRoom*>(r);
+            entries.push_back({ room, room->memoryUsage() });
+            total += entries.back().usage.total();
+            materializedCount += room->isMaterialized();
+        }
+    }
+    const auto roomCount = int(entries.size());
+    std::sort(entries.begin(), entries.end(),
+              [] (const Entry& a, const Entry& b) {
+                  return a.usage.total() > b.usage.total();
+              });
+    if (entries.size() > size_t(TopRoomsShown))
+        entries.resize(size_t(TopRoomsShown));
+
+    m_summary->setText(
+        tr("%n room(s) take about %1; %2 of them have extra data built."
+           " Avatars and images are not included.", "", roomCount)
+            .arg(formatBytes(total)).arg(materializedCount));
+
+    m_rooms->setSortingEnabled(false);
+    m_rooms->clear();
+    for (const auto& e: entries)
+    {
+        const auto& u = e.usage;
+        const auto clientData = u.highlights + u.relations + u.receipts;
+        auto* item = new MemoryItem(m_rooms);
+        item->setText(RoomColumn, e.room->displayName());
+        item->setData(RoomColumn, Qt::UserRole, e.room->id());
+        item->setText(AccountColumn, e.room->localUser()->id());
+        const std::pair<int, qint64> figures[] {
+            { EventsColumn, u.events }, { TimelineColumn, u.timeline },
+            { MembersColumn, u.memberList + u.memberHistory }, { ClientDataColumn, clientData },
+            { TotalColumn, u.total() }
+        };
+        for (const auto& f: figures)
+        {
+            item->setText(f.first, f.first == EventsColumn
+                                   ? QString::number(f.second)
+                                   : formatBytes(f.second));
+            item->setData(f.first, Qt::UserRole, f.second);
+            item->setTextAlignment(f.first, Qt::AlignRight|Qt::AlignVCenter);
+        }
+        if (!e.room->isMaterialized())
+            item->setDisabled(clientData == 0);
+    }
+    m_rooms->setSortingEnabled(true);
+    m_rooms->sortByColumn(TotalColumn, Qt::DescendingOrder);
+
+    QStringList modelLines;
+    for (const auto& m: qAsConst(m_models))
+        modelLines.push_back(tr("%1: %2").arg(m.name, formatBytes(m.bytes())));
+    m_modelsLabel->setText(modelLines.join('\n'));
+}
+
+void MemoryDialog::buttonClicked(QAbstractButton* button)
+{
+    if (button != m_trimButton)
+    {
+        Dialog::buttonClicked(button);
+        return;
+    }
+    // Rooms may have gone since the list was loaded, so look them up again
+    for (auto* item: m_rooms->selectedItems())
+        for (const auto& c: qAsConst(m_connections))
+            if (c && c->userId() == item->text(AccountColumn))
+            {
+                auto* room = static_cast<QuaternionRoom*>(c->room(
+                        item->data(RoomColumn, Qt::UserRole).toString()));
+                if (room)
+                    room->dematerialize();
+            }
+    load();
+}
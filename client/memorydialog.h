@@ -0,0 +1,69 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include "dialog.h"
+
+#include <QtCore/QPointer>
+#include <QtCore/QVector>
+
+#include <functional>
+
+namespace QMatrixClient {
+    class Connection;
+}
+
+class QTreeWidget;
+class QPushButton;
+
+/// Lists the rooms taking the most memory and lets to trim them
+/**
+ * The figures come from QuaternionRoom::memoryUsage(); trimming
+ * dematerializes the selected rooms.
+ */
+class MemoryDialog : public Dialog
+{
+        Q_OBJECT
+    public:
+        /// Memory taken by a model, for the list below the rooms
+        struct ModelFootprint
+        {
+            QString name;
+            std::function<qint64()> bytes;
+        };
+        using connections_t = QVector<QMatrixClient::Connection*>;
+
+        MemoryDialog(const connections_t& connections,
+                     QVector<ModelFootprint> models,
+                     QWidget* parent = nullptr);
+
+    private slots:
+        void load() override;
+        void buttonClicked(QAbstractButton* button) override;
+
+    private:
+        QVector<QPointer<QMatrixClient::Connection>> m_connections;
+        QVector<ModelFootprint> m_models;
+
+        QLabel* m_summary;
+        QTreeWidget* m_rooms;
+        QLabel* m_modelsLabel;
+        QPushButton* m_trimButton;
+};
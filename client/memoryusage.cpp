@@ -0,0 +1,106 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "memoryusage.h"
+
+#include "quaternionroom.h"
+
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonObject>
+
+/// QString and QJsonValue headers along with the allocation overhead
+static const qint64 StringOverheadBytes = 32;
+static const qint64 JsonValueOverheadBytes = 16;
+/// The event object, its timeline item and the JSON around the content
+/// (ids, timestamps, unsigned data), taken roughly
+static const qint64 EventOverheadBytes = 512;
+/// The User object with its names and the room's member tables
+static const qint64 MemberOverheadBytes = 384;
+
+qint64 MemoryUsage::ofString(const QString& s)
+{
+    return StringOverheadBytes + s.size() * qint64(sizeof(QChar));
+}
+
+qint64 MemoryUsage::ofJson(const QJsonValue& value)
+{
+    switch (value.type())
+    {
+        case QJsonValue::String:
+            return JsonValueOverheadBytes + ofString(value.toString());
+        case QJsonValue::Array:
+        {
+            qint64 result = JsonValueOverheadBytes;
+            for (const auto& v: value.toArray())
+                result += ofJson(v);
+            return result;
+        }
+        case QJsonValue::Object:
+        {
+            const auto object = value.toObject();
+            qint64 result = JsonValueOverheadBytes;
+            for (auto it = object.begin(); it != object.end(); ++it)
+                result += ofString(it.key()) + ofJson(it.value());
+            return result;
+        }
+        default:
+            return JsonValueOverheadBytes;
+    }
+}
+
+qint64 MemoryUsage::ofEvent(const EventSnapshot& event)
+{
+    return EventOverheadBytes + ofString(event.id) + ofString(event.senderId)
+           + ofJson(event.contentJson);
+}
+
+qint64 MemoryUsage::ofMember()
+{
+    return MemberOverheadBytes;
+}
+
+const QString MemoryAccountingProcessor::StageName = QStringLiteral("memory");
+
+QString MemoryAccountingProcessor::name() const
+{
+    return StageName;
+}
+
+QStringList MemoryAccountingProcessor::eventTypes() const
+{
+    return {}; // All events take memory
+}
+
+int MemoryAccountingProcessor::snapshotParts() const
+{
+    return EventSnapshot::ContentJsonPart;
+}
+
+TimelineProcessor::Job MemoryAccountingProcessor::prepare(QuaternionRoom*)
+{
+    return [] (const EventBatch& batch) -> Publisher
+    {
+        qint64 bytes = 0;
+        for (const auto& e: batch.events)
+            bytes += MemoryUsage::ofEvent(e);
+        return [events = batch.events.size(), bytes] (QuaternionRoom* r) {
+            r->addTimelineFootprint(events, bytes);
+        };
+    };
+}
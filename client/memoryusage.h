@@ -0,0 +1,80 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include "timelineprocessor.h"
+
+#include <QtCore/QJsonValue>
+#include <QtCore/QString>
+
+/// Estimated memory taken by the data of a room, in bytes
+/**
+ * The figures are estimates built from the sizes of strings and JSON
+ * values plus fixed overheads per object; they are meant to compare rooms
+ * with each other rather than to add up to the process resident size.
+ * Avatars and images are cached by libqmatrixclient and the QML engine
+ * without a reference to the room, so they are not counted.
+ */
+struct RoomMemoryUsage
+{
+    int events = 0;
+    /// Timeline events, including their JSON
+    qint64 timeline = 0;
+    qint64 highlights = 0;
+    int members = 0;
+    qint64 memberList = 0;
+    qint64 relations = 0;
+    qint64 receipts = 0;
+    qint64 memberHistory = 0;
+
+    qint64 total() const
+    {
+        return timeline + highlights + memberList + memberHistory
+               + relations + receipts;
+    }
+};
+
+namespace MemoryUsage
+{
+    /// Estimated memory taken by a string, including its header
+    qint64 ofString(const QString& s);
+    /// Estimated memory taken by a JSON value; thread-safe
+    qint64 ofJson(const QJsonValue& value);
+    /// Estimated memory taken by a timeline event; thread-safe
+    qint64 ofEvent(const EventSnapshot& event);
+    /// Estimated memory taken by a room member, aside from the avatar
+    qint64 ofMember();
+}
+
+/// Accounts the memory taken by timeline events of every room
+/**
+ * The estimates are made on the pipeline threads, once per event as it
+ * arrives; the room only adds them up.
+ */
+class MemoryAccountingProcessor: public TimelineProcessor
+{
+    public:
+        static const QString StageName;
+
+        QString name() const override;
+        QStringList eventTypes() const override;
+        int snapshotParts() const override;
+        Job prepare(QuaternionRoom* room) override;
+};
@@ -0,0 +1,215 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "membershipruns.h"
+
+#include <events/roommemberevent.h>
+
+#include <algorithm>
+
+using namespace QMatrixClient;
+
+static void countEvent(MembershipRuns::Summary& s, const RoomEvent& e)
+{
+    const auto& me = static_cast<const RoomMemberEvent&>(e);
+    switch (me.membership())
+    {
+        case MembershipType::Join:
+            if (!me.prevContent()
+                    || me.prevContent()->membership != MembershipType::Join)
+                ++s.joined;
+            else if (me.isRename())
+                ++s.renamed;
+            else if (me.isAvatarUpdate())
+                ++s.avatarChanged;
+            else
+                ++s.other;
+            break;
+        case MembershipType::Leave:
+            ++s.left;
+            break;
+        case MembershipType::Invite:
+            ++s.invited;
+            break;
+        case MembershipType::Ban:
+            ++s.banned;
+            break;
+        default:
+            ++s.other;
+    }
+}
+
+bool MembershipRuns::Summary::joinsAndLeavesOnly() const
+{
+    return renamed == 0 && avatarChanged == 0 && invited == 0 && banned == 0
+            && other == 0;
+}
+
+int MembershipRuns::Segment::rows() const
+{
+    return !isRun || events == 1 ? events : expanded ? events + 1 : 1;
+}
+
+bool MembershipRuns::isMembershipEvent(const RoomEvent& e)
+{
+    return is<RoomMemberEvent>(e);
+}
+
+void MembershipRuns::clear()
+{
+    m_segments.clear();
+}
+
+MembershipRuns::Change MembershipRuns::addNewest(const RoomEvent& e)
+{
+    const auto isRun = isMembershipEvent(e);
+    // Expanded runs don't grow, so that rows are only ever added at the end
+    if (!m_segments.empty() && m_segments.back().isRun == isRun
+            && !(isRun && m_segments.back().expanded))
+    {
+        auto& s = m_segments.back();
+        const auto rowsBefore = s.rows();
+        ++s.events;
+        if (isRun)
+            countEvent(s.summary, e);
+        const auto rowsAdded = s.rows() - rowsBefore;
+        return { rowsAdded, rowsAdded == 0 };
+    }
+    Segment s { isRun, false, 1, 0, 0, {} };
+    if (!m_segments.empty())
+    {
+        const auto& last = m_segments.back();
+        s.firstEvent = last.firstEvent + last.events;
+        s.firstRow = last.firstRow + last.rows();
+    }
+    if (isRun)
+        countEvent(s.summary, e);
+    m_segments.push_back(s);
+    return { 1, false };
+}
+
+MembershipRuns::Change MembershipRuns::addOldest(const RoomEvent& e)
+{
+    const auto isRun = isMembershipEvent(e);
+    if (!m_segments.empty() && m_segments.front().isRun == isRun
+            && !(isRun && m_segments.front().expanded))
+    {
+        auto& s = m_segments.front();
+        const auto rowsBefore = s.rows();
+        ++s.events;
+        --s.firstEvent;
+        if (isRun)
+            countEvent(s.summary, e);
+        const auto rowsAdded = s.rows() - rowsBefore;
+        s.firstRow -= rowsAdded;
+        return { rowsAdded, rowsAdded == 0 };
+    }
+    Segment s { isRun, false, 1, 0, 0, {} };
+    if (isRun)
+        countEvent(s.summary, e);
+    if (!m_segments.empty())
+    {
+        const auto& first = m_segments.front();
+        s.firstEvent = first.firstEvent - 1;
+        s.firstRow = first.firstRow - s.rows();
+    }
+    m_segments.push_front(s);
+    return { 1, false };
+}
+
+qint64 MembershipRuns::eventCount() const
+{
+    return m_segments.empty() ? 0 :
+        m_segments.back().firstEvent + m_segments.back().events
+            - m_segments.front().firstEvent;
+}
+
+int MembershipRuns::rowCount() const
+{
+    return m_segments.empty() ? 0 :
+        int(m_segments.back().firstRow + m_segments.back().rows()
+            - m_segments.front().firstRow);
+}
+
+std::deque<MembershipRuns::Segment>::const_iterator
+MembershipRuns::segmentAtRow(qint64 row) const
+{
+    // row is counted from the oldest one here, in the segments' terms
+    return std::upper_bound(m_segments.begin(), m_segments.end(), row,
+        [] (qint64 r, const Segment& s) { return r < s.firstRow; }) - 1;
+}
+
+MembershipRuns::Item MembershipRuns::itemAt(int row) const
+{
+    Q_ASSERT(row >= 0 && row < rowCount());
+    const auto& front = m_segments.front();
+    const auto target = front.firstRow + rowCount() - 1 - row;
+    const auto it = segmentAtRow(target);
+    const auto rowInSegment = target - it->firstRow;
+    qint64 eventPos; // Counted from the oldest event
+    if (!it->isRun || it->events == 1)
+        eventPos = it->firstEvent + rowInSegment;
+    else if (rowInSegment == 0)
+    {
+        // The summary row is at the top (oldest end) of the run
+        eventPos = it->firstEvent + it->events - 1;
+        return { int(front.firstEvent + eventCount() - 1 - eventPos),
+                 it->events, it->expanded, &it->summary };
+    } else
+        eventPos = it->firstEvent + rowInSegment - 1;
+    return { int(front.firstEvent + eventCount() - 1 - eventPos),
+             0, false, nullptr };
+}
+
+int MembershipRuns::rowOf(int offset) const
+{
+    if (offset < 0 || offset >= eventCount())
+        return -1;
+    const auto& front = m_segments.front();
+    const auto eventPos = front.firstEvent + eventCount() - 1 - offset;
+    const auto it = std::upper_bound(m_segments.begin(), m_segments.end(),
+        eventPos,
+        [] (qint64 p, const Segment& s) { return p < s.firstEvent; }) - 1;
+    const auto posInSegment = eventPos - it->firstEvent;
+    const auto rowInSegment =
+        !it->isRun || it->events == 1 ? posInSegment :
+        it->expanded ? posInSegment + 1 : 0;
+    return int(rowCount() - 1 - (it->firstRow - front.firstRow + rowInSegment));
+}
+
+int MembershipRuns::toggle(int row)
+{
+    const auto target = m_segments.front().firstRow + rowCount() - 1 - row;
+    const auto constIt = segmentAtRow(target);
+    auto it = m_segments.begin() + (constIt - m_segments.cbegin());
+    if (!it->isRun || it->events == 1 || target != it->firstRow)
+        return 0; // Not a summary row
+
+    const auto rowsBefore = it->rows();
+    it->expanded = !it->expanded;
+    const auto rowsAdded = it->rows() - rowsBefore;
+    for (++it; it != m_segments.end(); ++it)
+        it->firstRow += rowsAdded;
+    return rowsAdded;
+}
+
+qint64 MembershipRuns::memoryFootprint() const
+{
+    return qint64(m_segments.size() * sizeof(Segment));
+}
@@ -0,0 +1,109 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QtGlobal>
+
+#include <deque>
+
+namespace QMatrixClient
+{
+    class RoomEvent;
+}
+
+/// Groups consecutive membership events in the timeline into runs
+/**
+ * The timeline is kept as a sequence of segments, from the oldest event to
+ * the newest. A segment is either a span of other events, one row each,
+ * or a run of consecutive membership and profile change events; a run of
+ * more than one event takes a single summary row, plus a row for each of
+ * its events when it's expanded. Events are added at either end of
+ * the sequence as they come to the room timeline, so that the segments
+ * only have to be built from scratch when switching rooms. Rows and event
+ * offsets are counted from the newest event, like in MessageEventModel.
+ */
+class MembershipRuns
+{
+    public:
+        struct Summary
+        {
+            int joined = 0;
+            int left = 0;
+            int renamed = 0;
+            int avatarChanged = 0;
+            int invited = 0;
+            int banned = 0;
+            int other = 0;
+
+            /// Whether all the events are joins or leaves
+            bool joinsAndLeavesOnly() const;
+        };
+        struct Item
+        {
+            /// The offset of the event from the newest one; for a summary
+            /// row, the offset of the newest event in the run
+            int offset;
+            /// The number of events in the run for a summary row, 0 otherwise
+            int runLength;
+            bool expanded;
+            const Summary* summary;
+        };
+        struct Change
+        {
+            int rowsAdded;
+            /// Whether the row at that end, if existed before, has changed
+            bool endRowChanged;
+        };
+
+        static bool isMembershipEvent(const QMatrixClient::RoomEvent& e);
+
+        void clear();
+        Change addNewest(const QMatrixClient::RoomEvent& e);
+        Change addOldest(const QMatrixClient::RoomEvent& e);
+
+        int rowCount() const;
+        Item itemAt(int row) const;
+        /// The row showing the event; the summary row for collapsed runs
+        int rowOf(int offset) const;
+        /// Expand or collapse the run with the summary at the row
+        /** \return the number of rows added (negative if removed) */
+        int toggle(int row);
+
+        qint64 memoryFootprint() const;
+
+    private:
+        struct Segment
+        {
+            bool isRun;
+            bool expanded;
+            int events;
+            /// Positions of the first (oldest) event and row; these only
+            /// make sense relative to the same ones of the front segment
+            qint64 firstEvent;
+            qint64 firstRow;
+            Summary summary;
+
+            int rows() const;
+        };
+        std::deque<Segment> m_segments;
+
+        qint64 eventCount() const;
+        std::deque<Segment>::const_iterator segmentAtRow(qint64 row) const;
+};
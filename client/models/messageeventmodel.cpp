@@ -23,6 +23,7 @@
 #include <QtQml> // for qmlRegisterType()
 
 #include "../quaternionroom.h"
+#include "../tracing.h"
 #include <connection.h>
 #include <user.h>
 #include <settings.h>
@@ -46,6 +47,14 @@ enum EventRoles {
     SpecialMarksRole,
     LongOperationRole,
     AnnotationRole,
+    SearchMatchRole,
+    ReactionsRole,
+    EditedRole,
+    ReplyToRole,
+    ReadersRole,
+    MembershipRunRole,
+    AuthorNameRole,
+    AuthorAvatarRole,
     // For debugging
     EventResolvedTypeRole,
 };
@@ -67,6 +76,14 @@ QHash<int, QByteArray> MessageEventModel::roleNames() const
     roles[SpecialMarksRole] = "marks";
     roles[LongOperationRole] = "progressInfo";
     roles[AnnotationRole] = "annotation";
+    roles[SearchMatchRole] = "searchMatch";
+    roles[ReactionsRole] = "reactions";
+    roles[EditedRole] = "edited";
+    roles[ReplyToRole] = "replyTo";
+    roles[ReadersRole] = "readers";
+    roles[MembershipRunRole] = "membershipRun";
+    roles[AuthorNameRole] = "authorDisplayName";
+    roles[AuthorAvatarRole] = "authorAvatarMediaId";
     roles[EventResolvedTypeRole] = "eventResolvedType";
     return roles;
 }
@@ -86,7 +103,10 @@ void MessageEventModel::changeRoom(QuaternionRoom* room)
     if (room == m_currentRoom)
         return;
 
+    TRACE_SPAN("MessageEventModel::changeRoom", "model");
     beginResetModel();
+    searchMatches.clear();
+    hasCurrentSearchMatch = false;
     if( m_currentRoom )
     {
         m_currentRoom->disconnect( this );
@@ -98,102 +118,464 @@ void MessageEventModel::changeRoom(QuaternionRoom* room)
     {
         lastReadEventId = room->readMarkerEventId();
 
-        using namespace QMatrixClient;
-        connect(m_currentRoom, &Room::aboutToAddNewMessages, this,
-                [=](RoomEventsRange events)
-                {
-                    beginInsertRows({}, timelineBaseIndex(),
-                                    timelineBaseIndex() + int(events.size()) - 1);
-                });
-        connect(m_currentRoom, &Room::aboutToAddHistoricalMessages, this,
-                [=](RoomEventsRange events)
-                {
-                    if (rowCount() > 0)
-                        rowBelowInserted = rowCount() - 1; // See #312
-                    beginInsertRows({}, rowCount(),
-                                    rowCount() + int(events.size()) - 1);
-                });
-        connect(m_currentRoom, &Room::addedMessages, this,
-                [=] (int lowest, int biggest) {
-                    endInsertRows();
-                    if (biggest < m_currentRoom->maxTimelineIndex())
-                    {
-                        auto rowBelowInserted =
-                                m_currentRoom->maxTimelineIndex() - biggest + timelineBaseIndex() - 1;
-                        refreshEventRoles(rowBelowInserted,
-                                         {AboveAuthorRole, AboveSectionRole});
-                    }
-                    for (auto i = m_currentRoom->maxTimelineIndex() - biggest;
-                              i <= m_currentRoom->maxTimelineIndex() - lowest;
-                              ++i)
-                        refreshLastUserEvents(i);
-                });
-        connect(m_currentRoom, &Room::pendingEventAboutToAdd, this,
-                [this] { beginInsertRows({}, 0, 0); });
-        connect(m_currentRoom, &Room::pendingEventAdded,
-                this, &MessageEventModel::endInsertRows);
-        connect(m_currentRoom, &Room::pendingEventAboutToMerge, this,
-                [this] (RoomEvent*, int i)
-                {
-                    if (i == 0)
-                        return; // No need to move anything, just refresh
-
-                    movingEvent = true;
-                    // Reverse i because row 0 is bottommost in the model
-                    const auto row = timelineBaseIndex() - i - 1;
-                    Q_ASSERT(beginMoveRows({}, row, row,
-                                           {}, timelineBaseIndex()));
-                });
-        connect(m_currentRoom, &Room::pendingEventMerged, this,
-                [this] {
-                    if (movingEvent)
-                    {
-                        endMoveRows();
-                        movingEvent = false;
-                    }
-                    refreshRow(timelineBaseIndex()); // Refresh the looks
-                    refreshLastUserEvents(0);
-                    if (m_currentRoom->timelineSize() > 1) // Refresh above
-                        refreshEventRoles(timelineBaseIndex() + 1,
-                                          {ReadMarkerRole});
-                    if (timelineBaseIndex() > 0) // Refresh below, see #312
-                        refreshEventRoles(timelineBaseIndex() - 1,
-                                          {AboveAuthorRole, AboveSectionRole});
-                });
-        connect(m_currentRoom, &Room::pendingEventChanged,
-                this, &MessageEventModel::refreshRow);
-        connect(m_currentRoom, &Room::pendingEventAboutToDiscard,
-                this, [this] (int i) { beginRemoveRows({}, i, i); });
-        connect(m_currentRoom, &Room::pendingEventDiscarded,
-                this, &MessageEventModel::endRemoveRows);
-        connect(m_currentRoom, &Room::readMarkerMoved,
-            this, [this] {
-            refreshEventRoles(
-                std::exchange(lastReadEventId,
-                              m_currentRoom->readMarkerEventId()),
-                {ReadMarkerRole});
-            refreshEventRoles(lastReadEventId, {ReadMarkerRole});
-        });
-        connect(m_currentRoom, &Room::replacedEvent, this,
-                [this] (const RoomEvent* newEvent) {
-                    refreshLastUserEvents(
-                        refreshEvent(newEvent->id()) - timelineBaseIndex());
-                });
-        connect(m_currentRoom, &Room::fileTransferProgress,
-                this, &MessageEventModel::refreshEvent);
-        connect(m_currentRoom, &Room::fileTransferCompleted,
-                this, &MessageEventModel::refreshEvent);
-        connect(m_currentRoom, &Room::fileTransferFailed,
-                this, &MessageEventModel::refreshEvent);
-        connect(m_currentRoom, &Room::fileTransferCancelled,
-                this, &MessageEventModel::refreshEvent);
+        if (suspended)
+            collectChanges();
+        else
+            connectToRoom();
         qDebug() << "Connected to room" << room->id()
                  << "as" << room->localUser()->id();
     } else
         lastReadEventId.clear();
+    collapsingRuns = Settings().value("UI/collapse_membership_runs", false)
+                        .toBool();
+    rebuildRuns();
+    // Changes collected for the previous room don't apply anymore
+    freezeRows();
     endResetModel();
 }
 
+void MessageEventModel::connectToRoom()
+{
+    using namespace QMatrixClient;
+    connect(m_currentRoom, &Room::aboutToAddNewMessages, this,
+            [=](RoomEventsRange events)
+            {
+                // Closed at the end of the addedMessages handler, unless
+                // tracking spans starts in between
+                insertionTraced = Tracer::isActive();
+                if (insertionTraced)
+                    TRACE_BEGIN_ARG("MessageEventModel::insertNewRows",
+                                    "model", "rows", events.size());
+                const auto base = timelineBaseIndex();
+                const auto change = collapsingRuns
+                        ? addToRuns(events, false)
+                        : MembershipRuns::Change { int(events.size()), false };
+                if (change.endRowChanged) // A run has grown at the bottom
+                    runRowToRefresh = base + change.rowsAdded;
+                insertedRows = change.rowsAdded;
+                if (insertedRows > 0)
+                    beginInsertRows({}, base, base + insertedRows - 1);
+            });
+    connect(m_currentRoom, &Room::aboutToAddHistoricalMessages, this,
+            [=](RoomEventsRange events)
+            {
+                insertionTraced = Tracer::isActive();
+                if (insertionTraced)
+                    TRACE_BEGIN_ARG("MessageEventModel::insertHistoricalRows",
+                                    "model", "rows", events.size());
+                const auto oldRowCount = rowCount();
+                if (oldRowCount > 0)
+                    rowBelowInserted = oldRowCount - 1; // See #312
+                const auto change = collapsingRuns
+                        ? addToRuns(events, true)
+                        : MembershipRuns::Change { int(events.size()), false };
+                if (change.endRowChanged) // A run has grown at the top
+                    runRowToRefresh = timelineBaseIndex() + oldRowCount - 1;
+                insertedRows = change.rowsAdded;
+                if (insertedRows > 0)
+                    beginInsertRows({}, oldRowCount,
+                                    oldRowCount + insertedRows - 1);
+            });
+    connect(m_currentRoom, &Room::addedMessages, this,
+            [=] (int lowest, int biggest) {
+                if (std::exchange(insertedRows, 0) > 0)
+                    endInsertRows();
+                if (runRowToRefresh != -1)
+                    refreshRow(std::exchange(runRowToRefresh, -1));
+                if (biggest < m_currentRoom->maxTimelineIndex())
+                {
+                    auto rowBelowInserted = timelineBaseIndex() + timelineRow(
+                        int(m_currentRoom->maxTimelineIndex() - biggest) - 1);
+                    refreshEventRoles(rowBelowInserted,
+                                     {AboveAuthorRole, AboveSectionRole});
+                }
+                for (auto i = m_currentRoom->maxTimelineIndex() - biggest;
+                          i <= m_currentRoom->maxTimelineIndex() - lowest;
+                          ++i)
+                    refreshLastUserEvents(i);
+                TRACE_COUNTER("MessageEventModel.rows", rowCount());
+                if (std::exchange(insertionTraced, false))
+                    TRACE_END();
+            });
+    connect(m_currentRoom, &Room::pendingEventAboutToAdd, this,
+            [this] { beginInsertRows({}, 0, 0); });
+    connect(m_currentRoom, &Room::pendingEventAdded,
+            this, &MessageEventModel::endInsertRows);
+    connect(m_currentRoom, &Room::pendingEventAboutToMerge, this,
+            [this] (RoomEvent* event, int i)
+            {
+                // Reverse i because row 0 is bottommost in the model
+                const auto row = timelineBaseIndex() - i - 1;
+                if (collapsingRuns && runs.addNewest(*event).rowsAdded == 0)
+                {
+                    // The event joins the run at the bottom, its row goes
+                    removingEvent = true;
+                    beginRemoveRows({}, row, row);
+                    return;
+                }
+                if (i == 0)
+                    return; // No need to move anything, just refresh
+
+                movingEvent = true;
+                Q_ASSERT(beginMoveRows({}, row, row,
+                                       {}, timelineBaseIndex()));
+            });
+    connect(m_currentRoom, &Room::pendingEventMerged, this,
+            [this] {
+                if (movingEvent)
+                {
+                    endMoveRows();
+                    movingEvent = false;
+                }
+                if (removingEvent)
+                {
+                    endRemoveRows();
+                    removingEvent = false;
+                }
+                refreshRow(timelineBaseIndex()); // Refresh the looks
+                refreshLastUserEvents(0);
+                if (m_currentRoom->timelineSize() > 1) // Refresh above
+                    refreshEventRoles(timelineBaseIndex() + 1,
+                                      {ReadMarkerRole});
+                if (timelineBaseIndex() > 0) // Refresh below, see #312
+                    refreshEventRoles(timelineBaseIndex() - 1,
+                                      {AboveAuthorRole, AboveSectionRole});
+            });
+    connect(m_currentRoom, &Room::pendingEventChanged,
+            this, &MessageEventModel::refreshRow);
+    connect(m_currentRoom, &Room::pendingEventAboutToDiscard,
+            this, [this] (int i) { beginRemoveRows({}, i, i); });
+    connect(m_currentRoom, &Room::pendingEventDiscarded,
+            this, &MessageEventModel::endRemoveRows);
+    connect(m_currentRoom, &Room::readMarkerMoved,
+        this, [this] {
+        refreshEventRoles(
+            std::exchange(lastReadEventId,
+                          m_currentRoom->readMarkerEventId()),
+            {ReadMarkerRole});
+        refreshEventRoles(lastReadEventId, {ReadMarkerRole});
+    });
+    connect(m_currentRoom, &Room::replacedEvent, this,
+            [this] (const RoomEvent* newEvent) {
+                refreshLastUserEvents(
+                    plainRow(refreshEvent(newEvent->id()))
+                        - timelineBaseIndex());
+            });
+    connect(m_currentRoom, &Room::fileTransferProgress,
+            this, &MessageEventModel::refreshEvent);
+    connect(m_currentRoom, &Room::fileTransferCompleted,
+            this, &MessageEventModel::refreshEvent);
+    connect(m_currentRoom, &Room::fileTransferFailed,
+            this, &MessageEventModel::refreshEvent);
+    connect(m_currentRoom, &Room::fileTransferCancelled,
+            this, &MessageEventModel::refreshEvent);
+    connect(m_currentRoom, &QuaternionRoom::highlightsChanged, this,
+        [this] {
+            if (rowCount() > 0)
+                emit dataChanged(index(0), index(rowCount() - 1),
+                                 {HighlightRole});
+        });
+    connect(m_currentRoom, &QuaternionRoom::relationsChanged, this,
+        [this] (const QString& eventId) {
+            // The target event may well be not loaded yet
+            const auto row = findRow(eventId);
+            if (row != -1)
+                refreshEventRoles(row, { Qt::DisplayRole, ReactionsRole,
+                                         EditedRole, ReplyToRole });
+        });
+    connect(m_currentRoom, &QuaternionRoom::readReceiptMoved, this,
+        [this] (const QString& fromEventId, const QString& toEventId) {
+            // Receipts often point to events outside the loaded timeline
+            for (const auto& eventId: { fromEventId, toEventId })
+            {
+                const auto row = findRow(eventId);
+                if (row != -1)
+                    refreshEventRoles(row, {ReadersRole});
+            }
+        });
+}
+
+void MessageEventModel::collectChanges()
+{
+    using namespace QMatrixClient;
+    connect(m_currentRoom, &Room::aboutToAddNewMessages, this,
+            [this] (RoomEventsRange events) {
+                if (!collapsingRuns)
+                {
+                    suspendedChanges.newRows += int(events.size());
+                    return;
+                }
+                const auto& timeline = m_currentRoom->messageEvents();
+                const auto bottomId =
+                    timeline.empty() ? QString() : timeline.back()->id();
+                const auto change = addToRuns(events, false);
+                suspendedChanges.newRows += change.rowsAdded;
+                if (change.endRowChanged)
+                    noteChangedEvent(bottomId);
+            });
+    connect(m_currentRoom, &Room::aboutToAddHistoricalMessages, this,
+            [this] (RoomEventsRange events) {
+                if (!collapsingRuns)
+                {
+                    suspendedChanges.historicalRows += int(events.size());
+                    return;
+                }
+                const auto& timeline = m_currentRoom->messageEvents();
+                const auto topId =
+                    timeline.empty() ? QString() : timeline.front()->id();
+                const auto change = addToRuns(events, true);
+                suspendedChanges.historicalRows += change.rowsAdded;
+                if (change.endRowChanged)
+                    noteChangedEvent(topId);
+            });
+    // Pending events shift and move rows; not worth replaying
+    const auto resetNeeded = [this] { suspendedChanges.needsReset = true; };
+    connect(m_currentRoom, &Room::pendingEventAboutToAdd, this, resetNeeded);
+    connect(m_currentRoom, &Room::pendingEventAboutToMerge, this,
+            [this] (RoomEvent* event) {
+                suspendedChanges.needsReset = true;
+                // Still keep the frozen rows pointing to the same events
+                suspendedChanges.newRows +=
+                    collapsingRuns ? runs.addNewest(*event).rowsAdded : 1;
+            });
+    connect(m_currentRoom, &Room::pendingEventAboutToDiscard,
+            this, resetNeeded);
+    connect(m_currentRoom, &Room::pendingEventChanged, this,
+            [this] { suspendedChanges.refreshAll = true; });
+    connect(m_currentRoom, &QuaternionRoom::highlightsChanged, this,
+            [this] { suspendedChanges.refreshAll = true; });
+    connect(m_currentRoom, &Room::readMarkerMoved, this, [this] {
+        noteChangedEvent(std::exchange(lastReadEventId,
+                                       m_currentRoom->readMarkerEventId()));
+        noteChangedEvent(lastReadEventId);
+    });
+    connect(m_currentRoom, &Room::replacedEvent, this,
+            [this] (const RoomEvent* newEvent) {
+                noteChangedEvent(newEvent->id());
+            });
+    connect(m_currentRoom, &Room::fileTransferProgress,
+            this, &MessageEventModel::noteChangedEvent);
+    connect(m_currentRoom, &Room::fileTransferCompleted,
+            this, &MessageEventModel::noteChangedEvent);
+    connect(m_currentRoom, &Room::fileTransferFailed,
+            this, &MessageEventModel::noteChangedEvent);
+    connect(m_currentRoom, &Room::fileTransferCancelled,
+            this, &MessageEventModel::noteChangedEvent);
+    connect(m_currentRoom, &QuaternionRoom::relationsChanged,
+            this, &MessageEventModel::noteChangedEvent);
+    connect(m_currentRoom, &QuaternionRoom::readReceiptMoved, this,
+            [this] (const QString& fromEventId, const QString& toEventId) {
+                noteChangedEvent(fromEventId);
+                noteChangedEvent(toEventId);
+            });
+}
+
+void MessageEventModel::noteChangedEvent(const QString& eventId)
+{
+    // Past some point, refreshing everything is cheaper than looking
+    // for each event
+    static const int MaxChangedEvents = 100;
+    if (eventId.isEmpty() || suspendedChanges.refreshAll)
+        return;
+    suspendedChanges.changedEventIds.insert(eventId);
+    if (suspendedChanges.changedEventIds.size() > MaxChangedEvents)
+    {
+        suspendedChanges.changedEventIds.clear();
+        suspendedChanges.refreshAll = true;
+    }
+}
+
+void MessageEventModel::suspend()
+{
+    if (suspended)
+        return;
+    freezeRows();
+    suspended = true;
+    if (m_currentRoom)
+    {
+        m_currentRoom->disconnect(this);
+        collectChanges();
+    }
+}
+
+void MessageEventModel::resume()
+{
+    if (!suspended)
+        return;
+    suspended = false;
+    const auto changes = std::exchange(suspendedChanges, {});
+    if (!m_currentRoom)
+        return;
+
+    TRACE_SPAN("MessageEventModel::resume", "model");
+    m_currentRoom->disconnect(this);
+    // Replaying is only cheaper than a reset while the views have
+    // most of their delegates in place
+    static const int MaxReplayedRows = 200;
+    if (changes.needsReset
+            || changes.newRows + changes.historicalRows > MaxReplayedRows)
+    {
+        beginResetModel();
+        lastReadEventId = m_currentRoom->readMarkerEventId();
+        connectToRoom();
+        endResetModel();
+        return;
+    }
+    connectToRoom();
+
+    // The rows are in the room already; only tell the views
+    const auto total = rowCount();
+    const auto oldRowCount = changes.frozenRowCount;
+    if (changes.newRows > 0)
+    {
+        const auto base = timelineBaseIndex();
+        beginInsertRows({}, base, base + changes.newRows - 1);
+        endInsertRows();
+        // The marks of the last events by the same users (see
+        // refreshLastUserEvents()) are within that range
+        emit dataChanged(index(base),
+                         index(std::min(base + changes.newRows + 100,
+                                        total) - 1));
+    }
+    if (changes.historicalRows > 0)
+    {
+        const auto firstRow = oldRowCount + changes.newRows;
+        beginInsertRows({}, firstRow, total - 1);
+        endInsertRows();
+        // Also refresh the row that used to be the topmost one
+        emit dataChanged(index(std::max(firstRow - 100, 0)),
+                         index(total - 1));
+    }
+    if (changes.refreshAll)
+    {
+        if (total > 0)
+            emit dataChanged(index(0), index(total - 1));
+    } else
+        for (const auto& eventId: changes.changedEventIds)
+        {
+            const auto row = findRow(eventId);
+            if (row != -1)
+                refreshEventRoles(row);
+        }
+}
+
+bool MessageEventModel::isSuspended() const
+{
+    return suspended;
+}
+
+void MessageEventModel::freezeRows()
+{
+    suspendedChanges = {};
+    if (!m_currentRoom)
+        return;
+    suspendedChanges.frozenBaseIndex =
+        int(m_currentRoom->pendingEvents().size());
+    suspendedChanges.frozenRowCount =
+        collapsingRuns ? runs.rowCount() : m_currentRoom->timelineSize();
+}
+
+int MessageEventModel::timelineRowAt(int row) const
+{
+    // New rows went to the bottom while suspended, shifting the rest
+    return row - timelineBaseIndex()
+            + (suspended ? suspendedChanges.newRows : 0);
+}
+
+int MessageEventModel::rowAtTimelineRow(int timelineRow) const
+{
+    if (timelineRow == -1)
+        return -1;
+    if (!suspended)
+        return timelineBaseIndex() + timelineRow;
+    // The views only know the rows that were there at suspend()
+    const auto row = timelineRow - suspendedChanges.newRows;
+    return row < 0 || row >= suspendedChanges.frozenRowCount
+            ? -1 : timelineBaseIndex() + row;
+}
+
+void MessageEventModel::rebuildRuns()
+{
+    runs.clear();
+    if (!collapsingRuns || !m_currentRoom)
+        return;
+
+    TRACE_SPAN_ARG("MessageEventModel::rebuildRuns", "model",
+                   "events", m_currentRoom->timelineSize());
+    for (const auto& ti: m_currentRoom->messageEvents())
+        runs.addNewest(*ti);
+}
+
+MembershipRuns::Change MessageEventModel::addToRuns(
+        QMatrixClient::RoomEventsRange events, bool historical)
+{
+    // New events come oldest first, historical ones newest first
+    MembershipRuns::Change total { 0, false };
+    for (const auto& e: events)
+    {
+        const auto change =
+            historical ? runs.addOldest(*e) : runs.addNewest(*e);
+        // Only the row that was there before the range matters
+        if (total.rowsAdded == 0 && change.endRowChanged)
+            total.endRowChanged = true;
+        total.rowsAdded += change.rowsAdded;
+    }
+    return total;
+}
+
+int MessageEventModel::timelineRow(int offset) const
+{
+    return collapsingRuns ? runs.rowOf(offset) : offset;
+}
+
+void MessageEventModel::toggleRun(int row)
+{
+    const auto runRow = row - timelineBaseIndex();
+    if (!collapsingRuns || suspended || runRow < 0 || runRow >= rowCount())
+        return;
+    const auto item = runs.itemAt(runRow);
+    if (!item.summary)
+        return;
+
+    // Rows count from the bottom and the summary is at the top of the run,
+    // so the summary row moves up or down by the length of the run
+    TRACE_SPAN_ARG("MessageEventModel::toggleRun", "model",
+                   "rows", item.runLength);
+    if (item.expanded)
+    {
+        beginRemoveRows({}, row - item.runLength, row - 1);
+        runs.toggle(runRow);
+        endRemoveRows();
+        refreshEventRoles(row - item.runLength,
+                          {MembershipRunRole, ReadMarkerRole});
+    } else {
+        beginInsertRows({}, row, row + item.runLength - 1);
+        runs.toggle(runRow);
+        endInsertRows();
+        refreshEventRoles(row + item.runLength,
+                          {MembershipRunRole, ReadMarkerRole});
+    }
+}
+
+int MessageEventModel::plainRow(int row) const
+{
+    const auto base = timelineBaseIndex();
+    if (row < base || row >= base + rowCount())
+        return row;
+    const auto rowInTimeline = timelineRowAt(row);
+    return base + (collapsingRuns ? runs.itemAt(rowInTimeline).offset
+                                  : rowInTimeline);
+}
+
+int MessageEventModel::rowOfPlainRow(int plainRow) const
+{
+    const auto base = timelineBaseIndex();
+    if (plainRow < base)
+        return plainRow;
+    const auto row = rowAtTimelineRow(timelineRow(plainRow - base));
+    return row == -1 ? plainRow : row;
+}
+
 int MessageEventModel::refreshEvent(const QString& eventId)
 {
     return refreshEventRoles(eventId);
@@ -206,6 +588,8 @@ void MessageEventModel::refreshRow(int row)
 
 int MessageEventModel::timelineBaseIndex() const
 {
+    if (suspended)
+        return suspendedChanges.frozenBaseIndex;
     return m_currentRoom ? int(m_currentRoom->pendingEvents().size()) : 0;
 }
 
@@ -215,17 +599,92 @@ void MessageEventModel::refreshEventRoles(int row, const QVector<int>& roles)
     emit dataChanged(idx, idx, roles);
 }
 
-int MessageEventModel::refreshEventRoles(const QString& eventId,
-                                         const QVector<int>& roles)
+int MessageEventModel::rowForIndex(index_t index) const
+{
+    if (!m_currentRoom || m_currentRoom->messageEvents().empty() ||
+            index < m_currentRoom->minTimelineIndex() ||
+            index > m_currentRoom->maxTimelineIndex())
+        return -1;
+    return rowAtTimelineRow(
+                timelineRow(int(m_currentRoom->maxTimelineIndex() - index)));
+}
+
+void MessageEventModel::addSearchMatches(const QVector<index_t>& indices)
+{
+    for (const auto index: indices)
+    {
+        searchMatches.insert(index);
+        const auto row = rowForIndex(index);
+        if (row != -1)
+            refreshEventRoles(row, {SearchMatchRole});
+    }
+}
+
+void MessageEventModel::setCurrentSearchMatch(index_t index)
+{
+    const auto oldRow = hasCurrentSearchMatch
+                        ? rowForIndex(currentSearchMatch) : -1;
+    currentSearchMatch = index;
+    hasCurrentSearchMatch = true;
+    if (oldRow != -1)
+        refreshEventRoles(oldRow, {SearchMatchRole});
+    const auto row = rowForIndex(index);
+    if (row != -1)
+        refreshEventRoles(row, {SearchMatchRole});
+}
+
+void MessageEventModel::clearSearchMatches()
+{
+    if (searchMatches.isEmpty())
+        return;
+    searchMatches.clear();
+    hasCurrentSearchMatch = false;
+    if (rowCount() > 0)
+        emit dataChanged(index(0), index(rowCount() - 1), {SearchMatchRole});
+}
+
+void MessageEventModel::setCountingDataCalls(bool enabled)
+{
+    countingDataCalls = enabled;
+    dataCallCounts.clear();
+}
+
+QHash<int, int> MessageEventModel::takeDataCallCounts()
 {
+    QHash<int, int> result;
+    result.swap(dataCallCounts);
+    return result;
+}
+
+qint64 MessageEventModel::memoryFootprint() const
+{
+    // QSet and QHash nodes are roughly the size of three pointers
+    static const qint64 NodeBytes = 3 * sizeof(void*);
+    return (searchMatches.size() + dataCallCounts.size()) * NodeBytes
+           + lastReadEventId.size() * qint64(sizeof(QChar))
+           + runs.memoryFootprint();
+}
+
+int MessageEventModel::findRow(const QString& eventId) const
+{
+    if (!m_currentRoom)
+        return -1;
     const auto it = m_currentRoom->findInTimeline(eventId);
     if (it == m_currentRoom->timelineEdge())
+        return -1;
+    return rowAtTimelineRow(
+                timelineRow(int(it - m_currentRoom->messageEvents().rbegin())));
+}
+
+int MessageEventModel::refreshEventRoles(const QString& eventId,
+                                         const QVector<int>& roles)
+{
+    const auto row = findRow(eventId);
+    if (row == -1)
     {
         qWarning() << "Trying to refresh inexistent event:" << eventId;
         return -1;
     }
-    const auto row =
-            it - m_currentRoom->messageEvents().rbegin() + timelineBaseIndex();
     refreshEventRoles(row, roles);
     return row;
 }
@@ -374,7 +833,7 @@ void MessageEventModel::refreshLastUserEvents(int baseTimelineRow)
     {
         if ((*it)->senderId() == lastSender)
         {
-            auto idx = index(it - timelineBottom);
+            auto idx = index(timelineRow(int(it - timelineBottom)));
             emit dataChanged(idx, idx);
         }
     }
@@ -384,26 +843,91 @@ int MessageEventModel::rowCount(const QModelIndex& parent) const
 {
     if( !m_currentRoom || parent.isValid() )
         return 0;
-    return m_currentRoom->timelineSize();
+    if (suspended)
+        return suspendedChanges.frozenRowCount;
+    return collapsingRuns ? runs.rowCount() : m_currentRoom->timelineSize();
+}
+
+QString MessageEventModel::memberName(const QString& userId,
+        const MemberHistoryIndex::Profile* profile) const
+{
+    // Only the current names get disambiguated
+    if (!profile || profile->displayName ==
+                        m_currentRoom->user(userId)->displayname(m_currentRoom))
+        return m_currentRoom->roomMembername(userId);
+    return profile->displayName.isEmpty() ? userId : profile->displayName;
+}
+
+QString MessageEventModel::renderRunSummary(
+        const MembershipRuns::Summary& s) const
+{
+    QStringList parts;
+    if (s.joined > 0)
+        parts.push_back(tr("%n joined", "", s.joined));
+    if (s.left > 0)
+        parts.push_back(tr("%n left", "", s.left));
+    if (s.invited > 0)
+        parts.push_back(tr("%n invited", "", s.invited));
+    if (s.banned > 0)
+        parts.push_back(tr("%n banned", "", s.banned));
+    if (s.renamed > 0)
+        parts.push_back(tr("%n changed names", "", s.renamed));
+    if (s.avatarChanged > 0)
+        parts.push_back(tr("%n changed avatars", "", s.avatarChanged));
+    if (s.other > 0)
+        parts.push_back(tr("%n other changes", "", s.other));
+    return parts.join(", ");
 }
 
 QVariant MessageEventModel::data(const QModelIndex& idx, int role) const
 {
+    TRACE_SPAN_ARG("MessageEventModel::data", "model", "role", role);
+    if (countingDataCalls)
+        ++dataCallCounts[role];
     const auto row = idx.row();
 
-    if( !m_currentRoom || row < 0 ||
-            row >= int(m_currentRoom->pendingEvents().size()) +
-                       m_currentRoom->timelineSize())
+    if( !m_currentRoom || row < 0 || row >= timelineBaseIndex() + rowCount())
         return {};
 
     bool isPending = row < timelineBaseIndex();
-    const auto timelineIt = m_currentRoom->messageEvents().crbegin() +
-                                std::max(0, row - timelineBaseIndex());
+    const auto pendingCount = int(m_currentRoom->pendingEvents().size());
+    if (isPending && row >= pendingCount)
+        return {}; // Gone while suspended; a reset follows on resume()
+    // With collapsed runs, a row may stand for a whole run of events;
+    // such a row takes most of its data from the newest event in the run
+    const auto rowInTimeline = std::max(0, timelineRowAt(row));
+    const auto run = collapsingRuns && !isPending
+        ? runs.itemAt(rowInTimeline)
+        : MembershipRuns::Item { rowInTimeline, 0, false, nullptr };
+    const auto timelineIt =
+            m_currentRoom->messageEvents().crbegin() + run.offset;
     const auto pendingIt = m_currentRoom->pendingEvents().crbegin() +
-                                std::min(row, timelineBaseIndex());
+                                std::min(row, pendingCount);
     const auto& evt = isPending ? **pendingIt : **timelineIt;
 
     using namespace QMatrixClient;
+    if (run.summary)
+    {
+        if (role == Qt::DisplayRole)
+            return renderRunSummary(*run.summary);
+        if (role == EventTypeRole)
+            return QStringLiteral("membershipRun");
+        if (role == MembershipRunRole)
+            return QVariantMap {
+                { QStringLiteral("length"), run.runLength },
+                { QStringLiteral("expanded"), run.expanded }
+            };
+        if (role == SpecialMarksRole)
+            return run.summary->joinsAndLeavesOnly() &&
+                    !Settings().value("UI/show_joinleave", true).toBool()
+                    ? EventStatus::Hidden : EventStatus::Normal;
+        if (role == ReadMarkerRole && !run.expanded)
+            return std::any_of(timelineIt, timelineIt + run.runLength,
+                [this] (const TimelineItem& ti) {
+                    return ti->id() == lastReadEventId;
+                });
+    }
+
     if( role == Qt::DisplayRole )
     {
         if (evt.isRedacted())
@@ -420,6 +944,10 @@ QVariant MessageEventModel::data(const QModelIndex& idx, int role) const
             , [this] (const RoomMessageEvent& e) {
                 using namespace MessageEventContent;
 
+                if (const auto* edit = m_currentRoom->relations()
+                                        .latestEdit(e.id(), e.senderId()))
+                    return m_currentRoom->prettyPrint(edit->newBody);
+
                 if (e.hasTextContent() && e.mimeType().name() != "text/plain")
                     return static_cast<const TextContent*>(e.content())->body;
                 if (e.hasFileContent())
@@ -431,9 +959,11 @@ QVariant MessageEventModel::data(const QModelIndex& idx, int role) const
                 }
                 return m_currentRoom->prettyPrint(e.plainBody());
             }
-            , [this] (const RoomMemberEvent& e) {
-                // FIXME: Rewind to the name that was at the time of this event
-                QString subjectName = m_currentRoom->roomMembername(e.userId());
+            , [this, &timelineIt, isPending] (const RoomMemberEvent& e) {
+                // The name the member had before this event
+                QString subjectName = memberName(e.userId(), isPending ? nullptr :
+                    m_currentRoom->memberHistory().profileAt(e.userId(),
+                                                             timelineIt->index()));
                 // The below code assumes senderName output in AuthorRole
                 switch( e.membership() )
                 {
@@ -554,12 +1084,28 @@ QVariant MessageEventModel::data(const QModelIndex& idx, int role) const
 
     if( role == AuthorRole )
     {
-        // FIXME: It shouldn't be User, it should be its state "as of event"
+        // The user as of now; see AuthorNameRole and AuthorAvatarRole
+        // for the name and avatar as of the event
         return QVariant::fromValue(isPending
                                    ? m_currentRoom->localUser()
                                    : m_currentRoom->user(evt.senderId()));
     }
 
+    if (role == AuthorNameRole || role == AuthorAvatarRole)
+    {
+        const auto& senderId = isPending ? m_currentRoom->localUser()->id()
+                                         : evt.senderId();
+        const auto* profile = isPending ? nullptr :
+            m_currentRoom->memberHistory().profileAt(senderId,
+                                                     timelineIt->index());
+        if (role == AuthorNameRole)
+            return memberName(senderId, profile);
+        if (!profile)
+            return {}; // QML takes the current avatar then
+        const auto& url = profile->avatarUrl;
+        return url.isEmpty() ? QString() : url.authority() + url.path();
+    }
+
     if (role == ContentTypeRole)
     {
         if (auto e = eventCast<const RoomMessageEvent>(&evt))
@@ -593,11 +1139,77 @@ QVariant MessageEventModel::data(const QModelIndex& idx, int role) const
     }
 
     if( role == HighlightRole )
-        return m_currentRoom->isEventHighlighted(&evt);
+        return !isPending &&
+                m_currentRoom->isEventHighlighted(timelineIt->index());
+
+    if (role == SearchMatchRole)
+    {
+        // 0 - no match, 1 - a match, 2 - the current match
+        if (isPending || !searchMatches.contains(timelineIt->index()))
+            return 0;
+        return hasCurrentSearchMatch &&
+                timelineIt->index() == currentSearchMatch ? 2 : 1;
+    }
+
+    if (role == ReactionsRole)
+    {
+        QVariantList reactions;
+        if (isPending)
+            return reactions;
+        const auto& localUserId = m_currentRoom->localUser()->id();
+        for (const auto& r: m_currentRoom->relations().reactions(evt.id()))
+            reactions.push_back(QVariantMap {
+                { QStringLiteral("key"), r.key.toHtmlEscaped() },
+                { QStringLiteral("count"), r.senders.size() },
+                { QStringLiteral("mine"), r.senders.contains(localUserId) }
+            });
+        return reactions;
+    }
+
+    if (role == EditedRole)
+        return !isPending && !evt.isRedacted() &&
+                m_currentRoom->relations()
+                    .latestEdit(evt.id(), evt.senderId()) != nullptr;
+
+    if (role == ReplyToRole)
+    {
+        if (isPending)
+            return {};
+        const auto targetId = m_currentRoom->relations().replyTarget(evt.id());
+        if (targetId.isEmpty())
+            return {};
+        QVariantMap replyTo { { QStringLiteral("eventId"), targetId } };
+        // The replied-to event may not be loaded yet; QML shows
+        // a generic header in that case
+        const auto targetIt = m_currentRoom->findInTimeline(targetId);
+        if (targetIt != m_currentRoom->timelineEdge())
+        {
+            const auto& target = **targetIt;
+            replyTo.insert(QStringLiteral("author"),
+                m_currentRoom->roomMembername(target.senderId())
+                    .toHtmlEscaped());
+            if (auto e = eventCast<const RoomMessageEvent>(&target))
+                replyTo.insert(QStringLiteral("text"),
+                               e->plainBody().toHtmlEscaped());
+        }
+        return replyTo;
+    }
 
     if( role == ReadMarkerRole )
         return evt.id() == lastReadEventId;
 
+    if (role == ReadersRole)
+    {
+        // The local user's own position is shown by the read marker
+        QVariantList readers;
+        if (isPending)
+            return readers;
+        for (auto* u: m_currentRoom->readReceipts().readers(evt.id()))
+            if (u != m_currentRoom->localUser())
+                readers.push_back(QVariant::fromValue(u));
+        return readers;
+    }
+
     if( role == SpecialMarksRole )
     {
         if (isPending)
@@ -19,9 +19,11 @@
 
 #pragma once
 
+#include "membershipruns.h"
 #include "../quaternionroom.h"
 
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QSet>
 
 class MessageEventModel: public QAbstractListModel
 {
@@ -35,6 +37,45 @@ class MessageEventModel: public QAbstractListModel
         QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
         QHash<int, QByteArray> roleNames() const override;
 
+        /// The row of the event in the timeline, or -1 if it's not loaded
+        int findRow(const QString& eventId) const;
+
+        using index_t = QMatrixClient::TimelineItem::index_t;
+        /// Mark events as matching the in-room search
+        void addSearchMatches(const QVector<index_t>& indices);
+        /// Mark the search match the user is currently at
+        void setCurrentSearchMatch(index_t index);
+        void clearSearchMatches();
+
+        /// Count data() calls by role, for the performance overlay
+        void setCountingDataCalls(bool enabled);
+        /// Get the data() call counts by role and start counting anew
+        QHash<int, int> takeDataCallCounts();
+        /// Estimated memory taken by the model's own data, in bytes
+        qint64 memoryFootprint() const;
+
+        /// Stop updating the views, only noting what changes in the room
+        /**
+         * Used while the window is hidden, so that the views don't get
+         * a signal for every change. resume() brings the views up to date
+         * with a few signals (or a reset, if the changes are too big or
+         * involve pending events) and goes back to normal updates.
+         */
+        void suspend();
+        void resume();
+        bool isSuspended() const;
+
+        /// Expand or collapse the run of membership events at the row
+        Q_INVOKABLE void toggleRun(int row);
+        /// The row the event at the row would have without collapsed runs
+        /**
+         * The room saves the viewport in these terms, so that it doesn't
+         * depend on which runs are expanded. Both functions return
+         * the row unchanged when runs are not collapsed.
+         */
+        Q_INVOKABLE int plainRow(int row) const;
+        Q_INVOKABLE int rowOfPlainRow(int plainRow) const;
+
     private slots:
         int refreshEvent(const QString& eventId);
         void refreshRow(int row);
@@ -44,12 +85,67 @@ class MessageEventModel: public QAbstractListModel
         QString lastReadEventId;
         int rowBelowInserted = -1;
         bool movingEvent = 0;
+        bool removingEvent = false;
+        int insertedRows = 0;
+        int runRowToRefresh = -1;
+        /// Whether the span of the current insertion has been opened
+        bool insertionTraced = false;
+        QSet<index_t> searchMatches;
+        index_t currentSearchMatch = 0;
+        bool hasCurrentSearchMatch = false;
+        bool countingDataCalls = false;
+        mutable QHash<int, int> dataCallCounts;
+
+        struct SuspendedChanges
+        {
+            int newRows = 0;
+            int historicalRows = 0;
+            QSet<QString> changedEventIds;
+            bool refreshAll = false;
+            bool needsReset = false;
+            /// What the views were told last, see freezeRows()
+            int frozenBaseIndex = 0;
+            int frozenRowCount = 0;
+        };
+        bool suspended = false;
+        SuspendedChanges suspendedChanges;
+
+        /// Whether runs of membership events take a summary row each
+        bool collapsingRuns = false;
+        MembershipRuns runs;
+
+        void connectToRoom();
+        void collectChanges();
+        void noteChangedEvent(const QString& eventId);
+        /// Start collecting changes anew, remembering the current rows
+        /**
+         * While suspended, rowCount() and the row mapping stay as they were
+         * at this point, so that the views see a consistent model until
+         * resume() tells them about the new rows.
+         */
+        void freezeRows();
+        /// The row in the timeline (or the runs) for the model row
+        int timelineRowAt(int row) const;
+        /// The model row for the row in the timeline, -1 if not in the model
+        int rowAtTimelineRow(int timelineRow) const;
+
+        void rebuildRuns();
+        /// Add the events to the runs; the change is over the whole range
+        MembershipRuns::Change addToRuns(QMatrixClient::RoomEventsRange events,
+                                         bool historical);
+        /// The row of the event at the offset, not counting pending events
+        int timelineRow(int offset) const;
+        QString renderRunSummary(const MembershipRuns::Summary& s) const;
+        /// The member's name from the history profile, or the current one
+        QString memberName(const QString& userId,
+                           const MemberHistoryIndex::Profile* profile) const;
 
         int timelineBaseIndex() const;
         QDateTime makeMessageTimestamp(const QuaternionRoom::rev_iter_t& baseIt) const;
         QString renderDate(QDateTime timestamp) const;
         bool isUserActivityNotable(const QuaternionRoom::rev_iter_t& baseIt) const;
 
+        int rowForIndex(index_t index) const;
         void refreshLastUserEvents(int baseRow);
         void refreshEventRoles(int row, const QVector<int>& roles = {});
         int refreshEventRoles(const QString& eventId,
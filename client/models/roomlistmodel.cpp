@@ -20,6 +20,7 @@
 #include "roomlistmodel.h"
 
 #include "../quaternionroom.h"
+#include "../tracing.h"
 
 #include <user.h>
 #include <connection.h>
@@ -49,6 +50,7 @@ void RoomListModel::addConnection(QMatrixClient::Connection* connection)
 
     using QMatrixClient::Connection;
     using QMatrixClient::Room;
+    TRACE_SPAN("RoomListModel::addConnection", "model");
     beginResetModel();
     m_connections.emplace_back(connection, this);
     connect( connection, &Connection::loggedOut,
@@ -97,6 +99,16 @@ void RoomListModel::deleteConnection(QMatrixClient::Connection* connection)
     endResetModel();
 }
 
+qint64 RoomListModel::memoryFootprint() const
+{
+    static const qint64 GroupOverheadBytes = 64;
+    qint64 result = m_roomIdxCache.size() * qint64(sizeof(QPersistentModelIndex));
+    for (const auto& g: m_roomGroups)
+        result += GroupOverheadBytes
+                  + g.rooms.size() * qint64(sizeof(QuaternionRoom*));
+    return result;
+}
+
 void RoomListModel::deleteTag(QModelIndex index)
 {
     if (!isValidGroupIndex(index))
@@ -367,6 +379,7 @@ void RoomListModel::doRemoveRoom(QModelIndex idx)
 
 void RoomListModel::doRebuild()
 {
+    TRACE_SPAN("RoomListModel::doRebuild", "model");
     m_roomGroups.clear();
     for (const auto& c: m_connections)
         for (auto* r: c->roomMap())
@@ -49,6 +49,8 @@ class RoomListModel: public QAbstractItemModel
         void addConnection(QMatrixClient::Connection* connection);
         void deleteConnection(QMatrixClient::Connection* connection);
         void deleteTag(QModelIndex index);
+        /// Estimated memory taken by the model's own data, in bytes
+        qint64 memoryFootprint() const;
 
         QVariant roomGroupAt(QModelIndex idx) const;
         QuaternionRoom* roomAt(QModelIndex idx) const;
@@ -19,7 +19,8 @@
 
 #include "userlistmodel.h"
 
-#include <QElapsedTimer>
+#include "../tracing.h"
+
 #include <QtCore/QDebug>
 #include <QtGui/QPixmap>
 
@@ -41,6 +42,7 @@ void UserListModel::setRoom(QMatrixClient::Room* room)
         return;
 
     using namespace QMatrixClient;
+    TRACE_SPAN("UserListModel::setRoom", "model");
     beginResetModel();
     if( m_currentRoom )
     {
@@ -53,16 +55,21 @@ void UserListModel::setRoom(QMatrixClient::Room* room)
     m_currentRoom = room;
     if( m_currentRoom )
     {
+        const auto prepared = m_preparedRoom == m_currentRoom;
+        if (prepared)
+        {
+            m_users = m_preparedUsers;
+            dropPrepared();
+        }
         connect( m_currentRoom, &Room::userAdded, this, &UserListModel::userAdded );
         connect( m_currentRoom, &Room::userRemoved, this, &UserListModel::userRemoved );
         connect( m_currentRoom, &Room::memberAboutToRename, this, &UserListModel::userRemoved );
         connect( m_currentRoom, &Room::memberRenamed, this, &UserListModel::userAdded );
+        if (!prepared)
         {
-            QElapsedTimer et; et.start();
+            TRACE_SPAN("UserListModel::sortMembers", "model");
             m_users = m_currentRoom->users();
             std::sort(m_users.begin(), m_users.end(), room->memberSorter());
-            qDebug() << "Sorting" << m_users.size() << "user(s) in"
-                     << m_currentRoom->displayName() << "took" << et;
         }
         for( User* user: m_users )
         {
@@ -75,6 +82,38 @@ void UserListModel::setRoom(QMatrixClient::Room* room)
     endResetModel();
 }
 
+void UserListModel::prepare(QMatrixClient::Room* room)
+{
+    if (room == m_currentRoom || room == m_preparedRoom)
+        return;
+
+    using namespace QMatrixClient;
+    TRACE_SPAN("UserListModel::prepare", "model");
+    dropPrepared();
+    if (!room)
+        return;
+    m_preparedRoom = room;
+    m_preparedUsers = room->users();
+    std::sort(m_preparedUsers.begin(), m_preparedUsers.end(),
+              room->memberSorter());
+    // Any membership change can make the order stale
+    connect(room, &Room::userAdded, this, [this] { dropPrepared(); });
+    connect(room, &Room::userRemoved, this, [this] { dropPrepared(); });
+    connect(room, &Room::memberRenamed, this, [this] { dropPrepared(); });
+    // Scale the avatars of those likely to be on the screen
+    static const int PrewarmedAvatars = 50;
+    for (auto* user: m_preparedUsers.mid(0, PrewarmedAvatars))
+        user->avatar(25, 25, room);
+}
+
+void UserListModel::dropPrepared()
+{
+    if (m_preparedRoom)
+        m_preparedRoom->disconnect(this);
+    m_preparedRoom = nullptr;
+    m_preparedUsers.clear();
+}
+
 QMatrixClient::User* UserListModel::userAt(QModelIndex index)
 {
     if (index.row() < 0 || index.row() >= m_users.size())
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QPointer>
 
 namespace QMatrixClient
 {
@@ -38,6 +39,12 @@ class UserListModel: public QAbstractListModel
         virtual ~UserListModel();
 
         void setRoom(QMatrixClient::Room* room);
+        /// Sort the members of the room, to make switching to it faster
+        /**
+         * Only one room is kept prepared; the prepared list is dropped
+         * as soon as the room membership changes.
+         */
+        void prepare(QMatrixClient::Room* room);
         User* userAt(QModelIndex index);
 
         QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
@@ -52,7 +59,10 @@ class UserListModel: public QAbstractListModel
     private:
         QMatrixClient::Room* m_currentRoom;
         QList<User*> m_users;
+        QPointer<QMatrixClient::Room> m_preparedRoom;
+        QList<User*> m_preparedUsers;
 
+        void dropPrepared();
         int findUserPos(User* user) const;
         int findUserPos(const QString& username) const;
 };
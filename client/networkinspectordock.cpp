@@ -0,0 +1,456 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "networkinspectordock.h"
+
+#include <networkaccessmanager.h>
+
+#include <QtNetwork/QNetworkReply>
+#include <QtCore/QChildEvent>
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+#include <QtCore/QUrlQuery>
+#include <QtWidgets/QTreeWidget>
+#include <QtWidgets/QHeaderView>
+#include <QtWidgets/QTabWidget>
+#include <QtWidgets/QPushButton>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QBoxLayout>
+#include <QtWidgets/QFileDialog>
+#include <QtWidgets/QMessageBox>
+
+#include <algorithm>
+
+const int NetworkInspectorDock::RingSize = 5000;
+
+static const int RefreshIntervalMs = 1000;
+static const int MaxRequestsShown = 500;
+/// Failed requests are forgotten when there are more of them than this
+static const int MaxFailedRequests = 1000;
+
+enum EndpointColumns { EndpointColumn, CountColumn, ErrorsColumn,
+                       RetriesColumn, P50Column, P90Column, P99Column,
+                       WaitP50Column, AvgSizeColumn, MaxSizeColumn,
+                       EndpointColumnCount };
+enum RequestColumns { StartedColumn, MethodColumn, UrlColumn, StatusColumn,
+                      HandshakeColumn, WaitColumn, DownloadColumn,
+                      TotalColumn, SentColumn, ReceivedColumn,
+                      RequestColumnCount };
+
+static QString methodName(const QNetworkReply* reply)
+{
+    switch (reply->operation())
+    {
+        case QNetworkAccessManager::HeadOperation: return QStringLiteral("HEAD");
+        case QNetworkAccessManager::GetOperation: return QStringLiteral("GET");
+        case QNetworkAccessManager::PutOperation: return QStringLiteral("PUT");
+        case QNetworkAccessManager::PostOperation: return QStringLiteral("POST");
+        case QNetworkAccessManager::DeleteOperation:
+            return QStringLiteral("DELETE");
+        default:
+            return QString::fromLatin1(reply->request()
+                .attribute(QNetworkRequest::CustomVerbAttribute).toByteArray());
+    }
+}
+
+/// The path and the query of the URL, without the access token
+static QString safeUrl(const QUrl& url)
+{
+    QUrlQuery query(url);
+    query.removeAllQueryItems(QStringLiteral("access_token"));
+    return query.isEmpty() ? url.path()
+                           : url.path() + '?' + query.toString();
+}
+
+template <typename T>
+static T percentile(const std::vector<T>& sorted, double p)
+{
+    return sorted.empty() ? T() :
+        sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+QString NetworkInspectorDock::endpointName(const QString& path)
+{
+    // Media: /_matrix/media/<version>/<action>/<server>/<mediaId>
+    auto segments = path.split('/');
+    const auto mediaIt = std::find(segments.begin(), segments.end(),
+                                   QStringLiteral("media"));
+    if (mediaIt != segments.end() && segments.end() - mediaIt > 3)
+    {
+        segments.erase(mediaIt + 3, segments.end());
+        return segments.join('/') + QStringLiteral("/{server}/{mediaId}");
+    }
+    // Anything starting with a sigil is an id; a segment after the event
+    // type in send/ and state/ paths is a transaction id or a state key
+    static const QString Sigils = QStringLiteral("!@$#+");
+    for (int i = 0; i < segments.size(); ++i)
+    {
+        const auto segment = QUrl::fromPercentEncoding(segments[i].toUtf8());
+        if (!segment.isEmpty() && Sigils.contains(segment.front()))
+            segments[i] = QStringLiteral("{id}");
+        else if (i >= 2 && (segments[i - 2] == QStringLiteral("send")
+                            || segments[i - 2] == QStringLiteral("state")))
+            segments[i] = QStringLiteral("{key}");
+    }
+    return segments.join('/');
+}
+
+NetworkInspectorDock::NetworkInspectorDock(QWidget* parent)
+    : QDockWidget(tr("Network"), parent)
+    , m_summary(new QLabel)
+    , m_endpointsView(new QTreeWidget)
+    , m_requestsView(new QTreeWidget)
+{
+    setObjectName(QStringLiteral("NetworkInspectorDock"));
+
+    m_endpointsView->setColumnCount(EndpointColumnCount);
+    m_endpointsView->setHeaderLabels({ tr("Endpoint"), tr("Requests"),
+        tr("Errors"), tr("Retries"), tr("p50, ms"), tr("p90, ms"),
+        tr("p99, ms"), tr("Wait p50, ms"), tr("Avg size, KB"),
+        tr("Max size, KB") });
+    m_endpointsView->setRootIsDecorated(false);
+    m_endpointsView->setUniformRowHeights(true);
+    m_endpointsView->setSortingEnabled(true);
+    m_endpointsView->sortByColumn(P90Column, Qt::DescendingOrder);
+
+    m_requestsView->setColumnCount(RequestColumnCount);
+    m_requestsView->setHeaderLabels({ tr("Started, s"), tr("Method"),
+        tr("URL"), tr("Status"), tr("Handshake, ms"), tr("Wait, ms"),
+        tr("Download, ms"), tr("Total, ms"), tr("Sent, B"),
+        tr("Received, B") });
+    m_requestsView->setRootIsDecorated(false);
+    m_requestsView->setUniformRowHeights(true);
+
+    auto* tabs = new QTabWidget;
+    tabs->addTab(m_endpointsView, tr("Endpoints"));
+    tabs->addTab(m_requestsView, tr("Requests"));
+
+    auto* exportButton = new QPushButton(tr("&Export..."));
+    connect(exportButton, &QPushButton::clicked,
+            this, &NetworkInspectorDock::exportRecords);
+    auto* clearButton = new QPushButton(tr("C&lear"));
+    connect(clearButton, &QPushButton::clicked,
+            this, &NetworkInspectorDock::clear);
+
+    auto* buttonsLayout = new QHBoxLayout;
+    buttonsLayout->addWidget(m_summary, 1);
+    buttonsLayout->addWidget(exportButton);
+    buttonsLayout->addWidget(clearButton);
+
+    auto* layout = new QVBoxLayout;
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addLayout(buttonsLayout);
+    layout->addWidget(tabs);
+    auto* container = new QWidget;
+    container->setLayout(layout);
+    setWidget(container);
+
+    m_refreshTimer.setInterval(RefreshIntervalMs);
+    connect(&m_refreshTimer, &QTimer::timeout,
+            this, &NetworkInspectorDock::refresh);
+}
+
+void NetworkInspectorDock::setRecording(bool recording)
+{
+    if (m_recording == recording)
+        return;
+    m_recording = recording;
+    auto* nam = QMatrixClient::NetworkAccessManager::instance();
+    if (recording)
+    {
+        if (!m_clock.isValid())
+            m_clock.start();
+        // Replies are created as children of the manager; that's
+        // the only way to know when they start
+        nam->installEventFilter(this);
+        connect(nam, &QNetworkAccessManager::finished,
+                this, &NetworkInspectorDock::replyFinished);
+        m_refreshTimer.start();
+    } else {
+        nam->removeEventFilter(this);
+        nam->disconnect(this);
+        m_refreshTimer.stop();
+        for (auto* reply: m_pending.keys())
+            reply->disconnect(this);
+        m_pending.clear();
+        m_newReplies.clear();
+    }
+}
+
+bool NetworkInspectorDock::isRecording() const
+{
+    return m_recording;
+}
+
+std::vector<NetworkInspectorDock::Record> NetworkInspectorDock::records() const
+{
+    std::vector<Record> result;
+    result.reserve(m_ring.size());
+    result.insert(result.end(), m_ring.begin() + m_ringHead, m_ring.end());
+    result.insert(result.end(), m_ring.begin(), m_ring.begin() + m_ringHead);
+    return result;
+}
+
+bool NetworkInspectorDock::exportTo(const QString& fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly|QIODevice::Truncate|QIODevice::Text))
+        return false;
+    QTextStream out(&file);
+    out << "started_ms,method,endpoint,url,status,error,handshake_ms,wait_ms,"
+           "download_ms,total_ms,request_bytes,response_bytes,from_cache,"
+           "retry\n";
+    const auto quoted = [] (QString s) {
+        return '"' + s.replace('"', QStringLiteral("\"\"")) + '"';
+    };
+    for (const auto& r: records())
+        out << r.startedAtMs << ',' << r.method << ','
+            << quoted(r.endpoint) << ',' << quoted(r.url) << ','
+            << r.httpStatus << ',' << quoted(r.error) << ','
+            << r.handshakeMs << ',' << r.waitMs << ',' << r.downloadMs << ','
+            << r.totalMs << ',' << r.requestBytes << ',' << r.responseBytes
+            << ',' << int(r.fromCache) << ',' << int(r.retry) << '\n';
+    out.flush();
+    return file.error() == QFile::NoError;
+}
+
+bool NetworkInspectorDock::eventFilter(QObject* watched, QEvent* event)
+{
+    if (event->type() == QEvent::ChildAdded)
+    {
+        // The reply is still being constructed at this point; come back
+        // to it once the control gets back to the event loop
+        if (m_newReplies.isEmpty())
+            QMetaObject::invokeMethod(this, "trackNewReplies",
+                                      Qt::QueuedConnection);
+        m_newReplies.push_back(
+            { static_cast<QChildEvent*>(event)->child(), m_clock.elapsed() });
+    }
+    return QDockWidget::eventFilter(watched, event);
+}
+
+void NetworkInspectorDock::trackNewReplies()
+{
+    for (const auto& p: qAsConst(m_newReplies))
+    {
+        auto* reply = qobject_cast<QNetworkReply*>(p.first.data());
+        if (!reply || reply->isFinished())
+            continue;
+        m_pending.insert(reply, { p.second });
+        connect(reply, &QNetworkReply::encrypted, this, [this, reply] {
+            m_pending[reply].handshakeDoneAtMs = m_clock.elapsed();
+        });
+        connect(reply, &QNetworkReply::metaDataChanged, this, [this, reply] {
+            auto& pending = m_pending[reply];
+            if (pending.headersAtMs < 0)
+                pending.headersAtMs = m_clock.elapsed();
+        });
+        connect(reply, &QNetworkReply::uploadProgress, this,
+            [this, reply] (qint64 bytesSent, qint64) {
+                m_pending[reply].requestBytes = bytesSent;
+            });
+        connect(reply, &QNetworkReply::downloadProgress, this,
+            [this, reply] (qint64 bytesReceived, qint64) {
+                m_pending[reply].responseBytes = bytesReceived;
+            });
+        connect(reply, &QObject::destroyed, this, [this, reply] {
+            m_pending.remove(reply);
+        });
+    }
+    m_newReplies.clear();
+}
+
+void NetworkInspectorDock::replyFinished(QNetworkReply* reply)
+{
+    const auto pendingIt = m_pending.find(reply);
+    if (pendingIt == m_pending.end())
+        return; // Started before the recording
+    const auto pending = *pendingIt;
+    m_pending.erase(pendingIt);
+    reply->disconnect(this);
+
+    const auto now = m_clock.elapsed();
+    const auto sentAtMs = pending.handshakeDoneAtMs >= 0
+                          ? pending.handshakeDoneAtMs : pending.createdAtMs;
+    Record r;
+    r.startedAtMs = pending.createdAtMs;
+    r.method = methodName(reply);
+    r.endpoint = endpointName(reply->url().path());
+    r.url = safeUrl(reply->url());
+    r.httpStatus =
+        reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (reply->error() != QNetworkReply::NoError)
+        r.error = reply->errorString();
+    r.handshakeMs = pending.handshakeDoneAtMs >= 0
+                    ? int(pending.handshakeDoneAtMs - pending.createdAtMs) : -1;
+    r.waitMs = int((pending.headersAtMs >= 0 ? pending.headersAtMs : now)
+                   - sentAtMs);
+    r.downloadMs =
+        pending.headersAtMs >= 0 ? int(now - pending.headersAtMs) : 0;
+    r.totalMs = int(now - pending.createdAtMs);
+    r.requestBytes = pending.requestBytes;
+    r.responseBytes = std::max(pending.responseBytes, reply->bytesAvailable());
+    r.fromCache = reply->attribute(
+            QNetworkRequest::SourceIsFromCacheAttribute).toBool();
+
+    const auto requestKey = r.method + ' ' + r.url;
+    r.retry = m_failedRequests.contains(requestKey);
+    if (r.error.isEmpty())
+        m_failedRequests.remove(requestKey);
+    else
+    {
+        if (m_failedRequests.size() >= MaxFailedRequests)
+            m_failedRequests.clear();
+        m_failedRequests.insert(requestKey, now);
+    }
+    addRecord(std::move(r));
+}
+
+void NetworkInspectorDock::addRecord(Record&& record)
+{
+    if (m_ring.size() < size_t(RingSize))
+        m_ring.push_back(std::move(record));
+    else
+    {
+        m_ring[m_ringHead] = std::move(record);
+        m_ringHead = (m_ringHead + 1) % m_ring.size();
+    }
+    ++m_recordsAdded;
+}
+
+void NetworkInspectorDock::refresh()
+{
+    if (!isVisible() || m_recordsShown == m_recordsAdded)
+        return;
+
+    const auto all = records();
+    m_summary->setText(tr("%1 request(s) recorded, %2 in flight")
+                       .arg(m_recordsAdded).arg(m_pending.size()));
+
+    struct EndpointStats
+    {
+        std::vector<int> totalMs;
+        std::vector<int> waitMs;
+        int errors = 0;
+        int retries = 0;
+        qint64 totalBytes = 0;
+        qint64 maxBytes = 0;
+    };
+    QHash<QString, EndpointStats> stats;
+    for (const auto& r: all)
+    {
+        auto& s = stats[r.method + ' ' + r.endpoint];
+        s.totalMs.push_back(r.totalMs);
+        s.waitMs.push_back(r.waitMs);
+        s.errors += !r.error.isEmpty();
+        s.retries += r.retry;
+        s.totalBytes += r.responseBytes;
+        s.maxBytes = std::max(s.maxBytes, r.responseBytes);
+    }
+    m_endpointsView->setSortingEnabled(false);
+    m_endpointsView->clear();
+    for (auto it = stats.begin(); it != stats.end(); ++it)
+    {
+        auto& s = it.value();
+        std::sort(s.totalMs.begin(), s.totalMs.end());
+        std::sort(s.waitMs.begin(), s.waitMs.end());
+        const auto count = int(s.totalMs.size());
+        auto* item = new QTreeWidgetItem(m_endpointsView);
+        item->setText(EndpointColumn, it.key());
+        const std::pair<int, qint64> figures[] {
+            { CountColumn, count }, { ErrorsColumn, s.errors },
+            { RetriesColumn, s.retries },
+            { P50Column, percentile(s.totalMs, 0.5) },
+            { P90Column, percentile(s.totalMs, 0.9) },
+            { P99Column, percentile(s.totalMs, 0.99) },
+            { WaitP50Column, percentile(s.waitMs, 0.5) },
+            { AvgSizeColumn, s.totalBytes / count / 1024 },
+            { MaxSizeColumn, s.maxBytes / 1024 }
+        };
+        for (const auto& f: figures)
+        {
+            // Numbers rather than strings, to sort numerically
+            item->setData(f.first, Qt::DisplayRole, f.second);
+            item->setTextAlignment(f.first, Qt::AlignRight|Qt::AlignVCenter);
+        }
+    }
+    m_endpointsView->setSortingEnabled(true);
+
+    const auto newRecords = int(std::min(m_recordsAdded - m_recordsShown,
+                                         qint64(all.size())));
+    for (auto it = all.end() - newRecords; it != all.end(); ++it)
+    {
+        auto* item = new QTreeWidgetItem;
+        item->setText(StartedColumn,
+                      QString::number(it->startedAtMs / 1000.0, 'f', 1));
+        item->setText(MethodColumn, it->method);
+        item->setText(UrlColumn, it->url);
+        item->setText(StatusColumn, it->error.isEmpty()
+                      ? QString::number(it->httpStatus)
+                      : QStringLiteral("%1 %2").arg(it->httpStatus)
+                                               .arg(it->error));
+        if (it->retry)
+            item->setText(StatusColumn,
+                          item->text(StatusColumn) + tr(" (retry)"));
+        if (it->fromCache)
+            item->setText(StatusColumn,
+                          item->text(StatusColumn) + tr(" (cached)"));
+        const std::pair<int, qint64> figures[] {
+            { HandshakeColumn, it->handshakeMs }, { WaitColumn, it->waitMs },
+            { DownloadColumn, it->downloadMs }, { TotalColumn, it->totalMs },
+            { SentColumn, it->requestBytes },
+            { ReceivedColumn, it->responseBytes }
+        };
+        for (const auto& f: figures)
+        {
+            if (f.second >= 0)
+                item->setData(f.first, Qt::DisplayRole, f.second);
+            item->setTextAlignment(f.first, Qt::AlignRight|Qt::AlignVCenter);
+        }
+        item->setToolTip(UrlColumn, it->url);
+        m_requestsView->insertTopLevelItem(0, item);
+    }
+    while (m_requestsView->topLevelItemCount() > MaxRequestsShown)
+        delete m_requestsView->takeTopLevelItem(
+                    m_requestsView->topLevelItemCount() - 1);
+    m_recordsShown = m_recordsAdded;
+}
+
+void NetworkInspectorDock::exportRecords()
+{
+    const auto fileName = QFileDialog::getSaveFileName(this,
+            tr("Export network requests"), QStringLiteral("network.csv"),
+            tr("CSV files (*.csv)"));
+    if (fileName.isEmpty())
+        return;
+    if (!exportTo(fileName))
+        QMessageBox::warning(this, tr("Export failed"),
+            tr("Couldn't write the requests to %1").arg(fileName));
+}
+
+void NetworkInspectorDock::clear()
+{
+    m_ring.clear();
+    m_ringHead = 0;
+    m_recordsAdded = m_recordsShown = 0;
+    m_failedRequests.clear();
+    m_endpointsView->clear();
+    m_requestsView->clear();
+    m_summary->clear();
+}
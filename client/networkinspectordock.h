@@ -0,0 +1,121 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtWidgets/QDockWidget>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+
+#include <vector>
+
+class QNetworkReply;
+class QTreeWidget;
+class QLabel;
+
+/// Shows the requests made over the network, with timings and sizes
+/**
+ * Every reply of NetworkAccessManager is tracked from its creation till
+ * it's finished, so library jobs, media and everything else get into
+ * the list alike. The latest RingSize requests are kept; the endpoint
+ * statistics (percentiles of durations, sizes, errors and retries) are
+ * calculated over them. Nothing is recorded until recording is enabled.
+ */
+class NetworkInspectorDock: public QDockWidget
+{
+        Q_OBJECT
+    public:
+        static const int RingSize;
+
+        struct Record
+        {
+            qint64 startedAtMs;
+            QString method;
+            /// The path with ids replaced with placeholders
+            QString endpoint;
+            /// The path and the query, with secrets removed
+            QString url;
+            int httpStatus;
+            QString error;
+            /// -1 if the reply has reused a connection (no TLS handshake)
+            int handshakeMs;
+            /// From sending the request (or the handshake) to the headers
+            int waitMs;
+            int downloadMs;
+            int totalMs;
+            qint64 requestBytes;
+            qint64 responseBytes;
+            bool fromCache;
+            /// Whether the same request has failed right before
+            bool retry;
+        };
+
+        explicit NetworkInspectorDock(QWidget* parent = nullptr);
+
+        void setRecording(bool recording);
+        bool isRecording() const;
+
+        /// The recorded requests, from the oldest to the newest
+        std::vector<Record> records() const;
+        bool exportTo(const QString& fileName) const;
+
+        /// Turns a request path to an endpoint name, for grouping
+        static QString endpointName(const QString& path);
+
+    protected:
+        bool eventFilter(QObject* watched, QEvent* event) override;
+
+    private slots:
+        void trackNewReplies();
+        void replyFinished(QNetworkReply* reply);
+        void refresh();
+        void exportRecords();
+        void clear();
+
+    private:
+        struct Pending
+        {
+            qint64 createdAtMs;
+            qint64 handshakeDoneAtMs = -1;
+            qint64 headersAtMs = -1;
+            qint64 requestBytes = 0;
+            qint64 responseBytes = 0;
+        };
+
+        bool m_recording = false;
+        QElapsedTimer m_clock;
+        std::vector<Record> m_ring;
+        size_t m_ringHead = 0;
+        QVector<QPair<QPointer<QObject>, qint64>> m_newReplies;
+        QHash<QNetworkReply*, Pending> m_pending;
+        /// Requests that have failed last time, by method and url
+        QHash<QString, qint64> m_failedRequests;
+        qint64 m_recordsAdded = 0;
+        qint64 m_recordsShown = 0;
+        QTimer m_refreshTimer;
+
+        QLabel* m_summary;
+        QTreeWidget* m_endpointsView;
+        QTreeWidget* m_requestsView;
+
+        void addRecord(Record&& record);
+};
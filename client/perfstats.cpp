@@ -0,0 +1,300 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "perfstats.h"
+
+#include "imageprovider.h"
+#include "eventloopwatchdog.h"
+#include "roomswitchstats.h"
+#include "models/messageeventmodel.h"
+
+#include <connection.h>
+#include <networkaccessmanager.h>
+
+#include <QtQuick/QQuickWindow>
+#include <QtNetwork/QNetworkReply>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+
+using QMatrixClient::Connection;
+
+const int PerfStats::FrameHistorySize = 120;
+
+static const int UpdateIntervalMs = 1000;
+static const int StallCausesShown = 5;
+
+PerfStats* PerfStats::instance()
+{
+    static auto* stats = new PerfStats;
+    return stats;
+}
+
+PerfStats::PerfStats()
+    : m_frameTimes(size_t(FrameHistorySize), 0.0f)
+{
+    m_timer.setInterval(UpdateIntervalMs);
+    connect(&m_timer, &QTimer::timeout, this, &PerfStats::update);
+}
+
+void PerfStats::setEnabled(bool enabled)
+{
+    if (m_enabled == enabled)
+        return;
+    m_enabled = enabled;
+    if (m_model)
+        m_model->setCountingDataCalls(enabled);
+    auto* nam = QMatrixClient::NetworkAccessManager::instance();
+    if (enabled)
+    {
+        m_clock.start();
+        m_lastUpdateMs = 0;
+        m_timer.start();
+        // Same as with SyncRecorder, the manager reports a finished reply
+        // before the job that owns it has read the data
+        connect(nam, &QNetworkAccessManager::finished,
+                this, &PerfStats::replyFinished);
+    } else {
+        m_timer.stop();
+        nam->disconnect(this);
+    }
+}
+
+bool PerfStats::isEnabled() const
+{
+    return m_enabled;
+}
+
+void PerfStats::watchTimeline(QQuickWindow* window, MessageEventModel* model,
+                              const ImageProvider* imageProvider)
+{
+    m_model = model;
+    m_imageProvider = imageProvider;
+    if (m_enabled)
+        model->setCountingDataCalls(true);
+    // afterRendering() is emitted both for QQuickView and for the window
+    // behind QQuickWidget (unlike frameSwapped()); with the threaded render
+    // loop, it comes from the render thread.
+    connect(window, &QQuickWindow::afterRendering, this,
+            [this] { if (m_enabled) frameRendered(); },
+            Qt::DirectConnection);
+}
+
+void PerfStats::addConnection(Connection* connection)
+{
+    connect(connection, &Connection::syncDone, this, [this, connection] {
+        if (!m_enabled)
+            return;
+        const auto arrivedAt = m_syncArrivals.take(
+                "Bearer " + connection->accessToken());
+        if (arrivedAt > 0)
+            m_lastSyncMs = int(m_clock.elapsed() - arrivedAt);
+    });
+}
+
+void PerfStats::setWatchdog(const EventLoopWatchdog* watchdog)
+{
+    m_watchdog = watchdog;
+}
+
+double PerfStats::fps() const
+{
+    return m_fps;
+}
+
+QVariantList PerfStats::frameTimes() const
+{
+    QMutexLocker lock(&m_framesMutex);
+    QVariantList result;
+    result.reserve(FrameHistorySize);
+    for (size_t i = 0; i < m_frameTimes.size(); ++i)
+        result.push_back(
+            m_frameTimes[(m_frameCursor + i) % m_frameTimes.size()]);
+    return result;
+}
+
+QVariantList PerfStats::dataCalls() const
+{
+    return m_dataCalls;
+}
+
+int PerfStats::dataCallsTotal() const
+{
+    return m_dataCallsTotal;
+}
+
+int PerfStats::pendingImageRequests() const
+{
+    return m_imageProvider ? m_imageProvider->pendingRequests() : 0;
+}
+
+int PerfStats::mediaReplies() const
+{
+    return m_mediaRepliesShown;
+}
+
+double PerfStats::mediaCacheHitRate() const
+{
+    return m_mediaCacheHitRate;
+}
+
+int PerfStats::lastSyncMs() const
+{
+    return m_lastSyncMs;
+}
+
+qint64 PerfStats::lastSyncBytes() const
+{
+    return m_lastSyncBytes;
+}
+
+QVariantList PerfStats::eventLoopLag() const
+{
+    return m_eventLoopLag;
+}
+
+QVariantList PerfStats::stallCauses() const
+{
+    return m_stallCauses;
+}
+
+double PerfStats::lastRoomSwitchMs() const
+{
+    return RoomSwitchStats::instance()->lastSwitchMs();
+}
+
+QVariantList PerfStats::lastRoomSwitch() const
+{
+    QVariantList result;
+    for (const auto& s: RoomSwitchStats::instance()->lastSwitch())
+        result.push_back(QVariantMap {
+            { QStringLiteral("stage"), s.name },
+            { QStringLiteral("ms"), s.ms }
+        });
+    return result;
+}
+
+QVariantList PerfStats::roomSwitchTimes() const
+{
+    QVariantList result;
+    for (const auto& b: RoomSwitchStats::instance()->histogram())
+        result.push_back(QVariantMap {
+            { QStringLiteral("upToMs"), b.upToMs },
+            { QStringLiteral("count"), b.count }
+        });
+    return result;
+}
+
+void PerfStats::frameRendered()
+{
+    const auto now = m_clock.nsecsElapsed();
+    QMutexLocker lock(&m_framesMutex);
+    if (m_lastFrameNs >= 0)
+    {
+        m_frameTimes[m_frameCursor] = float(now - m_lastFrameNs) / 1000000;
+        m_frameCursor = (m_frameCursor + 1) % m_frameTimes.size();
+    }
+    m_lastFrameNs = now;
+    ++m_framesSinceUpdate;
+}
+
+void PerfStats::replyFinished(QNetworkReply* reply)
+{
+    if (reply->error() != QNetworkReply::NoError)
+        return;
+    const auto path = reply->url().path();
+    if (path.endsWith(QStringLiteral("/sync")))
+    {
+        m_syncArrivals.insert(reply->request().rawHeader("Authorization"),
+                              m_clock.elapsed());
+        m_lastSyncBytes = reply->bytesAvailable();
+    }
+    else if (path.contains(QStringLiteral("/_matrix/media/")))
+    {
+        ++m_mediaReplies;
+        if (reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute)
+                .toBool())
+            ++m_mediaCacheHits;
+    }
+}
+
+void PerfStats::update()
+{
+    const auto now = m_clock.elapsed();
+    const auto elapsedMs = std::max(qint64(1), now - m_lastUpdateMs);
+    m_lastUpdateMs = now;
+    {
+        QMutexLocker lock(&m_framesMutex);
+        m_fps = m_framesSinceUpdate * 1000.0 / elapsedMs;
+        m_framesSinceUpdate = 0;
+    }
+
+    m_dataCalls.clear();
+    m_dataCallsTotal = 0;
+    if (m_model)
+    {
+        const auto counts = m_model->takeDataCallCounts();
+        const auto roleNames = m_model->roleNames();
+        std::vector<std::pair<int, int>> sorted;
+        sorted.reserve(size_t(counts.size()));
+        for (auto it = counts.cbegin(); it != counts.cend(); ++it)
+        {
+            sorted.emplace_back(it.key(), it.value());
+            m_dataCallsTotal += it.value();
+        }
+        std::sort(sorted.begin(), sorted.end(),
+            [] (const std::pair<int, int>& a, const std::pair<int, int>& b) {
+                return a.second > b.second;
+            });
+        for (const auto& p: sorted)
+            m_dataCalls.push_back(QVariantMap {
+                { QStringLiteral("role"),
+                  QString::fromLatin1(roleNames.value(p.first,
+                                        QByteArray::number(p.first))) },
+                { QStringLiteral("calls"),
+                  qRound(p.second * 1000.0 / elapsedMs) }
+            });
+        m_dataCallsTotal = qRound(m_dataCallsTotal * 1000.0 / elapsedMs);
+    }
+
+    m_mediaRepliesShown = m_mediaReplies;
+    if (m_mediaReplies > 0)
+        m_mediaCacheHitRate = double(m_mediaCacheHits) / m_mediaReplies;
+    m_mediaReplies = m_mediaCacheHits = 0;
+
+    m_eventLoopLag.clear();
+    m_stallCauses.clear();
+    if (m_watchdog)
+    {
+        for (const auto& b: m_watchdog->histogram())
+            m_eventLoopLag.push_back(QVariantMap {
+                { QStringLiteral("upToMs"), b.upToMs },
+                { QStringLiteral("count"), b.count }
+            });
+        for (const auto& c: m_watchdog->stallCauses().mid(0, StallCausesShown))
+            m_stallCauses.push_back(QVariantMap {
+                { QStringLiteral("span"), c.span },
+                { QStringLiteral("stalls"), c.stalls },
+                { QStringLiteral("totalMs"), c.totalMs },
+                { QStringLiteral("maxMs"), c.maxMs }
+            });
+    }
+
+    emit updated();
+}
@@ -0,0 +1,146 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
+#include <QtCore/QVariantList>
+
+#include <vector>
+
+namespace QMatrixClient
+{
+    class Connection;
+}
+class MessageEventModel;
+class ImageProvider;
+class EventLoopWatchdog;
+class QQuickWindow;
+class QNetworkReply;
+
+/// Collects the figures shown by the performance overlay in debug mode
+/**
+ * Nothing is collected until the stats are enabled; after that, the figures
+ * are recalculated once a second and updated() is emitted. Frame times come
+ * from the timeline window, data() call counts from the timeline model,
+ * sync and media figures from NetworkAccessManager replies.
+ */
+class PerfStats: public QObject
+{
+        Q_OBJECT
+        Q_PROPERTY(double fps READ fps NOTIFY updated)
+        Q_PROPERTY(QVariantList frameTimes READ frameTimes NOTIFY updated)
+        Q_PROPERTY(QVariantList dataCalls READ dataCalls NOTIFY updated)
+        Q_PROPERTY(int dataCallsTotal READ dataCallsTotal NOTIFY updated)
+        Q_PROPERTY(int pendingImageRequests READ pendingImageRequests NOTIFY updated)
+        Q_PROPERTY(int mediaReplies READ mediaReplies NOTIFY updated)
+        Q_PROPERTY(double mediaCacheHitRate READ mediaCacheHitRate NOTIFY updated)
+        Q_PROPERTY(int lastSyncMs READ lastSyncMs NOTIFY updated)
+        Q_PROPERTY(qint64 lastSyncBytes READ lastSyncBytes NOTIFY updated)
+        Q_PROPERTY(QVariantList eventLoopLag READ eventLoopLag NOTIFY updated)
+        Q_PROPERTY(QVariantList stallCauses READ stallCauses NOTIFY updated)
+        Q_PROPERTY(double lastRoomSwitchMs READ lastRoomSwitchMs NOTIFY updated)
+        Q_PROPERTY(QVariantList lastRoomSwitch READ lastRoomSwitch NOTIFY updated)
+        Q_PROPERTY(QVariantList roomSwitchTimes READ roomSwitchTimes NOTIFY updated)
+    public:
+        /// The number of the latest frame times kept for the graph
+        static const int FrameHistorySize;
+
+        static PerfStats* instance();
+
+        void setEnabled(bool enabled);
+        bool isEnabled() const;
+
+        void watchTimeline(QQuickWindow* window, MessageEventModel* model,
+                           const ImageProvider* imageProvider);
+        void addConnection(QMatrixClient::Connection* connection);
+        void setWatchdog(const EventLoopWatchdog* watchdog);
+
+        double fps() const;
+        /// Durations between the latest frames, in milliseconds
+        QVariantList frameTimes() const;
+        /// Calls per second by role, as {role, calls} maps, most called first
+        QVariantList dataCalls() const;
+        int dataCallsTotal() const;
+        int pendingImageRequests() const;
+        /// Media replies in the last second
+        int mediaReplies() const;
+        /// The share of media replies served from the network cache
+        double mediaCacheHitRate() const;
+        /// Time from the arrival of the last sync response to syncDone()
+        int lastSyncMs() const;
+        qint64 lastSyncBytes() const;
+        /// The event loop lag histogram, as {upToMs, count} maps
+        /** upToMs is -1 for the last bucket. */
+        QVariantList eventLoopLag() const;
+        /// The worst stall causes, as {span, stalls, totalMs, maxMs} maps
+        QVariantList stallCauses() const;
+        double lastRoomSwitchMs() const;
+        /// Stages of the latest room switch, as {stage, ms} maps
+        QVariantList lastRoomSwitch() const;
+        /// The room switch time histogram, as {upToMs, count} maps
+        QVariantList roomSwitchTimes() const;
+
+    signals:
+        void updated();
+
+    private:
+        PerfStats();
+
+        bool m_enabled = false;
+        QTimer m_timer;
+        QElapsedTimer m_clock;
+        qint64 m_lastUpdateMs = 0;
+
+        QPointer<MessageEventModel> m_model;
+        const ImageProvider* m_imageProvider = nullptr;
+        const EventLoopWatchdog* m_watchdog = nullptr;
+
+        /// Guards m_frameTimes and m_lastFrameNs, written to from
+        /// the scene graph render thread
+        mutable QMutex m_framesMutex;
+        std::vector<float> m_frameTimes;
+        size_t m_frameCursor = 0;
+        qint64 m_lastFrameNs = -1;
+        int m_framesSinceUpdate = 0;
+        double m_fps = 0;
+
+        QVariantList m_dataCalls;
+        int m_dataCallsTotal = 0;
+        int m_mediaReplies = 0;
+        int m_mediaCacheHits = 0;
+        int m_mediaRepliesShown = 0;
+        double m_mediaCacheHitRate = 0;
+
+        QHash<QByteArray, qint64> m_syncArrivals;
+        int m_lastSyncMs = 0;
+        qint64 m_lastSyncBytes = 0;
+
+        QVariantList m_eventLoopLag;
+        QVariantList m_stallCauses;
+
+        void frameRendered();
+        void replyFinished(QNetworkReply* reply);
+        void update();
+};
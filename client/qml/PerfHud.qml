@@ -0,0 +1,144 @@
+import QtQuick 2.2
+import QtQuick.Controls 1.4
+
+// Performance overlay for the timeline, shown in debug mode
+Rectangle {
+    id: hud
+    property Item view // The ListView to count delegates in
+    property int delegateCount: 0
+    readonly property real frameBudgetMs: 1000 / 60
+
+    SystemPalette { id: hudPalette; colorGroup: SystemPalette.Active }
+
+    width: 260
+    height: hudColumn.height + 8
+    color: hudPalette.window
+    opacity: 0.85
+    radius: 3
+
+    Connections {
+        target: perfStats
+        onUpdated: hud.delegateCount = view ? view.contentItem.children.length : 0
+    }
+
+    function formatLag(buckets) {
+        var parts = []
+        var lowerBound = 0
+        for (var i = 0; i < buckets.length; ++i) {
+            if (buckets[i].count > 0)
+                parts.push((buckets[i].upToMs < 0 ? "≥" + lowerBound
+                                                  : "<" + buckets[i].upToMs)
+                           + ": " + buckets[i].count)
+            lowerBound = buckets[i].upToMs
+        }
+        return parts.join(", ")
+    }
+
+    function formatBytes(bytes) {
+        return bytes < 10000 ? qsTr("%1 B").arg(bytes)
+                             : qsTr("%1 KB").arg(Math.round(bytes / 1024))
+    }
+
+    Column {
+        id: hudColumn
+        x: 4; y: 4
+        width: parent.width - 8
+        spacing: 2
+
+        Label {
+            text: qsTr("%1 fps").arg(perfStats.fps.toFixed(1))
+            font.bold: true
+        }
+        // The latest frame times, oldest first; the line marks 60 fps
+        Item {
+            width: parent.width
+            height: 40
+            Row {
+                anchors.bottom: parent.bottom
+                Repeater {
+                    model: perfStats.frameTimes
+                    Rectangle {
+                        anchors.bottom: parent.bottom
+                        width: hudColumn.width / perfStats.frameTimes.length
+                        height: Math.min(40, modelData * 40 / (3 * hud.frameBudgetMs))
+                        color: modelData > 2 * hud.frameBudgetMs ? "red" :
+                               modelData > hud.frameBudgetMs ? "orange" : "green"
+                    }
+                }
+            }
+            Rectangle {
+                width: parent.width
+                height: 1
+                y: parent.height - parent.height / 3
+                color: hudPalette.text
+                opacity: 0.5
+            }
+        }
+        Label {
+            text: qsTr("Delegates: %1").arg(hud.delegateCount)
+        }
+        Label {
+            text: qsTr("data() calls: %1/s").arg(perfStats.dataCallsTotal)
+        }
+        Repeater {
+            model: perfStats.dataCalls.slice(0, 8)
+            Label {
+                x: 8
+                text: modelData.role + ": " + modelData.calls + "/s"
+                font.pointSize: 8
+            }
+        }
+        Label {
+            text: qsTr("Thumbnails in flight: %1")
+                    .arg(perfStats.pendingImageRequests)
+        }
+        Label {
+            text: qsTr("Media replies: %1/s, %2% from cache")
+                    .arg(perfStats.mediaReplies)
+                    .arg(Math.round(perfStats.mediaCacheHitRate * 100))
+        }
+        Label {
+            text: qsTr("Last sync: %1, processed in %2 ms")
+                    .arg(formatBytes(perfStats.lastSyncBytes))
+                    .arg(perfStats.lastSyncMs)
+        }
+        Label {
+            text: qsTr("Last room switch: %1 ms")
+                    .arg(perfStats.lastRoomSwitchMs.toFixed(1))
+            color: perfStats.lastRoomSwitchMs > hud.frameBudgetMs
+                   ? "red" : hudPalette.text
+        }
+        Repeater {
+            model: perfStats.lastRoomSwitch
+            Label {
+                x: 8
+                text: modelData.stage + ": " + modelData.ms.toFixed(1) + " ms"
+                font.pointSize: 8
+            }
+        }
+        Label {
+            width: parent.width
+            wrapMode: Text.Wrap
+            text: qsTr("Room switches, ms: %1")
+                    .arg(formatLag(perfStats.roomSwitchTimes))
+        }
+        Label {
+            width: parent.width
+            wrapMode: Text.Wrap
+            text: qsTr("Event loop lag, ms: %1")
+                    .arg(formatLag(perfStats.eventLoopLag))
+        }
+        Repeater {
+            model: perfStats.stallCauses
+            Label {
+                x: 8
+                width: hudColumn.width - x
+                elide: Text.ElideMiddle
+                text: qsTr("%1: %2 stall(s), %3 ms max")
+                        .arg(modelData.span).arg(modelData.stalls)
+                        .arg(modelData.maxMs)
+                font.pointSize: 8
+            }
+        }
+    }
+}
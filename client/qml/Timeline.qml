@@ -34,6 +34,7 @@ Rectangle {
 
     ListView {
         id: chatView
+        objectName: "chatView" // For tools that drive the timeline from C++
         anchors.fill: parent
 
         model: messageModel
@@ -74,7 +75,8 @@ Rectangle {
         function onModelReset() {
             if (room)
             {
-                var lastScrollPosition = room.savedTopVisibleIndex()
+                var lastScrollPosition =
+                    messageModel.rowOfPlainRow(room.savedTopVisibleIndex())
                 contentYChanged.connect(ensurePreviousContent)
                 if (lastScrollPosition === 0)
                     positionViewAtBeginning()
@@ -95,8 +97,22 @@ Rectangle {
             model.modelReset.connect(onModelReset)
         }
 
+        // The room keeps positions in terms of events, not rows
         onMovementEnded:
-            room.saveViewport(indexAt(contentX, contentY), largestVisibleIndex)
+            room.saveViewport(messageModel.plainRow(indexAt(contentX, contentY)),
+                              messageModel.plainRow(largestVisibleIndex))
+
+        Connections {
+            target: controller
+            onScrollToRowRequested: {
+                console.log("Scrolling to row", row)
+                chatView.positionViewAtIndex(row, ListView.Center)
+                room.saveViewport(
+                    messageModel.plainRow(chatView.indexAt(chatView.contentX,
+                                                           chatView.contentY)),
+                    messageModel.plainRow(chatView.largestVisibleIndex))
+            }
+        }
 
         displaced: Transition { NumberAnimation {
             property: "y"; duration: settings.fast_animations_duration_ms
@@ -247,4 +263,14 @@ Rectangle {
             cursorShape: Qt.PointingHandCursor
         }
     }
+
+    Loader {
+        active: debug
+        z: 4
+        anchors.top: parent.top
+        anchors.right: parent.right
+        anchors.topMargin: 4
+        anchors.rightMargin: chatViewScroller.width + 4
+        sourceComponent: Component { PerfHud { view: chatView } }
+    }
 }
@@ -48,13 +48,47 @@ Item {
         marks === EventStatus.Departed ? disabledPalette.text :
         redacted ? disabledPalette.text :
         highlight && settings.highlight_mode == "text" ? settings.highlight_color :
-        (["state", "notice", "other"].indexOf(eventType) >= 0) ?
+        (["state", "notice", "other", "membershipRun"].indexOf(eventType) >= 0) ?
                 disabledPalette.text : defaultPalette.text
-    readonly property string authorName: room && room.roomMembername(author.id)
+    readonly property string authorName: authorDisplayName
 
     readonly property bool xchatStyle: settings.timeline_style === "xchat"
     readonly property bool actionEvent: eventType == "state" || eventType == "emote"
-    readonly property bool singleRow: xchatStyle || actionEvent
+    // A summary of several membership events, see MessageEventModel
+    readonly property bool runSummary: eventType == "membershipRun"
+    readonly property bool singleRow: xchatStyle || actionEvent || runSummary
+
+    readonly property string replyHeader: !replyTo ? "" :
+        "<font size=-1>" + (replyTo.author
+            ? qsTr("In reply to %1: %2").arg(replyTo.author)
+                                         .arg(replyTo.text || "")
+            : qsTr("In reply to an earlier message")) + "</font><br>"
+    readonly property string reactionsLine: {
+        if (!reactions || reactions.length === 0)
+            return ""
+        var parts = []
+        for (var i = 0; i < reactions.length; ++i)
+        {
+            var r = reactions[i]
+            var part = r.key + "&nbsp;" + r.count
+            parts.push(r.mine ? "<b>" + part + "</b>" : part)
+        }
+        return "<br><font size=-1>" + parts.join(" &nbsp; ") + "</font>"
+    }
+    readonly property string readersLine: {
+        if (!readers || readers.length === 0)
+            return ""
+        var maxNames = 3
+        var names = []
+        for (var i = 0; i < readers.length && i < maxNames; ++i)
+            names.push(room.roomMembername(readers[i].id))
+        var line = readers.length > maxNames
+            ? qsTr("Read by %1 and %n more", "", readers.length - maxNames)
+                .arg(names.join(", "))
+            : qsTr("Read by %1").arg(names.join(", "))
+        return "<br><font size=-1 color=\"" + disabledPalette.text + "\">" +
+               line.replace(/&/g, "&amp;").replace(/</g, "&lt;") + "</font>"
+    }
 
     // A message is considered shown if its bottom is within the
     // viewing area of the timeline.
@@ -145,12 +179,16 @@ Item {
                     )
                 fillMode: Image.PreserveAspectFit
 
-                source: author.avatarMediaId ?
-                            "image://mtx/" + author.avatarMediaId : ""
+                // The model gives no avatar if the current one applies
+                readonly property string mediaId:
+                    authorAvatarMediaId !== undefined ? authorAvatarMediaId
+                                                      : author.avatarMediaId
+                source: mediaId ? "image://mtx/" + mediaId : ""
             }
             Label {
                 id: authorLabel
-                visible: sectionVisible || actionEvent || author != aboveAuthor
+                visible: !runSummary &&
+                         (sectionVisible || actionEvent || author != aboveAuthor)
                 anchors.left: singleRow ? authorAvatar.right : textField.left
                 anchors.leftMargin: singleRow * 2
                 width: if (xchatStyle) { 120 - authorAvatar.width }
@@ -217,6 +255,15 @@ Item {
                     radius: 2
                 }
             }
+            Rectangle {
+                id: searchMatchMarker
+                anchors.fill: textField
+                visible: searchMatch > 0
+                color: "transparent"
+                border.color: defaultPalette.highlight
+                border.width: searchMatch > 1 ? 2 : 1
+                radius: 2
+            }
             TextEdit {
                 id: textField
                 anchors.top: singleRow ? authorLabel.top : authorLabel.bottom
@@ -230,8 +277,15 @@ Item {
                 selectByMouse: true
                 readOnly: true
                 textFormat: TextEdit.RichText
-                text: ((xchatStyle || !singleRow) ? display : ' ' + display) +
-                       (annotation ? "<br><em>" + annotation + "</em>" : "")
+                text: runSummary
+                      ? (membershipRun.expanded ? "\u25BE " : "\u25B8 ")
+                        + display :
+                      replyHeader +
+                      ((xchatStyle || !singleRow) ? display : ' ' + display) +
+                      (edited ? " <font size=-1>" + qsTr("(edited)") + "</font>"
+                              : "") +
+                      (annotation ? "<br><em>" + annotation + "</em>" : "") +
+                      reactionsLine + readersLine
                 horizontalAlignment: Text.AlignLeft
                 wrapMode: Text.Wrap
                 color: textColor
@@ -256,6 +310,12 @@ Item {
 
                 onLinkActivated: Qt.openUrlExternally(link)
             }
+            MouseArea {
+                visible: runSummary
+                anchors.fill: textField
+                cursorShape: Qt.PointingHandCursor
+                onClicked: messageModel.toggleRun(index)
+            }
             Loader {
                 active: eventType == "image"
 
@@ -19,9 +19,17 @@
 
 #include "quaternionroom.h"
 
+#include "highlightengine.h"
+#include "ingestionpipeline.h"
+#include "searchindex.h"
+#include "tracing.h"
+
 #include <user.h>
+#include <events/event.h>
 #include <events/roommessageevent.h>
 
+#include <algorithm>
+
 using namespace QMatrixClient;
 
 QuaternionRoom::QuaternionRoom(Connection* connection, QString roomId,
@@ -30,6 +38,14 @@ QuaternionRoom::QuaternionRoom(Connection* connection, QString roomId,
 {
     connect( this, &QuaternionRoom::notificationCountChanged, this, &QuaternionRoom::countChanged );
     connect( this, &QuaternionRoom::highlightCountChanged, this, &QuaternionRoom::countChanged );
+    // Redacted messages should not be found anymore, whether or not
+    // the room is materialized
+    connect(this, &Room::replacedEvent, this,
+        [] (const RoomEvent* newEvent, const RoomEvent* oldEvent) {
+            if (newEvent->isRedacted() && is<RoomMessageEvent>(*oldEvent))
+                SearchIndex::instance()->removeMessage(newEvent->id(),
+                                                       newEvent->timestamp());
+        });
 }
 
 const QString& QuaternionRoom::cachedInput() const
@@ -42,9 +58,115 @@ void QuaternionRoom::setCachedInput(const QString& input)
     m_cachedInput = input;
 }
 
-bool QuaternionRoom::isEventHighlighted(const RoomEvent* e) const
+bool QuaternionRoom::isEventHighlighted(index_t index) const
+{
+    return std::binary_search(highlights.cbegin(), highlights.cend(), index);
+}
+
+const RelationsIndex& QuaternionRoom::relations() const
+{
+    return m_relations;
+}
+
+const ReceiptIndex& QuaternionRoom::readReceipts() const
+{
+    return m_receipts;
+}
+
+const MemberHistoryIndex& QuaternionRoom::memberHistory() const
+{
+    return m_memberHistory;
+}
+
+bool QuaternionRoom::isMaterialized() const
 {
-    return highlights.contains(e);
+    return m_materialized;
+}
+
+void QuaternionRoom::materialize()
+{
+    if (m_materialized)
+    {
+        if (m_engineGeneration != HighlightEngine::settingsGeneration())
+            rescanHighlights();
+        return;
+    }
+
+    m_materialized = true;
+    // The local user's name is only needed for highlights; so only track
+    // renames in rooms that have been materialized. Highlights of the old
+    // name go away and the loaded timeline is looked through for the new one.
+    m_materializedConnections.push_back(
+        connect(this, &Room::memberRenamed, this, [this] (User* u) {
+            if (u == localUser())
+                rescanHighlights();
+        }));
+    // Redacting a reaction or an edit undoes it
+    m_materializedConnections.push_back(connect(this, &Room::replacedEvent, this,
+        [this] (const RoomEvent* newEvent, const RoomEvent*) {
+            if (!newEvent->isRedacted())
+                return;
+            const auto changedId = m_relations.remove(newEvent->id());
+            if (!changedId.isEmpty())
+                emit relationsChanged(changedId);
+        }));
+    for (auto* u: users())
+    {
+        const auto markerIt = readMarker(u);
+        if (markerIt != timelineEdge())
+            m_receipts.move(u, (*markerIt)->id());
+    }
+    m_materializedConnections.push_back(
+        connect(this, &Room::readMarkerForUserMoved, this,
+            [this] (User* u, const QString&, const QString& toEventId) {
+                const auto fromEventId = m_receipts.move(u, toEventId);
+                if (fromEventId != toEventId)
+                    emit readReceiptMoved(fromEventId, toEventId);
+            }));
+    m_materializedConnections.push_back(
+        connect(this, &Room::userRemoved, this, [this] (User* u) {
+            const auto fromEventId = m_receipts.eventIdFor(u);
+            if (fromEventId.isEmpty())
+                return;
+            m_receipts.remove(u);
+            emit readReceiptMoved(fromEventId, {});
+        }));
+    rescanHighlights();
+    IngestionPipeline::instance()->submit(this, messageEvents().cbegin(),
+        messageEvents().cend(), false, RelationsProcessor::StageName);
+    emit materialized();
+}
+
+void QuaternionRoom::dematerialize()
+{
+    if (!m_materialized || displayed())
+        return;
+
+    for (const auto& c: qAsConst(m_materializedConnections))
+        disconnect(c);
+    m_materializedConnections.clear();
+    m_materialized = false;
+    m_highlightEngine.reset();
+    highlights.clear();
+    highlights.shrink_to_fit();
+    ++m_scanGeneration; // Drop highlights still in the pipeline
+    m_relations.clear();
+    m_receipts.clear();
+    emit highlightsChanged();
+}
+
+RoomMemoryUsage QuaternionRoom::memoryUsage() const
+{
+    RoomMemoryUsage usage;
+    usage.events = m_accountedEvents;
+    usage.timeline = m_timelineFootprint;
+    usage.highlights = qint64(highlights.size() * sizeof(index_t));
+    usage.members = users().size();
+    usage.memberList = usage.members * MemoryUsage::ofMember();
+    usage.relations = m_relations.memoryFootprint();
+    usage.receipts = m_receipts.memoryFootprint();
+    usage.memberHistory = m_memberHistory.memoryFootprint();
+    return usage;
 }
 
 int QuaternionRoom::savedTopVisibleIndex() const
@@ -78,6 +200,8 @@ void QuaternionRoom::saveViewport(int topIndex, int bottomIndex)
 
 void QuaternionRoom::countChanged()
 {
+    if (!m_materialized && highlightCount() > 0)
+        materialize();
     if( displayed() && !hasUnreadMessages() )
     {
         resetNotificationCount();
@@ -87,26 +211,96 @@ void QuaternionRoom::countChanged()
 
 void QuaternionRoom::onAddNewTimelineEvents(timeline_iter_t from)
 {
-    std::for_each(from, messageEvents().cend(),
-                  [this] (const TimelineItem& ti) { checkForHighlights(ti); });
+    TRACE_SPAN_ARG("QuaternionRoom::onAddNewTimelineEvents", "sync",
+                   "events", messageEvents().cend() - from);
+    // Member histories are needed by the views right away, and member
+    // events are rare enough to not bother the pipeline with them
+    for (auto it = from; it != messageEvents().cend(); ++it)
+        m_memberHistory.add(*it);
+    IngestionPipeline::instance()->submit(this, from, messageEvents().cend(),
+                                          false);
 }
 
 void QuaternionRoom::onAddHistoricalTimelineEvents(rev_iter_t from)
 {
-    std::for_each(from, messageEvents().crend(),
-                  [this] (const TimelineItem& ti) { checkForHighlights(ti); });
+    TRACE_SPAN_ARG("QuaternionRoom::onAddHistoricalTimelineEvents", "sync",
+                   "events", messageEvents().crend() - from);
+    for (auto it = from; it != messageEvents().crend(); ++it)
+        m_memberHistory.add(*it);
+    // Historical events go from the newest to the oldest; but the pipeline
+    // doesn't care about the order, so just take them as a forward range.
+    IngestionPipeline::instance()->submit(this, messageEvents().cbegin(),
+                                          from.base(), true);
 }
 
-void QuaternionRoom::checkForHighlights(const QMatrixClient::TimelineItem& ti)
+std::shared_ptr<const HighlightEngine> QuaternionRoom::highlightEngine()
 {
-    auto localUserId = localUser()->id();
-    if (ti->senderId() == localUserId)
-        return;
-    if (auto* e = ti.viewAs<RoomMessageEvent>())
+    const auto currentGeneration = HighlightEngine::settingsGeneration();
+    if (!m_highlightEngine || m_engineGeneration != currentGeneration)
     {
-        const auto& text = e->plainBody();
-        if (text.contains(localUserId) ||
-                text.contains(roomMembername(localUserId)))
-            highlights.insert(e);
+        const auto& localUserId = localUser()->id();
+        m_highlightEngine = HighlightEngine::fromSettings(
+                { localUserId, roomMembername(localUserId) });
+        m_engineGeneration = currentGeneration;
     }
+    return m_highlightEngine;
+}
+
+void QuaternionRoom::rescanHighlights()
+{
+    m_highlightEngine.reset();
+    highlights.clear();
+    ++m_scanGeneration;
+    IngestionPipeline::instance()->submit(this, messageEvents().cbegin(),
+        messageEvents().cend(), false, HighlightProcessor::StageName);
+    emit highlightsChanged();
+}
+
+void QuaternionRoom::addHighlights(const QVector<index_t>& indices,
+                                   int scanGeneration)
+{
+    if (scanGeneration != m_scanGeneration)
+        return; // The results are superseded by a newer rescan
+    for (const auto index: indices)
+        addHighlight(index);
+    emit highlightsChanged();
+}
+
+void QuaternionRoom::addHighlight(index_t index)
+{
+    // New events go to the back and historical ones to the front; anything
+    // else only happens when batches get published out of order.
+    if (highlights.empty() || index > highlights.back())
+        highlights.push_back(index);
+    else if (index < highlights.front())
+        highlights.push_front(index);
+    else
+    {
+        const auto it =
+            std::lower_bound(highlights.begin(), highlights.end(), index);
+        if (*it != index)
+            highlights.insert(it, index);
+    }
+}
+
+void QuaternionRoom::addRelations(
+        const QVector<RelationsIndex::Record>& records)
+{
+    if (!m_materialized)
+        return; // Dematerialized while the records were in the pipeline
+    QStringList changedIds;
+    for (const auto& r: records)
+    {
+        const auto changedId = m_relations.add(r);
+        if (!changedId.isEmpty() && !changedIds.contains(changedId))
+            changedIds.push_back(changedId);
+    }
+    for (const auto& id: changedIds)
+        emit relationsChanged(id);
+}
+
+void QuaternionRoom::addTimelineFootprint(int events, qint64 bytes)
+{
+    m_accountedEvents += events;
+    m_timelineFootprint += bytes;
 }
@@ -19,8 +19,18 @@
 
 #pragma once
 
+#include "relationsindex.h"
+#include "receiptindex.h"
+#include "memberhistoryindex.h"
+#include "memoryusage.h"
+
 #include <room.h>
 
+#include <deque>
+#include <memory>
+
+class HighlightEngine;
+
 class QuaternionRoom: public QMatrixClient::Room
 {
         Q_OBJECT
@@ -31,21 +41,96 @@ class QuaternionRoom: public QMatrixClient::Room
         const QString& cachedInput() const;
         void setCachedInput(const QString& input);
 
-        bool isEventHighlighted(const QMatrixClient::RoomEvent* e) const;
+        bool isEventHighlighted(QMatrixClient::TimelineItem::index_t index) const;
+        /// Reactions, edits and replies known for materialized rooms
+        const RelationsIndex& relations() const;
+        /// Members grouped by their read receipts, for materialized rooms
+        const ReceiptIndex& readReceipts() const;
+        /// Past names and avatars of members, over the loaded timeline
+        /**
+         * Unlike the other indices, this one is kept for stub rooms too:
+         * it only grows with member events and doesn't have to be rebuilt
+         * from the whole timeline on each materialize().
+         */
+        const MemberHistoryIndex& memberHistory() const;
+
+        /// Whether the client-side room data has been built
+        /**
+         * Rooms start as lightweight stubs that only carry what the library
+         * provides for the room list and notifications. The client-side data
+         * (highlights and the helper connections to maintain them) is built
+         * by materialize() when the room is first selected or when
+         * a highlight arrives for it.
+         */
+        bool isMaterialized() const;
+        /// Build the client-side room data, if not done yet
+        /**
+         * If the room is already materialized but the highlight settings
+         * have changed since, highlights are looked for again.
+         */
+        void materialize();
+        /// Drop the client-side room data to save memory
+        /**
+         * The room goes back to being a stub, until materialize() is
+         * called again. The timeline itself is kept by the library and
+         * stays. Does nothing for the room being displayed.
+         */
+        void dematerialize();
+
+        /// Estimate the memory taken by the room data
+        RoomMemoryUsage memoryUsage() const;
 
         Q_INVOKABLE int savedTopVisibleIndex() const;
         Q_INVOKABLE int savedBottomVisibleIndex() const;
         Q_INVOKABLE void saveViewport(int topIndex, int bottomIndex);
 
+    signals:
+        void materialized();
+        /// Emitted when highlights are found or reset
+        /**
+         * Highlights are looked for on worker threads, so they show up
+         * shortly after the events themselves.
+         */
+        void highlightsChanged();
+        /// Emitted once for each event whose relations have changed
+        void relationsChanged(const QString& eventId);
+        /// Emitted when a member's read receipt moves between two events
+        void readReceiptMoved(const QString& fromEventId,
+                              const QString& toEventId);
+
     private slots:
         void countChanged();
 
     private:
-        QSet<const QMatrixClient::RoomEvent*> highlights;
+        using index_t = QMatrixClient::TimelineItem::index_t;
+
+        /// Timeline indices of highlighted events, in ascending order
+        std::deque<index_t> highlights;
+        RelationsIndex m_relations;
+        ReceiptIndex m_receipts;
+        MemberHistoryIndex m_memberHistory;
+        std::shared_ptr<const HighlightEngine> m_highlightEngine;
+        int m_engineGeneration = -1;
+        /// Incremented on each full rescan, to drop results of stale scans
+        int m_scanGeneration = 0;
         QString m_cachedInput;
+        bool m_materialized = false;
+        /// Connections made by materialize(), undone by dematerialize()
+        QVector<QMetaObject::Connection> m_materializedConnections;
+        int m_accountedEvents = 0;
+        qint64 m_timelineFootprint = 0;
 
         void onAddNewTimelineEvents(timeline_iter_t from) override;
         void onAddHistoricalTimelineEvents(rev_iter_t from) override;
 
-        void checkForHighlights(const QMatrixClient::TimelineItem& ti);
+        std::shared_ptr<const HighlightEngine> highlightEngine();
+        void rescanHighlights();
+        void addHighlights(const QVector<index_t>& indices, int scanGeneration);
+        void addHighlight(index_t index);
+        void addRelations(const QVector<RelationsIndex::Record>& records);
+        void addTimelineFootprint(int events, qint64 bytes);
+
+        friend class HighlightProcessor;
+        friend class RelationsProcessor;
+        friend class MemoryAccountingProcessor;
 };
@@ -0,0 +1,90 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "readreceiptscheduler.h"
+
+#include "quaternionroom.h"
+
+#include <QtCore/QTimerEvent>
+
+#include <algorithm>
+#include <utility>
+
+// Receipts are not urgent; one batch a second is plenty even when the user
+// is actively scrolling through a busy room.
+static const int FlushIntervalMs = 1000;
+
+ReadReceiptScheduler::ReadReceiptScheduler(QObject* parent)
+    : QObject(parent)
+{ }
+
+ReadReceiptScheduler::~ReadReceiptScheduler()
+{
+    flush();
+}
+
+void ReadReceiptScheduler::schedule(QuaternionRoom* room,
+                                    const QString& eventId)
+{
+    Q_ASSERT(room);
+    const auto newIt = room->findInTimeline(eventId);
+    if (newIt == room->timelineEdge())
+    {
+        qWarning() << "ReadReceiptScheduler: event" << eventId
+                   << "is not in the timeline of" << room->objectName();
+        return;
+    }
+    const auto rm = room->readMarker();
+    if (rm != room->timelineEdge() && rm->index() >= newIt->index())
+        return; // Already read
+
+    auto it = std::find_if(pending.begin(), pending.end(),
+                           [room] (const PendingReceipt& r) {
+                               return r.room == room;
+                           });
+    if (it == pending.end())
+        pending.push_back({ room, eventId });
+    else
+    {
+        const auto oldIt = room->findInTimeline(it->eventId);
+        if (oldIt != room->timelineEdge() && oldIt->index() >= newIt->index())
+            return;
+        it->eventId = eventId;
+    }
+
+    if (!flushTimer.isActive())
+        flushTimer.start(FlushIntervalMs, this);
+}
+
+void ReadReceiptScheduler::flush()
+{
+    flushTimer.stop();
+    const auto receipts = std::exchange(pending, {});
+    for (const auto& r: receipts)
+        if (r.room)
+            r.room->markMessagesAsRead(r.eventId);
+}
+
+void ReadReceiptScheduler::timerEvent(QTimerEvent* event)
+{
+    if (event->timerId() == flushTimer.timerId())
+        flush();
+    else
+        QObject::timerEvent(event);
+}
@@ -0,0 +1,66 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QBasicTimer>
+#include <QtCore/QPointer>
+#include <QtCore/QVector>
+
+class QuaternionRoom;
+
+/// Coalesces read receipts before sending them to the server
+/**
+ * Marking messages as read results in a network request; since the user
+ * activity that triggers it comes in bursts, receipts are collected here
+ * and sent together once in a while. Only the newest event is kept for each
+ * room, and receipts for all rooms (and all connections) are sent at once.
+ */
+class ReadReceiptScheduler : public QObject
+{
+        Q_OBJECT
+    public:
+        explicit ReadReceiptScheduler(QObject* parent = nullptr);
+        /// Sends the receipts still scheduled
+        ~ReadReceiptScheduler() override;
+
+        /// Schedule marking messages up to \p eventId as read in \p room
+        /**
+         * Does nothing if the same or a newer event is already scheduled for
+         * the room or if the read marker is already at or below the event.
+         */
+        void schedule(QuaternionRoom* room, const QString& eventId);
+
+    public slots:
+        /// Send all scheduled receipts right now
+        void flush();
+
+    protected:
+        void timerEvent(QTimerEvent* event) override;
+
+    private:
+        struct PendingReceipt
+        {
+            QPointer<QuaternionRoom> room;
+            QString eventId;
+        };
+        QVector<PendingReceipt> pending;
+        QBasicTimer flushTimer;
+};
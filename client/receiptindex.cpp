@@ -0,0 +1,90 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "receiptindex.h"
+
+#include "memoryusage.h"
+
+QString ReceiptIndex::move(User* user, const QString& toEventId)
+{
+    const auto posIt = m_positions.find(user);
+    const auto fromEventId =
+        posIt != m_positions.end() ? posIt->eventId : QString();
+    if (fromEventId == toEventId)
+        return fromEventId;
+
+    if (posIt != m_positions.end())
+    {
+        auto it = m_readersByEvent.find(fromEventId);
+        if (it != m_readersByEvent.end())
+        {
+            // Put the last reader in place of the one leaving
+            auto* last = it->takeLast();
+            if (last != user)
+            {
+                (*it)[posIt->index] = last;
+                m_positions[last].index = posIt->index;
+            }
+            if (it->isEmpty())
+                m_readersByEvent.erase(it);
+        }
+    }
+    if (toEventId.isEmpty())
+        m_positions.remove(user);
+    else
+    {
+        auto& readers = m_readersByEvent[toEventId];
+        m_positions.insert(user, { toEventId, readers.size() });
+        readers.push_back(user);
+    }
+    return fromEventId;
+}
+
+void ReceiptIndex::remove(User* user)
+{
+    move(user, {});
+}
+
+void ReceiptIndex::clear()
+{
+    m_readersByEvent.clear();
+    m_positions.clear();
+}
+
+qint64 ReceiptIndex::memoryFootprint() const
+{
+    // Event ids are shared between the two hashes
+    static const qint64 EntryOverheadBytes = 48;
+    qint64 result = 0;
+    for (auto it = m_readersByEvent.cbegin(); it != m_readersByEvent.cend();
+         ++it)
+        result += EntryOverheadBytes + MemoryUsage::ofString(it.key())
+                  + it->size() * qint64(sizeof(User*));
+    return result + m_positions.size() * EntryOverheadBytes;
+}
+
+QVector<ReceiptIndex::User*> ReceiptIndex::readers(const QString& eventId) const
+{
+    return m_readersByEvent.value(eventId);
+}
+
+QString ReceiptIndex::eventIdFor(User* user) const
+{
+    return m_positions.value(user).eventId;
+}
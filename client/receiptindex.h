@@ -0,0 +1,61 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+namespace QMatrixClient
+{
+    class User;
+}
+
+/// Groups room members by the events their read receipts point to
+/**
+ * Each member is in exactly one bucket and knows its position there; when
+ * a receipt moves, the member is swapped out of one bucket and appended to
+ * another, so the cost of an update doesn't depend on the room size.
+ */
+class ReceiptIndex
+{
+    public:
+        using User = QMatrixClient::User;
+
+        /// Move the user's receipt to the event; returns the previous event
+        QString move(User* user, const QString& toEventId);
+        void remove(User* user);
+        void clear();
+
+        /// Members whose read receipts are at the event, in no particular order
+        QVector<User*> readers(const QString& eventId) const;
+        QString eventIdFor(User* user) const;
+        /// Estimated memory taken by the index, in bytes
+        qint64 memoryFootprint() const;
+
+    private:
+        struct Position
+        {
+            QString eventId;
+            int index;
+        };
+
+        QHash<QString, QVector<User*>> m_readersByEvent;
+        QHash<User*, Position> m_positions;
+};
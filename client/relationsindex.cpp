@@ -0,0 +1,216 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "relationsindex.h"
+
+#include "memoryusage.h"
+#include "quaternionroom.h"
+
+#include <QtCore/QJsonObject>
+
+#include <algorithm>
+
+bool RelationsIndex::parse(const EventSnapshot& event, Record* record)
+{
+    if (event.isRedacted)
+        return false;
+
+    const auto relatesTo = event.contentJson.value("m.relates_to").toObject();
+    if (relatesTo.isEmpty())
+        return false;
+
+    *record = { Record::Reply, event.id, event.senderId, event.index, {}, {} };
+    const auto relType = relatesTo.value("rel_type").toString();
+    if (relType == "m.annotation" && event.matrixType == "m.reaction")
+    {
+        record->kind = Record::Annotation;
+        record->targetId = relatesTo.value("event_id").toString();
+        record->payload = relatesTo.value("key").toString();
+        return !record->targetId.isEmpty() && !record->payload.isEmpty();
+    }
+    if (relType == "m.replace")
+    {
+        record->kind = Record::Replacement;
+        record->targetId = relatesTo.value("event_id").toString();
+        record->payload = event.contentJson.value("m.new_content").toObject()
+                                .value("body").toString();
+        return !record->targetId.isEmpty();
+    }
+    record->targetId = relatesTo.value("m.in_reply_to").toObject()
+                                .value("event_id").toString();
+    return !record->targetId.isEmpty();
+}
+
+QString RelationsIndex::add(const Record& record)
+{
+    if (m_byRelationEvent.contains(record.eventId))
+        return {}; // Already there, e.g. after rescanning
+    m_byRelationEvent.insert(record.eventId, record);
+
+    switch (record.kind)
+    {
+        case Record::Annotation:
+        {
+            auto& reactions = m_byTarget[record.targetId].reactions;
+            auto it = std::find_if(reactions.begin(), reactions.end(),
+                [&record] (const Reaction& r) { return r.key == record.payload; });
+            if (it == reactions.end())
+                it = reactions.insert(reactions.end(), { record.payload, {} });
+            if (it->senders.contains(record.senderId))
+                return {};
+            it->senders.push_back(record.senderId);
+            return record.targetId;
+        }
+        case Record::Replacement:
+        {
+            auto& edits = m_byTarget[record.targetId].edits;
+            const Edit edit { record.eventId, record.senderId, record.index,
+                              record.payload };
+            edits.insert(std::upper_bound(edits.begin(), edits.end(), edit,
+                [] (const Edit& e1, const Edit& e2) {
+                    return e1.index < e2.index;
+                }), edit);
+            return record.targetId;
+        }
+        case Record::Reply:
+            return record.eventId;
+    }
+    return {};
+}
+
+QString RelationsIndex::remove(const QString& relationEventId)
+{
+    const auto record = m_byRelationEvent.take(relationEventId);
+    if (record.eventId.isEmpty())
+        return {};
+
+    auto aggregationIt = m_byTarget.find(record.targetId);
+    switch (record.kind)
+    {
+        case Record::Annotation:
+        {
+            if (aggregationIt == m_byTarget.end())
+                return {};
+            auto& reactions = aggregationIt->reactions;
+            const auto it = std::find_if(reactions.begin(), reactions.end(),
+                [&record] (const Reaction& r) { return r.key == record.payload; });
+            if (it == reactions.end() || !it->senders.removeOne(record.senderId))
+                return {};
+            if (it->senders.isEmpty())
+                reactions.erase(it);
+            break;
+        }
+        case Record::Replacement:
+        {
+            if (aggregationIt == m_byTarget.end())
+                return {};
+            auto& edits = aggregationIt->edits;
+            edits.erase(std::remove_if(edits.begin(), edits.end(),
+                [&record] (const Edit& e) {
+                    return e.eventId == record.eventId;
+                }), edits.end());
+            break;
+        }
+        case Record::Reply:
+            return record.eventId;
+    }
+    if (aggregationIt->reactions.isEmpty() && aggregationIt->edits.isEmpty())
+        m_byTarget.erase(aggregationIt);
+    return record.targetId;
+}
+
+void RelationsIndex::clear()
+{
+    m_byTarget.clear();
+    m_byRelationEvent.clear();
+}
+
+qint64 RelationsIndex::memoryFootprint() const
+{
+    // Strings in aggregations are shared with the records
+    static const qint64 EntryOverheadBytes = 64;
+    qint64 result = 0;
+    for (auto it = m_byRelationEvent.cbegin(); it != m_byRelationEvent.cend();
+         ++it)
+        result += EntryOverheadBytes + MemoryUsage::ofString(it.key())
+                  + MemoryUsage::ofString(it->senderId)
+                  + MemoryUsage::ofString(it->targetId)
+                  + MemoryUsage::ofString(it->payload);
+    return result + m_byTarget.size() * EntryOverheadBytes;
+}
+
+QVector<RelationsIndex::Reaction>
+RelationsIndex::reactions(const QString& eventId) const
+{
+    return m_byTarget.value(eventId).reactions;
+}
+
+const RelationsIndex::Edit*
+RelationsIndex::latestEdit(const QString& eventId, const QString& authorId) const
+{
+    const auto it = m_byTarget.constFind(eventId);
+    if (it == m_byTarget.cend())
+        return nullptr;
+    // Only the author can edit a message
+    const auto& edits = it->edits;
+    const auto editIt = std::find_if(edits.crbegin(), edits.crend(),
+        [&authorId] (const Edit& e) { return e.senderId == authorId; });
+    return editIt != edits.crend() ? &*editIt : nullptr;
+}
+
+QString RelationsIndex::replyTarget(const QString& eventId) const
+{
+    const auto it = m_byRelationEvent.constFind(eventId);
+    return it != m_byRelationEvent.cend() && it->kind == Record::Reply
+            ? it->targetId : QString();
+}
+
+const QString RelationsProcessor::StageName = QStringLiteral("relations");
+
+QString RelationsProcessor::name() const
+{
+    return StageName;
+}
+
+QStringList RelationsProcessor::eventTypes() const
+{
+    return { QStringLiteral("m.reaction"), QStringLiteral("m.room.message") };
+}
+
+int RelationsProcessor::snapshotParts() const
+{
+    return EventSnapshot::ContentJsonPart;
+}
+
+TimelineProcessor::Job RelationsProcessor::prepare(QuaternionRoom* room)
+{
+    if (!room->isMaterialized())
+        return {}; // materialize() will go through the whole timeline anyway
+
+    return [] (const EventBatch& batch) -> Publisher {
+        QVector<RelationsIndex::Record> records;
+        RelationsIndex::Record record;
+        for (const auto& e: batch.events)
+            if (RelationsIndex::parse(e, &record))
+                records.push_back(record);
+        if (records.isEmpty())
+            return {};
+        return [records] (QuaternionRoom* r) { r->addRelations(records); };
+    };
+}
@@ -0,0 +1,109 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include "timelineprocessor.h"
+
+#include <QtCore/QHash>
+
+/// Aggregates reactions, edits and replies by the events they refer to
+/**
+ * Relations are added as events arrive, in whichever direction, and can
+ * be removed when relation events get redacted; lookups are hash-based,
+ * so that timeline delegates can get aggregated data in O(1).
+ */
+class RelationsIndex
+{
+    public:
+        using index_t = QMatrixClient::TimelineItem::index_t;
+
+        struct Record
+        {
+            enum Kind { Annotation, Replacement, Reply };
+
+            Kind kind;
+            QString eventId;
+            QString senderId;
+            index_t index;
+            QString targetId;
+            /// The reaction key for annotations, the new body for edits
+            QString payload;
+        };
+
+        struct Reaction
+        {
+            QString key;
+            QStringList senders;
+        };
+
+        struct Edit
+        {
+            QString eventId;
+            QString senderId;
+            index_t index;
+            QString newBody;
+        };
+
+        /// Get a relation from the event, if there's one; thread-safe
+        static bool parse(const EventSnapshot& event, Record* record);
+
+        /// Add a relation; returns the id of the event it changes, if any
+        /**
+         * For annotations and replacements, this is the target event;
+         * for replies, the reply itself (the target doesn't change).
+         */
+        QString add(const Record& record);
+        /// Forget the relation made by the event; returns the changed event
+        QString remove(const QString& relationEventId);
+        void clear();
+
+        QVector<Reaction> reactions(const QString& eventId) const;
+        /// The latest edit of the event made by its author, or nullptr
+        const Edit* latestEdit(const QString& eventId,
+                               const QString& authorId) const;
+        /// The event that the given event replies to, if it's a reply
+        QString replyTarget(const QString& eventId) const;
+        /// Estimated memory taken by the index, in bytes
+        qint64 memoryFootprint() const;
+
+    private:
+        struct Aggregation
+        {
+            QVector<Reaction> reactions;
+            /// Sorted by timeline index, so the latest edit is the last one
+            QVector<Edit> edits;
+        };
+
+        QHash<QString, Aggregation> m_byTarget;
+        /// Relations by the events that make them, to undo on redaction
+        QHash<QString, Record> m_byRelationEvent;
+};
+
+/// Keeps relations indices of materialized rooms up to date
+class RelationsProcessor: public TimelineProcessor
+{
+    public:
+        static const QString StageName;
+
+        QString name() const override;
+        QStringList eventTypes() const override;
+        int snapshotParts() const override;
+        Job prepare(QuaternionRoom* room) override;
+};
@@ -0,0 +1,410 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "roomfindbar.h"
+
+#include "models/messageeventmodel.h"
+
+#include <events/roommessageevent.h>
+#include <networkaccessmanager.h>
+
+#include <QtNetwork/QNetworkReply>
+#include <QtCore/QStringMatcher>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtWidgets/QAction>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QPushButton>
+#include <QtWidgets/QToolButton>
+#include <QtWidgets/QListWidget>
+#include <QtWidgets/QHBoxLayout>
+#include <QtWidgets/QVBoxLayout>
+
+#include <algorithm>
+#include <iterator>
+
+using QMatrixClient::TimelineItem;
+
+static const int ChunkSize = 256;
+static const int TypingDelayMs = 300;
+static const int OlderPageSize = 100;
+/// "Search older" loads up to this many pages until something is found
+static const int MaxOlderPages = 10;
+static const int SnippetContext = 40;
+
+struct ScanItem
+{
+    RoomFindBar::index_t index;
+    QString eventId;
+    QString body;
+};
+
+/// Looks for the pattern in a chunk of messages, on a worker thread
+struct ChunkScanner
+{
+    using result_type = QVector<RoomFindBar::Match>;
+
+    QStringMatcher matcher;
+
+    result_type operator()(const QVector<ScanItem>& chunk) const
+    {
+        result_type result;
+        for (const auto& item: chunk)
+        {
+            const auto pos = matcher.indexIn(item.body);
+            if (pos == -1)
+                continue;
+            const auto start = std::max(0, pos - SnippetContext);
+            auto snippet = item.body.mid(start,
+                    matcher.pattern().size() + 2 * SnippetContext).simplified();
+            if (start > 0)
+                snippet.prepend(QChar(0x2026)); // Horizontal ellipsis
+            result.push_back({ item.index, item.eventId, snippet });
+        }
+        return result;
+    }
+};
+
+RoomFindBar::RoomFindBar(MessageEventModel* model, QWidget* parent)
+    : QWidget(parent)
+    , m_model(model)
+    , m_patternEdit(new QLineEdit)
+    , m_statusLabel(new QLabel)
+    , m_olderButton(new QPushButton(tr("Search older")))
+    , m_matchList(new QListWidget)
+{
+    m_patternEdit->setPlaceholderText(tr("Find in the room"));
+    m_patternEdit->setClearButtonEnabled(true);
+    m_typingTimer.setSingleShot(true);
+    m_typingTimer.setInterval(TypingDelayMs);
+    connect(&m_typingTimer, &QTimer::timeout,
+            this, &RoomFindBar::startSearch);
+    connect(m_patternEdit, &QLineEdit::textChanged,
+            &m_typingTimer, static_cast<void(QTimer::*)()>(&QTimer::start));
+    connect(m_patternEdit, &QLineEdit::returnPressed, this, [this] {
+        if (m_patternEdit->text() != m_pattern)
+            startSearch();
+        else
+            findNext();
+    });
+
+    auto* previousButton = new QToolButton;
+    previousButton->setArrowType(Qt::UpArrow);
+    previousButton->setToolTip(tr("Newer match"));
+    connect(previousButton, &QToolButton::clicked,
+            this, &RoomFindBar::findPrevious);
+    auto* nextButton = new QToolButton;
+    nextButton->setArrowType(Qt::DownArrow);
+    nextButton->setToolTip(tr("Older match"));
+    connect(nextButton, &QToolButton::clicked, this, &RoomFindBar::findNext);
+    m_olderButton->setToolTip(
+        tr("Load older messages from the server and look through them"));
+    connect(m_olderButton, &QPushButton::clicked,
+            this, &RoomFindBar::searchOlder);
+    // A page without messages doesn't emit addedMessages(); the reply
+    // is the only way to know that the history has ended
+    connect(QMatrixClient::NetworkAccessManager::instance(),
+            &QNetworkAccessManager::finished,
+            this, &RoomFindBar::replyFinished);
+    auto* closeButton = new QToolButton;
+    closeButton->setText(tr("Close"));
+    connect(closeButton, &QToolButton::clicked,
+            this, &RoomFindBar::deactivate);
+
+    m_matchList->setUniformItemSizes(true);
+    m_matchList->setMaximumHeight(fontMetrics().height() * 8);
+    connect(m_matchList, &QListWidget::currentRowChanged,
+            this, &RoomFindBar::currentMatchChanged);
+
+    const auto addShortcut = [this] (const QKeySequence& keys,
+                                     void (RoomFindBar::*slot)()) {
+        auto* action = new QAction(this);
+        action->setShortcut(keys);
+        action->setShortcutContext(Qt::WidgetWithChildrenShortcut);
+        connect(action, &QAction::triggered, this, slot);
+        addAction(action);
+    };
+    addShortcut(Qt::Key_Escape, &RoomFindBar::deactivate);
+    addShortcut(QKeySequence::FindNext, &RoomFindBar::findNext);
+    addShortcut(QKeySequence::FindPrevious, &RoomFindBar::findPrevious);
+
+    auto* topLayout = new QHBoxLayout;
+    topLayout->addWidget(m_patternEdit, 1);
+    topLayout->addWidget(m_statusLabel);
+    topLayout->addWidget(previousButton);
+    topLayout->addWidget(nextButton);
+    topLayout->addWidget(m_olderButton);
+    topLayout->addWidget(closeButton);
+    auto* layout = new QVBoxLayout;
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addLayout(topLayout);
+    layout->addWidget(m_matchList);
+    setLayout(layout);
+    updateStatus();
+}
+
+void RoomFindBar::setRoom(QuaternionRoom* room)
+{
+    if (m_room)
+        m_room->disconnect(this);
+    m_room = room;
+    m_olderInFlight = false;
+    if (m_room)
+        connect(m_room, &QuaternionRoom::addedMessages,
+                this, [this] (int, int biggest) {
+                    // Syncs add new events; only history completes a page
+                    if (biggest < m_room->maxTimelineIndex())
+                        m_olderInFlight = false;
+                    scanNewEvents();
+                });
+    m_pattern.clear(); // Make startSearch() start anew
+    if (isVisible())
+        startSearch();
+}
+
+void RoomFindBar::activate()
+{
+    show();
+    m_patternEdit->setFocus();
+    m_patternEdit->selectAll();
+    startSearch();
+}
+
+void RoomFindBar::deactivate()
+{
+    hide();
+    m_typingTimer.stop();
+    cancelScans();
+    m_pattern.clear();
+    m_matches.clear();
+    m_matchList->clear();
+    m_model->clearSearchMatches();
+}
+
+void RoomFindBar::findNext()
+{
+    if (!m_matches.isEmpty())
+        m_matchList->setCurrentRow(
+            std::min(m_matchList->currentRow() + 1, m_matches.size() - 1));
+}
+
+void RoomFindBar::findPrevious()
+{
+    if (!m_matches.isEmpty())
+        m_matchList->setCurrentRow(
+            std::max(m_matchList->currentRow() - 1, 0));
+}
+
+void RoomFindBar::startSearch()
+{
+    m_typingTimer.stop();
+    const auto pattern = m_patternEdit->text();
+    if (pattern == m_pattern && !m_pattern.isEmpty())
+        return;
+
+    cancelScans();
+    m_pattern = pattern;
+    m_matches.clear();
+    m_currentEventId.clear();
+    m_matchList->clear();
+    m_model->clearSearchMatches();
+    m_olderPagesLeft = 0;
+    if (m_room && !m_pattern.isEmpty())
+    {
+        // Indices grow from 0 for new events and go down from -1 for
+        // historical ones; so this also works for an empty timeline.
+        const auto& timeline = m_room->messageEvents();
+        m_newestScanned = timeline.empty() ? -1 : timeline.back().index();
+        m_oldestScanned = timeline.empty() ? 0 : timeline.front().index();
+        scan(timeline.crbegin(), timeline.crend());
+    }
+    updateStatus();
+}
+
+void RoomFindBar::searchOlder()
+{
+    if (!m_room || m_pattern.isEmpty())
+        return;
+    m_olderPagesLeft = MaxOlderPages;
+    m_matchesBeforeOlder = m_matches.size();
+    if (!m_olderInFlight)
+        requestOlderPage();
+    updateStatus();
+}
+
+void RoomFindBar::replyFinished(QNetworkReply* reply)
+{
+    if (!m_room || !m_olderInFlight)
+        return;
+    const auto path = QUrl::fromPercentEncoding(reply->url().path().toUtf8());
+    if (!path.endsWith(QStringLiteral("/rooms/") + m_room->id()
+                       + QStringLiteral("/messages")))
+        return;
+
+    // The manager reports the reply before the job processes it; if
+    // the page hasn't added anything by the next turn of the event loop,
+    // there's no more history (or loading has failed).
+    QTimer::singleShot(0, this,
+        [this, room = m_room, requestNumber = m_olderRequestNumber] {
+        if (m_room != room || !m_olderInFlight
+                || m_olderRequestNumber != requestNumber)
+            return;
+        m_olderInFlight = false;
+        m_olderPagesLeft = 0;
+        updateStatus();
+    });
+}
+
+void RoomFindBar::requestOlderPage()
+{
+    --m_olderPagesLeft;
+    m_olderInFlight = true;
+    ++m_olderRequestNumber;
+    m_room->getPreviousContent(OlderPageSize);
+}
+
+void RoomFindBar::continueSearchingOlder()
+{
+    if (m_olderPagesLeft <= 0 || m_olderInFlight || !m_activeScans.isEmpty())
+        return;
+    if (m_matches.size() > m_matchesBeforeOlder)
+        m_olderPagesLeft = 0; // Found something, let the user look at it
+    else
+        requestOlderPage();
+    updateStatus();
+}
+
+void RoomFindBar::cancelScans()
+{
+    for (auto* watcher: m_activeScans)
+    {
+        watcher->disconnect(this);
+        watcher->cancel();
+        watcher->deleteLater();
+    }
+    m_activeScans.clear();
+}
+
+void RoomFindBar::scanNewEvents()
+{
+    if (!m_room || m_pattern.isEmpty() || m_room->messageEvents().empty())
+        return;
+
+    // The timeline is sorted by index; new events are at its back and
+    // historical ones at its front. Either way, scan newest first.
+    const auto& timeline = m_room->messageEvents();
+    const auto newerBegin =
+        std::upper_bound(timeline.cbegin(), timeline.cend(), m_newestScanned,
+            [] (index_t i, const TimelineItem& ti) { return i < ti.index(); });
+    scan(timeline.crbegin(), std::make_reverse_iterator(newerBegin));
+    const auto olderEnd =
+        std::lower_bound(timeline.cbegin(), timeline.cend(), m_oldestScanned,
+            [] (const TimelineItem& ti, index_t i) { return ti.index() < i; });
+    scan(std::make_reverse_iterator(olderEnd), timeline.crend());
+    m_newestScanned = timeline.back().index();
+    m_oldestScanned = timeline.front().index();
+
+    continueSearchingOlder(); // In case there was nothing to scan
+}
+
+void RoomFindBar::scan(QuaternionRoom::rev_iter_t from,
+                       QuaternionRoom::rev_iter_t to)
+{
+    // Copy the texts, so that the timeline can change while workers scan
+    QVector<QVector<ScanItem>> chunks;
+    for (auto it = from; it != to; ++it)
+    {
+        const TimelineItem& ti = *it;
+        if (auto* e = ti.viewAs<QMatrixClient::RoomMessageEvent>())
+        {
+            if (chunks.isEmpty() || chunks.back().size() == ChunkSize)
+            {
+                chunks.push_back({});
+                chunks.back().reserve(ChunkSize);
+            }
+            chunks.back().push_back({ ti.index(), e->id(), e->plainBody() });
+        }
+    }
+    if (chunks.isEmpty())
+        return;
+
+    auto* watcher = new Watcher(this);
+    connect(watcher, &Watcher::resultReadyAt, this, [this, watcher] (int i) {
+        addMatches(watcher->resultAt(i));
+    });
+    connect(watcher, &Watcher::finished, this, [this, watcher] {
+        m_activeScans.removeOne(watcher);
+        watcher->deleteLater();
+        continueSearchingOlder();
+        updateStatus();
+    });
+    m_activeScans.push_back(watcher);
+    watcher->setFuture(QtConcurrent::mapped(chunks,
+        ChunkScanner { QStringMatcher(m_pattern, Qt::CaseInsensitive) }));
+}
+
+void RoomFindBar::addMatches(const QVector<Match>& matches)
+{
+    if (matches.isEmpty())
+        return;
+
+    // Chunks finish in arbitrary order; keep the list sorted, newest first
+    QVector<index_t> indices;
+    indices.reserve(matches.size());
+    for (const auto& m: matches)
+    {
+        const auto row = int(std::lower_bound(m_matches.begin(), m_matches.end(),
+                m.index, [] (const Match& m1, index_t i) { return m1.index > i; })
+            - m_matches.begin());
+        m_matches.insert(row, m);
+        m_matchList->insertItem(row, m.snippet);
+        indices.push_back(m.index);
+    }
+    m_model->addSearchMatches(indices);
+    updateStatus();
+}
+
+void RoomFindBar::currentMatchChanged(int row)
+{
+    // The row also changes when matches are inserted above it
+    if (row < 0 || row >= m_matches.size() ||
+            m_matches[row].eventId == m_currentEventId)
+        return;
+    const auto& match = m_matches[row];
+    m_currentEventId = match.eventId;
+    m_model->setCurrentSearchMatch(match.index);
+    emit matchSelected(match.eventId);
+}
+
+void RoomFindBar::updateStatus()
+{
+    if (m_pattern.isEmpty())
+        m_statusLabel->clear();
+    else if (!m_activeScans.isEmpty())
+        m_statusLabel->setText(
+            tr("%Ln match(es), scanning...", "", m_matches.size()));
+    else if (m_olderPagesLeft > 0)
+        m_statusLabel->setText(
+            tr("%Ln match(es), loading older messages...", "",
+               m_matches.size()));
+    else
+        m_statusLabel->setText(tr("%Ln match(es)", "", m_matches.size()));
+    m_olderButton->setEnabled(m_room && !m_pattern.isEmpty() &&
+                              m_olderPagesLeft <= 0);
+}
@@ -0,0 +1,111 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include "quaternionroom.h"
+
+#include <QtWidgets/QWidget>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QTimer>
+
+class MessageEventModel;
+
+class QNetworkReply;
+class QLineEdit;
+class QLabel;
+class QPushButton;
+class QListWidget;
+
+/// A find bar for the current room timeline
+/**
+ * The loaded part of the timeline is scanned in chunks on worker threads;
+ * matches stream into the list and are marked in the timeline as soon as
+ * each chunk is done, newest first. Events that arrive while the bar is
+ * open are scanned too; "Search older" loads more history and continues.
+ */
+class RoomFindBar: public QWidget
+{
+        Q_OBJECT
+    public:
+        using index_t = QMatrixClient::TimelineItem::index_t;
+
+        struct Match
+        {
+            index_t index;
+            QString eventId;
+            QString snippet;
+        };
+
+        RoomFindBar(MessageEventModel* model, QWidget* parent = nullptr);
+
+        void setRoom(QuaternionRoom* room);
+
+    public slots:
+        void activate();
+        void deactivate();
+        void findNext();
+        void findPrevious();
+
+    signals:
+        void matchSelected(const QString& eventId);
+
+    private slots:
+        void startSearch();
+        void searchOlder();
+        void replyFinished(QNetworkReply* reply);
+
+    private:
+        using Watcher = QFutureWatcher<QVector<Match>>;
+
+        MessageEventModel* m_model;
+        QuaternionRoom* m_room = nullptr;
+
+        QLineEdit* m_patternEdit;
+        QLabel* m_statusLabel;
+        QPushButton* m_olderButton;
+        QListWidget* m_matchList;
+
+        QTimer m_typingTimer;
+
+        QString m_pattern;
+        /// Matches found so far, newest first
+        QVector<Match> m_matches;
+        QString m_currentEventId;
+        QVector<Watcher*> m_activeScans;
+        /// The range of timeline indices scanned for the current pattern
+        index_t m_oldestScanned = 0;
+        index_t m_newestScanned = 0;
+        int m_olderPagesLeft = 0;
+        int m_matchesBeforeOlder = 0;
+        /// Whether a page of older messages is being loaded
+        bool m_olderInFlight = false;
+        /// Counts page requests, to tell a reply to an earlier one
+        int m_olderRequestNumber = 0;
+
+        void cancelScans();
+        void scanNewEvents();
+        void scan(QuaternionRoom::rev_iter_t from,
+                  QuaternionRoom::rev_iter_t to);
+        void requestOlderPage();
+        void continueSearchingOlder();
+        void addMatches(const QVector<Match>& matches);
+        void currentMatchChanged(int row);
+        void updateStatus();
+};
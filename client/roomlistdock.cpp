@@ -30,6 +30,9 @@
 
 using QMatrixClient::SettingsGroup;
 
+/// Sweeping the mouse over the list shouldn't prepare every room on the way
+static const int HoverDelayMs = 100;
+
 class RoomListItemDelegate : public QStyledItemDelegate
 {
     public:
@@ -103,6 +106,16 @@ RoomListDock::RoomListDock(QWidget* parent)
     static const auto Collapsed = QStringLiteral("collapse");
 //    connect( view, &QTreeView::activated, this, &RoomListDock::rowSelected );
     connect( view, &QTreeView::clicked, this, &RoomListDock::rowSelected);
+    view->setMouseTracking(true);
+    connect( view, &QTreeView::entered, this, &RoomListDock::hoverRoom);
+    connect( view->selectionModel(), &QItemSelectionModel::currentChanged,
+             this, &RoomListDock::hoverRoom);
+    hoverTimer.setSingleShot(true);
+    hoverTimer.setInterval(HoverDelayMs);
+    connect( &hoverTimer, &QTimer::timeout, this, [this] {
+        if (hoveredRoom)
+            emit roomHovered(hoveredRoom);
+    });
     connect( view, &QTreeView::expanded, this, [this] (QModelIndex i) {
         SettingsGroup("UI/RoomsDock")
         .setValue(model->roomGroupAt(i).toString(), Expanded);
@@ -192,6 +205,11 @@ void RoomListDock::addConnection(QMatrixClient::Connection* connection)
     model->addConnection(connection);
 }
 
+qint64 RoomListDock::modelMemoryFootprint() const
+{
+    return model->memoryFootprint();
+}
+
 void RoomListDock::updateSortingMode()
 {
 //    const auto sortMode =
@@ -208,6 +226,16 @@ void RoomListDock::rowSelected(const QModelIndex& index)
         emit roomSelected(model->roomAt(index));
 }
 
+void RoomListDock::hoverRoom(const QModelIndex& index)
+{
+    hoveredRoom =
+        model->isValidRoomIndex(index) ? model->roomAt(index) : nullptr;
+    if (hoveredRoom)
+        hoverTimer.start();
+    else
+        hoverTimer.stop();
+}
+
 void RoomListDock::showContextMenu(const QPoint& pos)
 {
     auto index = view->indexAt(view->mapFromParent(pos));
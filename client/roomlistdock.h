@@ -22,6 +22,8 @@
 #include <QtWidgets/QDockWidget>
 #include <QtWidgets/QTreeView>
 #include <QtCore/QStringListModel>
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
 #include <QSortFilterProxyModel>
 
 class RoomListModel;
@@ -38,12 +40,18 @@ class RoomListDock : public QDockWidget
         explicit RoomListDock(QWidget* parent = nullptr);
 
         void addConnection(QMatrixClient::Connection* connection);
+        /// Estimated memory taken by the room list model, in bytes
+        qint64 modelMemoryFootprint() const;
 
     public slots:
         void updateSortingMode();
 
     signals:
         void roomSelected(QuaternionRoom* room);
+        /// The room is likely to be selected soon
+        /** Emitted when the mouse rests on the room or it gets keyboard
+         * focus in the list, to prepare the room before it's selected. */
+        void roomHovered(QuaternionRoom* room);
 
     private slots:
         void rowSelected(const QModelIndex& index);
@@ -65,7 +73,10 @@ class RoomListDock : public QDockWidget
         QAction* deleteTagAction;
         QVariant selectedGroupCache;
         QuaternionRoom* selectedRoomCache;
+        QPointer<QuaternionRoom> hoveredRoom;
+        QTimer hoverTimer;
 
         QVariant getSelectedGroup() const;
         QuaternionRoom* getSelectedRoom() const;
+        void hoverRoom(const QModelIndex& index);
 };
@@ -0,0 +1,194 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "roomswitchstats.h"
+
+#include <QtQuick/QQuickWindow>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+
+const double RoomSwitchStats::BudgetMs = 1000.0 / 60;
+
+static const int BucketBoundsMs[] = { 4, 8, 16, 33, 50, 100, 200, 500, -1 };
+/// If no frame comes in this time (e.g., the window is hidden), the switch
+/// is recorded without the rendering stage
+static const int FrameTimeoutMs = 500;
+
+RoomSwitchStats* RoomSwitchStats::instance()
+{
+    static auto* stats = new RoomSwitchStats;
+    return stats;
+}
+
+RoomSwitchStats::RoomSwitchStats()
+{
+    for (auto upToMs: BucketBoundsMs)
+        m_histogram.push_back({ upToMs, 0 });
+    m_clock.start();
+    m_frameTimeout.setSingleShot(true);
+    m_frameTimeout.setInterval(FrameTimeoutMs);
+    connect(&m_frameTimeout, &QTimer::timeout, this, [this] {
+        if (m_state == WaitingForFrame)
+            record();
+    });
+}
+
+void RoomSwitchStats::watchWindow(QQuickWindow* window)
+{
+    // afterRendering() may come from the render thread; the connection
+    // is queued then, which also counts the time to get the frame through
+    connect(window, &QQuickWindow::afterRendering,
+            this, &RoomSwitchStats::frameRendered);
+}
+
+void RoomSwitchStats::begin()
+{
+    if (m_state != Idle)
+        record(); // The previous switch hasn't got to the screen
+    m_state = Switching;
+    m_current.clear();
+    m_lastMarkNs = m_clock.nsecsElapsed();
+}
+
+void RoomSwitchStats::stage(const char* name)
+{
+    if (m_state == Switching)
+        addStage(QString::fromLatin1(name));
+}
+
+void RoomSwitchStats::finish()
+{
+    if (m_state != Switching)
+        return;
+    m_state = WaitingForFrame;
+    m_frameTimeout.start();
+}
+
+QVector<RoomSwitchStats::Bucket> RoomSwitchStats::histogram() const
+{
+    return m_histogram;
+}
+
+QVector<RoomSwitchStats::Stage> RoomSwitchStats::lastSwitch() const
+{
+    return m_lastSwitch;
+}
+
+double RoomSwitchStats::lastSwitchMs() const
+{
+    return m_lastSwitchMs;
+}
+
+QVector<RoomSwitchStats::StageTotals> RoomSwitchStats::stageTotals() const
+{
+    auto result = m_stageTotals;
+    std::sort(result.begin(), result.end(),
+        [] (const StageTotals& a, const StageTotals& b) {
+            return a.totalMs / a.count > b.totalMs / b.count;
+        });
+    return result;
+}
+
+void RoomSwitchStats::logSummary() const
+{
+    int switches = 0;
+    for (const auto& b: m_histogram)
+        switches += b.count;
+    if (switches == 0)
+        return;
+
+    qDebug() << "Room switch times over" << switches << "switch(es):";
+    int lowerBoundMs = 0;
+    for (const auto& b: m_histogram)
+    {
+        if (b.count > 0)
+        {
+            auto d = qDebug().noquote().nospace();
+            d << "  " << lowerBoundMs << '-';
+            if (b.upToMs >= 0)
+                d << b.upToMs << " ms: ";
+            else
+                d << "... ms: ";
+            d << b.count;
+        }
+        lowerBoundMs = b.upToMs;
+    }
+    qDebug() << "Room switch stages:";
+    for (const auto& s: stageTotals())
+        qDebug().noquote().nospace()
+            << "  " << s.name << ": " << QString::number(s.totalMs / s.count,
+                                                          'f', 1)
+            << " ms on average, " << QString::number(s.maxMs, 'f', 1)
+            << " ms at most";
+}
+
+void RoomSwitchStats::frameRendered()
+{
+    if (m_state != WaitingForFrame)
+        return;
+    addStage(QStringLiteral("first frame"));
+    record();
+}
+
+void RoomSwitchStats::addStage(const QString& name)
+{
+    const auto now = m_clock.nsecsElapsed();
+    m_current.push_back({ name, (now - m_lastMarkNs) / 1000000.0 });
+    m_lastMarkNs = now;
+}
+
+void RoomSwitchStats::record()
+{
+    m_state = Idle;
+    m_frameTimeout.stop();
+
+    double totalMs = 0;
+    for (const auto& s: qAsConst(m_current))
+    {
+        totalMs += s.ms;
+        auto it = std::find_if(m_stageTotals.begin(), m_stageTotals.end(),
+                    [&s] (const StageTotals& t) { return t.name == s.name; });
+        if (it == m_stageTotals.end())
+            m_stageTotals.push_back({ s.name, 1, s.ms, s.ms });
+        else
+        {
+            ++it->count;
+            it->totalMs += s.ms;
+            it->maxMs = std::max(it->maxMs, s.ms);
+        }
+    }
+    auto bucketIt = std::find_if(m_histogram.begin(), m_histogram.end(),
+        [totalMs] (const Bucket& b) { return b.upToMs < 0 || totalMs < b.upToMs; });
+    ++bucketIt->count;
+
+    if (totalMs > BudgetMs)
+    {
+        QStringList breakdown;
+        for (const auto& s: qAsConst(m_current))
+            breakdown.push_back(
+                QStringLiteral("%1 %2").arg(s.name).arg(s.ms, 0, 'f', 1));
+        qDebug().noquote() << "Room switch took"
+                           << QString::number(totalMs, 'f', 1) << "ms:"
+                           << breakdown.join(QStringLiteral(", "));
+    }
+    m_lastSwitch.swap(m_current);
+    m_current.clear();
+    m_lastSwitchMs = totalMs;
+}
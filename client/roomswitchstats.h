@@ -0,0 +1,100 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+
+class QQuickWindow;
+
+/// Measures room switches, stage by stage, against a one-frame budget
+/**
+ * A switch starts with begin() and goes through stages, each one ended
+ * with a stage() call; finish() ends the synchronous part, after which
+ * the time till the timeline window renders the next frame is counted
+ * as the last stage. Totals go to a histogram; stage times are aggregated
+ * by stage name. Switches going over BudgetMs are logged with
+ * the breakdown. stage() calls outside of a switch are ignored, so that
+ * the switching code can be reused in other contexts.
+ */
+class RoomSwitchStats: public QObject
+{
+        Q_OBJECT
+    public:
+        struct Bucket
+        {
+            /// The upper bound of the bucket, or -1 for the last one
+            int upToMs;
+            int count;
+        };
+        struct Stage
+        {
+            QString name;
+            double ms;
+        };
+        struct StageTotals
+        {
+            QString name;
+            int count;
+            double totalMs;
+            double maxMs;
+        };
+
+        /// A frame at 60 fps
+        static const double BudgetMs;
+
+        static RoomSwitchStats* instance();
+
+        void watchWindow(QQuickWindow* window);
+
+        void begin();
+        void stage(const char* name);
+        void finish();
+
+        QVector<Bucket> histogram() const;
+        /// Stage times of the latest switch, in the order of the stages
+        QVector<Stage> lastSwitch() const;
+        double lastSwitchMs() const;
+        /// Stage times over all switches, from the slowest stage on average
+        QVector<StageTotals> stageTotals() const;
+        /// Log the histogram and the stage totals
+        void logSummary() const;
+
+    private:
+        RoomSwitchStats();
+
+        enum State { Idle, Switching, WaitingForFrame };
+        State m_state = Idle;
+        QElapsedTimer m_clock;
+        qint64 m_lastMarkNs = 0;
+        QTimer m_frameTimeout;
+        QVector<Stage> m_current;
+
+        QVector<Stage> m_lastSwitch;
+        double m_lastSwitchMs = 0;
+        QVector<Bucket> m_histogram;
+        QVector<StageTotals> m_stageTotals;
+
+        void frameRendered();
+        void addStage(const QString& name);
+        void record();
+};
@@ -0,0 +1,1132 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "searchindex.h"
+
+#include <QtCore/QThread>
+#include <QtCore/QDir>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QDataStream>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSaveFile>
+#include <QtCore/QtEndian>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+
+// Segment file layout (all integers are little-endian):
+// - header: magic, version, term count, sparse entry count, first and last
+//   message numbers (6 x quint32), terms offset, sparse offset (2 x quint64);
+// - postings of each term: for each message, a varint delta of the message
+//   number, a varint number of positions and varint deltas of positions;
+// - terms, in ascending order: varint length and UTF-8 bytes of the term,
+//   then varints for postings offset, postings length, message count and
+//   the last message number;
+// - sparse dictionary: every SparseStep-th term, as varint length and bytes
+//   of the term and a varint offset of its entry from the terms start.
+static const quint32 SegmentMagic = 0x51534958; // "QSIX"
+static const quint32 SegmentVersion = 1;
+static const int HeaderSize = 40;
+static const int SparseStep = 64;
+
+static const int MaxTermLength = 64;
+static const int MaxSnippetLength = 500;
+static const int MaxRecordSize = 8192;
+static const int FlushThresholdBytes = 16 * 1024 * 1024;
+static const int FlushIntervalMs = 60000;
+static const int MergeFactor = 4;
+/// Segments below this size are all in the lowest tier
+static const qint64 MinTierBytes = 64 * 1024;
+
+static_assert(sizeof(quint64) + sizeof(qint64) == 16,
+              "Unexpected size of message index entries");
+
+inline void appendVarint(QByteArray& out, quint64 value)
+{
+    for (; value >= 0x80; value >>= 7)
+        out.append(char((value & 0x7F) | 0x80));
+    out.append(char(value));
+}
+
+/// Read a varint; never reads past \p end, even if the data are broken
+inline quint64 readVarint(const uchar*& p, const uchar* end)
+{
+    quint64 value = 0;
+    for (int shift = 0; p != end && shift < 64; shift += 7)
+    {
+        const auto byte = *p++;
+        value |= quint64(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return value;
+}
+
+template <typename T>
+inline void appendLittleEndian(QByteArray& out, T value)
+{
+    value = qToLittleEndian(value);
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/// The stored record of a message, as read back by loadHit()
+static QByteArray makeRecord(const QString& accountId, const QString& roomId,
+                             const QString& eventId, const QString& senderId,
+                             qint64 timestamp, const QString& snippet)
+{
+    QByteArray record;
+    QDataStream s { &record, QIODevice::WriteOnly };
+    s << accountId << roomId << eventId << senderId << timestamp << snippet;
+    return record;
+}
+
+inline quint64 eventHash(const QString& eventId)
+{
+    // FNV-1a; collisions are practically impossible at the scale of
+    // a personal message history
+    quint64 hash = 14695981039346656037ULL;
+    for (const auto c: eventId)
+    {
+        hash ^= c.unicode();
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// Split a text into case-folded words, in the order of appearance
+/**
+ * Overlong words (mostly URLs and hashes) are returned as empty byte arrays
+ * so that they still take their positions but don't bloat the dictionary.
+ */
+static QVector<QByteArray> tokenize(const QString& text)
+{
+    QVector<QByteArray> tokens;
+    QString word;
+    const auto finishWord = [&] {
+        if (!word.isEmpty())
+        {
+            tokens.push_back(word.size() <= MaxTermLength
+                             ? word.toUtf8() : QByteArray());
+            word.clear();
+        }
+    };
+    for (const auto c: text)
+        if (c.isLetterOrNumber() || c.isMark())
+            word += c.toCaseFolded();
+        else
+            finishWord();
+    finishWord();
+    return tokens;
+}
+
+/// Split a query into phrases; each word outside quotes is a phrase of its own
+static QVector<QVector<QByteArray>> parseQuery(const QString& query)
+{
+    QVector<QVector<QByteArray>> phrases;
+    const auto parts = query.split('"');
+    for (int i = 0; i < parts.size(); ++i)
+    {
+        const auto tokens = tokenize(parts[i]);
+        if (i % 2 == 1)
+        {
+            if (!tokens.isEmpty())
+                phrases.push_back(tokens);
+        } else
+            for (const auto& t: tokens)
+                phrases.push_back({ t });
+    }
+    return phrases;
+}
+
+class SearchIndex::Segment
+{
+    public:
+        struct TermInfo
+        {
+            quint64 postingsOffset = 0;
+            quint64 postingsLength = 0;
+            quint32 docCount = 0;
+            quint32 lastDoc = 0;
+        };
+
+        explicit Segment(const QString& fileName)
+            : file(fileName)
+        { }
+
+        bool open()
+        {
+            if (!file.open(QIODevice::ReadOnly) || file.size() < HeaderSize)
+                return false;
+            size = file.size();
+            data = file.map(0, size);
+            if (!data)
+                return false;
+            if (qFromLittleEndian<quint32>(data) != SegmentMagic ||
+                    qFromLittleEndian<quint32>(data + 4) != SegmentVersion)
+                return false;
+            termCount = qFromLittleEndian<quint32>(data + 8);
+            const auto sparseCount = qFromLittleEndian<quint32>(data + 12);
+            firstDoc = qFromLittleEndian<quint32>(data + 16);
+            lastDoc = qFromLittleEndian<quint32>(data + 20);
+            termsOffset = qFromLittleEndian<quint64>(data + 24);
+            sparseOffset = qFromLittleEndian<quint64>(data + 32);
+            if (termsOffset < quint64(HeaderSize) ||
+                    termsOffset > sparseOffset || sparseOffset > quint64(size))
+                return false;
+
+            // The sparse dictionary points right into the mapped file
+            const uchar* p = data + sparseOffset;
+            const uchar* const end = data + size;
+            sparse.reserve(int(sparseCount));
+            for (quint32 i = 0; i < sparseCount; ++i)
+            {
+                const auto length = readVarint(p, end);
+                if (quint64(end - p) < length)
+                    return false;
+                const auto term = QByteArray::fromRawData(
+                            reinterpret_cast<const char*>(p), int(length));
+                p += length;
+                const auto offset = termsOffset + readVarint(p, end);
+                if (offset >= sparseOffset)
+                    return false;
+                sparse.push_back({ term, offset });
+            }
+            return true;
+        }
+
+        void remove()
+        {
+            file.unmap(data);
+            file.close();
+            file.remove();
+        }
+
+        const uchar* termsBegin() const { return data + termsOffset; }
+        const uchar* postings(const TermInfo& info) const
+        {
+            return data + info.postingsOffset;
+        }
+
+        bool readEntry(const uchar*& p, QByteArray* term, TermInfo* info) const
+        {
+            const uchar* const end = data + sparseOffset;
+            const auto length = readVarint(p, end);
+            if (quint64(end - p) < length)
+                return false;
+            *term = QByteArray::fromRawData(reinterpret_cast<const char*>(p),
+                                            int(length));
+            p += length;
+            info->postingsOffset = readVarint(p, end);
+            info->postingsLength = readVarint(p, end);
+            info->docCount = quint32(readVarint(p, end));
+            info->lastDoc = quint32(readVarint(p, end));
+            return info->postingsOffset >= quint64(HeaderSize) &&
+                info->postingsOffset + info->postingsLength <= termsOffset;
+        }
+
+        bool find(const QByteArray& term, TermInfo* info) const
+        {
+            const auto it = std::upper_bound(sparse.cbegin(), sparse.cend(),
+                term, [] (const QByteArray& t, const SparseEntry& e) {
+                    return t < e.term;
+                });
+            if (it == sparse.cbegin())
+                return false;
+            const uchar* p = data + (it - 1)->offset;
+            QByteArray t;
+            for (int i = 0; i < SparseStep && p < data + sparseOffset; ++i)
+            {
+                if (!readEntry(p, &t, info) || term < t)
+                    return false;
+                if (t == term)
+                    return true;
+            }
+            return false;
+        }
+
+        QFile file;
+        qint64 size = 0;
+        quint32 termCount = 0;
+        quint32 firstDoc = 0;
+        quint32 lastDoc = 0;
+
+    private:
+        struct SparseEntry
+        {
+            QByteArray term;
+            quint64 offset;
+        };
+
+        uchar* data = nullptr;
+        quint64 termsOffset = 0;
+        quint64 sparseOffset = 0;
+        QVector<SparseEntry> sparse;
+};
+
+/// Writes a segment file; terms should be added in ascending order
+class SegmentWriter
+{
+    public:
+        explicit SegmentWriter(const QString& fileName)
+            : file(fileName)
+        { }
+
+        bool open()
+        {
+            if (!file.open(QIODevice::WriteOnly))
+                return false;
+            file.write(QByteArray(HeaderSize, '\0'));
+            return true;
+        }
+
+        void addTerm(const QByteArray& term, const QByteArray& postings,
+                     quint32 docCount, quint32 lastDoc)
+        {
+            if (termCount % SparseStep == 0)
+            {
+                appendVarint(sparse, quint64(term.size()));
+                sparse.append(term);
+                appendVarint(sparse, quint64(terms.size()));
+                ++sparseCount;
+            }
+            appendVarint(terms, quint64(term.size()));
+            terms.append(term);
+            appendVarint(terms, postingsEnd);
+            appendVarint(terms, quint64(postings.size()));
+            appendVarint(terms, docCount);
+            appendVarint(terms, lastDoc);
+            ++termCount;
+            file.write(postings);
+            postingsEnd += quint64(postings.size());
+        }
+
+        bool commit(quint32 firstDoc, quint32 lastDoc)
+        {
+            file.write(terms);
+            file.write(sparse);
+            QByteArray header;
+            appendLittleEndian(header, SegmentMagic);
+            appendLittleEndian(header, SegmentVersion);
+            appendLittleEndian(header, termCount);
+            appendLittleEndian(header, sparseCount);
+            appendLittleEndian(header, firstDoc);
+            appendLittleEndian(header, lastDoc);
+            appendLittleEndian(header, postingsEnd);
+            appendLittleEndian(header, postingsEnd + quint64(terms.size()));
+            Q_ASSERT(header.size() == HeaderSize);
+            file.seek(0);
+            file.write(header);
+            return file.commit();
+        }
+
+    private:
+        QSaveFile file;
+        QByteArray terms;
+        QByteArray sparse;
+        quint64 postingsEnd = HeaderSize;
+        quint32 termCount = 0;
+        quint32 sparseCount = 0;
+};
+
+/// Postings of one term, decoded for the messages that are still candidates
+struct PostingList
+{
+    QVector<quint32> docs;
+    /// For each message in docs, the start of its positions; plus the end
+    QVector<int> positionsBegin;
+    QVector<quint32> positions;
+};
+
+/// Decode postings; if \p filter is given, only keep messages listed in it
+static PostingList decodePostings(const uchar* p, const uchar* end,
+                                  quint32 docCount,
+                                  const QVector<quint32>* filter)
+{
+    PostingList result;
+    auto filterIt = filter ? filter->cbegin() : QVector<quint32>::const_iterator();
+    quint32 doc = 0;
+    for (quint32 i = 0; i < docCount && p != end; ++i)
+    {
+        doc += quint32(readVarint(p, end));
+        const auto positionCount = readVarint(p, end);
+        if (filter)
+        {
+            while (filterIt != filter->cend() && *filterIt < doc)
+                ++filterIt;
+            if (filterIt == filter->cend())
+                break;
+            if (*filterIt != doc)
+            {
+                for (quint64 j = 0; j < positionCount; ++j)
+                    readVarint(p, end);
+                continue;
+            }
+        }
+        result.docs.push_back(doc);
+        result.positionsBegin.push_back(result.positions.size());
+        quint32 position = 0;
+        for (quint64 j = 0; j < positionCount; ++j)
+        {
+            position += quint32(readVarint(p, end));
+            result.positions.push_back(position);
+        }
+    }
+    result.positionsBegin.push_back(result.positions.size());
+    return result;
+}
+
+struct TermPostings
+{
+    const uchar* begin;
+    const uchar* end;
+    quint32 docCount;
+};
+
+/// Find messages matching all phrases among postings from one segment
+static QVector<quint32> matchDocuments(
+        const QVector<QVector<QByteArray>>& phrases,
+        const QHash<QByteArray, TermPostings>& terms)
+{
+    // Decode the rarest term first; each next one only keeps the messages
+    // that are left, so the candidate list never grows.
+    auto order = terms.keys();
+    std::sort(order.begin(), order.end(),
+        [&terms] (const QByteArray& t1, const QByteArray& t2) {
+            return terms[t1].docCount < terms[t2].docCount;
+        });
+    std::vector<PostingList> lists;
+    lists.reserve(order.size());
+    QHash<QByteArray, int> listIndices;
+    const QVector<quint32>* filter = nullptr;
+    for (const auto& t: order)
+    {
+        const auto& tp = terms[t];
+        lists.push_back(decodePostings(tp.begin, tp.end, tp.docCount, filter));
+        if (lists.back().docs.isEmpty())
+            return {};
+        listIndices.insert(t, int(lists.size()) - 1);
+        filter = &lists.back().docs;
+    }
+
+    const auto positionsOf = [&] (const QByteArray& term, quint32 doc) {
+        const auto& l = lists[size_t(listIndices.value(term))];
+        const auto i = int(std::lower_bound(l.docs.cbegin(), l.docs.cend(), doc)
+                           - l.docs.cbegin());
+        return std::make_pair(l.positions.cbegin() + l.positionsBegin[i],
+                              l.positions.cbegin() + l.positionsBegin[i + 1]);
+    };
+    QVector<quint32> result;
+    for (const auto doc: *filter)
+    {
+        const auto allPhrasesMatch =
+            std::all_of(phrases.cbegin(), phrases.cend(),
+                [&] (const QVector<QByteArray>& phrase) {
+                    if (phrase.size() == 1)
+                        return true;
+                    const auto start = positionsOf(phrase.front(), doc);
+                    return std::any_of(start.first, start.second,
+                        [&] (quint32 startPos) {
+                            for (int k = 1; k < phrase.size(); ++k)
+                            {
+                                const auto next = positionsOf(phrase[k], doc);
+                                if (!std::binary_search(next.first, next.second,
+                                                        startPos + quint32(k)))
+                                    return false;
+                            }
+                            return true;
+                        });
+                });
+        if (allPhrasesMatch)
+            result.push_back(doc);
+    }
+    return result;
+}
+
+static QString& indexLocation()
+{
+    static QString path = QStandardPaths::writableLocation(
+                QStandardPaths::AppLocalDataLocation) + "/search";
+    return path;
+}
+
+SearchIndex* SearchIndex::instance()
+{
+    static SearchIndex* index = nullptr;
+    if (!index)
+    {
+        qRegisterMetaType<SearchHit>();
+        qRegisterMetaType<QVector<SearchHit>>("QVector<SearchHit>");
+        qRegisterMetaType<QVector<SearchIndex::Message>>(
+                    "QVector<SearchIndex::Message>");
+        index = new SearchIndex(indexLocation());
+    }
+    return index;
+}
+
+void SearchIndex::setLocation(const QString& path)
+{
+    indexLocation() = path;
+}
+
+SearchIndex::SearchIndex(QString path)
+    : m_path(std::move(path)), m_thread(new QThread)
+{
+    m_thread->setObjectName("SearchIndex");
+    moveToThread(m_thread);
+    connect(m_thread, &QThread::started, this, &SearchIndex::load);
+    m_thread->start(QThread::LowPriority);
+}
+
+SearchIndex::~SearchIndex() = default;
+
+void SearchIndex::addMessages(const QVector<Message>& messages)
+{
+    if (m_shutDown || messages.isEmpty())
+        return;
+    QMetaObject::invokeMethod(this, "doAddMessages", Qt::QueuedConnection,
+        Q_ARG(QVector<SearchIndex::Message>, messages));
+}
+
+void SearchIndex::removeMessage(const QString& eventId,
+                                const QDateTime& timestamp)
+{
+    if (m_shutDown)
+        return;
+    QMetaObject::invokeMethod(this, "doRemoveMessage", Qt::QueuedConnection,
+        Q_ARG(QString, eventId), Q_ARG(QDateTime, timestamp));
+}
+
+void SearchIndex::search(const QString& query, int maxHits)
+{
+    QMetaObject::invokeMethod(this, "doSearch", Qt::QueuedConnection,
+                              Q_ARG(QString, query), Q_ARG(int, maxHits));
+}
+
+void SearchIndex::shutdown(int timeoutMs)
+{
+    if (m_shutDown.exchange(true))
+        return;
+    QMetaObject::invokeMethod(this, "finishUp", Qt::QueuedConnection);
+    if (!m_thread->wait(static_cast<unsigned long>(timeoutMs)))
+        qWarning() << "Search index: couldn't save messages in"
+                   << timeoutMs << "ms, leaving the rest unsaved";
+}
+
+void SearchIndex::timerEvent(QTimerEvent* event)
+{
+    if (event->timerId() == m_flushTimer.timerId())
+    {
+        flushBuffer();
+        return;
+    }
+    QObject::timerEvent(event);
+}
+
+void SearchIndex::load()
+{
+    QElapsedTimer et; et.start();
+    QDir dir { m_path };
+    if (!dir.mkpath("."))
+        qWarning() << "Search index: couldn't create" << m_path;
+
+    m_docData.setFileName(dir.filePath("messages.dat"));
+    m_docIndex.setFileName(dir.filePath("messages.idx"));
+    // Unbuffered, so that a failed write doesn't linger in the buffer
+    // after the files are truncated back
+    const auto mode =
+        QIODevice::ReadWrite | QIODevice::Append | QIODevice::Unbuffered;
+    if (!m_docData.open(mode) || !m_docIndex.open(mode))
+        qWarning() << "Search index: couldn't open message files in"
+                   << m_path;
+    // Drop a partially written entry, if any
+    const auto extraBytes = m_docIndex.size() % qint64(sizeof(DocEntry));
+    if (extraBytes)
+        m_docIndex.resize(m_docIndex.size() - extraBytes);
+    m_docDataSize = m_docData.size();
+    mapDocIndex();
+
+    QFile seenFile { dir.filePath("seen.dat") };
+    if (seenFile.open(QIODevice::ReadOnly))
+    {
+        const auto seenData = seenFile.readAll();
+        m_seen.resize(size_t(seenData.size()) / sizeof(quint64));
+        for (size_t i = 0; i < m_seen.size(); ++i)
+            m_seen[i] = qFromLittleEndian<quint64>(
+                reinterpret_cast<const uchar*>(seenData.constData())
+                + i * sizeof(quint64));
+        std::sort(m_seen.begin(), m_seen.end());
+        m_seen.erase(std::unique(m_seen.begin(), m_seen.end()), m_seen.end());
+    }
+    QFile removedFile { dir.filePath("removed.dat") };
+    if (removedFile.open(QIODevice::ReadOnly))
+    {
+        const auto removedData = removedFile.readAll();
+        for (int i = 0; i + int(sizeof(quint32)) <= removedData.size();
+             i += int(sizeof(quint32)))
+            m_removedDocs.insert(qFromLittleEndian<quint32>(
+                reinterpret_cast<const uchar*>(removedData.constData()) + i));
+    }
+
+    for (const auto& fileName:
+            dir.entryList({ "segment-*.idx" }, QDir::Files, QDir::Name))
+    {
+        std::unique_ptr<Segment> segment { new Segment(dir.filePath(fileName)) };
+        if (!segment->open())
+        {
+            qWarning() << "Search index: skipping broken segment" << fileName;
+            continue;
+        }
+        m_nextSegmentNumber =
+            std::max(m_nextSegmentNumber, fileName.midRef(8, 8).toInt() + 1);
+        m_segments.push_back(std::move(segment));
+    }
+    // Segments must go in the order of messages, without overlaps; if
+    // merging was interrupted, the merged segment covers the source ones.
+    std::sort(m_segments.begin(), m_segments.end(),
+        [] (const std::unique_ptr<Segment>& s1, const std::unique_ptr<Segment>& s2) {
+            return s1->firstDoc < s2->firstDoc ||
+                (s1->firstDoc == s2->firstDoc && s1->lastDoc > s2->lastDoc);
+        });
+    for (auto it = m_segments.begin(); it != m_segments.end();)
+        if (it != m_segments.begin() && (*it)->firstDoc <= (*(it - 1))->lastDoc)
+        {
+            qDebug() << "Search index: removing the leftover of a merge"
+                     << (*it)->file.fileName();
+            (*it)->remove();
+            it = m_segments.erase(it);
+        } else
+            ++it;
+
+    qDebug() << "Search index: loaded" << m_segments.size()
+             << "segment(s) with" << docCount() << "message(s) in"
+             << et.elapsed() << "ms";
+}
+
+void SearchIndex::doAddMessages(QVector<Message> messages)
+{
+    for (const auto& m: messages)
+    {
+        const auto hash = eventHash(m.eventId);
+        if (isSeen(hash))
+            continue;
+        m_recentlySeen.insert(hash);
+
+        const auto tokens = tokenize(m.body);
+        if (tokens.isEmpty())
+            continue;
+
+        const auto docId = docCount();
+        const auto timestamp = m.timestamp.toMSecsSinceEpoch();
+        m_pendingDocs.push_back(
+            { quint64(m_docDataSize + m_pendingDocData.size()), timestamp });
+        m_pendingDocData += makeRecord(m.accountId, m.roomId, m.eventId,
+                                       m.senderId, timestamp,
+                                       m.body.left(MaxSnippetLength));
+
+        QHash<QByteArray, QVector<quint32>> termPositions;
+        for (int pos = 0; pos < tokens.size(); ++pos)
+            if (!tokens[pos].isEmpty())
+                termPositions[tokens[pos]].push_back(quint32(pos));
+        for (auto it = termPositions.cbegin(); it != termPositions.cend(); ++it)
+        {
+            auto& tb = m_buffer[it.key()];
+            const auto oldSize = tb.postings.size();
+            appendVarint(tb.postings, docId - tb.lastDoc);
+            appendVarint(tb.postings, quint64(it->size()));
+            quint32 lastPos = 0;
+            for (const auto pos: *it)
+            {
+                appendVarint(tb.postings, pos - lastPos);
+                lastPos = pos;
+            }
+            tb.lastDoc = docId;
+            ++tb.docCount;
+            m_bufferedBytes += tb.postings.size() - oldSize
+                               + (oldSize == 0 ? it.key().size() : 0);
+        }
+    }
+    if (m_bufferedBytes >= FlushThresholdBytes)
+        flushBuffer();
+    else if (!m_flushTimer.isActive() && !m_recentlySeen.isEmpty())
+        m_flushTimer.start(FlushIntervalMs, this);
+}
+
+void SearchIndex::doRemoveMessage(QString eventId, QDateTime timestamp)
+{
+    // If the message is still on its way to the index, it won't get in
+    const auto hash = eventHash(eventId);
+    if (!isSeen(hash))
+    {
+        m_recentlySeen.insert(hash);
+        if (!m_flushTimer.isActive())
+            m_flushTimer.start(FlushIntervalMs, this);
+        return;
+    }
+
+    // Redactions are rare enough to just look through the timestamps;
+    // only messages sent at the same millisecond have to be read.
+    const auto ts = timestamp.toMSecsSinceEpoch();
+    QByteArray removedData;
+    for (quint32 docId = 0; docId < docCount(); ++docId)
+    {
+        const auto entry = docEntry(docId);
+        if (entry.timestamp != ts || m_removedDocs.contains(docId))
+            continue;
+        const auto hit = loadHit(docId);
+        if (hit.eventId != eventId)
+            continue;
+
+        // The blank snippet takes as many bytes as the original one, so
+        // the record can be overwritten in place
+        const auto record = makeRecord(hit.accountId, hit.roomId, hit.eventId,
+                                       hit.senderId, ts,
+                                       QString(hit.snippet.size(), ' '));
+        if (entry.offset >= quint64(m_docDataSize))
+            m_pendingDocData.replace(int(entry.offset - m_docDataSize),
+                                     record.size(), record);
+        else
+        {
+            // m_docData only appends, so write through another handle
+            QFile docData { m_docData.fileName() };
+            if (!docData.open(QIODevice::ReadWrite) ||
+                    !docData.seek(qint64(entry.offset)) ||
+                    docData.write(record) != record.size())
+                qWarning() << "Search index: couldn't blank a redacted"
+                              " message in" << m_path;
+        }
+        m_removedDocs.insert(docId);
+        appendLittleEndian(removedData, docId);
+    }
+    if (removedData.isEmpty())
+        return;
+    QFile removedFile { QDir(m_path).filePath("removed.dat") };
+    if (!removedFile.open(QIODevice::WriteOnly | QIODevice::Append) ||
+            removedFile.write(removedData) != removedData.size())
+        qWarning() << "Search index: couldn't save the list of"
+                      " redacted messages";
+}
+
+void SearchIndex::doSearch(QString query, int maxHits)
+{
+    QElapsedTimer et; et.start();
+    const auto phrases = parseQuery(query);
+    QSet<QByteArray> allTerms;
+    for (const auto& phrase: phrases)
+        for (const auto& t: phrase)
+            allTerms.insert(t);
+
+    QVector<quint32> found;
+    if (!allTerms.isEmpty() && !allTerms.contains({}))
+    {
+        for (const auto& segment: m_segments)
+        {
+            QHash<QByteArray, TermPostings> terms;
+            for (const auto& t: allTerms)
+            {
+                Segment::TermInfo info;
+                if (!segment->find(t, &info))
+                    break;
+                const auto* begin = segment->postings(info);
+                terms.insert(t, { begin, begin + info.postingsLength,
+                                  info.docCount });
+            }
+            if (terms.size() == allTerms.size())
+                found += matchDocuments(phrases, terms);
+        }
+        QHash<QByteArray, TermPostings> terms;
+        for (const auto& t: allTerms)
+        {
+            const auto it = m_buffer.constFind(t);
+            if (it == m_buffer.cend())
+                break;
+            const auto* begin =
+                reinterpret_cast<const uchar*>(it->postings.constData());
+            terms.insert(t, { begin, begin + it->postings.size(),
+                              it->docCount });
+        }
+        if (terms.size() == allTerms.size())
+            found += matchDocuments(phrases, terms);
+    }
+    if (!m_removedDocs.isEmpty())
+        found.erase(std::remove_if(found.begin(), found.end(),
+                        [this] (quint32 docId) {
+                            return m_removedDocs.contains(docId);
+                        }), found.end());
+
+    // Newest first; only the top is fully sorted
+    const auto hitCount = std::min(found.size(), maxHits);
+    std::partial_sort(found.begin(), found.begin() + hitCount, found.end(),
+        [this] (quint32 d1, quint32 d2) {
+            return docEntry(d1).timestamp > docEntry(d2).timestamp;
+        });
+    QVector<SearchHit> hits;
+    hits.reserve(hitCount);
+    for (int i = 0; i < hitCount; ++i)
+        hits.push_back(loadHit(found[i]));
+    qDebug() << "Search index: found" << found.size() << "message(s) for"
+             << query << "in" << et.elapsed() << "ms";
+    emit searchFinished(query, hits, found.size(), et.elapsed());
+}
+
+void SearchIndex::flushBuffer()
+{
+    if (saveBuffer())
+        mergeSegments();
+}
+
+void SearchIndex::finishUp()
+{
+    saveBuffer();
+    thread()->quit();
+}
+
+bool SearchIndex::saveBuffer()
+{
+    m_flushTimer.stop();
+    if (m_pendingDocs.isEmpty() && m_recentlySeen.isEmpty())
+        return false;
+
+    QElapsedTimer et; et.start();
+    // Messages go first, so that segments only refer to what's on disk
+    const auto firstDoc = m_mappedDocCount;
+    const auto lastDoc = docCount() - 1;
+    QByteArray entries;
+    for (const auto& e: qAsConst(m_pendingDocs))
+    {
+        appendLittleEndian(entries, e.offset);
+        appendLittleEndian(entries, e.timestamp);
+    }
+    const auto docIndexSize = m_docIndex.size();
+    if (m_docData.write(m_pendingDocData) != m_pendingDocData.size() ||
+            m_docIndex.write(entries) != entries.size() ||
+            !m_docData.flush() || !m_docIndex.flush())
+    {
+        qWarning() << "Search index: couldn't save messages to" << m_path;
+        // Drop whatever got written, for the next attempt to start over
+        if (!m_docData.resize(m_docDataSize) ||
+                !m_docIndex.resize(docIndexSize))
+            qWarning() << "Search index: couldn't undo a partial write to"
+                       << m_path;
+        m_flushTimer.start(FlushIntervalMs, this); // Try again later
+        return false;
+    }
+    m_docDataSize += m_pendingDocData.size();
+    m_pendingDocs.clear();
+    m_pendingDocData.clear();
+    mapDocIndex();
+
+    bool committed = true;
+    if (!m_buffer.isEmpty())
+    {
+        auto terms = m_buffer.keys();
+        std::sort(terms.begin(), terms.end());
+        const auto fileName = segmentFileName(m_nextSegmentNumber++);
+        SegmentWriter writer { fileName };
+        committed = writer.open();
+        if (committed)
+        {
+            for (const auto& t: terms)
+            {
+                const auto& tb = m_buffer[t];
+                writer.addTerm(t, tb.postings, tb.docCount, tb.lastDoc);
+            }
+            committed = writer.commit(firstDoc, lastDoc);
+        }
+        std::unique_ptr<Segment> segment { new Segment(fileName) };
+        if (committed && segment->open())
+            m_segments.push_back(std::move(segment));
+        else
+        {
+            // The messages will be indexed anew next time they are loaded
+            qWarning() << "Search index: couldn't write" << fileName;
+            committed = false;
+        }
+        m_buffer.clear();
+        m_bufferedBytes = 0;
+    }
+
+    if (committed)
+    {
+        QByteArray seenData;
+        for (const auto hash: qAsConst(m_recentlySeen))
+            appendLittleEndian(seenData, hash);
+        QFile seenFile { QDir(m_path).filePath("seen.dat") };
+        if (!seenFile.open(QIODevice::WriteOnly | QIODevice::Append) ||
+                seenFile.write(seenData) != seenData.size())
+            qWarning() << "Search index: couldn't save the list of"
+                          " indexed messages";
+        const auto oldSize = m_seen.size();
+        m_seen.insert(m_seen.end(),
+                      m_recentlySeen.cbegin(), m_recentlySeen.cend());
+        std::sort(m_seen.begin() + oldSize, m_seen.end());
+        std::inplace_merge(m_seen.begin(), m_seen.begin() + oldSize,
+                           m_seen.end());
+    }
+    m_recentlySeen.clear();
+    qDebug() << "Search index: saved messages up to" << lastDoc + 1
+             << "in" << et.elapsed() << "ms";
+    return true;
+}
+
+static int segmentTier(qint64 size)
+{
+    // floor(log_MergeFactor(size / MinTierBytes)); a merge of MergeFactor
+    // segments of one tier is about one tier up
+    int tier = 0;
+    for (size /= MinTierBytes; size >= MergeFactor; size /= MergeFactor)
+        ++tier;
+    return tier;
+}
+
+void SearchIndex::mergeSegments()
+{
+    // Merge the newest segments while they are of the same size tier, like
+    // carries in a counter; this way each message is rewritten only
+    // a logarithmic number of times.
+    while (m_segments.size() >= size_t(MergeFactor))
+    {
+        const auto first = m_segments.end() - MergeFactor;
+        const auto tier = segmentTier((*first)->size);
+        if (!std::all_of(first, m_segments.end(),
+                [tier] (const std::unique_ptr<Segment>& s) {
+                    return segmentTier(s->size) == tier;
+                }) || !mergeLastSegments(MergeFactor))
+            break;
+    }
+}
+
+bool SearchIndex::mergeLastSegments(int count)
+{
+    QElapsedTimer et; et.start();
+    struct Cursor
+    {
+        const Segment* segment;
+        const uchar* p;
+        quint32 termsLeft;
+        QByteArray term;
+        Segment::TermInfo info;
+
+        bool next()
+        {
+            if (termsLeft == 0)
+                return false;
+            --termsLeft;
+            return segment->readEntry(p, &term, &info);
+        }
+    };
+    const auto first = m_segments.end() - count;
+    const auto firstMergedDoc = (*first)->firstDoc;
+    const auto lastMergedDoc = m_segments.back()->lastDoc;
+    // Postings of redacted messages are dropped; this needs decoding, so
+    // the postings are only copied as they are if there's nothing to drop
+    const auto dropRemoved =
+        std::any_of(m_removedDocs.cbegin(), m_removedDocs.cend(),
+            [firstMergedDoc, lastMergedDoc] (quint32 docId) {
+                return docId >= firstMergedDoc && docId <= lastMergedDoc;
+            });
+    std::vector<Cursor> cursors;
+    for (auto it = first; it != m_segments.end(); ++it)
+    {
+        Cursor c { it->get(), (*it)->termsBegin(), (*it)->termCount, {}, {} };
+        if (c.next())
+            cursors.push_back(c);
+    }
+
+    const auto fileName = segmentFileName(m_nextSegmentNumber++);
+    SegmentWriter writer { fileName };
+    if (!writer.open())
+        return false;
+    while (!cursors.empty())
+    {
+        const auto& term = std::min_element(cursors.cbegin(), cursors.cend(),
+            [] (const Cursor& c1, const Cursor& c2) {
+                return c1.term < c2.term;
+            })->term;
+        // Postings of later segments go after those of earlier ones; only
+        // the first message number in each needs to become a delta.
+        QByteArray postings;
+        quint32 docCount = 0;
+        quint32 lastDoc = 0;
+        const auto mergedTerm = term; // The cursor will move on
+        for (auto it = cursors.begin(); it != cursors.end();)
+        {
+            if (it->term != mergedTerm)
+            {
+                ++it;
+                continue;
+            }
+            const uchar* p = it->segment->postings(it->info);
+            const uchar* const end = p + it->info.postingsLength;
+            if (dropRemoved)
+            {
+                const auto list =
+                    decodePostings(p, end, it->info.docCount, nullptr);
+                for (int i = 0; i < list.docs.size(); ++i)
+                {
+                    const auto doc = list.docs[i];
+                    if (m_removedDocs.contains(doc))
+                        continue;
+                    appendVarint(postings, doc - lastDoc);
+                    appendVarint(postings, quint64(list.positionsBegin[i + 1]
+                                                   - list.positionsBegin[i]));
+                    quint32 lastPos = 0;
+                    for (auto j = list.positionsBegin[i];
+                         j < list.positionsBegin[i + 1]; ++j)
+                    {
+                        appendVarint(postings, list.positions[j] - lastPos);
+                        lastPos = list.positions[j];
+                    }
+                    ++docCount;
+                    lastDoc = doc;
+                }
+            } else {
+                appendVarint(postings, readVarint(p, end) - lastDoc);
+                postings.append(reinterpret_cast<const char*>(p), int(end - p));
+                docCount += it->info.docCount;
+                lastDoc = it->info.lastDoc;
+            }
+            if (it->next())
+                ++it;
+            else
+                it = cursors.erase(it);
+        }
+        if (docCount > 0)
+            writer.addTerm(mergedTerm, postings, docCount, lastDoc);
+    }
+    std::unique_ptr<Segment> merged { new Segment(fileName) };
+    if (!writer.commit(firstMergedDoc, lastMergedDoc) ||
+            !merged->open())
+    {
+        qWarning() << "Search index: couldn't merge segments into" << fileName;
+        return false;
+    }
+    for (auto it = first; it != m_segments.end(); ++it)
+        (*it)->remove();
+    m_segments.erase(first, m_segments.end());
+    m_segments.push_back(std::move(merged));
+    qDebug() << "Search index: merged" << count << "segments in"
+             << et.elapsed() << "ms";
+    return true;
+}
+
+quint32 SearchIndex::docCount() const
+{
+    return m_mappedDocCount + quint32(m_pendingDocs.size());
+}
+
+SearchIndex::DocEntry SearchIndex::docEntry(quint32 docId) const
+{
+    if (docId < m_mappedDocCount)
+    {
+        const auto& e = m_mappedDocs[docId];
+        return { qFromLittleEndian(e.offset), qFromLittleEndian(e.timestamp) };
+    }
+    return m_pendingDocs.value(int(docId - m_mappedDocCount), { 0, 0 });
+}
+
+SearchHit SearchIndex::loadHit(quint32 docId)
+{
+    const auto entry = docEntry(docId);
+    QByteArray record;
+    if (entry.offset >= quint64(m_docDataSize))
+        record = m_pendingDocData.mid(int(entry.offset - m_docDataSize),
+                                      MaxRecordSize);
+    else if (m_docData.seek(qint64(entry.offset)))
+        record = m_docData.read(MaxRecordSize);
+
+    SearchHit hit;
+    qint64 timestamp = 0;
+    QDataStream s { record };
+    s >> hit.accountId >> hit.roomId >> hit.eventId >> hit.senderId
+      >> timestamp >> hit.snippet;
+    hit.timestamp = QDateTime::fromMSecsSinceEpoch(timestamp);
+    return hit;
+}
+
+bool SearchIndex::isSeen(quint64 eventHash) const
+{
+    return std::binary_search(m_seen.cbegin(), m_seen.cend(), eventHash) ||
+            m_recentlySeen.contains(eventHash);
+}
+
+void SearchIndex::mapDocIndex()
+{
+    if (m_mappedDocs && m_docIndexCopy.isEmpty())
+        m_docIndex.unmap(reinterpret_cast<uchar*>(
+                             const_cast<DocEntry*>(m_mappedDocs)));
+    m_mappedDocs = nullptr;
+    m_docIndexCopy.clear();
+
+    const auto count = m_docIndex.size() / qint64(sizeof(DocEntry));
+    m_mappedDocCount = quint32(count);
+    if (count == 0)
+        return;
+    if (auto* p = m_docIndex.map(0, count * qint64(sizeof(DocEntry))))
+        m_mappedDocs = reinterpret_cast<const DocEntry*>(p);
+    else
+    {
+        qWarning() << "Search index: couldn't map the message index,"
+                      " loading it to memory instead";
+        m_docIndex.seek(0);
+        m_docIndexCopy = m_docIndex.read(count * qint64(sizeof(DocEntry)));
+        m_mappedDocs =
+            reinterpret_cast<const DocEntry*>(m_docIndexCopy.constData());
+        m_mappedDocCount =
+            quint32(m_docIndexCopy.size() / qint64(sizeof(DocEntry)));
+    }
+}
+
+QString SearchIndex::segmentFileName(int number) const
+{
+    return QStringLiteral("%1/segment-%2.idx")
+            .arg(m_path).arg(number, 8, 10, QChar('0'));
+}
+
+QString SearchIndexProcessor::name() const
+{
+    return QStringLiteral("search");
+}
+
+QStringList SearchIndexProcessor::eventTypes() const
+{
+    return { QStringLiteral("m.room.message") };
+}
+
+int SearchIndexProcessor::snapshotParts() const
+{
+    return EventSnapshot::PlainBodyPart;
+}
+
+TimelineProcessor::Job SearchIndexProcessor::prepare(QuaternionRoom*)
+{
+    // Events loaded from the state cache come through here too; the index
+    // skips those it already has.
+    return [index = SearchIndex::instance()] (const EventBatch& batch)
+           -> Publisher
+    {
+        QVector<SearchIndex::Message> messages;
+        messages.reserve(batch.events.size());
+        for (const auto& e: batch.events)
+            if (!e.isRedacted && !e.plainBody.isEmpty())
+                messages.push_back({ batch.accountId, batch.roomId, e.id,
+                                     e.senderId, e.timestamp, e.plainBody });
+        index->addMessages(messages);
+        return {};
+    };
+}
@@ -0,0 +1,188 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include "timelineprocessor.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QDateTime>
+#include <QtCore/QVector>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QFile>
+#include <QtCore/QBasicTimer>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class QThread;
+
+/// A message found by SearchIndex
+struct SearchHit
+{
+    QString accountId;
+    QString roomId;
+    QString eventId;
+    QString senderId;
+    QDateTime timestamp;
+    QString snippet;
+};
+Q_DECLARE_METATYPE(SearchHit)
+
+/// A persistent full-text index of messages from all rooms and accounts
+/**
+ * Message bodies are split into case-folded words; each word maps to a list
+ * of postings (the message and positions of the word in it), so that both
+ * words and phrases can be looked up. Postings are collected in memory and
+ * then written to immutable segment files; only every few dozenth word of
+ * a segment dictionary stays in memory, the rest is read from the mapped
+ * file on demand. Segments of similar size are merged in the background,
+ * keeping the number of files to look through logarithmic.
+ *
+ * The index lives in its own thread; public methods can be called from
+ * any thread and return immediately, except shutdown().
+ */
+class SearchIndex: public QObject
+{
+        Q_OBJECT
+    public:
+        struct Message
+        {
+            QString accountId;
+            QString roomId;
+            QString eventId;
+            QString senderId;
+            QDateTime timestamp;
+            QString body;
+        };
+
+        static SearchIndex* instance();
+        /// Keep the index in the directory instead of the default one
+        /** Only has effect if called before the first instance() call. */
+        static void setLocation(const QString& path);
+
+        /// Queue messages for indexing; already indexed ones are skipped
+        void addMessages(const QVector<Message>& messages);
+        /// Forget a redacted message
+        /**
+         * The message is no longer found, its stored snippet is blanked
+         * and its postings are dropped the next time its segment is
+         * merged. If the message is not indexed yet, it never will be.
+         */
+        void removeMessage(const QString& eventId, const QDateTime& timestamp);
+        /// Look up messages that have all the words from the query
+        /**
+         * Words enclosed in double quotes should go in a row. The results,
+         * newest first, are delivered with searchFinished().
+         */
+        void search(const QString& query, int maxHits = 200);
+        /// Write pending data to disk and stop the index thread
+        /**
+         * Waits for at most \p timeoutMs; messages not saved by then are
+         * indexed anew the next time they are loaded. Segments are not
+         * merged at shutdown, that waits till the next run.
+         */
+        void shutdown(int timeoutMs);
+
+    signals:
+        /// \p hits are the newest \p totalCount messages found, up to maxHits
+        void searchFinished(QString query, QVector<SearchHit> hits,
+                            int totalCount, qint64 elapsedMs);
+
+    protected:
+        void timerEvent(QTimerEvent* event) override;
+
+    private slots:
+        void load();
+        void doAddMessages(QVector<SearchIndex::Message> messages);
+        void doRemoveMessage(QString eventId, QDateTime timestamp);
+        void doSearch(QString query, int maxHits);
+        void flushBuffer();
+        void finishUp();
+
+    private:
+        class Segment;
+        struct TermBuffer
+        {
+            QByteArray postings;
+            quint32 docCount = 0;
+            quint32 lastDoc = 0;
+        };
+        struct DocEntry
+        {
+            quint64 offset;
+            qint64 timestamp;
+        };
+
+        explicit SearchIndex(QString path);
+        ~SearchIndex() override;
+
+        QString m_path;
+        QThread* m_thread = nullptr;
+        std::atomic<bool> m_shutDown { false };
+
+        std::vector<std::unique_ptr<Segment>> m_segments;
+        int m_nextSegmentNumber = 0;
+
+        /// Postings of messages not yet written to a segment
+        QHash<QByteArray, TermBuffer> m_buffer;
+        int m_bufferedBytes = 0;
+        QBasicTimer m_flushTimer;
+
+        QFile m_docData;
+        QFile m_docIndex;
+        const DocEntry* m_mappedDocs = nullptr;
+        quint32 m_mappedDocCount = 0;
+        /// Only used if the message index cannot be mapped to memory
+        QByteArray m_docIndexCopy;
+        qint64 m_docDataSize = 0;
+        /// Entries and records of messages not yet written to disk
+        QVector<DocEntry> m_pendingDocs;
+        QByteArray m_pendingDocData;
+
+        /// Sorted hashes of event ids that have been indexed
+        std::vector<quint64> m_seen;
+        QSet<quint64> m_recentlySeen;
+        /// Numbers of messages redacted after they were indexed
+        QSet<quint32> m_removedDocs;
+
+        /// Write buffered messages to disk; false if nothing was written
+        bool saveBuffer();
+        quint32 docCount() const;
+        DocEntry docEntry(quint32 docId) const;
+        SearchHit loadHit(quint32 docId);
+        bool isSeen(quint64 eventHash) const;
+        void mapDocIndex();
+        QString segmentFileName(int number) const;
+        void mergeSegments();
+        bool mergeLastSegments(int count);
+};
+Q_DECLARE_METATYPE(SearchIndex::Message)
+
+/// Feeds messages from all rooms to the search index
+class SearchIndexProcessor: public TimelineProcessor
+{
+    public:
+        QString name() const override;
+        QStringList eventTypes() const override;
+        int snapshotParts() const override;
+        Job prepare(QuaternionRoom* room) override;
+};
@@ -0,0 +1,147 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "searchresultsdock.h"
+
+#include "quaternionroom.h"
+
+#include <connection.h>
+
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QTreeWidget>
+#include <QtWidgets/QHeaderView>
+#include <QtWidgets/QVBoxLayout>
+
+enum SearchHitRoles { AccountIdRole = Qt::UserRole, RoomIdRole, EventIdRole };
+
+SearchResultsDock::SearchResultsDock(QWidget* parent)
+    : QDockWidget(tr("Search"), parent)
+    , m_queryEdit(new QLineEdit)
+    , m_statusLabel(new QLabel)
+    , m_view(new QTreeWidget)
+{
+    setObjectName(QStringLiteral("SearchDock"));
+
+    m_queryEdit->setPlaceholderText(
+        tr("Search all rooms; use \"quotes\" for phrases"));
+    m_queryEdit->setClearButtonEnabled(true);
+    connect(m_queryEdit, &QLineEdit::returnPressed, this,
+            [this] { search(m_queryEdit->text()); });
+
+    m_view->setColumnCount(4);
+    m_view->setHeaderLabels({ tr("Room"), tr("Sender"), tr("Time"),
+                              tr("Message") });
+    m_view->setRootIsDecorated(false);
+    m_view->setUniformRowHeights(true);
+    m_view->header()->setStretchLastSection(true);
+    connect(m_view, &QTreeWidget::itemActivated,
+            this, &SearchResultsDock::activateHit);
+
+    auto* layout = new QVBoxLayout;
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(m_queryEdit);
+    layout->addWidget(m_statusLabel);
+    layout->addWidget(m_view);
+    auto* container = new QWidget;
+    container->setLayout(layout);
+    setWidget(container);
+
+    connect(SearchIndex::instance(), &SearchIndex::searchFinished,
+            this, &SearchResultsDock::showResults);
+}
+
+void SearchResultsDock::addConnection(QMatrixClient::Connection* connection)
+{
+    m_connections.push_back(connection);
+    connect(connection, &QObject::destroyed, this, [this, connection] {
+        m_connections.removeOne(connection);
+    });
+}
+
+void SearchResultsDock::search(const QString& query)
+{
+    m_currentQuery = query.trimmed();
+    if (m_queryEdit->text() != query)
+        m_queryEdit->setText(query);
+    m_view->clear();
+    if (m_currentQuery.isEmpty())
+    {
+        m_statusLabel->clear();
+        return;
+    }
+    m_statusLabel->setText(tr("Searching..."));
+    SearchIndex::instance()->search(m_currentQuery);
+}
+
+void SearchResultsDock::showResults(const QString& query,
+                                    const QVector<SearchHit>& hits,
+                                    int totalCount, qint64 elapsedMs)
+{
+    if (query != m_currentQuery)
+        return; // A newer search has been started since
+
+    if (hits.isEmpty())
+        m_statusLabel->setText(tr("Nothing found"));
+    else if (totalCount > hits.size())
+        m_statusLabel->setText(
+            tr("%Ln message(s) found in %1 ms, showing the newest %2", "",
+               totalCount).arg(elapsedMs).arg(hits.size()));
+    else
+        m_statusLabel->setText(
+            tr("%Ln message(s) found in %1 ms", "", totalCount).arg(elapsedMs));
+    QList<QTreeWidgetItem*> items;
+    for (const auto& hit: hits)
+    {
+        auto* room = findRoom(hit.accountId, hit.roomId);
+        auto* item = new QTreeWidgetItem({
+            room ? room->displayName() : hit.roomId,
+            room ? room->roomMembername(hit.senderId) : hit.senderId,
+            hit.timestamp.toLocalTime().toString(Qt::DefaultLocaleShortDate),
+            hit.snippet.simplified() });
+        item->setToolTip(3, hit.snippet);
+        item->setData(0, AccountIdRole, hit.accountId);
+        item->setData(0, RoomIdRole, hit.roomId);
+        item->setData(0, EventIdRole, hit.eventId);
+        items.push_back(item);
+    }
+    m_view->addTopLevelItems(items);
+}
+
+void SearchResultsDock::activateHit(QTreeWidgetItem* item)
+{
+    auto* room = findRoom(item->data(0, AccountIdRole).toString(),
+                          item->data(0, RoomIdRole).toString());
+    if (!room)
+    {
+        m_statusLabel->setText(
+            tr("The room of this message is not available in any account"));
+        return;
+    }
+    emit hitActivated(room, item->data(0, EventIdRole).toString());
+}
+
+QuaternionRoom* SearchResultsDock::findRoom(const QString& accountId,
+                                            const QString& roomId) const
+{
+    for (auto* c: m_connections)
+        if (c->userId() == accountId)
+            return qobject_cast<QuaternionRoom*>(c->room(roomId));
+    return nullptr;
+}
@@ -0,0 +1,65 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include "searchindex.h"
+
+#include <QtWidgets/QDockWidget>
+
+namespace QMatrixClient
+{
+    class Connection;
+}
+
+class QuaternionRoom;
+class QLineEdit;
+class QLabel;
+class QTreeWidget;
+class QTreeWidgetItem;
+
+class SearchResultsDock: public QDockWidget
+{
+        Q_OBJECT
+    public:
+        explicit SearchResultsDock(QWidget* parent = nullptr);
+
+        void addConnection(QMatrixClient::Connection* connection);
+
+    public slots:
+        void search(const QString& query);
+
+    signals:
+        void hitActivated(QuaternionRoom* room, const QString& eventId);
+
+    private slots:
+        void showResults(const QString& query, const QVector<SearchHit>& hits,
+                         int totalCount, qint64 elapsedMs);
+        void activateHit(QTreeWidgetItem* item);
+
+    private:
+        QLineEdit* m_queryEdit;
+        QLabel* m_statusLabel;
+        QTreeWidget* m_view;
+        QVector<QMatrixClient::Connection*> m_connections;
+        QString m_currentQuery;
+
+        QuaternionRoom* findRoom(const QString& accountId,
+                                 const QString& roomId) const;
+};
@@ -0,0 +1,201 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "syncrecorder.h"
+
+#include "tracing.h"
+
+#include <connection.h>
+#include <networkaccessmanager.h>
+
+#include <QtNetwork/QNetworkReply>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QRegularExpression>
+#include <QtCore/QStringList>
+#include <QtCore/QUrlQuery>
+#include <QtCore/QDebug>
+
+using QMatrixClient::Connection;
+
+const QString SyncRecorder::Format = QStringLiteral("quaternion-sync-recording");
+const int SyncRecorder::FormatVersion = 1;
+
+static const QRegularExpression MessagesPathRe {
+    QStringLiteral("/rooms/([^/]+)/messages$") };
+static const QRegularExpression UserIdRe { QStringLiteral("^@[^:]+:.+$") };
+/// Keys of texts replaced with placeholders when scrubbing
+static const QStringList ScrubbedTextKeys {
+    QStringLiteral("body"), QStringLiteral("formatted_body"),
+    QStringLiteral("displayname"), QStringLiteral("name"),
+    QStringLiteral("topic"), QStringLiteral("alias"),
+    QStringLiteral("aliases"), QStringLiteral("alt_aliases"),
+    QStringLiteral("filename")
+};
+/// Keys of media URLs replaced with a dummy one when scrubbing
+static const QStringList ScrubbedUrlKeys {
+    QStringLiteral("url"), QStringLiteral("avatar_url"),
+    QStringLiteral("thumbnail_url")
+};
+
+static QString scrubbedQuery(const QUrl& url)
+{
+    // Filters and sync tokens can tell a lot; only keep the parameter names
+    QUrlQuery query { url };
+    auto items = query.queryItems(QUrl::FullyDecoded);
+    for (auto& item: items)
+        item.second = QString(item.second.size(), 'x');
+    query.setQueryItems(items);
+    return query.query();
+}
+
+SyncRecorder::SyncRecorder(const QString& fileName, bool scrub, QObject* parent)
+    : QObject(parent), m_file(fileName), m_scrub(scrub)
+{
+    if (!m_file.open(QIODevice::WriteOnly|QIODevice::Truncate))
+    {
+        qWarning() << "Couldn't open" << fileName << "for recording:"
+                   << m_file.errorString();
+        return;
+    }
+    const QJsonObject header {
+        { QStringLiteral("format"), Format },
+        { QStringLiteral("version"), FormatVersion },
+        { QStringLiteral("scrubbed"), scrub }
+    };
+    m_file.write(QJsonDocument(header).toJson(QJsonDocument::Compact) + '\n');
+    m_clock.start();
+    // The manager gets notified about a finished reply before the job
+    // that owns it, so the reply data is still there to peek at
+    connect(QMatrixClient::NetworkAccessManager::instance(),
+            &QNetworkAccessManager::finished,
+            this, &SyncRecorder::recordReply);
+    qDebug() << "Recording syncs to" << fileName
+             << (scrub ? "(scrubbed)" : "");
+}
+
+bool SyncRecorder::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+void SyncRecorder::addConnection(Connection* connection)
+{
+    m_connectionsByAuth.insert("Bearer " + connection->accessToken(),
+                               connection);
+    connect(connection, &QObject::destroyed, this, [this, connection] {
+        for (auto it = m_connectionsByAuth.begin();
+             it != m_connectionsByAuth.end();)
+            if (it.value() == connection)
+                it = m_connectionsByAuth.erase(it);
+            else
+                ++it;
+    });
+}
+
+void SyncRecorder::recordReply(QNetworkReply* reply)
+{
+    if (!m_file.isOpen() || reply->error() != QNetworkReply::NoError)
+        return;
+
+    const auto* connection = m_connectionsByAuth.value(
+            reply->request().rawHeader("Authorization"));
+    if (!connection)
+        return;
+
+    const auto url = reply->url();
+    QJsonObject record {
+        { QStringLiteral("ts"), m_clock.elapsed() },
+        { QStringLiteral("account"), m_scrub
+                ? scrubbedUserId(connection->userId()) : connection->userId() },
+        { QStringLiteral("query"),
+                m_scrub ? scrubbedQuery(url) : url.query() }
+    };
+    const auto path = url.path();
+    if (path.endsWith(QStringLiteral("/sync")))
+        record.insert(QStringLiteral("endpoint"), QStringLiteral("sync"));
+    else
+    {
+        const auto match = MessagesPathRe.match(path);
+        if (!match.hasMatch())
+            return;
+        record.insert(QStringLiteral("endpoint"), QStringLiteral("messages"));
+        record.insert(QStringLiteral("room"),
+                      QUrl::fromPercentEncoding(match.captured(1).toUtf8()));
+    }
+
+    // Peeking leaves the data in place for the job that owns the reply
+    const auto data = reply->peek(reply->bytesAvailable());
+    const auto body = QJsonDocument::fromJson(data).object();
+    record.insert(QStringLiteral("body"), m_scrub ? scrubbed(body) : body);
+
+    m_file.write(QJsonDocument(record).toJson(QJsonDocument::Compact) + '\n');
+    m_file.flush();
+    ++m_recordsCount;
+    TRACE_COUNTER("SyncRecorder.records", m_recordsCount);
+}
+
+QString SyncRecorder::scrubbedUserId(const QString& userId)
+{
+    auto it = m_scrubbedUserIds.find(userId);
+    if (it == m_scrubbedUserIds.end())
+        it = m_scrubbedUserIds.insert(userId,
+                QStringLiteral("@user%1:example.org")
+                    .arg(m_scrubbedUserIds.size() + 1));
+    return *it;
+}
+
+QJsonValue SyncRecorder::scrubbed(const QJsonValue& value, const QString& key)
+{
+    switch (value.type())
+    {
+        case QJsonValue::Object:
+        {
+            // User ids are also used as keys, e.g. in receipts and m.direct
+            const auto object = value.toObject();
+            QJsonObject result;
+            for (auto it = object.begin(); it != object.end(); ++it)
+            {
+                const auto newKey = UserIdRe.match(it.key()).hasMatch()
+                                    ? scrubbedUserId(it.key()) : it.key();
+                result.insert(newKey, scrubbed(it.value(), it.key()));
+            }
+            return result;
+        }
+        case QJsonValue::Array:
+        {
+            QJsonArray result;
+            for (const auto& v: value.toArray())
+                result.push_back(scrubbed(v, key)); // E.g. aliases
+            return result;
+        }
+        case QJsonValue::String:
+        {
+            const auto s = value.toString();
+            if (ScrubbedTextKeys.contains(key))
+                return QString(s.size(), 'x');
+            if (ScrubbedUrlKeys.contains(key))
+                return QStringLiteral("mxc://example.org/scrubbed");
+            return UserIdRe.match(s).hasMatch() ? scrubbedUserId(s) : s;
+        }
+        default:
+            return value;
+    }
+}
@@ -0,0 +1,77 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QJsonValue>
+
+namespace QMatrixClient
+{
+    class Connection;
+}
+class QNetworkReply;
+
+/// Writes the sync and /messages responses of a session to a file
+/**
+ * The recording is a JSON Lines file: a header line followed by one line
+ * per response, with the time it arrived at (relative to the start of
+ * recording), the endpoint, and the response body. SyncReplayServer can
+ * play it back later.
+ *
+ * Responses are picked from NetworkAccessManager before the jobs read
+ * them, and matched to connections by their access tokens, so only
+ * connections passed to addConnection() are recorded.
+ *
+ * With scrubbing enabled, message bodies, display names, room names,
+ * topics, aliases and file names are replaced with placeholders of the same
+ * length, media URLs with a dummy one, and user ids with made-up ones
+ * (consistently throughout the recording). Values of the request query
+ * parameters (filters, sync tokens) are blanked out as well. Room and event
+ * ids, server names in them, timestamps and the structure of the events are
+ * kept, so that the recording can be replayed.
+ */
+class SyncRecorder: public QObject
+{
+        Q_OBJECT
+    public:
+        static const QString Format;
+        static const int FormatVersion;
+
+        SyncRecorder(const QString& fileName, bool scrub,
+                     QObject* parent = nullptr);
+
+        bool isOpen() const;
+        void addConnection(QMatrixClient::Connection* connection);
+
+    private:
+        QFile m_file;
+        bool m_scrub;
+        QElapsedTimer m_clock;
+        QHash<QByteArray, QMatrixClient::Connection*> m_connectionsByAuth;
+        QHash<QString, QString> m_scrubbedUserIds;
+        int m_recordsCount = 0;
+
+        void recordReply(QNetworkReply* reply);
+        QString scrubbedUserId(const QString& userId);
+        QJsonValue scrubbed(const QJsonValue& value, const QString& key = {});
+};
@@ -0,0 +1,203 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "syncreplayserver.h"
+
+#include "syncrecorder.h"
+
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtCore/QFile>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonArray>
+#include <QtCore/QRegularExpression>
+#include <QtCore/QTimer>
+#include <QtCore/QUrlQuery>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+
+static const QRegularExpression MessagesPathRe {
+    QStringLiteral("/rooms/([^/]+)/messages$") };
+/// How long to hold a sync request when there's nothing more to replay
+static const int IdleSyncTimeoutMs = 30000;
+
+SyncReplayServer::SyncReplayServer(QObject* parent)
+    : QObject(parent), m_server(new QTcpServer(this))
+{
+    connect(m_server, &QTcpServer::newConnection,
+            this, &SyncReplayServer::acceptConnection);
+}
+
+QString SyncReplayServer::load(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return file.errorString();
+
+    const auto header = QJsonDocument::fromJson(file.readLine()).object();
+    if (header.value("format").toString() != SyncRecorder::Format ||
+            header.value("version").toInt() > SyncRecorder::FormatVersion)
+        return tr("%1 is not a supported sync recording").arg(fileName);
+
+    while (!file.atEnd())
+    {
+        const auto line = file.readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+        const auto record = QJsonDocument::fromJson(line).object();
+        const auto account = record.value("account").toString();
+        if (m_userId.isEmpty())
+            m_userId = account;
+        else if (account != m_userId)
+            continue;
+
+        Record r { qint64(record.value("ts").toDouble()),
+                   record.value("body").toObject() };
+        if (record.value("endpoint").toString() == "sync")
+            m_syncs.enqueue(r);
+        else
+            m_messagesByRoom[record.value("room").toString()].enqueue(r);
+    }
+    if (m_syncs.isEmpty())
+        return tr("%1 has no syncs recorded").arg(fileName);
+    m_firstSyncTimestamp = m_syncs.head().timestamp;
+    qDebug() << "Loaded" << m_syncs.size() << "syncs and"
+             << m_messagesByRoom.size() << "rooms with history for" << m_userId;
+    return {};
+}
+
+void SyncReplayServer::setSpeed(double speed)
+{
+    m_speed = speed;
+}
+
+bool SyncReplayServer::listen()
+{
+    if (!m_server->listen(QHostAddress::LocalHost))
+    {
+        qWarning() << "Couldn't start the replay server:"
+                   << m_server->errorString();
+        return false;
+    }
+    m_clock.start();
+    qDebug() << "Replaying syncs at" << url();
+    return true;
+}
+
+QUrl SyncReplayServer::url() const
+{
+    return QUrl(QStringLiteral("http://127.0.0.1:%1")
+                .arg(m_server->serverPort()));
+}
+
+QString SyncReplayServer::userId() const
+{
+    return m_userId;
+}
+
+void SyncReplayServer::acceptConnection()
+{
+    while (auto* socket = m_server->nextPendingConnection())
+    {
+        connect(socket, &QTcpSocket::disconnected,
+                socket, &QObject::deleteLater);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket] {
+            // Requests from the library are small and have no body that
+            // matters here; wait for the headers and ignore the rest.
+            const auto data = socket->peek(socket->bytesAvailable());
+            if (!data.contains("\r\n\r\n"))
+                return;
+            socket->readAll();
+            const auto requestLine = data.left(data.indexOf("\r\n")).split(' ');
+            if (requestLine.size() < 2)
+            {
+                socket->disconnectFromHost();
+                return;
+            }
+            serve(socket, requestLine[0],
+                  QUrl(QString::fromUtf8(requestLine[1])));
+        });
+    }
+}
+
+void SyncReplayServer::serve(QTcpSocket* socket, const QByteArray& method,
+                             const QUrl& url)
+{
+    const auto path = url.path();
+    if (path.endsWith("/sync"))
+    {
+        if (m_syncs.isEmpty())
+        {
+            // Behave like a server with nothing new: hold the request
+            QTimer::singleShot(IdleSyncTimeoutMs, socket,
+                [this, socket] {
+                    reply(socket, { { "next_batch", m_lastNextBatch } });
+                });
+            return;
+        }
+        const auto record = m_syncs.dequeue();
+        m_lastNextBatch = record.body.value("next_batch").toString();
+        const auto dueMs = m_speed > 0
+            ? qint64((record.timestamp - m_firstSyncTimestamp) / m_speed) : 0;
+        const auto delayMs = std::max(qint64(0), dueMs - m_clock.elapsed());
+        QTimer::singleShot(int(delayMs), socket,
+            [this, socket, body = record.body] { reply(socket, body); });
+        return;
+    }
+
+    const auto match = MessagesPathRe.match(path);
+    if (match.hasMatch())
+    {
+        const auto roomId =
+            QUrl::fromPercentEncoding(match.captured(1).toUtf8());
+        auto& queue = m_messagesByRoom[roomId];
+        if (!queue.isEmpty())
+        {
+            reply(socket, queue.dequeue().body);
+            return;
+        }
+        const auto from = QUrlQuery(url).queryItemValue("from");
+        reply(socket, { { "start", from }, { "end", from },
+                        { "chunk", QJsonArray() } });
+        return;
+    }
+
+    if (path.startsWith("/_matrix/media/"))
+    {
+        reply(socket, { { "errcode", "M_NOT_FOUND" },
+                        { "error", "Media are not recorded" } }, 404);
+        return;
+    }
+    qDebug() << "Replay server: answering" << method << path << "with {}";
+    reply(socket, {});
+}
+
+void SyncReplayServer::reply(QTcpSocket* socket, const QJsonObject& body,
+                             int status)
+{
+    const auto data = QJsonDocument(body).toJson(QJsonDocument::Compact);
+    socket->write("HTTP/1.1 " + QByteArray::number(status) +
+                  (status == 200 ? " OK" : " Not Found") + "\r\n"
+                  "Content-Type: application/json\r\n"
+                  "Connection: close\r\n"
+                  "Content-Length: " + QByteArray::number(data.size()) +
+                  "\r\n\r\n" + data);
+    socket->disconnectFromHost();
+}
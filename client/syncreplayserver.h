@@ -0,0 +1,76 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QJsonObject>
+#include <QtCore/QObject>
+#include <QtCore/QQueue>
+#include <QtCore/QUrl>
+
+class QTcpServer;
+class QTcpSocket;
+
+/// Plays a SyncRecorder recording back as a local homeserver
+/**
+ * Sync requests get the recorded sync responses in order, at the recorded
+ * pace (sped up or slowed down by the speed factor; 0 means no delays).
+ * /messages requests get the recorded responses for the same room in
+ * order, or an empty chunk once those run out. Other requests are
+ * answered with an empty object, except media, which is never recorded.
+ * Only the first account of the recording is played back.
+ */
+class SyncReplayServer: public QObject
+{
+        Q_OBJECT
+    public:
+        explicit SyncReplayServer(QObject* parent = nullptr);
+
+        /// Load the recording; returns an error message on failure
+        QString load(const QString& fileName);
+        void setSpeed(double speed);
+        bool listen();
+
+        QUrl url() const;
+        QString userId() const;
+
+    private:
+        struct Record
+        {
+            qint64 timestamp;
+            QJsonObject body;
+        };
+
+        QTcpServer* m_server;
+        QString m_userId;
+        double m_speed = 1;
+        QQueue<Record> m_syncs;
+        QHash<QString, QQueue<Record>> m_messagesByRoom;
+        qint64 m_firstSyncTimestamp = -1;
+        QElapsedTimer m_clock;
+        QString m_lastNextBatch;
+
+        void acceptConnection();
+        void serve(QTcpSocket* socket, const QByteArray& method,
+                   const QUrl& url);
+        void reply(QTcpSocket* socket, const QJsonObject& body,
+                   int status = 200);
+};
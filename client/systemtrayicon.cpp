@@ -23,38 +23,144 @@
 #include "quaternionroom.h"
 #include <settings.h>
 
+#include <QtCore/QTimerEvent>
+#include <QtCore/QStringBuilder>
+
+#include <utility>
+
+// Highlights arriving within this period are shown in a single notification
+static const int NotificationWindowMs = 2000;
+// In "intrusive" mode, don't steal focus more often than this
+static const int ActivationIntervalMs = 30000;
+
 SystemTrayIcon::SystemTrayIcon(MainWindow* parent)
     : QSystemTrayIcon(parent)
     , m_parent(parent)
 {
     setIcon(QIcon(":/icon.png"));
-    setToolTip("Quaternion");
+    updateToolTip();
     connect( this, &SystemTrayIcon::activated, this, &SystemTrayIcon::systemTrayIconAction);
+    connect( this, &SystemTrayIcon::messageClicked, m_parent, [this] {
+        if (m_shownMessageRoom)
+            m_parent->selectRoom(m_shownMessageRoom);
+    });
 }
 
 void SystemTrayIcon::newRoom(QMatrixClient::Room* room)
 {
     connect(room, &QMatrixClient::Room::highlightCountChanged,
             this, &SystemTrayIcon::highlightCountChanged);
+    connect(room, &QMatrixClient::Room::notificationCountChanged,
+            this, &SystemTrayIcon::notificationCountChanged);
+    connect(room, &QObject::destroyed, this, [this,room] { forgetRoom(room); });
+    notificationCountChanged(room);
+    m_roomCounts[room].highlights = room->highlightCount();
+    m_totalHighlights += room->highlightCount();
+    updateToolTip();
+}
+
+void SystemTrayIcon::forgetRoom(QMatrixClient::Room* room)
+{
+    // The room is being destroyed, so don't call anything on it
+    const auto counts = m_roomCounts.take(room);
+    m_totalNotifications -= counts.notifications;
+    m_totalHighlights -= counts.highlights;
+    m_pendingHighlights.remove(room);
+    updateToolTip();
+}
+
+void SystemTrayIcon::notificationCountChanged(QMatrixClient::Room* room)
+{
+    auto& counts = m_roomCounts[room];
+    const auto newCount = room->notificationCount();
+    m_totalNotifications += newCount - counts.notifications;
+    counts.notifications = newCount;
+    updateToolTip();
 }
 
 void SystemTrayIcon::highlightCountChanged(QMatrixClient::Room* room)
 {
+    auto& counts = m_roomCounts[room];
+    const auto newCount = room->highlightCount();
+    const auto delta = newCount - counts.highlights;
+    m_totalHighlights += delta;
+    counts.highlights = newCount;
+    updateToolTip();
+
+    if (delta <= 0)
+        return; // Highlights have been read, nothing to notify about
+
+    m_pendingHighlights[room] += delta;
+    m_lastHighlightedRoom = room;
+    if (!m_notificationTimer.isActive())
+        m_notificationTimer.start(NotificationWindowMs, this);
+}
+
+void SystemTrayIcon::timerEvent(QTimerEvent* event)
+{
+    if (event->timerId() != m_notificationTimer.timerId())
+    {
+        QSystemTrayIcon::timerEvent(event);
+        return;
+    }
+    m_notificationTimer.stop();
+    showPendingHighlights();
+}
+
+void SystemTrayIcon::showPendingHighlights()
+{
+    const auto pending = std::exchange(m_pendingHighlights, {});
     auto mode = QMatrixClient::SettingsGroup("UI")
                                 .value("notifications", "intrusive");
-    if (mode == "none")
+    if (mode == "none" || pending.isEmpty())
         return;
-    if( room->highlightCount() > 0 )
+
+    // Highlights arriving after this don't change what a click opens
+    m_shownMessageRoom = pending.size() == 1 || !m_lastHighlightedRoom
+                         ? pending.begin().key() : m_lastHighlightedRoom.data();
+    if (pending.size() == 1)
     {
-        showMessage(tr("Highlight!"), tr("%1: %2 highlight(s)").arg(room->displayName()).arg(room->highlightCount()));
-        if (mode != "non-intrusive")
-            m_parent->activateWindow();
-        auto* qRoom = static_cast<QuaternionRoom*>(room);
-        connect(this, &SystemTrayIcon::messageClicked, m_parent, [this,qRoom] {
-            m_parent->selectRoom(qRoom);
-            disconnect(this, &SystemTrayIcon::messageClicked, nullptr, nullptr);
-        });
+        auto* room = pending.begin().key();
+        showMessage(tr("Highlight!"), tr("%1: %2 highlight(s)")
+                    .arg(room->displayName()).arg(room->highlightCount()));
+    } else {
+        int total = 0;
+        QStringList roomLines;
+        for (auto it = pending.cbegin(); it != pending.cend(); ++it)
+        {
+            total += it.value();
+            if (roomLines.size() < 5)
+                roomLines.push_back(
+                    tr("%1: %2").arg(it.key()->displayName()).arg(it.value()));
+        }
+        if (pending.size() > roomLines.size())
+            roomLines.push_back(
+                tr("...and %1 more room(s)")
+                    .arg(pending.size() - roomLines.size()));
+        showMessage(tr("%1 new highlight(s) in %2 rooms")
+                        .arg(total).arg(pending.size()),
+                    roomLines.join('\n'));
+    }
+
+    if (mode != "non-intrusive" &&
+            (!m_sinceLastActivation.isValid() ||
+             m_sinceLastActivation.hasExpired(ActivationIntervalMs)))
+    {
+        m_parent->activateWindow();
+        m_sinceLastActivation.start();
+    }
+}
+
+void SystemTrayIcon::updateToolTip()
+{
+    if (m_totalNotifications == 0 && m_totalHighlights == 0)
+    {
+        setToolTip("Quaternion");
+        return;
     }
+    setToolTip("Quaternion\n" %
+        tr("%1 unread notification(s), %2 highlight(s)")
+            .arg(m_totalNotifications).arg(m_totalHighlights));
 }
 
 void SystemTrayIcon::systemTrayIconAction(QSystemTrayIcon::ActivationReason reason)
@@ -20,6 +20,10 @@
 #pragma once
 
 #include <QtWidgets/QSystemTrayIcon>
+#include <QtCore/QBasicTimer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QPointer>
 
 namespace QMatrixClient
 {
@@ -28,6 +32,14 @@ namespace QMatrixClient
 
 class MainWindow;
 
+/// The tray icon that also serves as a notification engine
+/**
+ * Highlights arriving in a short period of time (possibly in several rooms)
+ * are collected and shown as a single notification; the window is activated
+ * (in "intrusive" mode) not more often than once in a while. The tooltip
+ * shows totals of unread notifications and highlights across all rooms;
+ * these are updated by deltas as counters in individual rooms change.
+ */
 class SystemTrayIcon: public QSystemTrayIcon
 {
         Q_OBJECT
@@ -37,11 +49,37 @@ class SystemTrayIcon: public QSystemTrayIcon
     public slots:
         void newRoom(QMatrixClient::Room* room);
 
+    protected:
+        void timerEvent(QTimerEvent* event) override;
+
     private slots:
         void highlightCountChanged(QMatrixClient::Room* room);
+        void notificationCountChanged(QMatrixClient::Room* room);
         void systemTrayIconAction(QSystemTrayIcon::ActivationReason reason);
 
     private:
         MainWindow* m_parent;
+
+        struct RoomCounts
+        {
+            int notifications = 0;
+            int highlights = 0;
+        };
+        QHash<QMatrixClient::Room*, RoomCounts> m_roomCounts;
+        int m_totalNotifications = 0;
+        int m_totalHighlights = 0;
+
+        /// New highlights per room since the last notification
+        QHash<QMatrixClient::Room*, int> m_pendingHighlights;
+        /// The room with the newest of the pending highlights
+        QPointer<QMatrixClient::Room> m_lastHighlightedRoom;
+        /// The room to open when the shown message is clicked
+        QPointer<QMatrixClient::Room> m_shownMessageRoom;
+        QBasicTimer m_notificationTimer;
+        QElapsedTimer m_sinceLastActivation;
+
+        void forgetRoom(QMatrixClient::Room* room);
+        void showPendingHighlights();
+        void updateToolTip();
         void showHide();
 };
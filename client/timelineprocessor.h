@@ -0,0 +1,102 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <room.h>
+
+#include <QtCore/QDateTime>
+#include <QtCore/QJsonObject>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include <functional>
+
+class QuaternionRoom;
+
+/// An immutable copy of what processors may need from a timeline event
+/**
+ * Snapshots are taken on the GUI thread and only ever read afterwards,
+ * so they can be passed to worker threads; Qt's implicit sharing keeps
+ * copying them cheap.
+ */
+struct EventSnapshot
+{
+    /// Optional parts of the snapshot, only taken if some stage reads them
+    enum Part { PlainBodyPart = 0x1, ContentJsonPart = 0x2,
+                AllParts = PlainBodyPart | ContentJsonPart };
+
+    QMatrixClient::TimelineItem::index_t index;
+    QString id;
+    QString matrixType;
+    QString senderId;
+    QDateTime timestamp;
+    bool isRedacted;
+    /// Plain-text body for room messages, empty for other events
+    QString plainBody;
+    /// Shares the data with the event, the JSON is not copied
+    QJsonObject contentJson;
+};
+
+/// A batch of events from one room, handed to a processor
+struct EventBatch
+{
+    QString accountId;
+    QString roomId;
+    bool historical;
+    QVector<EventSnapshot> events;
+};
+
+/// A stage of the timeline ingestion pipeline
+/**
+ * Each stage is prepared on the GUI thread for a specific room, processes
+ * a batch of event snapshots on a worker thread and returns a publisher
+ * that applies the result to the room back on the GUI thread. Batches of
+ * the same stage may be processed in parallel and their results may be
+ * published in any order.
+ *
+ * \sa IngestionPipeline
+ */
+class TimelineProcessor
+{
+    public:
+        using Publisher = std::function<void(QuaternionRoom*)>;
+        using Job = std::function<Publisher(const EventBatch&)>;
+
+        virtual ~TimelineProcessor() = default;
+
+        /// The name of the stage, for timing statistics
+        virtual QString name() const = 0;
+        /// Matrix types of events the stage wants; empty means all events
+        virtual QStringList eventTypes() const { return {}; }
+        /// Optional parts of the snapshots the stage reads
+        /** A combination of EventSnapshot::Part flags; the parts that
+         * no stage reads are left empty. */
+        virtual int snapshotParts() const { return EventSnapshot::AllParts; }
+
+        /// Make a job for a new batch from the room
+        /**
+         * This is called on the GUI thread; the job should capture
+         * everything it needs from the room because it cannot touch
+         * the room itself. Return an empty job to skip the batch.
+         * The job can return an empty publisher if there's nothing
+         * to apply to the room.
+         */
+        virtual Job prepare(QuaternionRoom* room) = 0;
+};
@@ -0,0 +1,298 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "tracing.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QSaveFile>
+#include <QtCore/QThread>
+#include <QtCore/QDebug>
+
+#include <memory>
+#include <vector>
+
+std::atomic<bool> Tracer::s_active { false };
+std::atomic<bool> Tracer::s_recording { false };
+
+namespace {
+    /// No more events are recorded on a thread beyond this number
+    static const size_t MaxEventsPerThread = 2000000;
+
+    struct TraceEvent
+    {
+        const char* name;
+        const char* category;
+        const char* argName;
+        qint64 argValue;
+        qint64 startNs;
+        qint64 durationNs;
+        char phase;
+    };
+
+    struct OpenSpan
+    {
+        const char* name;
+        const char* category;
+        const char* argName;
+        qint64 argValue;
+        qint64 startNs;
+    };
+
+    struct ThreadBuffer
+    {
+        int tid;
+        const QThread* thread;
+        QString threadName;
+        /// The name of the innermost open span, for currentSpan()
+        std::atomic<const char*> currentSpan { nullptr };
+        /// Guards events and dropped; the span stack is only ever
+        /// touched by the thread owning the buffer
+        QMutex mutex;
+        std::vector<TraceEvent> events;
+        qint64 dropped = 0;
+        std::vector<OpenSpan> stack;
+    };
+
+    struct TracerState
+    {
+        QMutex mutex;
+        QString fileName;
+        QElapsedTimer clock;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    };
+
+    TracerState& state()
+    {
+        static TracerState s;
+        return s;
+    }
+
+    thread_local ThreadBuffer* t_buffer = nullptr;
+
+    ThreadBuffer* threadBuffer()
+    {
+        if (!t_buffer)
+        {
+            auto& s = state();
+            QMutexLocker lock(&s.mutex);
+            s.buffers.emplace_back(new ThreadBuffer);
+            t_buffer = s.buffers.back().get();
+            t_buffer->tid = int(s.buffers.size());
+            auto* thread = QThread::currentThread();
+            t_buffer->thread = thread;
+            t_buffer->threadName =
+                qApp && thread == qApp->thread() ? QStringLiteral("GUI") :
+                !thread->objectName().isEmpty() ? thread->objectName() :
+                QStringLiteral("Thread %1").arg(t_buffer->tid);
+        }
+        return t_buffer;
+    }
+
+    qint64 now()
+    {
+        return state().clock.nsecsElapsed();
+    }
+
+    void record(ThreadBuffer* b, const TraceEvent& e)
+    {
+        QMutexLocker lock(&b->mutex);
+        if (b->events.size() < MaxEventsPerThread)
+            b->events.push_back(e);
+        else
+            ++b->dropped;
+    }
+
+    QByteArray jsonString(const QString& s)
+    {
+        QByteArray result = "\"";
+        for (auto c: s.toUtf8())
+        {
+            if (c == '"' || c == '\\')
+                result += '\\';
+            if (c >= 0 && c < ' ')
+                continue;
+            result += c;
+        }
+        return result + '"';
+    }
+
+    QByteArray jsonString(const char* s)
+    {
+        return jsonString(QString::fromUtf8(s));
+    }
+
+    QByteArray micros(qint64 ns)
+    {
+        return QByteArray::number(double(ns) / 1000, 'f', 3);
+    }
+}
+
+bool Tracer::start(const QString& fileName)
+{
+    if (!compiledIn)
+    {
+        qWarning() << "This build of Quaternion has no tracing support;"
+                      " rebuild with ENABLE_TRACING turned on";
+        return false;
+    }
+    auto& s = state();
+    {
+        QMutexLocker lock(&s.mutex);
+        s.fileName = fileName;
+        if (!s.clock.isValid())
+            s.clock.start();
+    }
+    s_recording = true;
+    s_active = true;
+    qDebug() << "Tracing to" << fileName;
+    return true;
+}
+
+void Tracer::trackSpans()
+{
+    if (!compiledIn)
+        return;
+    {
+        auto& s = state();
+        QMutexLocker lock(&s.mutex);
+        if (!s.clock.isValid())
+            s.clock.start();
+    }
+    s_active = true;
+}
+
+const char* Tracer::currentSpan(const QThread* thread)
+{
+    auto& s = state();
+    QMutexLocker lock(&s.mutex);
+    // Finished threads leave their buffers behind, and their QThread
+    // addresses may be reused; the latest buffer is the live one.
+    for (auto it = s.buffers.crbegin(); it != s.buffers.crend(); ++it)
+        if ((*it)->thread == thread)
+            return (*it)->currentSpan.load(std::memory_order_acquire);
+    return nullptr;
+}
+
+void Tracer::stop()
+{
+    if (!s_recording)
+        return;
+    s_recording = false;
+
+    auto& s = state();
+    QMutexLocker lock(&s.mutex);
+    QSaveFile file(s.fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Couldn't write the trace to" << s.fileName << '-'
+                   << file.errorString();
+        return;
+    }
+
+    const auto pid = QByteArray::number(QCoreApplication::applicationPid());
+    file.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    qint64 eventCount = 0, droppedCount = 0;
+    for (const auto& b: s.buffers)
+    {
+        QMutexLocker bufferLock(&b->mutex);
+        const auto tid = QByteArray::number(b->tid);
+        QByteArray chunk;
+        chunk.reserve(int(b->events.size() * 100 + 100));
+        chunk += first ? "" : ",\n";
+        first = false;
+        chunk += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid
+                 + ",\"tid\":" + tid
+                 + ",\"args\":{\"name\":" + jsonString(b->threadName) + "}}";
+        for (const auto& e: b->events)
+        {
+            chunk += ",\n{\"name\":" + jsonString(e.name);
+            if (e.category)
+                chunk += ",\"cat\":" + jsonString(e.category);
+            chunk += ",\"ph\":\"";
+            chunk += e.phase;
+            chunk += "\",\"ts\":" + micros(e.startNs);
+            if (e.phase == 'X')
+                chunk += ",\"dur\":" + micros(e.durationNs);
+            if (e.phase == 'i')
+                chunk += ",\"s\":\"t\"";
+            chunk += ",\"pid\":" + pid + ",\"tid\":" + tid;
+            if (e.argName)
+                chunk += ",\"args\":{" + jsonString(e.argName) + ':'
+                         + QByteArray::number(e.argValue) + '}';
+            chunk += '}';
+        }
+        file.write(chunk);
+        eventCount += qint64(b->events.size());
+        droppedCount += b->dropped;
+    }
+    file.write("\n]}\n");
+    if (!file.commit())
+    {
+        qWarning() << "Couldn't write the trace to" << s.fileName << '-'
+                   << file.errorString();
+        return;
+    }
+    qDebug() << "Written" << eventCount << "trace event(s) to" << s.fileName;
+    if (droppedCount > 0)
+        qWarning() << droppedCount << "trace event(s) dropped after reaching"
+                   << MaxEventsPerThread << "events on a thread";
+}
+
+void Tracer::beginSpan(const char* name, const char* category,
+                       const char* argName, qint64 argValue)
+{
+    if (!isActive())
+        return;
+    auto* b = threadBuffer();
+    b->stack.push_back({ name, category, argName, argValue,
+                         s_recording ? now() : 0 });
+    b->currentSpan.store(name, std::memory_order_release);
+}
+
+void Tracer::endSpan()
+{
+    if (!compiledIn || !t_buffer || t_buffer->stack.empty())
+        return;
+    const auto span = t_buffer->stack.back();
+    t_buffer->stack.pop_back();
+    t_buffer->currentSpan.store(
+        t_buffer->stack.empty() ? nullptr : t_buffer->stack.back().name,
+        std::memory_order_release);
+    if (s_recording && span.startNs > 0)
+        record(t_buffer, { span.name, span.category, span.argName,
+                           span.argValue, span.startNs,
+                           now() - span.startNs, 'X' });
+}
+
+void Tracer::counter(const char* name, qint64 value)
+{
+    if (s_recording)
+        record(threadBuffer(),
+               { name, nullptr, "value", value, now(), 0, 'C' });
+}
+
+void Tracer::instant(const char* name, const char* category)
+{
+    if (s_recording)
+        record(threadBuffer(),
+               { name, category, nullptr, 0, now(), 0, 'i' });
+}
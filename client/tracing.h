@@ -0,0 +1,137 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QString>
+
+class QThread;
+
+#include <atomic>
+
+/// Lightweight in-process tracing of spans and counters
+/**
+ * Spans are nested intervals on a thread; counters are sampled values.
+ * Nothing is recorded until start() is called (the --trace command line
+ * option), and when the client is built with ENABLE_TRACING turned off,
+ * the TRACE_* macros expand to nothing at all. Without recording, spans
+ * can still be tracked (see trackSpans()) so that other threads can see
+ * what a thread is busy with.
+ *
+ * Events are buffered per thread and written out by stop() in the Chrome
+ * trace event format, which chrome://tracing and the Perfetto UI can open.
+ * Names and categories must be string literals (or otherwise outlive
+ * the tracer): only the pointers are stored.
+ */
+class Tracer
+{
+    public:
+#ifdef QUATERNION_TRACING
+        static constexpr bool compiledIn = true;
+#else
+        static constexpr bool compiledIn = false;
+#endif
+
+        /// Start recording; the trace will be written to fileName on stop()
+        static bool start(const QString& fileName);
+        /// Stop recording and write the trace file
+        static void stop();
+        /// Maintain the stacks of open spans, even if not recording
+        static void trackSpans();
+
+        /// Whether spans are tracked (not necessarily recorded)
+        static bool isActive()
+        {
+            return compiledIn && s_active.load(std::memory_order_relaxed);
+        }
+        /// The innermost span open on the thread, or nullptr if none
+        /** Can be called from any thread. Only spans opened after
+         * trackSpans() or start() are known. */
+        static const char* currentSpan(const QThread* thread);
+
+        /// Open a span on the current thread
+        /**
+         * \param argName if not null, the span gets an integer argument
+         *                with this name and argValue value
+         */
+        static void beginSpan(const char* name, const char* category,
+                              const char* argName = nullptr,
+                              qint64 argValue = 0);
+        /// Close the innermost span opened on the current thread
+        /** Does nothing if there's no open span, e.g. if recording
+         * has been started after the span was supposed to begin. */
+        static void endSpan();
+        static void counter(const char* name, qint64 value);
+        static void instant(const char* name, const char* category);
+
+    private:
+        static std::atomic<bool> s_active;
+        static std::atomic<bool> s_recording;
+};
+
+/// Records a span for its lifetime; use TRACE_SPAN instead of this directly
+class TraceSpan
+{
+    public:
+        TraceSpan(const char* name, const char* category,
+                  const char* argName = nullptr, qint64 argValue = 0)
+            : active(Tracer::isActive())
+        {
+            if (active)
+                Tracer::beginSpan(name, category, argName, argValue);
+        }
+        ~TraceSpan()
+        {
+            if (active)
+                Tracer::endSpan();
+        }
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+    private:
+        bool active;
+};
+
+#define TRACE_CONCAT_IMPL(A, B) A##B
+#define TRACE_CONCAT(A, B) TRACE_CONCAT_IMPL(A, B)
+
+#ifdef QUATERNION_TRACING
+#define TRACE_SPAN(Name, Category) \
+    TraceSpan TRACE_CONCAT(traceSpan_, __LINE__) { Name, Category }
+#define TRACE_SPAN_ARG(Name, Category, ArgName, ArgValue) \
+    TraceSpan TRACE_CONCAT(traceSpan_, __LINE__) \
+        { Name, Category, ArgName, qint64(ArgValue) }
+#define TRACE_COUNTER(Name, Value) \
+    do { if (Tracer::isActive()) Tracer::counter(Name, qint64(Value)); } \
+    while (false)
+/// Open a span to be closed by TRACE_END, e.g. in another signal handler
+#define TRACE_BEGIN(Name, Category) Tracer::beginSpan(Name, Category)
+#define TRACE_BEGIN_ARG(Name, Category, ArgName, ArgValue) \
+    Tracer::beginSpan(Name, Category, ArgName, qint64(ArgValue))
+#define TRACE_END() Tracer::endSpan()
+#else
+#define TRACE_SPAN(Name, Category) do { } while (false)
+#define TRACE_SPAN_ARG(Name, Category, ArgName, ArgValue) \
+    do { } while (false)
+#define TRACE_COUNTER(Name, Value) do { } while (false)
+#define TRACE_BEGIN(Name, Category) do { } while (false)
+#define TRACE_BEGIN_ARG(Name, Category, ArgName, ArgValue) \
+    do { } while (false)
+#define TRACE_END() do { } while (false)
+#endif
@@ -68,6 +68,11 @@ void UserListDock::setRoom(QMatrixClient::Room* room)
     m_model->setRoom(room);
 }
 
+void UserListDock::prewarm(QMatrixClient::Room* room)
+{
+    m_model->prepare(room);
+}
+
 void UserListDock::refreshTitle()
 {
     setWindowTitle(tr("Users (%1)").arg(m_model->rowCount(QModelIndex())));
@@ -38,6 +38,8 @@ class UserListDock: public QDockWidget
         explicit UserListDock(QWidget* parent = nullptr);
 
         void setRoom( QMatrixClient::Room* room );
+        /// Prepare the member list of the room before switching to it
+        void prewarm(QMatrixClient::Room* room);
 
     signals:
         void userMentionRequested(QMatrixClient::User* u);
@@ -0,0 +1,91 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "mockhomeserver.h"
+
+#include <QtGui/QGuiApplication>
+#include <QtCore/QCommandLineParser>
+
+#include <algorithm>
+
+int main(int argc, char* argv[])
+{
+    // QImage is used to make media, but nothing is shown
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+    QGuiApplication::setApplicationName(QStringLiteral("quaternion-mock-homeserver"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Serves synthetic Matrix rooms under configurable load, for testing"
+        " Quaternion offline. Start Quaternion with"
+        " --homeserver http://127.0.0.1:<port> and log in as anyone."));
+    parser.addHelpOption();
+    const MockHomeserver::Options defaults;
+    QCommandLineOption portOption("port",
+        QStringLiteral("Port to listen on"), "port",
+        QString::number(defaults.port));
+    QCommandLineOption roomsOption("rooms",
+        QStringLiteral("Number of rooms"), "count",
+        QString::number(defaults.rooms));
+    QCommandLineOption membersOption("members",
+        QStringLiteral("Initial number of members in each room"), "count",
+        QString::number(defaults.membersPerRoom));
+    QCommandLineOption historyOption("history",
+        QStringLiteral("Number of events in each room's history"), "count",
+        QString::number(defaults.historyDepth));
+    QCommandLineOption rateOption("events-per-second",
+        QStringLiteral("New messages per second, across all rooms"), "rate",
+        QString::number(defaults.eventsPerSecond));
+    QCommandLineOption membershipOption("membership-per-second",
+        QStringLiteral("Joins and leaves per second, across all rooms"
+                       " (a membership storm if high)"), "rate",
+        QString::number(defaults.membershipPerSecond));
+    QCommandLineOption imageRatioOption("image-ratio",
+        QStringLiteral("Share of messages that are images, 0 to 1"), "ratio",
+        QString::number(defaults.imageRatio));
+    QCommandLineOption mediaSizeOption("media-size",
+        QStringLiteral("Approximate size of each image, in bytes"), "bytes",
+        QString::number(defaults.mediaSize));
+    QCommandLineOption seedOption("seed",
+        QStringLiteral("Seed for the generated content"), "number",
+        QString::number(defaults.seed));
+    parser.addOptions({ portOption, roomsOption, membersOption, historyOption,
+                        rateOption, membershipOption, imageRatioOption,
+                        mediaSizeOption, seedOption });
+    parser.process(app);
+
+    MockHomeserver::Options options;
+    options.port = quint16(parser.value(portOption).toUInt());
+    options.rooms = std::max(1, parser.value(roomsOption).toInt());
+    options.membersPerRoom = std::max(1, parser.value(membersOption).toInt());
+    options.historyDepth = std::max(0, parser.value(historyOption).toInt());
+    options.eventsPerSecond = parser.value(rateOption).toDouble();
+    options.membershipPerSecond = parser.value(membershipOption).toDouble();
+    options.imageRatio = parser.value(imageRatioOption).toDouble();
+    options.mediaSize = std::max(1, parser.value(mediaSizeOption).toInt());
+    options.seed = parser.value(seedOption).toUInt();
+
+    MockHomeserver server(options);
+    if (!server.listen())
+        return 1;
+    return app.exec();
+}
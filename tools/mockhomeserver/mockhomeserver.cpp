@@ -0,0 +1,589 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#include "mockhomeserver.h"
+
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtGui/QImage>
+#include <QtCore/QBuffer>
+#include <QtCore/QDateTime>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QTimer>
+#include <QtCore/QUrlQuery>
+#include <QtCore/QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+static const int LoadTickMs = 20;
+static const int StatsIntervalMs = 1000;
+static const int InitialTimelineSize = 20;
+static const int MaxHistoryPage = 1000;
+static const int DefaultSyncTimeoutMs = 30000;
+static const QString ServerName = QStringLiteral("localhost");
+static const char* const Words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+    "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+    "et", "dolore", "magna", "aliqua", "matrix", "quaternion", "sync"
+};
+
+static QString userId(int n)
+{
+    return QStringLiteral("@user%1:%2").arg(n).arg(ServerName);
+}
+
+MockHomeserver::MockHomeserver(const Options& options, QObject* parent)
+    : QObject(parent), m_options(options), m_server(new QTcpServer(this))
+    , m_loadTimer(new QTimer(this)), m_random(options.seed)
+{
+    m_rooms.resize(options.rooms);
+    for (int i = 0; i < options.rooms; ++i)
+    {
+        auto& r = m_rooms[i];
+        r.id = QStringLiteral("!room%1:%2").arg(i).arg(ServerName);
+        r.name = QStringLiteral("Load room %1").arg(i);
+        for (int m = 0; m < options.membersPerRoom; ++m)
+            r.members.push_back(userId((i * 7 + m) % (options.rooms * 3 + 10)));
+        m_roomIndices.insert(r.id, i);
+    }
+    m_nextUserNo = options.rooms * 3 + 10;
+
+    connect(m_server, &QTcpServer::newConnection,
+            this, &MockHomeserver::acceptConnection);
+    connect(m_loadTimer, &QTimer::timeout, this, &MockHomeserver::generateLoad);
+    auto* statsTimer = new QTimer(this);
+    connect(statsTimer, &QTimer::timeout, this, &MockHomeserver::reportStats);
+    statsTimer->start(StatsIntervalMs);
+}
+
+bool MockHomeserver::listen()
+{
+    if (!m_server->listen(QHostAddress::LocalHost, m_options.port))
+    {
+        qCritical() << "Couldn't listen on port" << m_options.port << "-"
+                    << m_server->errorString();
+        return false;
+    }
+    qInfo().noquote() << "Mock homeserver is at"
+        << QStringLiteral("http://127.0.0.1:%1").arg(m_server->serverPort())
+        << "with" << m_rooms.size() << "rooms";
+    return true;
+}
+
+// HTTP
+
+void MockHomeserver::acceptConnection()
+{
+    while (auto* socket = m_server->nextPendingConnection())
+    {
+        connect(socket, &QTcpSocket::readyRead,
+                this, [this, socket] { readRequest(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket] {
+            m_buffers.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void MockHomeserver::readRequest(QTcpSocket* socket)
+{
+    auto& buffer = m_buffers[socket];
+    buffer += socket->readAll();
+    const auto headersEnd = buffer.indexOf("\r\n\r\n");
+    if (headersEnd == -1)
+        return;
+
+    const auto headers = buffer.left(headersEnd).split('\n');
+    int contentLength = 0;
+    for (const auto& h: headers)
+        if (h.toLower().startsWith("content-length:"))
+            contentLength = h.mid(h.indexOf(':') + 1).trimmed().toInt();
+    if (buffer.size() < headersEnd + 4 + contentLength)
+        return; // Wait for the rest of the body
+
+    const auto requestLine = headers.front().trimmed().split(' ');
+    Request request;
+    if (requestLine.size() >= 2)
+    {
+        request.method = requestLine[0];
+        request.url = QUrl(QString::fromUtf8(requestLine[1]));
+    }
+    request.body = QJsonDocument::fromJson(
+            buffer.mid(headersEnd + 4, contentLength)).object();
+    buffer.clear();
+    handle(socket, request);
+}
+
+void MockHomeserver::reply(QTcpSocket* socket, const QJsonObject& body,
+                           int status)
+{
+    replyRaw(socket, QJsonDocument(body).toJson(QJsonDocument::Compact),
+             "application/json", status);
+}
+
+void MockHomeserver::replyRaw(QTcpSocket* socket, const QByteArray& data,
+                              const QByteArray& contentType, int status)
+{
+    if (!socket || socket->state() != QAbstractSocket::ConnectedState)
+        return;
+    socket->write("HTTP/1.1 " + QByteArray::number(status) +
+                  (status == 200 ? " OK" : " Error") + "\r\n"
+                  "Content-Type: " + contentType + "\r\n"
+                  "Access-Control-Allow-Origin: *\r\n"
+                  "Connection: close\r\n"
+                  "Content-Length: " + QByteArray::number(data.size()) +
+                  "\r\n\r\n" + data);
+    socket->disconnectFromHost();
+    m_bytesServed += data.size();
+}
+
+void MockHomeserver::handle(QTcpSocket* socket, const Request& request)
+{
+    const auto path = request.url.path(QUrl::FullyDecoded);
+    const auto parts = path.split('/', QString::SkipEmptyParts);
+    // parts: _matrix, client|media, r0|version, ...
+    if (parts.size() < 3 || parts[0] != "_matrix")
+    {
+        reply(socket, { { "errcode", "M_UNRECOGNIZED" } }, 404);
+        return;
+    }
+
+    if (parts[1] == "media")
+    {
+        if (parts.size() >= 6 && (parts[3] == "download" ||
+                                  parts[3] == "thumbnail"))
+        {
+            const QUrlQuery query(request.url);
+            QSize size;
+            if (parts[3] == "thumbnail")
+                size = QSize(query.queryItemValue("width").toInt(),
+                             query.queryItemValue("height").toInt());
+            replyRaw(socket, image(size), "image/png");
+            return;
+        }
+        reply(socket, { { "errcode", "M_NOT_FOUND" } }, 404);
+        return;
+    }
+
+    if (parts[2] == "versions")
+    {
+        reply(socket, { { "versions", QJsonArray { "r0.3.0", "r0.4.0" } } });
+        return;
+    }
+    const auto endpoint = parts.mid(3);
+    if (endpoint == QStringList { "login" })
+    {
+        if (request.method == "GET")
+            reply(socket, { { "flows", QJsonArray { QJsonObject {
+                    { "type", "m.login.password" } } } } });
+        else
+            reply(socket, login(request.body));
+        return;
+    }
+    if (endpoint == QStringList { "sync" })
+    {
+        sync(socket, request.url);
+        return;
+    }
+    if (endpoint.size() >= 3 && endpoint[0] == "rooms")
+    {
+        const auto roomIt = m_roomIndices.constFind(endpoint[1]);
+        if (roomIt == m_roomIndices.cend())
+        {
+            reply(socket, { { "errcode", "M_NOT_FOUND" } }, 404);
+            return;
+        }
+        auto& room = m_rooms[*roomIt];
+        const auto& action = endpoint[2];
+        if (action == "messages")
+        {
+            reply(socket, messages(room, request.url));
+            return;
+        }
+        if (action == "send" && endpoint.size() >= 5)
+        {
+            // Echo the message back through the sync, as a real server does
+            auto e = makeEvent(room, endpoint[3], m_userId, request.body);
+            e.insert("unsigned",
+                     QJsonObject { { "transaction_id", endpoint[4] } });
+            room.pendingTimeline.push_back(e);
+            reply(socket, { { "event_id", e.value("event_id") } });
+            flushHeldSyncs();
+            return;
+        }
+        QString readEventId;
+        if (action == "receipt" && endpoint.size() >= 5)
+            readEventId = endpoint[4];
+        else if (action == "read_markers")
+            readEventId = request.body.value("m.read").toString();
+        if (!readEventId.isEmpty())
+        {
+            room.pendingReceipts.insert(readEventId, QJsonObject {
+                { "m.read", QJsonObject { { m_userId, QJsonObject {
+                    { "ts", QDateTime::currentMSecsSinceEpoch() } } } } } });
+            flushHeldSyncs();
+        }
+    }
+    if (endpoint.size() >= 3 && endpoint[0] == "user" && endpoint[2] == "filter")
+    {
+        reply(socket, { { "filter_id", "1" } });
+        return;
+    }
+    // Typing, presence, account data etc. - accept and forget
+    reply(socket, {});
+}
+
+// Client-server API
+
+QJsonObject MockHomeserver::login(const QJsonObject& body)
+{
+    auto user = body.value("identifier").toObject().value("user").toString();
+    if (user.isEmpty())
+        user = body.value("user").toString();
+    if (user.isEmpty())
+        user = QStringLiteral("tester");
+    m_userId = user.startsWith('@') ? user
+               : QStringLiteral("@%1:%2").arg(user, ServerName);
+    for (auto& r: m_rooms)
+        if (!r.members.contains(m_userId))
+            r.members.push_back(m_userId);
+    return {
+        { "user_id", m_userId },
+        { "access_token", "mock_access_token" },
+        { "device_id", "MOCKDEVICE" },
+        { "home_server", ServerName }
+    };
+}
+
+void MockHomeserver::sync(QTcpSocket* socket, const QUrl& url)
+{
+    const QUrlQuery query(url);
+    if (!query.hasQueryItem("since"))
+    {
+        reply(socket, initialSync());
+        ++m_syncsServed;
+        if (!m_loadTimer->isActive())
+        {
+            m_clock.start();
+            m_lastTickMs = 0;
+            m_loadTimer->start(LoadTickMs);
+        }
+        return;
+    }
+
+    const auto timeoutMs = query.hasQueryItem("timeout")
+            ? query.queryItemValue("timeout").toInt() : DefaultSyncTimeoutMs;
+    auto* timer = new QTimer(this);
+    timer->setSingleShot(true);
+    m_heldSyncs.push_back({ socket, timer });
+    connect(timer, &QTimer::timeout, this, [this, timer] {
+        // Nothing happened in time - reply with an empty sync
+        const auto it = std::find_if(m_heldSyncs.begin(), m_heldSyncs.end(),
+            [timer] (const HeldSync& s) { return s.timeout == timer; });
+        if (it != m_heldSyncs.end())
+        {
+            reply(it->socket, { { "next_batch",
+                                  QStringLiteral("s%1").arg(++m_syncCounter) } });
+            m_heldSyncs.erase(it);
+        }
+        timer->deleteLater();
+    });
+    timer->start(timeoutMs);
+    flushHeldSyncs();
+}
+
+QJsonObject MockHomeserver::initialSync()
+{
+    QJsonObject joinedRooms;
+    for (auto& r: m_rooms)
+    {
+        QJsonArray state;
+        state.push_back(makeEvent(r, "m.room.create", r.members.front(),
+            { { "creator", r.members.front() } }, QString(), false));
+        state.push_back(makeEvent(r, "m.room.name", r.members.front(),
+            { { "name", r.name } }, QString(), false));
+        for (const auto& m: r.members)
+            state.push_back(makeEvent(r, "m.room.member", m,
+                { { "membership", "join" } }, m, false));
+
+        const auto firstShown =
+            std::max(0, m_options.historyDepth - InitialTimelineSize);
+        QJsonArray timeline;
+        for (int seq = firstShown; seq < m_options.historyDepth; ++seq)
+            timeline.push_back(makeMessage(r, seq, false));
+        for (const auto& e: r.pendingTimeline)
+            timeline.push_back(e);
+        r.pendingTimeline = {};
+        r.pendingReceipts = {};
+
+        joinedRooms.insert(r.id, QJsonObject {
+            { "state", QJsonObject { { "events", state } } },
+            { "timeline", QJsonObject {
+                { "events", timeline },
+                { "limited", true },
+                { "prev_batch", QStringLiteral("p%1").arg(firstShown) }
+            } }
+        });
+    }
+    return {
+        { "next_batch", QStringLiteral("s%1").arg(++m_syncCounter) },
+        { "rooms", QJsonObject { { "join", joinedRooms } } }
+    };
+}
+
+QJsonObject MockHomeserver::incrementalSync()
+{
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+    QJsonObject joinedRooms;
+    for (auto& r: m_rooms)
+    {
+        if (r.pendingTimeline.isEmpty() && r.pendingReceipts.isEmpty())
+            continue;
+
+        QJsonObject roomJson;
+        if (!r.pendingTimeline.isEmpty())
+        {
+            for (const auto& e: r.pendingTimeline)
+                m_deliveryLagsMs.push_back(
+                    now - qint64(e.toObject().value("origin_server_ts").toDouble()));
+            m_delivered += r.pendingTimeline.size();
+            roomJson.insert("timeline", QJsonObject {
+                { "events", r.pendingTimeline }, { "limited", false } });
+        }
+        if (!r.pendingReceipts.isEmpty())
+            roomJson.insert("ephemeral", QJsonObject { { "events",
+                QJsonArray { QJsonObject {
+                    { "type", "m.receipt" },
+                    { "content", r.pendingReceipts } } } } });
+        joinedRooms.insert(r.id, roomJson);
+        r.pendingTimeline = {};
+        r.pendingReceipts = {};
+    }
+    return {
+        { "next_batch", QStringLiteral("s%1").arg(++m_syncCounter) },
+        { "rooms", QJsonObject { { "join", joinedRooms } } }
+    };
+}
+
+void MockHomeserver::flushHeldSyncs()
+{
+    // Drop the syncs the client has given up on, not to lose events in them
+    for (auto it = m_heldSyncs.begin(); it != m_heldSyncs.end();)
+        if (!it->socket)
+        {
+            it->timeout->deleteLater();
+            it = m_heldSyncs.erase(it);
+        } else
+            ++it;
+    if (m_heldSyncs.isEmpty())
+        return;
+    const auto hasNews = std::any_of(m_rooms.cbegin(), m_rooms.cend(),
+        [] (const Room& r) {
+            return !r.pendingTimeline.isEmpty() || !r.pendingReceipts.isEmpty();
+        });
+    if (!hasNews)
+        return;
+
+    const auto held = m_heldSyncs.takeFirst();
+    held.timeout->stop();
+    held.timeout->deleteLater();
+    reply(held.socket, incrementalSync());
+    ++m_syncsServed;
+}
+
+QJsonObject MockHomeserver::messages(Room& room, const QUrl& url)
+{
+    const QUrlQuery query(url);
+    const auto from = query.queryItemValue("from");
+    auto pos = from.startsWith('p') ? from.mid(1).toInt()
+                                    : m_options.historyDepth;
+    const auto limit = std::min(std::max(1,
+            query.queryItemValue("limit").toInt()), MaxHistoryPage);
+
+    QJsonArray chunk;
+    const auto end = std::max(0, pos - limit);
+    for (auto seq = pos - 1; seq >= end; --seq)
+        chunk.push_back(makeMessage(room, seq, false));
+    return {
+        { "start", from },
+        { "end", QStringLiteral("p%1").arg(end) },
+        { "chunk", chunk }
+    };
+}
+
+QByteArray MockHomeserver::image(const QSize& requestedSize)
+{
+    // Noise doesn't compress, so the PNG is about as big as the pixel data
+    const auto side = std::max(1, int(std::sqrt(m_options.mediaSize / 3.0)));
+    QSize size { side, side };
+    if (requestedSize.isValid() && !requestedSize.isEmpty())
+        size = size.boundedTo(requestedSize);
+
+    const auto key = quint64(size.width()) << 32 | quint64(size.height());
+    auto it = m_imageCache.find(key);
+    if (it == m_imageCache.end())
+    {
+        QImage img(size, QImage::Format_RGB32);
+        std::mt19937 gen { m_options.seed };
+        for (int y = 0; y < img.height(); ++y)
+        {
+            auto* line = reinterpret_cast<QRgb*>(img.scanLine(y));
+            for (int x = 0; x < img.width(); ++x)
+                line[x] = gen() | 0xff000000;
+        }
+        QByteArray data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        img.save(&buffer, "PNG");
+        it = m_imageCache.insert(key, data);
+    }
+    return *it;
+}
+
+// Load generation
+
+QJsonObject MockHomeserver::makeEvent(Room& room, const QString& type,
+        const QString& sender, const QJsonObject& content,
+        const QString& stateKey, bool live)
+{
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+    QJsonObject e {
+        { "type", type },
+        { "sender", sender },
+        { "content", content },
+        { "origin_server_ts", live ? now : now - 86400000 }
+    };
+    const auto seq = m_options.historyDepth + room.nextEventNo++;
+    e.insert("event_id", QStringLiteral("$%1.%2:%3")
+             .arg(room.id.mid(1, room.id.indexOf(':') - 1)).arg(seq)
+             .arg(ServerName));
+    if (!stateKey.isNull())
+        e.insert("state_key", stateKey);
+    return e;
+}
+
+QJsonObject MockHomeserver::makeMessage(Room& room, int seq, bool live)
+{
+    // History is generated from the sequence number alone, so that
+    // the same event always looks the same
+    std::mt19937 gen { m_options.seed * 1000003u + unsigned(seq) * 31u
+                       + unsigned(qHash(room.id)) };
+    const auto sender = room.members[int(gen() % unsigned(room.members.size()))];
+    const bool isImage = std::uniform_real_distribution<>()(gen)
+                         < m_options.imageRatio;
+    QJsonObject content;
+    if (isImage)
+    {
+        const auto side = std::max(1, int(std::sqrt(m_options.mediaSize / 3.0)));
+        content = {
+            { "msgtype", "m.image" },
+            { "body", QStringLiteral("image%1.png").arg(seq) },
+            { "url", QStringLiteral("mxc://%1/img%2").arg(ServerName).arg(seq) },
+            { "info", QJsonObject {
+                { "w", side }, { "h", side }, { "mimetype", "image/png" },
+                { "size", m_options.mediaSize } } }
+        };
+    } else {
+        QStringList words;
+        const auto wordsCount = 3 + int(gen() % 40);
+        for (int i = 0; i < wordsCount; ++i)
+            words.push_back(Words[gen() % (sizeof(Words) / sizeof(Words[0]))]);
+        content = { { "msgtype", "m.text" }, { "body", words.join(' ') } };
+    }
+
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+    return {
+        { "type", "m.room.message" },
+        { "event_id", QStringLiteral("$%1.%2:%3")
+            .arg(room.id.mid(1, room.id.indexOf(':') - 1)).arg(seq)
+            .arg(ServerName) },
+        { "sender", sender },
+        { "content", content },
+        { "origin_server_ts", live ? now
+              : now - qint64(m_options.historyDepth - seq) * 60000 }
+    };
+}
+
+void MockHomeserver::generateLoad()
+{
+    const auto nowMs = m_clock.elapsed();
+    const auto dt = (nowMs - m_lastTickMs) / 1000.0;
+    m_lastTickMs = nowMs;
+    if (m_rooms.isEmpty())
+        return;
+
+    std::uniform_int_distribution<int> roomDist { 0, m_rooms.size() - 1 };
+    m_pendingMessages += m_options.eventsPerSecond * dt;
+    for (; m_pendingMessages >= 1; m_pendingMessages -= 1)
+    {
+        auto& room = m_rooms[roomDist(m_random)];
+        room.pendingTimeline.push_back(makeMessage(room,
+            m_options.historyDepth + room.nextEventNo++, true));
+        ++m_generated;
+    }
+
+    m_pendingMembership += m_options.membershipPerSecond * dt;
+    for (; m_pendingMembership >= 1; m_pendingMembership -= 1)
+    {
+        auto& room = m_rooms[roomDist(m_random)];
+        const bool join = room.members.size() <= 2 || m_random() % 2 == 0;
+        QString memberId;
+        if (join)
+        {
+            memberId = userId(m_nextUserNo++);
+            room.members.push_back(memberId);
+        } else {
+            // Never kick the local user out
+            std::uniform_int_distribution<int> memberDist {
+                0, room.members.size() - 1 };
+            memberId = room.members[memberDist(m_random)];
+            if (memberId == m_userId)
+                continue;
+            room.members.removeOne(memberId);
+        }
+        room.pendingTimeline.push_back(makeEvent(room, "m.room.member",
+            memberId, { { "membership", join ? "join" : "leave" } },
+            memberId));
+        ++m_generated;
+    }
+    flushHeldSyncs();
+}
+
+void MockHomeserver::reportStats()
+{
+    if (!m_clock.isValid())
+        return; // No client yet
+
+    std::sort(m_deliveryLagsMs.begin(), m_deliveryLagsMs.end());
+    const auto lag = [this] (double p) -> qint64 {
+        if (m_deliveryLagsMs.isEmpty())
+            return 0;
+        return m_deliveryLagsMs[std::max(0,
+            int(std::ceil(p * m_deliveryLagsMs.size())) - 1)];
+    };
+    qInfo().noquote() << QStringLiteral(
+        "t=%1s generated=%2 delivered=%3 syncs=%4 bytes=%5"
+        " lag_ms.p50=%6 lag_ms.p95=%7")
+        .arg(m_clock.elapsed() / 1000).arg(m_generated).arg(m_delivered)
+        .arg(m_syncsServed).arg(m_bytesServed).arg(lag(0.5)).arg(lag(0.95));
+    m_generated = m_delivered = m_syncsServed = 0;
+    m_bytesServed = 0;
+    m_deliveryLagsMs.clear();
+}
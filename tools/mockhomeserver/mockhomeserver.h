@@ -0,0 +1,146 @@
+/**************************************************************************
+ *                                                                        *
+ * Copyright (C) 2018 QMatrixClient project                               *
+ *                                                                        *
+ * This program is free software; you can redistribute it and/or          *
+ * modify it under the terms of the GNU General Public License            *
+ * as published by the Free Software Foundation; either version 3         *
+ * of the License, or (at your option) any later version.                 *
+ *                                                                        *
+ * This program is distributed in the hope that it will be useful,        *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ * GNU General Public License for more details.                           *
+ *                                                                        *
+ * You should have received a copy of the GNU General Public License      *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  *
+ *                                                                        *
+ **************************************************************************/
+
+#pragma once
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonObject>
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+#include <QtCore/QUrl>
+#include <QtCore/QVector>
+
+#include <random>
+
+class QTcpServer;
+class QTcpSocket;
+class QTimer;
+class QSize;
+
+/// A minimal Matrix homeserver that generates load for a single client
+/**
+ * Implements just enough of the client-server API for Quaternion to log
+ * in, sync, load history, fetch media, send messages and post receipts.
+ * Rooms and their history are synthetic. New events are generated at
+ * a configurable rate and delivered through long-polled syncs, so that
+ * the client can be observed under a steady, reproducible load.
+ *
+ * All state is in memory and shared by all clients; use one client
+ * at a time.
+ */
+class MockHomeserver: public QObject
+{
+        Q_OBJECT
+    public:
+        struct Options
+        {
+            quint16 port = 8008;
+            int rooms = 100;
+            int membersPerRoom = 20;
+            /// Events per room available through /messages
+            int historyDepth = 10000;
+            /// New messages per second, across all rooms
+            double eventsPerSecond = 10;
+            /// Joins and leaves per second, across all rooms
+            double membershipPerSecond = 0;
+            /// Share of new messages that are images, 0 to 1
+            double imageRatio = 0.1;
+            /// Approximate size of each image in bytes
+            int mediaSize = 100 * 1024;
+            unsigned int seed = 1;
+        };
+
+        explicit MockHomeserver(const Options& options,
+                                QObject* parent = nullptr);
+
+        bool listen();
+
+    private:
+        struct Request
+        {
+            QByteArray method;
+            QUrl url;
+            QJsonObject body;
+        };
+        struct Room
+        {
+            QString id;
+            QString name;
+            QStringList members;
+            int nextEventNo = 0;
+            QJsonArray pendingTimeline;
+            QJsonObject pendingReceipts;
+        };
+        struct HeldSync
+        {
+            QPointer<QTcpSocket> socket;
+            QTimer* timeout;
+        };
+
+        Options m_options;
+        QTcpServer* m_server;
+        QTimer* m_loadTimer;
+        QElapsedTimer m_clock;
+        qint64 m_lastTickMs = 0;
+        double m_pendingMessages = 0;
+        double m_pendingMembership = 0;
+        std::mt19937 m_random;
+
+        QVector<Room> m_rooms;
+        QHash<QString, int> m_roomIndices;
+        QVector<HeldSync> m_heldSyncs;
+        QHash<QTcpSocket*, QByteArray> m_buffers;
+        /// Encoded images by their width and height packed into one key
+        QHash<quint64, QByteArray> m_imageCache;
+        QString m_userId;
+        int m_syncCounter = 0;
+        int m_nextUserNo = 0;
+
+        // Load statistics, reported and reset every second
+        int m_generated = 0;
+        int m_delivered = 0;
+        int m_syncsServed = 0;
+        qint64 m_bytesServed = 0;
+        QVector<qint64> m_deliveryLagsMs;
+
+        void acceptConnection();
+        void readRequest(QTcpSocket* socket);
+        void handle(QTcpSocket* socket, const Request& request);
+        void reply(QTcpSocket* socket, const QJsonObject& body,
+                   int status = 200);
+        void replyRaw(QTcpSocket* socket, const QByteArray& data,
+                      const QByteArray& contentType, int status = 200);
+
+        QJsonObject login(const QJsonObject& body);
+        void sync(QTcpSocket* socket, const QUrl& url);
+        QJsonObject initialSync();
+        QJsonObject incrementalSync();
+        void flushHeldSyncs();
+        QJsonObject messages(Room& room, const QUrl& url);
+        QByteArray image(const QSize& requestedSize);
+
+        void generateLoad();
+        QJsonObject makeEvent(Room& room, const QString& type,
+                              const QString& sender, const QJsonObject& content,
+                              const QString& stateKey = {}, bool live = true);
+        QJsonObject makeMessage(Room& room, int seq, bool live);
+        void reportStats();
+};